@@ -112,6 +112,7 @@ LOCAL_C_INCLUDES := \
 		deps/sqlite/
 
 LOCAL_SRC_FILES := \
+		jni/src/activeobjectindex.cpp             \
 		jni/src/ban.cpp                           \
 		jni/src/camera.cpp                        \
 		jni/src/cavegen.cpp                       \
@@ -169,8 +170,10 @@ LOCAL_SRC_FILES := \
 		jni/src/log.cpp                           \
 		jni/src/main.cpp                          \
 		jni/src/map.cpp                           \
+		jni/src/map_saver.cpp                     \
 		jni/src/map_settings_manager.cpp          \
 		jni/src/mapblock.cpp                      \
+		jni/src/mapblockindex.cpp                 \
 		jni/src/mapblock_mesh.cpp                 \
 		jni/src/mapgen.cpp                        \
 		jni/src/mapgen_flat.cpp                   \
@@ -183,6 +186,7 @@ LOCAL_SRC_FILES := \
 		jni/src/mapnode.cpp                       \
 		jni/src/mapsector.cpp                     \
 		jni/src/mesh.cpp                          \
+		jni/src/mesh_generator_thread.cpp         \
 		jni/src/mg_biome.cpp                      \
 		jni/src/mg_decoration.cpp                 \
 		jni/src/mg_ore.cpp                        \
@@ -233,14 +237,24 @@ LOCAL_SRC_FILES := \
 		jni/src/util/string.cpp                   \
 		jni/src/util/srp.cpp                      \
 		jni/src/util/timetaker.cpp                \
+		jni/src/util/workerpool.cpp               \
 		jni/src/unittest/test.cpp                 \
+		jni/src/unittest/test_abm.cpp             \
+		jni/src/unittest/test_activeobjectindex.cpp \
 		jni/src/unittest/test_collision.cpp       \
 		jni/src/unittest/test_compression.cpp     \
 		jni/src/unittest/test_connection.cpp      \
+		jni/src/unittest/test_database.cpp        \
+		jni/src/unittest/test_emerge.cpp          \
 		jni/src/unittest/test_filepath.cpp        \
+		jni/src/unittest/test_genericobject.cpp   \
 		jni/src/unittest/test_inventory.cpp       \
+		jni/src/unittest/test_liquid.cpp          \
+		jni/src/unittest/test_map_saver.cpp       \
 		jni/src/unittest/test_map_settings_manager.cpp \
+		jni/src/unittest/test_mapblockindex.cpp  \
 		jni/src/unittest/test_mapnode.cpp         \
+		jni/src/unittest/test_meshupdate.cpp      \
 		jni/src/unittest/test_nodedef.cpp         \
 		jni/src/unittest/test_noderesolver.cpp    \
 		jni/src/unittest/test_noise.cpp           \
@@ -253,6 +267,7 @@ LOCAL_SRC_FILES := \
 		jni/src/unittest/test_socket.cpp          \
 		jni/src/unittest/test_utilities.cpp       \
 		jni/src/unittest/test_voxelalgorithms.cpp \
+		jni/src/unittest/test_voxelbuffer.cpp     \
 		jni/src/unittest/test_voxelmanipulator.cpp \
 		jni/src/touchscreengui.cpp                \
 		jni/src/database-leveldb.cpp              \
@@ -311,6 +326,7 @@ LOCAL_SRC_FILES += \
 		jni/src/script/lua_api/l_http.cpp         \
 		jni/src/script/lua_api/l_util.cpp         \
 		jni/src/script/lua_api/l_vmanip.cpp       \
+		jni/src/script/scripting_emerge.cpp       \
 		jni/src/script/scripting_game.cpp         \
 		jni/src/script/scripting_mainmenu.cpp
 
@@ -0,0 +1,19 @@
+
+core.log("info", "Initializing Mapgen environment")
+
+local scriptdir = core.get_builtin_path() .. DIR_DELIM
+
+dofile(scriptdir .. "common" .. DIR_DELIM .. "vector.lua")
+dofile(scriptdir .. "game" .. DIR_DELIM .. "voxelarea.lua")
+
+core.registered_on_generateds = {}
+
+function core.register_on_generated(func)
+	core.registered_on_generateds[#core.registered_on_generateds + 1] = func
+end
+
+function core.run_on_generated(vm, minp, maxp, blockseed)
+	for _, func in ipairs(core.registered_on_generateds) do
+		func(vm, minp, maxp, blockseed)
+	end
+end
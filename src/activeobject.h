@@ -46,12 +46,17 @@ struct ActiveObjectMessage
 	ActiveObjectMessage(u16 id_, bool reliable_=true, std::string data_=""):
 		id(id_),
 		reliable(reliable_),
-		datastring(data_)
+		datastring(data_),
+		min_protocol_version(0),
+		max_protocol_version(U16_MAX)
 	{}
 
 	u16 id;
 	bool reliable;
 	std::string datastring;
+	// Only clients with a protocol version in this range get the message
+	u16 min_protocol_version;
+	u16 max_protocol_version;
 };
 
 /*
@@ -0,0 +1,150 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "activeobjectindex.h"
+#include "constants.h"
+#include "util/numeric.h"
+#include <algorithm>
+#include <cmath>
+
+// Queries at the object sending range look at 4x4x4 cells
+#define CELL_SIZE (2 * MAP_BLOCKSIZE * BS)
+
+static s16 cell_coord(f32 x)
+{
+	// Positions beyond the map limits end up in the outermost cells
+	return rangelim(floor(x / CELL_SIZE), -32768.0, 32767.0);
+}
+
+u64 ActiveObjectIndex::cellOf(v3f pos)
+{
+	return packCell(cell_coord(pos.X), cell_coord(pos.Y), cell_coord(pos.Z));
+}
+
+void ActiveObjectIndex::insert(u16 id, v3f pos)
+{
+	if (m_cell_of.find(id) != m_cell_of.end()) {
+		update(id, pos);
+		return;
+	}
+	u64 cell = cellOf(pos);
+	m_cell_of[id] = cell;
+	addToCell(cell, id, pos);
+}
+
+void ActiveObjectIndex::remove(u16 id)
+{
+	UNORDERED_MAP<u16, u64>::iterator it = m_cell_of.find(id);
+	if (it == m_cell_of.end())
+		return;
+	removeFromCell(it->second, id);
+	m_cell_of.erase(it);
+}
+
+void ActiveObjectIndex::update(u16 id, v3f pos)
+{
+	UNORDERED_MAP<u16, u64>::iterator it = m_cell_of.find(id);
+	if (it == m_cell_of.end())
+		return;
+
+	u64 cell = cellOf(pos);
+	if (it->second == cell) {
+		std::vector<Entry> &entries = m_cells[cell];
+		for (size_t i = 0; i < entries.size(); i++) {
+			if (entries[i].id == id) {
+				entries[i].pos = pos;
+				return;
+			}
+		}
+	}
+
+	removeFromCell(it->second, id);
+	it->second = cell;
+	addToCell(cell, id, pos);
+}
+
+void ActiveObjectIndex::clear()
+{
+	m_cells.clear();
+	m_cell_of.clear();
+}
+
+void ActiveObjectIndex::getObjectsInsideRadius(v3f pos, f32 radius,
+		std::vector<u16> &ids) const
+{
+	size_t first = ids.size();
+	v3s16 cmin(cell_coord(pos.X - radius), cell_coord(pos.Y - radius),
+		cell_coord(pos.Z - radius));
+	v3s16 cmax(cell_coord(pos.X + radius), cell_coord(pos.Y + radius),
+		cell_coord(pos.Z + radius));
+
+	u64 num_cells = (u64)(cmax.X - cmin.X + 1) * (cmax.Y - cmin.Y + 1) *
+		(cmax.Z - cmin.Z + 1);
+	if (num_cells > m_cells.size()) {
+		// Fewer cells are occupied than the area has, look at those
+		for (CellMap::const_iterator i = m_cells.begin();
+				i != m_cells.end(); ++i)
+			addInsideRadius(i->second, pos, radius, ids);
+	} else {
+		// s32, so that the loops end at the last possible cell
+		for (s32 z = cmin.Z; z <= cmax.Z; z++)
+		for (s32 y = cmin.Y; y <= cmax.Y; y++)
+		for (s32 x = cmin.X; x <= cmax.X; x++) {
+			CellMap::const_iterator i = m_cells.find(packCell(x, y, z));
+			if (i != m_cells.end())
+				addInsideRadius(i->second, pos, radius, ids);
+		}
+	}
+
+	std::sort(ids.begin() + first, ids.end());
+}
+
+void ActiveObjectIndex::addInsideRadius(const std::vector<Entry> &entries,
+		v3f pos, f32 radius, std::vector<u16> &ids)
+{
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].pos.getDistanceFrom(pos) <= radius)
+			ids.push_back(entries[i].id);
+	}
+}
+
+void ActiveObjectIndex::addToCell(u64 cell, u16 id, v3f pos)
+{
+	Entry e;
+	e.id = id;
+	e.pos = pos;
+	m_cells[cell].push_back(e);
+}
+
+void ActiveObjectIndex::removeFromCell(u64 cell, u16 id)
+{
+	CellMap::iterator i = m_cells.find(cell);
+	if (i == m_cells.end())
+		return;
+	std::vector<Entry> &entries = i->second;
+	for (size_t j = 0; j < entries.size(); j++) {
+		if (entries[j].id == id) {
+			entries[j] = entries.back();
+			entries.pop_back();
+			break;
+		}
+	}
+	if (entries.empty())
+		m_cells.erase(i);
+}
@@ -0,0 +1,77 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef ACTIVEOBJECTINDEX_HEADER
+#define ACTIVEOBJECTINDEX_HEADER
+
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+#include "util/cpp11_container.h"
+#include <vector>
+
+/*
+	Uniform grid over the positions of active objects, used to find the
+	objects near a position without looking at all of them.
+
+	The cells are two map blocks wide. The positions are kept next to the
+	ids, so that a query only has to look at the cells that touch the
+	sphere, and not at the objects themselves.
+*/
+class ActiveObjectIndex
+{
+public:
+	// Replaces the position of id if it is in the index already
+	void insert(u16 id, v3f pos);
+	// Does nothing if id isn't in the index
+	void remove(u16 id);
+	// Does nothing if id isn't in the index
+	void update(u16 id, v3f pos);
+	void clear();
+
+	// Appends the ids of the objects at most radius away from pos to ids,
+	// in ascending order
+	void getObjectsInsideRadius(v3f pos, f32 radius,
+			std::vector<u16> &ids) const;
+
+	size_t size() const { return m_cell_of.size(); }
+
+private:
+	struct Entry
+	{
+		u16 id;
+		v3f pos;
+	};
+	// Cells are keyed by their packed position
+	typedef UNORDERED_MAP<u64, std::vector<Entry> > CellMap;
+
+	static u64 cellOf(v3f pos);
+	static inline u64 packCell(s32 x, s32 y, s32 z)
+	{
+		return (u64)(u16)x | ((u64)(u16)y << 16) | ((u64)(u16)z << 32);
+	}
+	static void addInsideRadius(const std::vector<Entry> &entries, v3f pos,
+			f32 radius, std::vector<u16> &ids);
+	void addToCell(u64 cell, u16 id, v3f pos);
+	void removeFromCell(u64 cell, u16 id);
+
+	CellMap m_cells;
+	UNORDERED_MAP<u16, u64> m_cell_of;
+};
+
+#endif
@@ -510,8 +510,9 @@ u32 TextureSource::getTextureId(const std::string &name)
 	{
 		infostream<<"getTextureId(): Queued: name=\""<<name<<"\""<<std::endl;
 
-		// We're gonna ask the result to be put into here
-		static ResultQueue<std::string, u32, u8, u8> result_queue;
+		// We're gonna ask the result to be put into here.  Each call has
+		// its own, as mesh update threads wait for textures at the same time.
+		ResultQueue<std::string, u32, u8, u8> result_queue;
 
 		// Throw a request in
 		m_get_texture_queue.add(name, 0, 0, &result_queue);
@@ -521,18 +522,15 @@ u32 TextureSource::getTextureId(const std::string &name)
 
 		try
 		{
-			while(true) {
-				// Wait result for a second
-				GetResult<std::string, u32, u8, u8>
-					result = result_queue.pop_front(1000);
-
-				if (result.key == name) {
-					return result.item;
-				}
-			}
+			// Wait result for a second
+			return result_queue.pop_front(1000).item;
 		}
 		catch(ItemNotFoundException &e)
 		{
+			// The main thread may be making it already
+			if (!m_get_texture_queue.cancel(name, &result_queue))
+				return result_queue.pop_frontNoEx().item;
+
 			errorstream<<"Waiting for texture " << name << " timed out."<<std::endl;
 			return 0;
 		}
@@ -33,6 +33,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "log.h"
 #include "util/srp.h"
 
+/*
+	Protects the lazily updated state of MapBlocks that is read during block
+	selection (see MapBlock::getDayNightDiff()), as GetNextBlocks() may run
+	on several threads at once.
+*/
+static Mutex s_block_state_mutex;
+
 const char *ClientInterface::statenames[] = {
 	"Invalid",
 	"Disconnecting",
@@ -65,7 +72,8 @@ void RemoteClient::GetNextBlocks (
 		ServerEnvironment *env,
 		EmergeManager * emerge,
 		float dtime,
-		std::vector<PrioritySortedBlockTransfer> &dest)
+		std::vector<PrioritySortedBlockTransfer> &dest,
+		std::vector<MapBlock *> &used_blocks)
 {
 	DSTACK(FUNCTION_NAME);
 
@@ -270,8 +278,11 @@ void RemoteClient::GetNextBlocks (
 			bool block_is_invalid = false;
 			if(block != NULL)
 			{
-				// Reset usage timer, this block will be of use in the future.
-				block->resetUsageTimer();
+				// The caller resets the usage timer, this block will be
+				// of use in the future.
+				used_blocks.push_back(block);
+
+				MutexAutoLock blocklock(s_block_state_mutex);
 
 				// Block is dummy if data doesn't exist.
 				// It means it has been not found from disk and not generated
@@ -783,8 +794,8 @@ void ClientInterface::DeleteClient(u16 peer_id)
 		u16 id = *i;
 		ServerActiveObject* obj = m_env->getActiveObject(id);
 
-		if(obj && obj->m_known_by_count > 0)
-			obj->m_known_by_count--;
+		if(obj)
+			obj->removeKnownByPeer(peer_id);
 	}
 
 	// Delete client
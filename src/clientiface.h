@@ -277,9 +277,15 @@ class RemoteClient
 		Finds block that should be sent next to the client.
 		Environment should be locked when this is called.
 		dtime is used for resetting send radius at slow interval
+
+		Loaded blocks that were considered are added to used_blocks; the
+		caller has to reset their usage timers. Apart from that, only the
+		state of this client is modified, so this can be run for several
+		clients in parallel while the environment lock is held.
 	*/
 	void GetNextBlocks(ServerEnvironment *env, EmergeManager* emerge,
-			float dtime, std::vector<PrioritySortedBlockTransfer> &dest);
+			float dtime, std::vector<PrioritySortedBlockTransfer> &dest,
+			std::vector<MapBlock *> &used_blocks);
 
 	void GotBlock(v3s16 p);
 
@@ -344,6 +350,13 @@ class RemoteClient
 	void setDeployedCompressionMode(u16 byteFlag)
 		{ m_deployed_compression = byteFlag; }
 
+	// Whether map blocks compressed with codec can be sent to the client
+	bool canReceiveBlockCodec(CompressionCodec codec)
+	{
+		return codec == COMPRESSION_ZLIB ||
+			(m_deployed_compression & (1 << codec));
+	}
+
 	void confirmSerializationVersion()
 		{ serialization_version = m_pending_serialization_version; }
 
@@ -48,7 +48,12 @@ ClientMap::ClientMap(
 	m_control(control),
 	m_camera_position(0,0,0),
 	m_camera_direction(0,0,1),
-	m_camera_fov(M_PI)
+	m_camera_fov(M_PI),
+	m_blocks_in_range_camera_block(0,0,0),
+	m_blocks_in_range_range(0),
+	m_blocks_in_range_all(false),
+	m_blocks_changed(true),
+	m_occlusion_camera_node(0,0,0)
 {
 	m_box = aabb3f(-BS*1000000,-BS*1000000,-BS*1000000,
 			BS*1000000,BS*1000000,BS*1000000);
@@ -168,6 +173,85 @@ void ClientMap::getBlocksInViewRange(v3s16 cam_pos_nodes,
 			p_nodes_max.Z / MAP_BLOCKSIZE + 1);
 }
 
+bool ClientMap::isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes)
+{
+	INodeDefManager *nodemgr = m_gamedef->ndef();
+
+	v3s16 cpn = block->getPos() * MAP_BLOCKSIZE;
+	cpn += v3s16(MAP_BLOCKSIZE / 2, MAP_BLOCKSIZE / 2, MAP_BLOCKSIZE / 2);
+	float step = BS * 1;
+	float stepfac = 1.1;
+	float startoff = BS * 1;
+	float endoff = -BS*MAP_BLOCKSIZE * 1.42 * 1.42;
+	v3s16 spn = cam_pos_nodes + v3s16(0, 0, 0);
+	s16 bs2 = MAP_BLOCKSIZE / 2 + 1;
+	u32 needed_count = 1;
+	return (
+		isOccluded(this, spn, cpn + v3s16(0, 0, 0),
+			step, stepfac, startoff, endoff, needed_count, nodemgr) &&
+		isOccluded(this, spn, cpn + v3s16(bs2,bs2,bs2),
+			step, stepfac, startoff, endoff, needed_count, nodemgr) &&
+		isOccluded(this, spn, cpn + v3s16(bs2,bs2,-bs2),
+			step, stepfac, startoff, endoff, needed_count, nodemgr) &&
+		isOccluded(this, spn, cpn + v3s16(bs2,-bs2,bs2),
+			step, stepfac, startoff, endoff, needed_count, nodemgr) &&
+		isOccluded(this, spn, cpn + v3s16(bs2,-bs2,-bs2),
+			step, stepfac, startoff, endoff, needed_count, nodemgr) &&
+		isOccluded(this, spn, cpn + v3s16(-bs2,bs2,bs2),
+			step, stepfac, startoff, endoff, needed_count, nodemgr) &&
+		isOccluded(this, spn, cpn + v3s16(-bs2,bs2,-bs2),
+			step, stepfac, startoff, endoff, needed_count, nodemgr) &&
+		isOccluded(this, spn, cpn + v3s16(-bs2,-bs2,bs2),
+			step, stepfac, startoff, endoff, needed_count, nodemgr) &&
+		isOccluded(this, spn, cpn + v3s16(-bs2,-bs2,-bs2),
+			step, stepfac, startoff, endoff, needed_count, nodemgr));
+}
+
+void ClientMap::updateBlocksInRange(v3s16 camera_block)
+{
+	m_blocks_in_range.clear();
+	m_blocks_in_range_camera_block = camera_block;
+	m_blocks_in_range_range = m_control.wanted_range;
+	m_blocks_in_range_all = m_control.range_all;
+	m_blocks_changed = false;
+
+	// The view range of any node in the camera block
+	v3s16 p_blocks_min;
+	v3s16 p_blocks_max;
+	v3s16 unused;
+	v3s16 camera_block_nodes = camera_block * MAP_BLOCKSIZE;
+	getBlocksInViewRange(camera_block_nodes, &p_blocks_min, &unused);
+	getBlocksInViewRange(camera_block_nodes +
+		v3s16(1, 1, 1) * (MAP_BLOCKSIZE - 1), &unused, &p_blocks_max);
+
+	MapBlockVect sectorblocks;
+	for (std::map<v2s16, MapSector*>::iterator si = m_sectors.begin();
+			si != m_sectors.end(); ++si) {
+		MapSector *sector = si->second;
+		v2s16 sp = sector->getPos();
+
+		if (m_control.range_all == false) {
+			if (sp.X < p_blocks_min.X || sp.X > p_blocks_max.X ||
+					sp.Y < p_blocks_min.Z || sp.Y > p_blocks_max.Z)
+				continue;
+		}
+
+		sectorblocks.clear();
+		sector->getBlocks(sectorblocks);
+		for (MapBlockVect::iterator i = sectorblocks.begin();
+				i != sectorblocks.end(); ++i) {
+			v3s16 d = (*i)->getPos() - camera_block;
+			BlockInRange b;
+			b.block = *i;
+			b.distance = d.X * d.X + d.Y * d.Y + d.Z * d.Z;
+			b.occluded = OCCLUSION_UNKNOWN;
+			m_blocks_in_range.push_back(b);
+		}
+	}
+
+	std::sort(m_blocks_in_range.begin(), m_blocks_in_range.end());
+}
+
 void ClientMap::updateDrawList(video::IVideoDriver* driver)
 {
 	ScopeProfiler sp(g_profiler, "CM::updateDrawList()", SPT_AVG);
@@ -175,9 +259,9 @@ void ClientMap::updateDrawList(video::IVideoDriver* driver)
 
 	INodeDefManager *nodemgr = m_gamedef->ndef();
 
-	for (std::map<v3s16, MapBlock*>::iterator i = m_drawlist.begin();
+	for (std::vector<MapBlock*>::iterator i = m_drawlist.begin();
 			i != m_drawlist.end(); ++i) {
-		MapBlock *block = i->second;
+		MapBlock *block = *i;
 		block->refDrop();
 	}
 	m_drawlist.clear();
@@ -192,14 +276,48 @@ void ClientMap::updateDrawList(video::IVideoDriver* driver)
 	camera_fov *= 1.2;
 
 	v3s16 cam_pos_nodes = floatToInt(camera_position, BS);
-	v3s16 p_blocks_min;
-	v3s16 p_blocks_max;
-	getBlocksInViewRange(cam_pos_nodes, &p_blocks_min, &p_blocks_max);
+
+	/*
+		The blocks in range only change when the camera gets into another
+		block, and whether they are occluded when it gets to another node
+	*/
+	if (m_blocks_changed ||
+			getNodeBlockPos(cam_pos_nodes) != m_blocks_in_range_camera_block ||
+			m_control.wanted_range != m_blocks_in_range_range ||
+			m_control.range_all != m_blocks_in_range_all) {
+		updateBlocksInRange(getNodeBlockPos(cam_pos_nodes));
+		m_occlusion_camera_node = cam_pos_nodes;
+	} else if (cam_pos_nodes != m_occlusion_camera_node) {
+		for (std::vector<BlockInRange>::iterator i = m_blocks_in_range.begin();
+				i != m_blocks_in_range.end(); ++i)
+			i->occluded = OCCLUSION_UNKNOWN;
+		m_occlusion_camera_node = cam_pos_nodes;
+	}
+
+	// No occlusion culling when free_move is on and camera is
+	// inside ground
+	bool occlusion_culling_enabled = true;
+	if (g_settings->getBool("free_move")) {
+		MapNode n = getNodeNoEx(cam_pos_nodes);
+		if (n.getContent() == CONTENT_IGNORE ||
+				nodemgr->get(n).solidness == 2)
+			occlusion_culling_enabled = false;
+	}
+
+	float range = 100000 * BS;
+	if (m_control.range_all == false)
+		range = m_control.wanted_range * BS;
+
+	// Blocks farther from the camera block than this are out of range
+	// from anywhere in it
+	float max_block_distance = range / BS / MAP_BLOCKSIZE + 1;
 
 	// Number of blocks in rendering range
 	u32 blocks_in_range = 0;
 	// Number of blocks occlusion culled
 	u32 blocks_occlusion_culled = 0;
+	// Number of blocks whose occlusion was not known from before
+	u32 blocks_occlusion_checked = 0;
 	// Number of blocks in rendering range but don't have a mesh
 	u32 blocks_in_range_without_mesh = 0;
 	// Blocks that had mesh that would have been drawn according to
@@ -207,142 +325,76 @@ void ClientMap::updateDrawList(video::IVideoDriver* driver)
 	u32 blocks_would_have_drawn = 0;
 	// Blocks that were drawn and had a mesh
 	u32 blocks_drawn = 0;
-	// Blocks which had a corresponding meshbuffer for this pass
-	//u32 blocks_had_pass_meshbuf = 0;
-	// Blocks from which stuff was actually drawn
-	//u32 blocks_without_stuff = 0;
 	// Distance to farthest drawn block
 	float farthest_drawn = 0;
 
-	for (std::map<v2s16, MapSector*>::iterator si = m_sectors.begin();
-			si != m_sectors.end(); ++si) {
-		MapSector *sector = si->second;
-		v2s16 sp = sector->getPos();
-
-		if (m_control.range_all == false) {
-			if (sp.X < p_blocks_min.X || sp.X > p_blocks_max.X ||
-					sp.Y < p_blocks_min.Z || sp.Y > p_blocks_max.Z)
-				continue;
-		}
+	/*
+		Loop through the blocks in range, nearest first
+	*/
+	for (std::vector<BlockInRange>::iterator i = m_blocks_in_range.begin();
+			i != m_blocks_in_range.end(); ++i) {
+		MapBlock *block = i->block;
 
-		MapBlockVect sectorblocks;
-		sector->getBlocks(sectorblocks);
+		if (i->distance > max_block_distance * max_block_distance)
+			break;
 
 		/*
-			Loop through blocks in sector
+			Compare block position to camera position, skip
+			if not seen on display
 		*/
 
-		u32 sector_blocks_drawn = 0;
-
-		for (MapBlockVect::iterator i = sectorblocks.begin();
-				i != sectorblocks.end(); ++i) {
-			MapBlock *block = *i;
-
-			/*
-				Compare block position to camera position, skip
-				if not seen on display
-			*/
-
-			if (block->mesh != NULL)
-				block->mesh->updateCameraOffset(m_camera_offset);
+		if (block->mesh != NULL)
+			block->mesh->updateCameraOffset(m_camera_offset);
 
-			float range = 100000 * BS;
-			if (m_control.range_all == false)
-				range = m_control.wanted_range * BS;
-
-			float d = 0.0;
-			if (!isBlockInSight(block->getPos(), camera_position,
-					camera_direction, camera_fov, range, &d))
-				continue;
-
-			// This is ugly (spherical distance limit?)
-			/*if(m_control.range_all == false &&
-					d - 0.5*BS*MAP_BLOCKSIZE > range)
-				continue;*/
-
-			blocks_in_range++;
+		float d = 0.0;
+		if (!isBlockInSight(block->getPos(), camera_position,
+				camera_direction, camera_fov, range, &d))
+			continue;
 
-			/*
-				Ignore if mesh doesn't exist
-			*/
-			{
-				//MutexAutoLock lock(block->mesh_mutex);
+		blocks_in_range++;
 
-				if (block->mesh == NULL) {
-					blocks_in_range_without_mesh++;
-					continue;
-				}
-			}
+		/*
+			Ignore if mesh doesn't exist
+		*/
+		if (block->mesh == NULL) {
+			blocks_in_range_without_mesh++;
+			continue;
+		}
 
-			/*
-				Occlusion culling
-			*/
-
-			// No occlusion culling when free_move is on and camera is
-			// inside ground
-			bool occlusion_culling_enabled = true;
-			if (g_settings->getBool("free_move")) {
-				MapNode n = getNodeNoEx(cam_pos_nodes);
-				if (n.getContent() == CONTENT_IGNORE ||
-						nodemgr->get(n).solidness == 2)
-					occlusion_culling_enabled = false;
+		/*
+			Occlusion culling
+		*/
+		if (occlusion_culling_enabled) {
+			if (i->occluded == OCCLUSION_UNKNOWN) {
+				i->occluded = isBlockOccluded(block, cam_pos_nodes) ?
+					OCCLUSION_OCCLUDED : OCCLUSION_VISIBLE;
+				blocks_occlusion_checked++;
 			}
-
-			v3s16 cpn = block->getPos() * MAP_BLOCKSIZE;
-			cpn += v3s16(MAP_BLOCKSIZE / 2, MAP_BLOCKSIZE / 2, MAP_BLOCKSIZE / 2);
-			float step = BS * 1;
-			float stepfac = 1.1;
-			float startoff = BS * 1;
-			float endoff = -BS*MAP_BLOCKSIZE * 1.42 * 1.42;
-			v3s16 spn = cam_pos_nodes + v3s16(0, 0, 0);
-			s16 bs2 = MAP_BLOCKSIZE / 2 + 1;
-			u32 needed_count = 1;
-			if (occlusion_culling_enabled &&
-					isOccluded(this, spn, cpn + v3s16(0, 0, 0),
-						step, stepfac, startoff, endoff, needed_count, nodemgr) &&
-					isOccluded(this, spn, cpn + v3s16(bs2,bs2,bs2),
-						step, stepfac, startoff, endoff, needed_count, nodemgr) &&
-					isOccluded(this, spn, cpn + v3s16(bs2,bs2,-bs2),
-						step, stepfac, startoff, endoff, needed_count, nodemgr) &&
-					isOccluded(this, spn, cpn + v3s16(bs2,-bs2,bs2),
-						step, stepfac, startoff, endoff, needed_count, nodemgr) &&
-					isOccluded(this, spn, cpn + v3s16(bs2,-bs2,-bs2),
-						step, stepfac, startoff, endoff, needed_count, nodemgr) &&
-					isOccluded(this, spn, cpn + v3s16(-bs2,bs2,bs2),
-						step, stepfac, startoff, endoff, needed_count, nodemgr) &&
-					isOccluded(this, spn, cpn + v3s16(-bs2,bs2,-bs2),
-						step, stepfac, startoff, endoff, needed_count, nodemgr) &&
-					isOccluded(this, spn, cpn + v3s16(-bs2,-bs2,bs2),
-						step, stepfac, startoff, endoff, needed_count, nodemgr) &&
-					isOccluded(this, spn, cpn + v3s16(-bs2,-bs2,-bs2),
-						step, stepfac, startoff, endoff, needed_count, nodemgr)) {
+			if (i->occluded == OCCLUSION_OCCLUDED) {
 				blocks_occlusion_culled++;
 				continue;
 			}
+		}
 
-			// This block is in range. Reset usage timer.
-			block->resetUsageTimer();
-
-			// Limit block count in case of a sudden increase
-			blocks_would_have_drawn++;
-			if (blocks_drawn >= m_control.wanted_max_blocks &&
-					!m_control.range_all &&
-					d > m_control.wanted_range * BS)
-				continue;
-
-			// Add to set
-			block->refGrab();
-			m_drawlist[block->getPos()] = block;
+		// This block is in range. Reset usage timer.
+		block->resetUsageTimer();
 
-			sector_blocks_drawn++;
-			blocks_drawn++;
-			if (d / BS > farthest_drawn)
-				farthest_drawn = d / BS;
+		// Limit block count in case of a sudden increase
+		blocks_would_have_drawn++;
+		if (blocks_drawn >= m_control.wanted_max_blocks &&
+				!m_control.range_all &&
+				d > m_control.wanted_range * BS)
+			continue;
 
-		} // foreach sectorblocks
+		// Add to list
+		block->refGrab();
+		m_drawlist.push_back(block);
 
-		if (sector_blocks_drawn != 0)
-			m_last_drawn_sectors.insert(sp);
+		v3s16 p = block->getPos();
+		m_last_drawn_sectors.insert(v2s16(p.X, p.Z));
+		blocks_drawn++;
+		if (d / BS > farthest_drawn)
+			farthest_drawn = d / BS;
 	}
 
 	m_control.blocks_would_have_drawn = blocks_would_have_drawn;
@@ -351,6 +403,7 @@ void ClientMap::updateDrawList(video::IVideoDriver* driver)
 
 	g_profiler->avg("CM: blocks in range", blocks_in_range);
 	g_profiler->avg("CM: blocks occlusion culled", blocks_occlusion_culled);
+	g_profiler->avg("CM: blocks occlusion checked", blocks_occlusion_checked);
 	if (blocks_in_range != 0)
 		g_profiler->avg("CM: blocks in range without mesh (frac)",
 				(float)blocks_in_range_without_mesh / blocks_in_range);
@@ -467,9 +520,9 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 
 	MeshBufListList drawbufs;
 
-	for (std::map<v3s16, MapBlock*>::iterator i = m_drawlist.begin();
+	for (std::vector<MapBlock*>::iterator i = m_drawlist.begin();
 			i != m_drawlist.end(); ++i) {
-		MapBlock *block = i->second;
+		MapBlock *block = *i;
 
 		// If the mesh of the block happened to get deleted, ignore it
 		if (block->mesh == NULL)
@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "camera.h"
 #include <set>
 #include <map>
+#include <vector>
 
 struct MapDrawControl
 {
@@ -120,6 +121,16 @@ class ClientMap : public Map, public scene::ISceneNode
 	void getBlocksInViewRange(v3s16 cam_pos_nodes, 
 		v3s16 *p_blocks_min, v3s16 *p_blocks_max);
 	void updateDrawList(video::IVideoDriver* driver);
+
+	/*
+		Blocks were unloaded or got other meshes.  The blocks in range
+		are found again by the next updateDrawList().
+	*/
+	void onBlocksChanged()
+	{
+		m_blocks_changed = true;
+	}
+
 	void renderMap(video::IVideoDriver* driver, s32 pass);
 
 	int getBackgroundBrightness(float max_d, u32 daylight_factor,
@@ -137,6 +148,28 @@ class ClientMap : public Map, public scene::ISceneNode
 	}
 	
 private:
+	enum Occlusion {
+		OCCLUSION_UNKNOWN,
+		OCCLUSION_VISIBLE,
+		OCCLUSION_OCCLUDED
+	};
+
+	struct BlockInRange {
+		MapBlock *block;
+		// Squared distance to the camera block
+		u32 distance;
+		// From m_occlusion_camera_node
+		Occlusion occluded;
+
+		bool operator < (const BlockInRange &other) const
+		{
+			return distance < other.distance;
+		}
+	};
+
+	bool isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes);
+	void updateBlocksInRange(v3s16 camera_block);
+
 	Client *m_client;
 	
 	aabb3f m_box;
@@ -148,7 +181,17 @@ class ClientMap : public Map, public scene::ISceneNode
 	f32 m_camera_fov;
 	v3s16 m_camera_offset;
 
-	std::map<v3s16, MapBlock*> m_drawlist;
+	// Nearest first
+	std::vector<MapBlock*> m_drawlist;
+
+	// The loaded blocks around the camera block that can be in view
+	// range, nearest first
+	std::vector<BlockInRange> m_blocks_in_range;
+	v3s16 m_blocks_in_range_camera_block;
+	float m_blocks_in_range_range;
+	bool m_blocks_in_range_all;
+	bool m_blocks_changed;
+	v3s16 m_occlusion_camera_node;
 	
 	std::set<v2s16> m_last_drawn_sectors;
 
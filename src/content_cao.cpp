@@ -1590,20 +1590,32 @@ void GenericCAO::processMessage(const std::string &data)
 
 		expireVisuals();
 	}
-	else if(cmd == GENERIC_CMD_UPDATE_POSITION)
+	else if(cmd == GENERIC_CMD_UPDATE_POSITION ||
+			cmd == GENERIC_CMD_UPDATE_POSITION_KEYFRAME ||
+			cmd == GENERIC_CMD_UPDATE_POSITION_DELTA)
 	{
 		// Not sent by the server if this object is an attachment.
 		// We might however get here if the server notices the object being detached before the client.
-		m_position = readV3F1000(is);
-		m_velocity = readV3F1000(is);
-		m_acceleration = readV3F1000(is);
+		ObjectPositionUpdate update;
+		if(cmd == GENERIC_CMD_UPDATE_POSITION) {
+			update.position = readV3F1000(is);
+			update.velocity = readV3F1000(is);
+			update.acceleration = readV3F1000(is);
+			update.yaw = readF1000(is);
+			update.do_interpolate = readU8(is);
+			update.is_movement_end = readU8(is);
+			update.update_interval = readF1000(is);
+		} else if(!m_position_decoder.read(cmd, is, &update)) {
+			return;
+		}
+		m_position = update.position;
+		m_velocity = update.velocity;
+		m_acceleration = update.acceleration;
 		if(fabs(m_prop.automatic_rotate) < 0.001)
-			m_yaw = readF1000(is);
-		else
-			readF1000(is);
-		bool do_interpolate = readU8(is);
-		bool is_end_position = readU8(is);
-		float update_interval = readF1000(is);
+			m_yaw = update.yaw;
+		bool do_interpolate = update.do_interpolate;
+		bool is_end_position = update.is_movement_end;
+		float update_interval = update.update_interval;
 
 		// Place us a bit higher if we're physical, to not sink into
 		// the ground due to sucky collision detection...
@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "clientobject.h"
 #include "object_properties.h"
 #include "itemgroup.h"
+#include "genericobject.h"
 
 class Camera;
 struct Nametag;
@@ -81,6 +82,7 @@ class GenericCAO : public ClientActiveObject
 	float m_yaw;
 	s16 m_hp;
 	SmoothTranslator pos_translator;
+	PositionUpdateDecoder m_position_decoder;
 	// Spritesheet/animation stuff
 	v2f m_tx_size;
 	v2s16 m_tx_basepos;
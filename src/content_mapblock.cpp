@@ -167,7 +167,7 @@ void makeCuboid(MeshCollector *collector, const aabb3f &box,
 static inline void getNeighborConnectingFace(v3s16 p, INodeDefManager *nodedef,
 		MeshMakeData *data, MapNode n, int v, int *neighbors)
 {
-	MapNode n2 = data->m_vmanip.getNodeNoEx(p);
+	MapNode n2 = data->getNodeNoEx(p);
 	if (nodedef->nodeboxConnects(n, n2, v))
 		*neighbors |= v;
 }
@@ -199,7 +199,7 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 	{
 		v3s16 p(x,y,z);
 
-		MapNode n = data->m_vmanip.getNodeNoEx(blockpos_nodes + p);
+		MapNode n = data->getNodeNoEx(blockpos_nodes + p);
 		const ContentFeatures &f = nodedef->get(n);
 
 		// Only solidness=0 stuff is drawn here
@@ -222,7 +222,7 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 			TileSpec tile_liquid_bfculled = getNodeTile(n, p, v3s16(0,0,0), data);
 
 			bool top_is_same_liquid = false;
-			MapNode ntop = data->m_vmanip.getNodeNoEx(blockpos_nodes + v3s16(x,y+1,z));
+			MapNode ntop = data->getNodeNoEx(blockpos_nodes + v3s16(x,y+1,z));
 			content_t c_flowing = nodedef->getId(f.liquid_alternative_flowing);
 			content_t c_source = nodedef->getId(f.liquid_alternative_source);
 			if(ntop.getContent() == c_flowing || ntop.getContent() == c_source)
@@ -244,10 +244,10 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 			{
 				v3s16 dir = side_dirs[i];
 
-				MapNode neighbor = data->m_vmanip.getNodeNoEx(blockpos_nodes + p + dir);
+				MapNode neighbor = data->getNodeNoEx(blockpos_nodes + p + dir);
 				content_t neighbor_content = neighbor.getContent();
 				const ContentFeatures &n_feat = nodedef->get(neighbor_content);
-				MapNode n_top = data->m_vmanip.getNodeNoEx(blockpos_nodes + p + dir+ v3s16(0,1,0));
+				MapNode n_top = data->getNodeNoEx(blockpos_nodes + p + dir+ v3s16(0,1,0));
 				content_t n_top_c = n_top.getContent();
 
 				if(neighbor_content == CONTENT_IGNORE)
@@ -375,7 +375,7 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 			TileSpec tile_liquid_bfculled = f.special_tiles[1];
 
 			bool top_is_same_liquid = false;
-			MapNode ntop = data->m_vmanip.getNodeNoEx(blockpos_nodes + v3s16(x,y+1,z));
+			MapNode ntop = data->getNodeNoEx(blockpos_nodes + v3s16(x,y+1,z));
 			content_t c_flowing = nodedef->getId(f.liquid_alternative_flowing);
 			content_t c_source = nodedef->getId(f.liquid_alternative_source);
 			if(ntop.getContent() == c_flowing || ntop.getContent() == c_source)
@@ -423,7 +423,7 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 				u8 flags = 0;
 				// Check neighbor
 				v3s16 p2 = p + neighbor_dirs[i];
-				MapNode n2 = data->m_vmanip.getNodeNoEx(blockpos_nodes + p2);
+				MapNode n2 = data->getNodeNoEx(blockpos_nodes + p2);
 				if(n2.getContent() != CONTENT_IGNORE)
 				{
 					content = n2.getContent();
@@ -443,7 +443,7 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 					// NOTE: This doesn't get executed if neighbor
 					//       doesn't exist
 					p2.Y += 1;
-					n2 = data->m_vmanip.getNodeNoEx(blockpos_nodes + p2);
+					n2 = data->getNodeNoEx(blockpos_nodes + p2);
 					if(n2.getContent() == c_source ||
 							n2.getContent() == c_flowing)
 						flags |= neighborflag_top_is_same_liquid;
@@ -706,7 +706,7 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 				// Check this neighbor
 				v3s16 dir = g_6dirs[j];
 				v3s16 n2p = blockpos_nodes + p + dir;
-				MapNode n2 = data->m_vmanip.getNodeNoEx(n2p);
+				MapNode n2 = data->getNodeNoEx(n2p);
 				// Don't make face if neighbor is of same type
 				if(n2.getContent() == n.getContent())
 					continue;
@@ -834,19 +834,19 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 
 			if (!H_merge && V_merge) {
 				n2p = blockpos_nodes + p + g_26dirs[1];
-				n2 = data->m_vmanip.getNodeNoEx(n2p);
+				n2 = data->getNodeNoEx(n2p);
 				n2c = n2.getContent();
 				if (n2c == current || n2c == CONTENT_IGNORE)
 					nb[1] = 1;
 				n2p = blockpos_nodes + p + g_26dirs[4];
-				n2 = data->m_vmanip.getNodeNoEx(n2p);
+				n2 = data->getNodeNoEx(n2p);
 				n2c = n2.getContent();
 				if (n2c == current || n2c == CONTENT_IGNORE)
 					nb[4] = 1;
 			} else if (H_merge && !V_merge) {
 				for(i = 0; i < 8; i++) {
 					n2p = blockpos_nodes + p + g_26dirs[nb_H_dirs[i]];
-					n2 = data->m_vmanip.getNodeNoEx(n2p);
+					n2 = data->getNodeNoEx(n2p);
 					n2c = n2.getContent();
 					if (n2c == current || n2c == CONTENT_IGNORE)
 						nb[nb_H_dirs[i]] = 1;
@@ -854,7 +854,7 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 			} else if (H_merge && V_merge) {
 				for(i = 0; i < 18; i++)	{
 					n2p = blockpos_nodes + p + g_26dirs[i];
-					n2 = data->m_vmanip.getNodeNoEx(n2p);
+					n2 = data->getNodeNoEx(n2p);
 					n2c = n2.getContent();
 					if (n2c == current || n2c == CONTENT_IGNORE)
 						nb[i] = 1;
@@ -869,7 +869,7 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 			} else {
 				for(i = 0; i < 2; i++) {
 					n2p = blockpos_nodes + p + dirs[i];
-					n2 = data->m_vmanip.getNodeNoEx(n2p);
+					n2 = data->getNodeNoEx(n2p);
 					n2c = n2.getContent();
 					if (n2c != current)
 						visible_faces[i] = 1;
@@ -884,7 +884,7 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 			} else {
 				for(i = 2; i < 6; i++) {
 					n2p = blockpos_nodes + p + dirs[i];
-					n2 = data->m_vmanip.getNodeNoEx(n2p);
+					n2 = data->getNodeNoEx(n2p);
 					n2c = n2.getContent();
 					if (n2c != current)
 						visible_faces[i] = 1;
@@ -1306,7 +1306,7 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 			// Check for adjacent nodes
 			for (int i = 0; i < 6; i++) {
 				n2p = blockpos_nodes + p + dirs[i];
-				n2 = data->m_vmanip.getNodeNoEx(n2p);
+				n2 = data->getNodeNoEx(n2p);
 				n2c = n2.getContent();
 				if (n2c != CONTENT_IGNORE && n2c != CONTENT_AIR && n2c != current) {
 					doDraw[i] = 1;
@@ -1440,7 +1440,7 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 			// Now a section of fence, +X, if there's a post there
 			v3s16 p2 = p;
 			p2.X++;
-			MapNode n2 = data->m_vmanip.getNodeNoEx(blockpos_nodes + p2);
+			MapNode n2 = data->getNodeNoEx(blockpos_nodes + p2);
 			const ContentFeatures *f2 = &nodedef->get(n2);
 			if(f2->drawtype == NDT_FENCELIKE)
 			{
@@ -1466,7 +1466,7 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 			// Now a section of fence, +Z, if there's a post there
 			p2 = p;
 			p2.Z++;
-			n2 = data->m_vmanip.getNodeNoEx(blockpos_nodes + p2);
+			n2 = data->getNodeNoEx(blockpos_nodes + p2);
 			f2 = &nodedef->get(n2);
 			if(f2->drawtype == NDT_FENCELIKE)
 			{
@@ -1504,8 +1504,8 @@ void mapblock_mesh_generate_special(MeshMakeData *data,
 				for (s8 xz = -1; xz <= 1; xz++) {
 					if (xz == 0)
 						continue;
-					MapNode n_xy = data->m_vmanip.getNodeNoEx(blockpos_nodes + v3s16(x + xz, y + y0, z));
-					MapNode n_zy = data->m_vmanip.getNodeNoEx(blockpos_nodes + v3s16(x, y + y0, z + xz));
+					MapNode n_xy = data->getNodeNoEx(blockpos_nodes + v3s16(x + xz, y + y0, z));
+					MapNode n_zy = data->getNodeNoEx(blockpos_nodes + v3s16(x, y + y0, z + xz));
 					ContentFeatures def_xy = nodedef->get(n_xy);
 					ContentFeatures def_zy = nodedef->get(n_zy);
 
@@ -34,6 +34,32 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 std::map<u16, ServerActiveObject::Factory> ServerActiveObject::m_types;
 
+/*
+	Clients from protocol version 29 on get position keyframes and deltas,
+	older clients the full position every time.
+*/
+static void push_position_update(std::queue<ActiveObjectMessage> &messages,
+		u16 id, PositionUpdateEncoder &encoder, const ObjectPositionUpdate &update)
+{
+	bool is_keyframe;
+	ActiveObjectMessage aom(id, false, encoder.encode(update, &is_keyframe));
+	aom.reliable = is_keyframe;
+	aom.min_protocol_version = 29;
+	messages.push(aom);
+
+	ActiveObjectMessage legacy_aom(id, false, gob_cmd_update_position(
+		update.position,
+		update.velocity,
+		update.acceleration,
+		update.yaw,
+		update.do_interpolate,
+		update.is_movement_end,
+		update.update_interval
+	));
+	legacy_aom.max_protocol_version = 28;
+	messages.push(legacy_aom);
+}
+
 /*
 	TestSAO
 */
@@ -66,9 +92,11 @@ class TestSAO : public ServerActiveObject
 			return;
 		}
 
-		m_base_position.Y += dtime * BS * 2;
-		if(m_base_position.Y > 8*BS)
-			m_base_position.Y = 2*BS;
+		v3f pos = m_base_position;
+		pos.Y += dtime * BS * 2;
+		if(pos.Y > 8*BS)
+			pos.Y = 2*BS;
+		setBasePosition(pos);
 
 		if(send_recommended == false)
 			return;
@@ -248,13 +276,14 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 	}
 
 	m_last_sent_position_timer += dtime;
+	m_position_encoder.step(dtime);
 
 	// Each frame, parent position is copied if the object is attached, otherwise it's calculated normally
 	// If the object gets detached this comes into effect automatically from the last known origin
 	if(isAttached())
 	{
 		v3f pos = m_env->getActiveObject(m_attachment_parent_id)->getBasePosition();
-		m_base_position = pos;
+		setBasePosition(pos);
 		m_velocity = v3f(0,0,0);
 		m_acceleration = v3f(0,0,0);
 	}
@@ -275,12 +304,12 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 					this, m_prop.collideWithObjects);
 
 			// Apply results
-			m_base_position = p_pos;
+			setBasePosition(p_pos);
 			m_velocity = p_velocity;
 			m_acceleration = p_acceleration;
 		} else {
-			m_base_position += dtime * m_velocity + 0.5 * dtime
-					* dtime * m_acceleration;
+			setBasePosition(m_base_position + dtime * m_velocity + 0.5 * dtime
+					* dtime * m_acceleration);
 			m_velocity += dtime * m_acceleration;
 		}
 
@@ -378,7 +407,10 @@ std::string LuaEntitySAO::getClientInitializationData(u16 protocol_version)
 		writeF1000(os, m_yaw);
 		writeS16(os, m_hp);
 
-		writeU8(os, 4 + m_bone_position.size()); // number of messages stuffed in here
+		std::string keyframe;
+		if(protocol_version >= 29)
+			keyframe = m_position_encoder.getKeyframe();
+		writeU8(os, 4 + m_bone_position.size() + !keyframe.empty()); // number of messages stuffed in here
 		os<<serializeLongString(getPropertyPacket()); // message 1
 		os<<serializeLongString(gob_cmd_update_armor_groups(m_armor_groups)); // 2
 		os<<serializeLongString(gob_cmd_update_animation(
@@ -387,6 +419,8 @@ std::string LuaEntitySAO::getClientInitializationData(u16 protocol_version)
 			os<<serializeLongString(gob_cmd_update_bone_position((*ii).first, (*ii).second.X, (*ii).second.Y)); // m_bone_position.size
 		}
 		os<<serializeLongString(gob_cmd_update_attachment(m_attachment_parent_id, m_attachment_bone, m_attachment_position, m_attachment_rotation)); // 4
+		if(!keyframe.empty())
+			os<<serializeLongString(keyframe); // 5
 	}
 	else
 	{
@@ -498,7 +532,7 @@ void LuaEntitySAO::setPos(v3f pos)
 {
 	if(isAttached())
 		return;
-	m_base_position = pos;
+	setBasePosition(pos);
 	sendPosition(false, true);
 }
 
@@ -506,7 +540,7 @@ void LuaEntitySAO::moveTo(v3f pos, bool continuous)
 {
 	if(isAttached())
 		return;
-	m_base_position = pos;
+	setBasePosition(pos);
 	if(!continuous)
 		sendPosition(true, true);
 }
@@ -705,20 +739,15 @@ void LuaEntitySAO::sendPosition(bool do_interpolate, bool is_movement_end)
 	m_last_sent_velocity = m_velocity;
 	//m_last_sent_acceleration = m_acceleration;
 
-	float update_interval = m_env->getSendRecommendedInterval();
-
-	std::string str = gob_cmd_update_position(
-		m_base_position,
-		m_velocity,
-		m_acceleration,
-		m_yaw,
-		do_interpolate,
-		is_movement_end,
-		update_interval
-	);
-	// create message and add to list
-	ActiveObjectMessage aom(getId(), false, str);
-	m_messages_out.push(aom);
+	ObjectPositionUpdate update;
+	update.position = m_base_position;
+	update.velocity = m_velocity;
+	update.acceleration = m_acceleration;
+	update.yaw = m_yaw;
+	update.do_interpolate = do_interpolate;
+	update.is_movement_end = is_movement_end;
+	update.update_interval = m_env->getSendRecommendedInterval();
+	push_position_update(m_messages_out, getId(), m_position_encoder, update);
 }
 
 bool LuaEntitySAO::getCollisionBox(aabb3f *toset) {
@@ -857,7 +886,10 @@ std::string PlayerSAO::getClientInitializationData(u16 protocol_version)
 		writeF1000(os, m_player->getYaw());
 		writeS16(os, getHP());
 
-		writeU8(os, 6 + m_bone_position.size()); // number of messages stuffed in here
+		std::string keyframe;
+		if(protocol_version >= 29)
+			keyframe = m_position_encoder.getKeyframe();
+		writeU8(os, 6 + m_bone_position.size() + !keyframe.empty()); // number of messages stuffed in here
 		os<<serializeLongString(getPropertyPacket()); // message 1
 		os<<serializeLongString(gob_cmd_update_armor_groups(m_armor_groups)); // 2
 		os<<serializeLongString(gob_cmd_update_animation(
@@ -870,6 +902,8 @@ std::string PlayerSAO::getClientInitializationData(u16 protocol_version)
 				m_physics_override_jump, m_physics_override_gravity, m_physics_override_sneak,
 				m_physics_override_sneak_glitch)); // 5
 		os << serializeLongString(gob_cmd_update_nametag_attributes(m_prop.nametag_color)); // 6 (GENERIC_CMD_UPDATE_NAMETAG_ATTRIBUTES) : Deprecated, for backwards compatibility only.
+		if(!keyframe.empty())
+			os<<serializeLongString(keyframe); // 7
 	}
 	else
 	{
@@ -942,6 +976,7 @@ void PlayerSAO::step(float dtime, bool send_recommended)
 	m_move_pool.add(dtime);
 	m_time_from_last_punch += dtime;
 	m_nocheat_dig_time += dtime;
+	m_position_encoder.step(dtime);
 
 	// Each frame, parent position is copied if the object is attached, otherwise it's calculated normally
 	// If the object gets detached this comes into effect automatically from the last known origin
@@ -959,24 +994,15 @@ void PlayerSAO::step(float dtime, bool send_recommended)
 	if(m_position_not_sent && !isAttached())
 	{
 		m_position_not_sent = false;
-		float update_interval = m_env->getSendRecommendedInterval();
-		v3f pos;
+		ObjectPositionUpdate update;
 		if(isAttached()) // Just in case we ever do send attachment position too
-			pos = m_env->getActiveObject(m_attachment_parent_id)->getBasePosition();
+			update.position = m_env->getActiveObject(m_attachment_parent_id)->getBasePosition();
 		else
-			pos = m_player->getPosition() + v3f(0,BS*1,0);
-		std::string str = gob_cmd_update_position(
-			pos,
-			v3f(0,0,0),
-			v3f(0,0,0),
-			m_player->getYaw(),
-			true,
-			false,
-			update_interval
-		);
-		// create message and add to list
-		ActiveObjectMessage aom(getId(), false, str);
-		m_messages_out.push(aom);
+			update.position = m_player->getPosition() + v3f(0,BS*1,0);
+		update.yaw = m_player->getYaw();
+		update.do_interpolate = true;
+		update.update_interval = m_env->getSendRecommendedInterval();
+		push_position_update(m_messages_out, getId(), m_position_encoder, update);
 	}
 
 	if(m_armor_groups_sent == false) {
@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "itemgroup.h"
 #include "player.h"
 #include "object_properties.h"
+#include "genericobject.h"
 
 /*
 	LuaEntitySAO needs some internals exposed.
@@ -104,6 +105,7 @@ class LuaEntitySAO : public ServerActiveObject
 	v3f m_last_sent_velocity;
 	float m_last_sent_position_timer;
 	float m_last_sent_move_precision;
+	PositionUpdateEncoder m_position_encoder;
 	bool m_armor_groups_sent;
 
 	v2f m_animation_range;
@@ -306,6 +308,7 @@ class PlayerSAO : public ServerActiveObject
 
 	int m_wield_index;
 	bool m_position_not_sent;
+	PositionUpdateEncoder m_position_encoder;
 	ItemGroupList m_armor_groups;
 	bool m_armor_groups_sent;
 
@@ -74,6 +74,24 @@ void Database_LevelDB::loadBlock(const v3s16 &pos, std::string *block)
 	*block = (status.ok()) ? datastr : "";
 }
 
+void Database_LevelDB::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> &blocks)
+{
+	blocks.clear();
+	blocks.resize(positions.size());
+
+	// Read all blocks from the same state of the database
+	leveldb::ReadOptions options;
+	options.snapshot = m_database->GetSnapshot();
+	for (size_t i = 0; i < positions.size(); i++) {
+		leveldb::Status status = m_database->Get(options,
+			i64tos(getBlockAsInteger(positions[i])), &blocks[i]);
+		if (!status.ok())
+			blocks[i] = "";
+	}
+	m_database->ReleaseSnapshot(options.snapshot);
+}
+
 bool Database_LevelDB::deleteBlock(const v3s16 &pos)
 {
 	leveldb::Status status = m_database->Delete(leveldb::WriteOptions(),
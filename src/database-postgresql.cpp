@@ -39,6 +39,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "log.h"
 #include "exceptions.h"
 #include "settings.h"
+#include "util/string.h"
+#include <map>
+
+// For results in binary format
+static inline s32 pg_binary_to_int(PGresult *res, int row, int col)
+{
+	return (s32)ntohl(*(u32 *)PQgetvalue(res, row, col));
+}
 
 Database_PostgreSQL::Database_PostgreSQL(const Settings &conf) :
 	m_connect_string(""),
@@ -125,6 +133,11 @@ void Database_PostgreSQL::initStatements()
 			"WHERE posX = $1::int4 AND posY = $2::int4 AND "
 			"posZ = $3::int4");
 
+	prepareStatement("read_blocks",
+			"SELECT b.posX, b.posY, b.posZ, b.data FROM blocks b "
+			"JOIN unnest($1::int4[], $2::int4[], $3::int4[]) AS p(x, y, z) "
+			"ON b.posX = p.x AND b.posY = p.y AND b.posZ = p.z");
+
 	prepareStatement("write_block",
 			"INSERT INTO blocks (posX, posY, posZ, data) VALUES "
 			"($1::int4, $2::int4, $3::int4, $4::bytea) "
@@ -249,6 +262,59 @@ void Database_PostgreSQL::loadBlock(const v3s16 &pos,
 	PQclear(results);
 }
 
+void Database_PostgreSQL::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> &blocks)
+{
+	verifyDatabase();
+
+	blocks.clear();
+	blocks.resize(positions.size());
+	if (positions.empty())
+		return;
+
+	// One round trip for all blocks, the coordinates are passed as arrays
+	std::string xs = "{", ys = "{", zs = "{";
+	std::map<v3s16, std::vector<size_t> > wanted;
+	for (size_t i = 0; i < positions.size(); i++) {
+		const v3s16 &p = positions[i];
+		if (i != 0) {
+			xs += ",";
+			ys += ",";
+			zs += ",";
+		}
+		xs += itos(p.X);
+		ys += itos(p.Y);
+		zs += itos(p.Z);
+		wanted[p].push_back(i);
+	}
+	xs += "}";
+	ys += "}";
+	zs += "}";
+
+	const void *args[] = { xs.c_str(), ys.c_str(), zs.c_str() };
+	const int argLen[] = { -1, -1, -1 };
+	const int argFmt[] = { 0, 0, 0 };
+
+	PGresult *results = execPrepared("read_blocks", ARRLEN(args), args,
+			argLen, argFmt, false);
+
+	int numrows = PQntuples(results);
+	for (int row = 0; row < numrows; ++row) {
+		v3s16 p(pg_binary_to_int(results, row, 0),
+			pg_binary_to_int(results, row, 1),
+			pg_binary_to_int(results, row, 2));
+		std::map<v3s16, std::vector<size_t> >::iterator it = wanted.find(p);
+		if (it == wanted.end())
+			continue;
+		for (size_t j = 0; j < it->second.size(); j++) {
+			blocks[it->second[j]].assign(PQgetvalue(results, row, 3),
+				PQgetlength(results, row, 3));
+		}
+	}
+
+	PQclear(results);
+}
+
 bool Database_PostgreSQL::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
@@ -143,6 +143,57 @@ void Database_Redis::loadBlock(const v3s16 &pos, std::string *block)
 		"Redis command 'HGET %s %s' gave invalid reply."));
 }
 
+void Database_Redis::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> &blocks)
+{
+	blocks.clear();
+	blocks.resize(positions.size());
+	if (positions.empty())
+		return;
+
+	// Fetch all blocks with a single HMGET
+	std::vector<std::string> args;
+	args.reserve(positions.size() + 2);
+	args.push_back("HMGET");
+	args.push_back(hash);
+	for (size_t i = 0; i < positions.size(); i++)
+		args.push_back(i64tos(getBlockAsInteger(positions[i])));
+
+	std::vector<const char *> argv(args.size());
+	std::vector<size_t> argvlen(args.size());
+	for (size_t i = 0; i < args.size(); i++) {
+		argv[i] = args[i].c_str();
+		argvlen[i] = args[i].size();
+	}
+
+	redisReply *reply = static_cast<redisReply *>(redisCommandArgv(ctx,
+			args.size(), &argv[0], &argvlen[0]));
+	if (!reply) {
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s ...' failed: ") + ctx->errstr);
+	}
+	if (reply->type == REDIS_REPLY_ERROR) {
+		std::string errstr(reply->str, reply->len);
+		freeReplyObject(reply);
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s ...' errored: ") + errstr);
+	}
+	if (reply->type != REDIS_REPLY_ARRAY ||
+			reply->elements != positions.size()) {
+		freeReplyObject(reply);
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s ...' gave invalid reply."));
+	}
+
+	for (size_t i = 0; i < reply->elements; i++) {
+		redisReply *r = reply->element[i];
+		// Missing blocks are nil
+		if (r->type == REDIS_REPLY_STRING)
+			blocks[i].assign(r->str, r->len);
+	}
+	freeReplyObject(reply);
+}
+
 bool Database_Redis::deleteBlock(const v3s16 &pos)
 {
 	std::string tmp = i64tos(getBlockAsInteger(pos));
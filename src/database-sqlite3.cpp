@@ -32,9 +32,11 @@ SQLite format specification:
 #include "exceptions.h"
 #include "settings.h"
 #include "porting.h"
+#include "util/basic_macros.h"
 #include "util/string.h"
 
 #include <cassert>
+#include <map>
 
 // When to print messages when the database is being held locked by another process
 // Note: I've seen occasional delays of over 250ms while running minetestmapper.
@@ -44,6 +46,9 @@ SQLite format specification:
 #define BUSY_FATAL_TRESHOLD	3000	// Allow SQLITE_BUSY to be returned, which will cause a minetest crash.
 #define BUSY_ERROR_INTERVAL	10000	// Safety net: report again every 10 seconds
 
+// Number of blocks loadBlocks() asks for with one query
+#define READ_BATCH_SIZE 64
+
 
 #define SQLRES(s, r, m) \
 	if ((s) != (r)) { \
@@ -116,6 +121,7 @@ Database_SQLite3::Database_SQLite3(const std::string &savedir) :
 	m_savedir(savedir),
 	m_database(NULL),
 	m_stmt_read(NULL),
+	m_stmt_read_batch(NULL),
 	m_stmt_write(NULL),
 	m_stmt_list(NULL),
 	m_stmt_delete(NULL),
@@ -181,6 +187,14 @@ void Database_SQLite3::verifyDatabase()
 	PREPARE_STATEMENT(begin, "BEGIN");
 	PREPARE_STATEMENT(end, "COMMIT");
 	PREPARE_STATEMENT(read, "SELECT `data` FROM `blocks` WHERE `pos` = ? LIMIT 1");
+
+	std::string read_batch = "SELECT `pos`, `data` FROM `blocks` WHERE `pos` IN (?";
+	for (u32 i = 1; i < READ_BATCH_SIZE; i++)
+		read_batch += ", ?";
+	read_batch += ")";
+	SQLOK(sqlite3_prepare_v2(m_database, read_batch.c_str(), -1,
+			&m_stmt_read_batch, NULL),
+		"Failed to prepare query '" + read_batch + "'");
 #ifdef __ANDROID__
 	PREPARE_STATEMENT(write,  "INSERT INTO `blocks` (`pos`, `data`) VALUES (?, ?)");
 #else
@@ -264,6 +278,48 @@ void Database_SQLite3::loadBlock(const v3s16 &pos, std::string *block)
 	sqlite3_reset(m_stmt_read);
 }
 
+void Database_SQLite3::loadBlocks(const std::vector<v3s16> &positions,
+	std::vector<std::string> &blocks)
+{
+	verifyDatabase();
+
+	blocks.clear();
+	blocks.resize(positions.size());
+
+	std::map<s64, std::vector<size_t> > wanted;
+	for (size_t start = 0; start < positions.size(); start += READ_BATCH_SIZE) {
+		size_t end = MYMIN(start + READ_BATCH_SIZE, positions.size());
+
+		wanted.clear();
+		for (size_t i = start; i < end; i++) {
+			s64 key = getBlockAsInteger(positions[i]);
+			wanted[key].push_back(i);
+		}
+
+		// Unused parameters repeat the last position
+		for (size_t i = start; i < start + READ_BATCH_SIZE; i++)
+			bindPos(m_stmt_read_batch, positions[MYMIN(i, end - 1)],
+				i - start + 1);
+
+		while (sqlite3_step(m_stmt_read_batch) == SQLITE_ROW) {
+			s64 key = sqlite3_column_int64(m_stmt_read_batch, 0);
+			const char *data = (const char *)
+				sqlite3_column_blob(m_stmt_read_batch, 1);
+			size_t len = sqlite3_column_bytes(m_stmt_read_batch, 1);
+			if (!data)
+				continue;
+
+			std::map<s64, std::vector<size_t> >::iterator it =
+				wanted.find(key);
+			if (it == wanted.end())
+				continue;
+			for (size_t j = 0; j < it->second.size(); j++)
+				blocks[it->second[j]].assign(data, len);
+		}
+		sqlite3_reset(m_stmt_read_batch);
+	}
+}
+
 void Database_SQLite3::createDatabase()
 {
 	assert(m_database); // Pre-condition
@@ -289,6 +345,7 @@ void Database_SQLite3::listAllLoadableBlocks(std::vector<v3s16> &dst)
 Database_SQLite3::~Database_SQLite3()
 {
 	FINALIZE_STATEMENT(m_stmt_read)
+	FINALIZE_STATEMENT(m_stmt_read_batch)
 	FINALIZE_STATEMENT(m_stmt_write)
 	FINALIZE_STATEMENT(m_stmt_list)
 	FINALIZE_STATEMENT(m_stmt_begin)
@@ -38,6 +38,8 @@ class Database_SQLite3 : public Database
 
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
+	void loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> &blocks);
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 	bool initialized() const { return m_initialized; }
@@ -58,6 +60,7 @@ class Database_SQLite3 : public Database
 
 	sqlite3 *m_database;
 	sqlite3_stmt *m_stmt_read;
+	sqlite3_stmt *m_stmt_read_batch;
 	sqlite3_stmt *m_stmt_write;
 	sqlite3_stmt *m_stmt_list;
 	sqlite3_stmt *m_stmt_delete;
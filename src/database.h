@@ -39,6 +39,10 @@ class Database
 
 	virtual bool saveBlock(const v3s16 &pos, const std::string &data) = 0;
 	virtual void loadBlock(const v3s16 &pos, std::string *block) = 0;
+	// Loads several blocks at once; blocks[i] is set to the data of
+	// positions[i], or to "" if it isn't in the database
+	virtual void loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> &blocks);
 	virtual bool deleteBlock(const v3s16 &pos) = 0;
 
 	static s64 getBlockAsInteger(const v3s16 &pos);
@@ -21,12 +21,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "emerge.h"
 
+#include <algorithm>
 #include <iostream>
-#include <queue>
 
 #include "util/container.h"
 #include "util/thread.h"
-#include "threading/event.h"
 
 #include "config.h"
 #include "constants.h"
@@ -40,6 +39,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mg_schematic.h"
 #include "nodedef.h"
 #include "profiler.h"
+#include "scripting_emerge.h"
 #include "scripting_game.h"
 #include "server.h"
 #include "serverobject.h"
@@ -55,12 +55,6 @@ class EmergeThread : public Thread {
 	~EmergeThread();
 
 	void *run();
-	void signal();
-
-	// Requires queue mutex held
-	bool pushBlock(v3s16 pos);
-
-	void cancelPendingItems();
 
 	static void runCompletionCallbacks(
 		v3s16 pos, EmergeAction action,
@@ -71,12 +65,12 @@ class EmergeThread : public Thread {
 	ServerMap *m_map;
 	EmergeManager *m_emerge;
 	Mapgen *m_mapgen;
+	EmergeScripting *m_script;
 
-	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
-
-	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
+	bool takeChunk(v3s16 *chunkpos);
+	bool popBlockEmerge(v3s16 chunkpos, v3s16 *pos, BlockEmergeData *bedata);
 
+	void getChunkArea(v3s16 pos, std::vector<v3s16> *positions);
 	EmergeAction getBlockOrStartGen(
 		v3s16 pos, bool allow_gen, MapBlock **block, BlockMakeData *data);
 	MapBlock *finishGen(v3s16 pos, BlockMakeData *bmdata,
@@ -136,16 +130,10 @@ EmergeManager::EmergeManager(IGameDef *gamedef)
 
 EmergeManager::~EmergeManager()
 {
-	for (u32 i = 0; i != m_threads.size(); i++) {
-		EmergeThread *thread = m_threads[i];
+	stopThreads();
 
-		if (m_threads_active) {
-			thread->stop();
-			thread->signal();
-			thread->wait();
-		}
-
-		delete thread;
+	for (u32 i = 0; i != m_threads.size(); i++) {
+		delete m_threads[i];
 		delete m_mapgens[i];
 	}
 
@@ -201,10 +189,9 @@ void EmergeManager::stopThreads()
 		return;
 
 	// Request thread stop in parallel
-	for (u32 i = 0; i != m_threads.size(); i++) {
+	for (u32 i = 0; i != m_threads.size(); i++)
 		m_threads[i]->stop();
-		m_threads[i]->signal();
-	}
+	m_queue_sem.post(m_threads.size());
 
 	// Then do the waiting for each
 	for (u32 i = 0; i != m_threads.size(); i++)
@@ -243,8 +230,8 @@ bool EmergeManager::enqueueBlockEmergeEx(
 	EmergeCompletionCallback callback,
 	void *callback_param)
 {
-	EmergeThread *thread = NULL;
 	bool entry_already_exists = false;
+	bool chunk_queued = false;
 
 	{
 		MutexAutoLock queuelock(m_queue_mutex);
@@ -256,16 +243,25 @@ bool EmergeManager::enqueueBlockEmergeEx(
 		if (entry_already_exists)
 			return true;
 
-		thread = getOptimalThread();
-		thread->pushBlock(blockpos);
+		chunk_queued = m_scheduler.push(blockpos,
+			getContainingChunk(blockpos));
 	}
 
-	thread->signal();
+	if (chunk_queued)
+		m_queue_sem.post();
 
 	return true;
 }
 
 
+void EmergeManager::setPlayerPositions(const std::vector<v3s16> &blockpositions)
+{
+	MutexAutoLock queuelock(m_queue_mutex);
+
+	m_scheduler.setPlayerPositions(blockpositions);
+}
+
+
 //
 // Mapgen-related helper functions
 //
@@ -396,77 +392,163 @@ bool EmergeManager::popBlockEmergeData(
 }
 
 
-EmergeThread *EmergeManager::getOptimalThread()
+////
+//// EmergeScheduler
+////
+
+EmergeScheduler::EmergeScheduler() :
+	m_next_seq(0)
 {
-	size_t nthreads = m_threads.size();
+}
+
 
-	FATAL_ERROR_IF(nthreads == 0, "No emerge threads!");
+bool EmergeScheduler::push(v3s16 blockpos, v3s16 chunkpos)
+{
+	std::pair<std::map<v3s16, QueuedChunk>::iterator, bool> findres;
+	findres = m_chunks.insert(std::make_pair(chunkpos, QueuedChunk()));
+
+	QueuedChunk &chunk = findres.first->second;
+	chunk.blocks.push_back(blockpos);
+
+	if (findres.second) {
+		chunk.distance = getDistance(blockpos);
+		chunk.seq = m_next_seq++;
+		chunk.taken = false;
+		pushHeap(chunkpos, chunk);
+		return true;
+	}
 
-	size_t index = 0;
-	size_t nitems_lowest = m_threads[0]->m_block_queue.size();
+	// The thread working on it takes the block as well
+	if (chunk.taken)
+		return false;
 
-	for (size_t i = 1; i < nthreads; i++) {
-		size_t nitems = m_threads[i]->m_block_queue.size();
-		if (nitems < nitems_lowest) {
-			index = i;
-			nitems_lowest = nitems;
-		}
+	u32 distance = getDistance(blockpos);
+	if (distance < chunk.distance) {
+		chunk.distance = distance;
+		pushHeap(chunkpos, chunk);
 	}
 
-	return m_threads[index];
+	return false;
 }
 
 
-////
-//// EmergeThread
-////
-
-EmergeThread::EmergeThread(Server *server, int ethreadid) :
-	enable_mapgen_debug_info(false),
-	id(ethreadid),
-	m_server(server),
-	m_map(NULL),
-	m_emerge(NULL),
-	m_mapgen(NULL)
+bool EmergeScheduler::takeChunk(v3s16 *chunkpos)
 {
-	m_name = "Emerge-" + itos(ethreadid);
+	while (!m_heap.empty()) {
+		std::pop_heap(m_heap.begin(), m_heap.end());
+		HeapEntry entry = m_heap.back();
+		m_heap.pop_back();
+
+		std::map<v3s16, QueuedChunk>::iterator it = m_chunks.find(entry.chunkpos);
+		if (it == m_chunks.end())
+			continue;
+
+		QueuedChunk &chunk = it->second;
+		if (chunk.taken || chunk.seq != entry.seq ||
+				chunk.distance != entry.distance)
+			continue;
+
+		chunk.taken = true;
+		*chunkpos = entry.chunkpos;
+		return true;
+	}
+
+	return false;
 }
 
 
-EmergeThread::~EmergeThread()
+bool EmergeScheduler::popBlock(v3s16 chunkpos, v3s16 *blockpos)
 {
-	//cancelPendingItems();
+	std::map<v3s16, QueuedChunk>::iterator it = m_chunks.find(chunkpos);
+	if (it == m_chunks.end())
+		return false;
+
+	QueuedChunk &chunk = it->second;
+	assert(chunk.taken);
+	if (chunk.blocks.empty()) {
+		m_chunks.erase(it);
+		return false;
+	}
+
+	*blockpos = chunk.blocks.front();
+	chunk.blocks.erase(chunk.blocks.begin());
+
+	return true;
 }
 
 
-void EmergeThread::signal()
+void EmergeScheduler::setPlayerPositions(const std::vector<v3s16> &positions)
 {
-	m_queue_event.signal();
+	if (positions == m_players)
+		return;
+
+	m_players = positions;
+
+	m_heap.clear();
+	for (std::map<v3s16, QueuedChunk>::iterator it = m_chunks.begin();
+			it != m_chunks.end(); ++it) {
+		QueuedChunk &chunk = it->second;
+		if (chunk.taken)
+			continue;
+
+		chunk.distance = U32_MAX;
+		for (size_t i = 0; i != chunk.blocks.size(); i++)
+			chunk.distance = MYMIN(chunk.distance, getDistance(chunk.blocks[i]));
+
+		HeapEntry entry;
+		entry.distance = chunk.distance;
+		entry.seq = chunk.seq;
+		entry.chunkpos = it->first;
+		m_heap.push_back(entry);
+	}
+	std::make_heap(m_heap.begin(), m_heap.end());
 }
 
 
-bool EmergeThread::pushBlock(v3s16 pos)
+u32 EmergeScheduler::getDistance(v3s16 blockpos) const
 {
-	m_block_queue.push(pos);
-	return true;
+	// Without players, mapchunks are taken in the order they came in
+	u32 distance = U32_MAX;
+	for (size_t i = 0; i != m_players.size(); i++) {
+		v3s16 d = blockpos - m_players[i];
+		distance = MYMIN(distance, (u32)(d.X * d.X + d.Y * d.Y + d.Z * d.Z));
+	}
+
+	return distance;
 }
 
 
-void EmergeThread::cancelPendingItems()
+void EmergeScheduler::pushHeap(v3s16 chunkpos, const QueuedChunk &chunk)
 {
-	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+	HeapEntry entry;
+	entry.distance = chunk.distance;
+	entry.seq = chunk.seq;
+	entry.chunkpos = chunkpos;
+	m_heap.push_back(entry);
+	std::push_heap(m_heap.begin(), m_heap.end());
+}
 
-	while (!m_block_queue.empty()) {
-		BlockEmergeData bedata;
-		v3s16 pos;
 
-		pos = m_block_queue.front();
-		m_block_queue.pop();
+////
+//// EmergeThread
+////
+
+EmergeThread::EmergeThread(Server *server, int ethreadid) :
+	enable_mapgen_debug_info(false),
+	id(ethreadid),
+	m_server(server),
+	m_map(NULL),
+	m_emerge(NULL),
+	m_mapgen(NULL),
+	m_script(NULL)
+{
+	m_name = "Emerge-" + itos(ethreadid);
+}
 
-		m_emerge->popBlockEmergeData(pos, &bedata);
 
-		runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
-	}
+EmergeThread::~EmergeThread()
+{
+	//cancelPendingItems();
 }
 
 
@@ -487,15 +569,21 @@ void EmergeThread::runCompletionCallbacks(
 }
 
 
-bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
+bool EmergeThread::takeChunk(v3s16 *chunkpos)
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
-	if (m_block_queue.empty())
-		return false;
+	return m_emerge->m_scheduler.takeChunk(chunkpos);
+}
+
 
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
+bool EmergeThread::popBlockEmerge(v3s16 chunkpos, v3s16 *pos,
+	BlockEmergeData *bedata)
+{
+	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+
+	if (!m_emerge->m_scheduler.popBlock(chunkpos, pos))
+		return false;
 
 	m_emerge->popBlockEmergeData(*pos, bedata);
 
@@ -503,17 +591,59 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 }
 
 
+void EmergeThread::getChunkArea(v3s16 pos, std::vector<v3s16> *positions)
+{
+	/*
+		Emerge requests come in for whole areas, and generating a chunk
+		needs the blocks around it as well. These are read from the
+		database at once instead of one by one.
+	*/
+	s16 csize = m_map->getMapgenParams()->chunksize;
+	v3s16 bpmin = EmergeManager::getContainingChunk(pos, csize) -
+		v3s16(1, 1, 1);
+	v3s16 bpmax = bpmin + v3s16(1, 1, 1) * (csize + 1);
+
+	v3s16 p;
+	for (p.Z = bpmin.Z; p.Z <= bpmax.Z; p.Z++)
+	for (p.Y = bpmin.Y; p.Y <= bpmax.Y; p.Y++)
+	for (p.X = bpmin.X; p.X <= bpmax.X; p.X++) {
+		if (!blockpos_over_limit(p))
+			positions->push_back(p);
+	}
+}
+
+
 EmergeAction EmergeThread::getBlockOrStartGen(
 	v3s16 pos, bool allow_gen, MapBlock **block, BlockMakeData *bmdata)
 {
+	std::vector<v3s16> positions;
+	getChunkArea(pos, &positions);
+
+	std::vector<v3s16> wanted;
+	u32 save_count;
+	{
+		MutexAutoLock envlock(m_server->m_env_mutex);
+
+		// 1). Attempt to fetch block from memory
+		*block = m_map->getBlockNoCreateNoEx(pos);
+		if (*block && !(*block)->isDummy() && (*block)->isGenerated())
+			return EMERGE_FROM_MEMORY;
+
+		save_count = m_map->startPrefetch(positions, &wanted);
+	}
+
+	// 2). Read the chunk from disk, without blocking the server meanwhile
+	std::vector<std::string> blocks;
+	m_map->readPrefetch(wanted, &blocks);
+
 	MutexAutoLock envlock(m_server->m_env_mutex);
+	m_map->finishPrefetch(wanted, &blocks, save_count);
 
-	// 1). Attempt to fetch block from memory
+	// Another thread may have loaded or generated it in the meantime
 	*block = m_map->getBlockNoCreateNoEx(pos);
 	if (*block && !(*block)->isDummy() && (*block)->isGenerated())
 		return EMERGE_FROM_MEMORY;
 
-	// 2). Attempt to load block from disk
 	*block = m_map->loadBlock(pos);
 	if (*block && (*block)->isGenerated())
 		return EMERGE_FROM_DISK;
@@ -584,6 +714,8 @@ void *EmergeThread::run()
 	BEGIN_DEBUG_EXCEPTION_HANDLER
 
 	v3s16 pos;
+	v3s16 chunkpos;
+	bool have_chunk = false;
 
 	m_map    = (ServerMap *)&(m_server->m_env->getMap());
 	m_emerge = m_server->m_emerge;
@@ -591,6 +723,12 @@ void *EmergeThread::run()
 	enable_mapgen_debug_info = m_emerge->enable_mapgen_debug_info;
 
 	try {
+	// Only when mods registered scripts to run here
+	if (!m_emerge->mapgen_scripts.empty()) {
+		m_script = new EmergeScripting(m_server);
+		m_script->loadScripts(m_emerge->mapgen_scripts);
+	}
+
 	while (!stopRequested()) {
 		std::map<v3s16, MapBlock *> modified_blocks;
 		BlockEmergeData bedata;
@@ -598,8 +736,17 @@ void *EmergeThread::run()
 		EmergeAction action;
 		MapBlock *block;
 
-		if (!popBlockEmerge(&pos, &bedata)) {
-			m_queue_event.wait();
+		if (!have_chunk) {
+			if (!takeChunk(&chunkpos)) {
+				m_emerge->m_queue_sem.wait();
+				continue;
+			}
+			have_chunk = true;
+		}
+
+		// Blocks of the mapchunk requested meanwhile come here as well
+		if (!popBlockEmerge(chunkpos, &pos, &bedata)) {
+			have_chunk = false;
 			continue;
 		}
 
@@ -622,6 +769,21 @@ void *EmergeThread::run()
 					t.stop(true); // Hide output
 			}
 
+			// Lua mapgen scripts work on the chunk before the env lock
+			if (m_script) {
+				ScopeProfiler sp(g_profiler,
+					"EmergeThread: Lua on_generated", SPT_AVG);
+				v3s16 minp = bmdata.blockpos_min * MAP_BLOCKSIZE;
+				v3s16 maxp = bmdata.blockpos_max * MAP_BLOCKSIZE +
+					v3s16(1,1,1) * (MAP_BLOCKSIZE - 1);
+				try {
+					m_script->on_generated(bmdata.vmanip, minp, maxp,
+						m_mapgen->blockseed);
+				} catch (LuaError &e) {
+					m_server->setAsyncFatalError("Lua: " + std::string(e.what()));
+				}
+			}
+
 			block = finishGen(pos, &bmdata, &modified_blocks);
 		}
 
@@ -651,8 +813,13 @@ void *EmergeThread::run()
 			<< "You can ignore this using [ignore_world_load_errors = true]."
 			<< std::endl;
 		m_server->setAsyncFatalError(err.str());
+	} catch (ModError &e) {
+		m_server->setAsyncFatalError(e.what());
 	}
 
+	delete m_script;
+	m_script = NULL;
+
 	END_DEBUG_EXCEPTION_HANDLER
 	return NULL;
 }
@@ -21,7 +21,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define EMERGE_HEADER
 
 #include <map>
+#include <vector>
 #include "irr_v3d.h"
+#include "threading/semaphore.h"
 #include "util/container.h"
 #include "mapgen.h" // for MapgenParams
 #include "map.h"
@@ -62,6 +64,12 @@ struct BlockMakeData {
 	~BlockMakeData() { delete vmanip; }
 };
 
+// Script that every emerge thread runs in its own Lua environment
+struct MapgenScript {
+	std::string mod_name;
+	std::string path;
+};
+
 // Result from processing an item on the emerge queue
 enum EmergeAction {
 	EMERGE_CANCELLED,
@@ -88,6 +96,61 @@ struct BlockEmergeData {
 	EmergeCallbackList callbacks;
 };
 
+/*
+	Blocks waiting to be emerged, grouped by mapchunk.  The mapchunk with the
+	block closest to a player is taken first.  Only one thread works on a
+	mapchunk at a time, blocks requested for it meanwhile go to that thread
+	as well.  Not thread-safe.
+*/
+class EmergeScheduler {
+public:
+	EmergeScheduler();
+
+	// Returns true if the mapchunk was not queued or taken yet
+	bool push(v3s16 blockpos, v3s16 chunkpos);
+
+	// Takes the most important mapchunk nobody is working on
+	bool takeChunk(v3s16 *chunkpos);
+
+	// Next block of a taken mapchunk.  If there is none, the mapchunk is
+	// released and false is returned.
+	bool popBlock(v3s16 chunkpos, v3s16 *blockpos);
+
+	// Block positions of the players
+	void setPlayerPositions(const std::vector<v3s16> &positions);
+
+private:
+	struct QueuedChunk {
+		std::vector<v3s16> blocks;
+		u32 distance;
+		u32 seq;
+		bool taken;
+	};
+
+	struct HeapEntry {
+		u32 distance;
+		u32 seq;
+		v3s16 chunkpos;
+
+		// Less important ones compare smaller
+		bool operator < (const HeapEntry &other) const
+		{
+			if (distance != other.distance)
+				return distance > other.distance;
+			return seq > other.seq;
+		}
+	};
+
+	u32 getDistance(v3s16 blockpos) const;
+	void pushHeap(v3s16 chunkpos, const QueuedChunk &chunk);
+
+	std::map<v3s16, QueuedChunk> m_chunks;
+	// Entries of taken or moved mapchunks are skipped
+	std::vector<HeapEntry> m_heap;
+	std::vector<v3s16> m_players;
+	u32 m_next_seq;
+};
+
 class EmergeManager {
 public:
 	INodeDefManager *ndef;
@@ -114,6 +177,9 @@ class EmergeManager {
 	DecorationManager *decomgr;
 	SchematicManager *schemmgr;
 
+	// Registered by mods at load time, see register_mapgen_script()
+	std::vector<MapgenScript> mapgen_scripts;
+
 	// Methods
 	EmergeManager(IGameDef *gamedef);
 	~EmergeManager();
@@ -137,6 +203,9 @@ class EmergeManager {
 		EmergeCompletionCallback callback,
 		void *callback_param);
 
+	// Blocks close to these players are emerged first
+	void setPlayerPositions(const std::vector<v3s16> &blockpositions);
+
 	v3s16 getContainingChunk(v3s16 blockpos);
 
 	Mapgen *getCurrentMapgen();
@@ -157,14 +226,14 @@ class EmergeManager {
 	Mutex m_queue_mutex;
 	std::map<v3s16, BlockEmergeData> m_blocks_enqueued;
 	std::map<u16, u16> m_peer_queue_count;
+	EmergeScheduler m_scheduler;
+	// Posted for every mapchunk that gets queued
+	Semaphore m_queue_sem;
 
 	u16 m_qlimit_total;
 	u16 m_qlimit_diskonly;
 	u16 m_qlimit_generate;
 
-	// Requires m_queue_mutex held
-	EmergeThread *getOptimalThread();
-
 	bool pushBlockEmergeData(
 		v3s16 pos,
 		u16 peer_requested,
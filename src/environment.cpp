@@ -17,6 +17,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <algorithm>
 #include <fstream>
 #include "environment.h"
 #include "filesys.h"
@@ -43,7 +44,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "daynightratio.h"
 #include "map.h"
 #include "emerge.h"
+#include "noise.h"
 #include "util/serialize.h"
+#include "util/workerpool.h"
 #include "threading/mutex_auto_lock.h"
 
 #define PP(x) "("<<(x).X<<","<<(x).Y<<","<<(x).Z<<")"
@@ -289,6 +292,22 @@ ABMWithState::ABMWithState(ActiveBlockModifier *abm_):
 	timer = myrand_range(minval, maxval);
 }
 
+void ActiveBlockModifier::triggerBatch(ServerEnvironment *env,
+		const ABMTriggerCandidate *candidates, u32 count,
+		ABMTriggerContext &context)
+{
+	for (u32 i = 0; i < count; i++) {
+		const ABMTriggerCandidate &c = candidates[i];
+		MapNode n;
+		if (!context.getCurrentNode(c, &n))
+			continue;
+		trigger(env, c.p, n);
+		trigger(env, c.p, n, context.active_object_count,
+				context.active_object_count_wider);
+		context.triggered();
+	}
+}
+
 /*
 	LBMManager
 */
@@ -594,6 +613,8 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 	m_recommended_send_interval(0.1),
 	m_max_lag_estimate(0.1)
 {
+	m_abm_pool = new WorkerPool("ABMScan",
+			g_settings->getU16("num_abm_threads"));
 }
 
 ServerEnvironment::~ServerEnvironment()
@@ -605,6 +626,8 @@ ServerEnvironment::~ServerEnvironment()
 	// Convert all objects to static and delete the active objects
 	deactivateFarObjects(true);
 
+	delete m_abm_pool;
+
 	// Drop/delete map
 	m_map->drop();
 
@@ -813,23 +836,253 @@ void ServerEnvironment::loadDefaultMeta()
 	m_lbm_mgr.loadIntroductionTimes("", m_gamedef, m_game_time);
 }
 
-struct ActiveABM
+/*
+	ABMContentLookup
+*/
+
+ABMContentLookup::~ABMContentLookup()
 {
-	ActiveBlockModifier *abm;
-	int chance;
-	std::set<content_t> required_neighbors;
-};
+	for (size_t i = 0; i < m_lut.size(); i++)
+		delete m_lut[i];
+}
+
+void ABMContentLookup::addABM(const ActiveABM &aabm,
+		const std::set<content_t> &contents)
+{
+	ActiveABM ordered = aabm;
+	ordered.order = m_num_abms++;
+	for (std::set<content_t>::const_iterator it = contents.begin();
+			it != contents.end(); ++it) {
+		content_t c = *it;
+		if (c >= m_lut.size())
+			m_lut.resize(c + 1, NULL);
+		if (m_lut[c] == NULL)
+			m_lut[c] = new std::vector<ActiveABM>;
+		m_lut[c]->push_back(ordered);
+	}
+}
+
+bool ABMContentLookup::blockHasTriggers(MapBlock *block) const
+{
+	const std::vector<content_t> &contents = block->getContents();
+	for (size_t i = 0; i < contents.size(); i++) {
+		if (get(contents[i]))
+			return true;
+	}
+	return false;
+}
+
+static bool abm_order_less(const ABMTriggerCandidate &a,
+		const ABMTriggerCandidate &b)
+{
+	return a.abm_order < b.abm_order;
+}
+
+void ABMContentLookup::findCandidates(Map *map, MapBlock *block,
+		ABMNeighborWindow &window, PcgRandom &rand,
+		std::vector<ABMTriggerCandidate> &candidates) const
+{
+	if (empty() || !blockHasTriggers(block))
+		return;
+
+	size_t first = candidates.size();
+	window.invalidate();
+
+	v3s16 p0;
+	for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++)
+	for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+	for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++) {
+		MapNode n = block->getNodeNoEx(p0);
+		const std::vector<ActiveABM> *aabms = get(n.getContent());
+		if (aabms == NULL)
+			continue;
+
+		for (std::vector<ActiveABM>::const_iterator
+				i = aabms->begin(); i != aabms->end(); ++i) {
+			if (rand.range(i->chance) != 0)
+				continue;
+
+			// Check neighbors
+			if (!i->required_neighbors.empty()) {
+				if (!window.isValid())
+					window.update(map, block);
+				if (!window.hasNeighbor(p0, i->required_neighbors))
+					continue;
+			}
+
+			ABMTriggerCandidate c;
+			c.abm = i->abm;
+			c.abm_order = i->order;
+			c.p = p0 + block->getPosRelative();
+			c.n = n;
+			candidates.push_back(c);
+		}
+	}
+
+	// Nodes that several ABMs trigger on interleave their candidates;
+	// group them so that each ABM gets one batch
+	std::stable_sort(candidates.begin() + first, candidates.end(),
+			abm_order_less);
+}
+
+/*
+	ABMTriggerContext
+*/
+
+ABMTriggerContext::ABMTriggerContext(ServerEnvironment *env, MapBlock *block):
+	m_env(env),
+	m_map(&env->getMap()),
+	m_block(block)
+{
+	countObjects();
+}
+
+ABMTriggerContext::ABMTriggerContext(Map *map, MapBlock *block):
+	active_object_count(0),
+	active_object_count_wider(0),
+	m_env(NULL),
+	m_map(map),
+	m_block(block)
+{
+}
+
+void ABMTriggerContext::trigger(const std::vector<ABMTriggerCandidate> &candidates)
+{
+	size_t start = 0;
+	for (size_t i = 1; i <= candidates.size(); i++) {
+		if (i < candidates.size() &&
+				candidates[i].abm == candidates[start].abm)
+			continue;
+		candidates[start].abm->triggerBatch(m_env, &candidates[start],
+				i - start, *this);
+		start = i;
+	}
+}
+
+bool ABMTriggerContext::getCurrentNode(const ABMTriggerCandidate &candidate,
+		MapNode *n)
+{
+	*n = m_map->getNodeNoEx(candidate.p);
+	return n->getContent() == candidate.n.getContent();
+}
+
+void ABMTriggerContext::triggered()
+{
+	if (m_env != NULL && m_env->m_added_objects > 0)
+		countObjects();
+}
+
+void ABMTriggerContext::countObjects()
+{
+	Map *map = m_map;
+	u32 wider = 0;
+	u32 wider_unknown_count = 0;
+	for(s16 x=-1; x<=1; x++)
+	for(s16 y=-1; y<=1; y++)
+	for(s16 z=-1; z<=1; z++)
+	{
+		MapBlock *block2 = map->getBlockNoCreateNoEx(
+				m_block->getPos() + v3s16(x,y,z));
+		if(block2==NULL){
+			wider_unknown_count++;
+			continue;
+		}
+		wider += block2->m_static_objects.m_active.size()
+				+ block2->m_static_objects.m_stored.size();
+	}
+	// Extrapolate
+	u32 wider_known_count = 3*3*3 - wider_unknown_count;
+	wider += wider_unknown_count * wider / wider_known_count;
+
+	active_object_count = m_block->m_static_objects.m_active.size();
+	active_object_count_wider = wider;
+	m_env->m_added_objects = 0;
+}
+
+/*
+	ABMNeighborWindow
+*/
+
+ABMNeighborWindow::ABMNeighborWindow():
+	m_data(SIZE * SIZE * SIZE, CONTENT_IGNORE),
+	m_valid(false)
+{
+}
+
+// First and last window coordinate covered by the block at offset d
+static inline s16 window_start(s16 d)
+{
+	return d < 0 ? 0 : d == 0 ? 1 : MAP_BLOCKSIZE + 1;
+}
+
+static inline s16 window_end(s16 d)
+{
+	return d < 0 ? 0 : d == 0 ? MAP_BLOCKSIZE : MAP_BLOCKSIZE + 1;
+}
+
+void ABMNeighborWindow::update(Map *map, MapBlock *block)
+{
+	v3s16 blockpos = block->getPos();
+
+	v3s16 d;
+	for (d.Z = -1; d.Z <= 1; d.Z++)
+	for (d.Y = -1; d.Y <= 1; d.Y++)
+	for (d.X = -1; d.X <= 1; d.X++) {
+		MapBlock *block2 = (d == v3s16(0, 0, 0)) ? block :
+				map->getBlockNoCreateNoEx(blockpos + d);
+
+		// Part of the window covered by block2
+		v3s16 w0(window_start(d.X), window_start(d.Y), window_start(d.Z));
+		v3s16 w1(window_end(d.X), window_end(d.Y), window_end(d.Z));
+		// Window coordinates relative to block2
+		v3s16 offset = v3s16(1, 1, 1) + d * MAP_BLOCKSIZE;
+
+		v3s16 w;
+		for (w.Z = w0.Z; w.Z <= w1.Z; w.Z++)
+		for (w.Y = w0.Y; w.Y <= w1.Y; w.Y++) {
+			u32 i = (w.Z * SIZE + w.Y) * SIZE + w0.X;
+			for (w.X = w0.X; w.X <= w1.X; w.X++, i++) {
+				m_data[i] = block2 == NULL ? CONTENT_IGNORE :
+						block2->getNodeNoEx(w - offset).getContent();
+			}
+		}
+	}
+
+	m_valid = true;
+}
+
+bool ABMNeighborWindow::hasNeighbor(v3s16 p0,
+		const std::vector<bool> &contents) const
+{
+	v3s16 d;
+	for (d.Z = 0; d.Z <= 2; d.Z++)
+	for (d.Y = 0; d.Y <= 2; d.Y++) {
+		u32 i = ((p0.Z + d.Z) * SIZE + p0.Y + d.Y) * SIZE + p0.X;
+		for (d.X = 0; d.X <= 2; d.X++, i++) {
+			if (d == v3s16(1, 1, 1))
+				continue;
+			content_t c = m_data[i];
+			if (c < contents.size() && contents[c])
+				return true;
+		}
+	}
+	return false;
+}
 
 class ABMHandler
 {
 private:
 	ServerEnvironment *m_env;
-	std::map<content_t, std::vector<ActiveABM> > m_aabms;
+	ABMContentLookup m_aabms;
+	// Used by apply()
+	ABMNeighborWindow m_window;
+	PcgRandom m_rand;
 public:
 	ABMHandler(std::vector<ABMWithState> &abms,
 			float dtime_s, ServerEnvironment *env,
 			bool use_timers):
-		m_env(env)
+		m_env(env),
+		m_rand(myrand())
 	{
 		if(dtime_s < 0.001)
 			return;
@@ -864,131 +1117,91 @@ class ABMHandler
 				aabm.chance = chance;
 			}
 			// Trigger neighbors
+			std::set<content_t> required_neighbors;
 			std::set<std::string> required_neighbors_s
 					= abm->getRequiredNeighbors();
 			for(std::set<std::string>::iterator
 					i = required_neighbors_s.begin();
 					i != required_neighbors_s.end(); ++i)
 			{
-				ndef->getIds(*i, aabm.required_neighbors);
+				ndef->getIds(*i, required_neighbors);
+			}
+			if (!required_neighbors.empty()) {
+				aabm.required_neighbors.resize(
+						*required_neighbors.rbegin() + 1, false);
+				for (std::set<content_t>::const_iterator
+						k = required_neighbors.begin();
+						k != required_neighbors.end(); ++k)
+					aabm.required_neighbors[*k] = true;
 			}
 			// Trigger contents
+			std::set<content_t> contents;
 			std::set<std::string> contents_s = abm->getTriggerContents();
 			for(std::set<std::string>::iterator
 					i = contents_s.begin(); i != contents_s.end(); ++i)
 			{
-				std::set<content_t> ids;
-				ndef->getIds(*i, ids);
-				for(std::set<content_t>::const_iterator k = ids.begin();
-						k != ids.end(); ++k)
-				{
-					content_t c = *k;
-					std::map<content_t, std::vector<ActiveABM> >::iterator j;
-					j = m_aabms.find(c);
-					if(j == m_aabms.end()){
-						std::vector<ActiveABM> aabmlist;
-						m_aabms[c] = aabmlist;
-						j = m_aabms.find(c);
-					}
-					j->second.push_back(aabm);
-				}
+				ndef->getIds(*i, contents);
 			}
+			m_aabms.addABM(aabm, contents);
 		}
 	}
-	// Find out how many objects the given block and its neighbours contain.
-	// Returns the number of objects in the block, and also in 'wider' the
-	// number of objects in the block and all its neighbours. The latter
-	// may an estimate if any neighbours are unloaded.
-	u32 countObjects(MapBlock *block, ServerMap * map, u32 &wider)
+	// See ABMContentLookup::findCandidates()
+	void findCandidates(MapBlock *block, ABMNeighborWindow &window,
+			PcgRandom &rand, std::vector<ABMTriggerCandidate> &candidates)
 	{
-		wider = 0;
-		u32 wider_unknown_count = 0;
-		for(s16 x=-1; x<=1; x++)
-		for(s16 y=-1; y<=1; y++)
-		for(s16 z=-1; z<=1; z++)
-		{
-			MapBlock *block2 = map->getBlockNoCreateNoEx(
-					block->getPos() + v3s16(x,y,z));
-			if(block2==NULL){
-				wider_unknown_count++;
-				continue;
-			}
-			wider += block2->m_static_objects.m_active.size()
-					+ block2->m_static_objects.m_stored.size();
-		}
-		// Extrapolate
-		u32 active_object_count = block->m_static_objects.m_active.size();
-		u32 wider_known_count = 3*3*3 - wider_unknown_count;
-		wider += wider_unknown_count * wider / wider_known_count;
-		return active_object_count;
-
+		m_aabms.findCandidates(&m_env->getMap(), block, window, rand,
+				candidates);
 	}
-	void apply(MapBlock *block)
+	// Runs the triggers of the candidates found in block
+	void trigger(MapBlock *block,
+			const std::vector<ABMTriggerCandidate> &candidates)
 	{
-		if(m_aabms.empty())
+		if(candidates.empty())
 			return;
 
-		ServerMap *map = &m_env->getServerMap();
-
-		u32 active_object_count_wider;
-		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
-		m_env->m_added_objects = 0;
-
-		v3s16 p0;
-		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
-		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
-		for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
-		{
-			MapNode n = block->getNodeNoEx(p0);
-			content_t c = n.getContent();
-			v3s16 p = p0 + block->getPosRelative();
-
-			std::map<content_t, std::vector<ActiveABM> >::iterator j;
-			j = m_aabms.find(c);
-			if(j == m_aabms.end())
-				continue;
-
-			for(std::vector<ActiveABM>::iterator
-					i = j->second.begin(); i != j->second.end(); ++i) {
-				if(myrand() % i->chance != 0)
-					continue;
-
-				// Check neighbors
-				if(!i->required_neighbors.empty())
-				{
-					v3s16 p1;
-					for(p1.X = p.X-1; p1.X <= p.X+1; p1.X++)
-					for(p1.Y = p.Y-1; p1.Y <= p.Y+1; p1.Y++)
-					for(p1.Z = p.Z-1; p1.Z <= p.Z+1; p1.Z++)
-					{
-						if(p1 == p)
-							continue;
-						MapNode n = map->getNodeNoEx(p1);
-						content_t c = n.getContent();
-						std::set<content_t>::const_iterator k;
-						k = i->required_neighbors.find(c);
-						if(k != i->required_neighbors.end()){
-							goto neighbor_found;
-						}
-					}
-					// No required neighbor found
-					continue;
-				}
-neighbor_found:
-
-				// Call all the trigger variations
-				i->abm->trigger(m_env, p, n);
-				i->abm->trigger(m_env, p, n,
-						active_object_count, active_object_count_wider);
+		ABMTriggerContext context(m_env, block);
+		context.trigger(candidates);
+	}
+	void apply(MapBlock *block)
+	{
+		std::vector<ABMTriggerCandidate> candidates;
+		findCandidates(block, m_window, m_rand, candidates);
+		trigger(block, candidates);
+	}
+};
 
-				// Count surrounding objects again if the abms added any
-				if(m_env->m_added_objects > 0) {
-					active_object_count = countObjects(block, map, active_object_count_wider);
-					m_env->m_added_objects = 0;
-				}
-			}
-		}
+/*
+	Finds the ABM trigger candidates of a range of active blocks.
+*/
+class ABMScanJob : public WorkerJob
+{
+public:
+	ABMScanJob(ABMHandler *handler, const std::vector<MapBlock *> &blocks,
+			std::vector<std::vector<ABMTriggerCandidate> > &candidates,
+			size_t begin, size_t end, u64 seed):
+		m_handler(handler),
+		m_blocks(blocks),
+		m_candidates(candidates),
+		m_begin(begin),
+		m_end(end),
+		m_rand(seed)
+	{}
+
+	void run()
+	{
+		for (size_t i = m_begin; i < m_end; i++)
+			m_handler->findCandidates(m_blocks[i], m_window, m_rand,
+					m_candidates[i]);
 	}
+
+private:
+	ABMHandler *m_handler;
+	const std::vector<MapBlock *> &m_blocks;
+	std::vector<std::vector<ABMTriggerCandidate> > &m_candidates;
+	size_t m_begin;
+	size_t m_end;
+	ABMNeighborWindow m_window;
+	PcgRandom m_rand;
 };
 
 void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
@@ -1124,17 +1337,7 @@ bool ServerEnvironment::swapNode(v3s16 p, const MapNode &n)
 
 void ServerEnvironment::getObjectsInsideRadius(std::vector<u16> &objects, v3f pos, float radius)
 {
-	for(std::map<u16, ServerActiveObject*>::iterator
-			i = m_active_objects.begin();
-			i != m_active_objects.end(); ++i)
-	{
-		ServerActiveObject* obj = i->second;
-		u16 id = i->first;
-		v3f objectpos = obj->getBasePosition();
-		if(objectpos.getDistanceFrom(pos) > radius)
-			continue;
-		objects.push_back(id);
-	}
+	m_active_object_index.getObjectsInsideRadius(pos, radius, objects);
 }
 
 void ServerEnvironment::clearObjects(ClearObjectsMode mode)
@@ -1160,7 +1363,7 @@ void ServerEnvironment::clearObjects(ClearObjectsMode mode)
 			}
 		}
 		// If known by some client, don't delete immediately
-		if (obj->m_known_by_count > 0) {
+		if (!obj->m_known_by_peers.empty()) {
 			obj->m_pending_deactivation = true;
 			obj->m_removed = true;
 			continue;
@@ -1182,6 +1385,7 @@ void ServerEnvironment::clearObjects(ClearObjectsMode mode)
 	for (std::vector<u16>::iterator i = objects_to_remove.begin();
 			i != objects_to_remove.end(); ++i) {
 		m_active_objects.erase(*i);
+		m_active_object_index.remove(*i);
 	}
 
 	// Get list of loaded blocks
@@ -1465,24 +1669,54 @@ void ServerEnvironment::step(float dtime)
 		// Initialize handling of ActiveBlockModifiers
 		ABMHandler abmhandler(m_abms, m_cache_abm_interval, this, true);
 
+		std::vector<v3s16> positions;
+		std::vector<MapBlock *> blocks;
 		for(std::set<v3s16>::iterator
 				i = m_active_blocks.m_list.begin();
 				i != m_active_blocks.m_list.end(); ++i)
 		{
-			v3s16 p = *i;
-
-			/*infostream<<"Server: Block ("<<p.X<<","<<p.Y<<","<<p.Z
-					<<") being handled"<<std::endl;*/
-
-			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+			MapBlock *block = m_map->getBlockNoCreateNoEx(*i);
 			if(block == NULL)
 				continue;
 
 			// Set current time as timestamp
 			block->setTimestampNoChangedFlag(m_game_time);
 
-			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block);
+			positions.push_back(*i);
+			blocks.push_back(block);
+		}
+
+		/*
+			Find the nodes to trigger on in parallel. The map doesn't
+			change until this is done, since the emerge threads need the
+			environment lock to insert blocks.
+		*/
+		std::vector<std::vector<ABMTriggerCandidate> > candidates(blocks.size());
+		{
+			ScopeProfiler sp(g_profiler, "SEnv: ABM scan avg", SPT_AVG);
+			// A few jobs per thread to even out the load
+			size_t num_jobs = MYMIN(blocks.size(),
+					(size_t)(m_abm_pool->getThreadCount() + 1) * 4);
+			std::vector<WorkerJob *> jobs;
+			for(size_t i = 0; i < num_jobs; i++) {
+				jobs.push_back(new ABMScanJob(&abmhandler, blocks, candidates,
+						blocks.size() * i / num_jobs,
+						blocks.size() * (i + 1) / num_jobs, myrand()));
+			}
+			m_abm_pool->run(jobs);
+			for(size_t i = 0; i < jobs.size(); i++)
+				delete jobs[i];
+		}
+
+		// Lua is single threaded, so triggers run here. Look the blocks up
+		// again since triggers may unload or replace them.
+		for(size_t i = 0; i < blocks.size(); i++) {
+			if(candidates[i].empty())
+				continue;
+			MapBlock *block = m_map->getBlockNoCreateNoEx(positions[i]);
+			if(block == NULL)
+				continue;
+			abmhandler.trigger(block, candidates[i]);
 		}
 
 		u32 time_ms = timer.stop(true);
@@ -1545,7 +1779,7 @@ void ServerEnvironment::step(float dtime)
 	{
 		ScopeProfiler sp(g_profiler, "SEnv: remove removed objs avg /.5s", SPT_AVG);
 		/*
-			Remove objects that satisfy (m_removed && m_known_by_count==0)
+			Remove objects that satisfy (m_removed && m_known_by_peers.empty())
 		*/
 		removeRemovedObjects();
 	}
@@ -1653,27 +1887,43 @@ void ServerEnvironment::getAddedActiveObjects(Player *player, s16 radius,
 		player_radius_f = 0;
 
 	/*
-		Go through the object list,
+		Go through the objects near the player and the player objects,
 		- discard m_removed objects,
 		- discard objects that are too far away,
 		- discard objects that are found in current_objects.
 		- add remaining objects to added_objects
 	*/
-	for(std::map<u16, ServerActiveObject*>::iterator
-			i = m_active_objects.begin();
-			i != m_active_objects.end(); ++i) {
-		u16 id = i->first;
+	v3f player_pos = player->getPosition();
+	std::vector<u16> candidates;
+	m_active_object_index.getObjectsInsideRadius(player_pos, radius_f,
+		candidates);
+	// Player objects have a range of their own
+	size_t num_nearby = candidates.size();
+	for (std::vector<Player*>::iterator i = m_players.begin();
+			i != m_players.end(); ++i) {
+		PlayerSAO *sao = (*i)->getPlayerSAO();
+		if (sao && sao->getId() != 0)
+			candidates.push_back(sao->getId());
+	}
+
+	for (size_t i = 0; i < candidates.size(); i++) {
+		u16 id = candidates[i];
 
 		// Get object
-		ServerActiveObject *object = i->second;
+		ServerActiveObject *object = getActiveObject(id);
 		if(object == NULL)
 			continue;
 
+		// Player objects are looked at after the others
+		if ((object->getType() == ACTIVEOBJECT_TYPE_PLAYER) !=
+				(i >= num_nearby))
+			continue;
+
 		// Discard if removed or deactivating
 		if(object->m_removed || object->m_pending_deactivation)
 			continue;
 
-		f32 distance_f = object->getBasePosition().getDistanceFrom(player->getPosition());
+		f32 distance_f = object->getBasePosition().getDistanceFrom(player_pos);
 		if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER) {
 			// Discard if too far
 			if (distance_f > player_radius_f && player_radius_f != 0)
@@ -1772,6 +2022,16 @@ void ServerEnvironment::setStaticForActiveObjectsInBlock(
 	}
 }
 
+void ServerEnvironment::activeObjectMoved(ServerActiveObject *obj)
+{
+	// Ignore objects that aren't (or not yet) in the environment
+	std::map<u16, ServerActiveObject*>::iterator n =
+		m_active_objects.find(obj->getId());
+	if (n == m_active_objects.end() || n->second != obj)
+		return;
+	m_active_object_index.update(obj->getId(), obj->getBasePosition());
+}
+
 ActiveObjectMessage ServerEnvironment::getActiveObjectMessage()
 {
 	if(m_active_object_messages.empty())
@@ -1829,6 +2089,7 @@ u16 ServerEnvironment::addActiveObjectRaw(ServerActiveObject *object,
 			<<"added (id="<<object->getId()<<")"<<std::endl;*/
 
 	m_active_objects[object->getId()] = object;
+	m_active_object_index.insert(object->getId(), object->getBasePosition());
 
 	verbosestream<<"ServerEnvironment::addActiveObjectRaw(): "
 			<<"Added id="<<object->getId()<<"; there are now "
@@ -1870,7 +2131,7 @@ u16 ServerEnvironment::addActiveObjectRaw(ServerActiveObject *object,
 }
 
 /*
-	Remove objects that satisfy (m_removed && m_known_by_count==0)
+	Remove objects that satisfy (m_removed && m_known_by_peers.empty())
 */
 void ServerEnvironment::removeRemovedObjects()
 {
@@ -1914,9 +2175,9 @@ void ServerEnvironment::removeRemovedObjects()
 			}
 		}
 
-		// If m_known_by_count > 0, don't actually remove. On some future
-		// invocation this will be 0, which is when removal will continue.
-		if(obj->m_known_by_count > 0)
+		// If known by some client, don't actually remove. On some future
+		// invocation nobody will know it, which is when removal will continue.
+		if(!obj->m_known_by_peers.empty())
 			continue;
 
 		/*
@@ -1955,6 +2216,7 @@ void ServerEnvironment::removeRemovedObjects()
 	for(std::vector<u16>::iterator i = objects_to_remove.begin();
 			i != objects_to_remove.end(); ++i) {
 		m_active_objects.erase(*i);
+		m_active_object_index.remove(*i);
 	}
 }
 
@@ -2083,7 +2345,7 @@ void ServerEnvironment::activateObjects(MapBlock *block, u32 dtime_s)
 /*
 	Convert objects that are not standing inside active blocks to static.
 
-	If m_known_by_count != 0, active object is not deleted, but static
+	If m_known_by_peers isn't empty, active object is not deleted, but static
 	data is still updated.
 
 	If force_delete is set, active object is deleted nevertheless. It
@@ -2164,7 +2426,7 @@ void ServerEnvironment::deactivateFarObjects(bool force_delete)
 				<<PP(blockpos_o)<<std::endl;
 
 		// If known by some client, don't immediately delete.
-		bool pending_delete = (obj->m_known_by_count > 0 && !force_delete);
+		bool pending_delete = (!obj->m_known_by_peers.empty() && !force_delete);
 
 		/*
 			Update the static data
@@ -2316,6 +2578,7 @@ void ServerEnvironment::deactivateFarObjects(bool force_delete)
 	for(std::vector<u16>::iterator i = objects_to_remove.begin();
 			i != objects_to_remove.end(); ++i) {
 		m_active_objects.erase(*i);
+		m_active_object_index.remove(*i);
 	}
 }
 
@@ -36,6 +36,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <map>
 #include "irr_v3d.h"
 #include "activeobject.h"
+#include "activeobjectindex.h"
 #include "util/numeric.h"
 #include "mapnode.h"
 #include "mapblock.h"
@@ -54,6 +55,11 @@ class ClientMap;
 class GameScripting;
 class Player;
 class RemotePlayer;
+class PcgRandom;
+class WorkerPool;
+struct ABMTriggerCandidate;
+class ABMTriggerContext;
+class ABMNeighborWindow;
 
 class Environment
 {
@@ -175,6 +181,12 @@ class ActiveBlockModifier
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n){};
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 			u32 active_object_count, u32 active_object_count_wider){};
+	// Called with the trigger candidates of this ABM in a block. Calls both
+	// trigger() variants with the current node of each candidate that is
+	// still there.
+	virtual void triggerBatch(ServerEnvironment *env,
+			const ABMTriggerCandidate *candidates, u32 count,
+			ABMTriggerContext &context);
 };
 
 struct ABMWithState
@@ -185,6 +197,139 @@ struct ABMWithState
 	ABMWithState(ActiveBlockModifier *abm_);
 };
 
+struct ActiveABM
+{
+	ActiveBlockModifier *abm;
+	int chance;
+	// Indexed by content; empty = do not check neighbors
+	std::vector<bool> required_neighbors;
+	// Position in the order the ABMs were added to ABMContentLookup
+	u32 order;
+};
+
+/*
+	Flat lookup table from content to the ABMs that trigger on it.
+*/
+class ABMContentLookup
+{
+public:
+	ABMContentLookup(): m_num_abms(0) {}
+	~ABMContentLookup();
+
+	// Sets the order of aabm
+	void addABM(const ActiveABM &aabm, const std::set<content_t> &contents);
+
+	bool empty() const
+	{
+		return m_lut.empty();
+	}
+
+	// Returns NULL if no ABM triggers on c
+	inline const std::vector<ActiveABM> *get(content_t c) const
+	{
+		return c < m_lut.size() ? m_lut[c] : NULL;
+	}
+
+	// Whether any node of the block may trigger an ABM
+	bool blockHasTriggers(MapBlock *block) const;
+
+	// Appends the nodes of the block the ABMs trigger on to candidates,
+	// grouped by ABM in the order they were added.
+	// This only reads the map, and may be called from several threads at
+	// once for different blocks as long as the map doesn't change.
+	void findCandidates(Map *map, MapBlock *block, ABMNeighborWindow &window,
+			PcgRandom &rand, std::vector<ABMTriggerCandidate> &candidates) const;
+
+private:
+	std::vector<std::vector<ActiveABM> *> m_lut;
+	u32 m_num_abms;
+
+	DISABLE_CLASS_COPY(ABMContentLookup);
+};
+
+/*
+	A node an ABM is going to be triggered on. These are collected for all
+	active blocks before any trigger is run, see ServerEnvironment::step().
+*/
+struct ABMTriggerCandidate
+{
+	ActiveBlockModifier *abm;
+	// ActiveABM::order
+	u32 abm_order;
+	v3s16 p;
+	// The node when the candidate was found
+	MapNode n;
+};
+
+/*
+	State shared by the triggers run for the candidates of one block.
+*/
+class ABMTriggerContext
+{
+public:
+	ABMTriggerContext(ServerEnvironment *env, MapBlock *block);
+	// Without an environment no objects are counted
+	ABMTriggerContext(Map *map, MapBlock *block);
+
+	// Runs the triggers of candidates found in the block, one batch for
+	// each ABM
+	void trigger(const std::vector<ABMTriggerCandidate> &candidates);
+
+	// Reads the node of the candidate as it is now, since earlier triggers
+	// may have changed it. Returns false if it was replaced with another
+	// content.
+	bool getCurrentNode(const ABMTriggerCandidate &candidate, MapNode *n);
+
+	// Must be called after each trigger. Counts the objects around the
+	// block again if the trigger added any.
+	void triggered();
+
+	// Number of objects in the block, and in the block and its neighbors.
+	// The latter may be an estimate if any neighbors are unloaded.
+	u32 active_object_count;
+	u32 active_object_count_wider;
+
+private:
+	void countObjects();
+
+	ServerEnvironment *m_env;
+	Map *m_map;
+	MapBlock *m_block;
+};
+
+/*
+	Contents of a block and the nodes bordering it, so that required
+	neighbors of ABMs can be checked without going through the map.
+*/
+class ABMNeighborWindow
+{
+public:
+	ABMNeighborWindow();
+
+	// Reads the block and its border from map
+	void update(Map *map, MapBlock *block);
+
+	inline void invalidate()
+	{
+		m_valid = false;
+	}
+
+	inline bool isValid() const
+	{
+		return m_valid;
+	}
+
+	// Whether any of the 26 nodes around p0 (relative to the block) has
+	// one of the given contents
+	bool hasNeighbor(v3s16 p0, const std::vector<bool> &contents) const;
+
+private:
+	static const s16 SIZE = MAP_BLOCKSIZE + 2;
+
+	std::vector<content_t> m_data;
+	bool m_valid;
+};
+
 struct LoadingBlockModifierDef
 {
 	// Set of contents to trigger on
@@ -390,6 +535,9 @@ class ServerEnvironment : public Environment
 	*/
 	ActiveObjectMessage getActiveObjectMessage();
 
+	// Called by active objects whenever their position changes
+	void activeObjectMoved(ServerActiveObject *obj);
+
 	/*
 		Activate objects and dynamically modify for the dtime determined
 		from timestamp and additional_dtime
@@ -458,7 +606,7 @@ class ServerEnvironment : public Environment
 	u16 addActiveObjectRaw(ServerActiveObject *object, bool set_changed, u32 dtime_s);
 
 	/*
-		Remove all objects that satisfy (m_removed && m_known_by_count==0)
+		Remove all objects that satisfy (m_removed && m_known_by_peers.empty())
 	*/
 	void removeRemovedObjects();
 
@@ -470,7 +618,7 @@ class ServerEnvironment : public Environment
 	/*
 		Convert objects that are not in active blocks to static.
 
-		If m_known_by_count != 0, active object is not deleted, but static
+		If m_known_by_peers isn't empty, active object is not deleted, but static
 		data is still updated.
 
 		If force_delete is set, active object is deleted nevertheless. It
@@ -492,6 +640,8 @@ class ServerEnvironment : public Environment
 	const std::string m_path_world;
 	// Active object list
 	std::map<u16, ServerActiveObject*> m_active_objects;
+	// Where the objects of m_active_objects are
+	ActiveObjectIndex m_active_object_index;
 	// Outgoing network message buffer for active objects
 	std::queue<ActiveObjectMessage> m_active_object_messages;
 	// Some timers
@@ -513,6 +663,8 @@ class ServerEnvironment : public Environment
 	u32 m_last_clear_objects_time;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
+	// Threads for finding ABM trigger candidates
+	WorkerPool *m_abm_pool;
 	LBMManager m_lbm_mgr;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval;
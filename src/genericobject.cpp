@@ -19,6 +19,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "genericobject.h"
 #include <sstream>
+#include <cmath>
+#include "constants.h"
 #include "util/serialize.h"
 
 std::string gob_cmd_set_properties(const ObjectProperties &prop)
@@ -65,6 +67,209 @@ std::string gob_cmd_update_position(
 	return os.str();
 }
 
+/*
+	Position keyframes and deltas
+*/
+
+// Deltas are in 1/128 nodes, which covers 256 nodes around the keyframe
+#define POSITION_DELTA_STEP (BS / 128)
+// A keyframe is made at least this often (in seconds)
+#define POSITION_KEYFRAME_INTERVAL 1.0f
+
+// Fields of GENERIC_CMD_UPDATE_POSITION_DELTA following the position
+#define POSITION_DELTA_INTERPOLATE   0x01
+#define POSITION_DELTA_MOVEMENT_END  0x02
+#define POSITION_DELTA_VELOCITY      0x04
+#define POSITION_DELTA_ACCELERATION  0x08
+#define POSITION_DELTA_YAW           0x10
+#define POSITION_DELTA_INTERVAL      0x20
+
+ObjectPositionUpdate::ObjectPositionUpdate():
+	position(0,0,0),
+	velocity(0,0,0),
+	acceleration(0,0,0),
+	yaw(0),
+	do_interpolate(false),
+	is_movement_end(false),
+	update_interval(0)
+{
+}
+
+// The value of f after writeF1000() and readF1000()
+static f32 round_f1000(f32 f)
+{
+	return (f32)(s32)(f * FIXEDPOINT_FACTOR) / FIXEDPOINT_FACTOR;
+}
+
+static v3f round_v3f1000(v3f v)
+{
+	return v3f(round_f1000(v.X), round_f1000(v.Y), round_f1000(v.Z));
+}
+
+static bool quantize_delta(v3f delta, v3s16 *result)
+{
+	v3f q = delta / POSITION_DELTA_STEP;
+	if (fabs(q.X) > 32767 || fabs(q.Y) > 32767 || fabs(q.Z) > 32767)
+		return false;
+	*result = v3s16(floor(q.X + 0.5), floor(q.Y + 0.5), floor(q.Z + 0.5));
+	return true;
+}
+
+static v3f dequantize_delta(v3s16 delta)
+{
+	return v3f(delta.X, delta.Y, delta.Z) * POSITION_DELTA_STEP;
+}
+
+// Yaw is in degrees, all turns map to the same 16 bits
+static u16 quantize_yaw(f32 yaw)
+{
+	f32 turn = fmod(yaw, 360.0f);
+	if (turn < 0)
+		turn += 360.0f;
+	return (u16)(u32)floor(turn * 65536.0f / 360.0f + 0.5f);
+}
+
+static f32 dequantize_yaw(u16 yaw)
+{
+	return yaw * 360.0f / 65536.0f;
+}
+
+static std::string position_keyframe(u8 keyframe_id, bool apply,
+		const ObjectPositionUpdate &update)
+{
+	std::ostringstream os(std::ios::binary);
+	writeU8(os, GENERIC_CMD_UPDATE_POSITION_KEYFRAME);
+	writeU8(os, keyframe_id);
+	// whether to move the object, or only to remember the keyframe
+	writeU8(os, apply);
+	// the same as GENERIC_CMD_UPDATE_POSITION
+	writeV3F1000(os, update.position);
+	writeV3F1000(os, update.velocity);
+	writeV3F1000(os, update.acceleration);
+	writeF1000(os, update.yaw);
+	writeU8(os, update.do_interpolate);
+	writeU8(os, update.is_movement_end);
+	writeF1000(os, update.update_interval);
+	return os.str();
+}
+
+PositionUpdateEncoder::PositionUpdateEncoder():
+	m_has_keyframe(false),
+	m_keyframe_id(0),
+	m_keyframe_age(0)
+{
+}
+
+std::string PositionUpdateEncoder::encode(const ObjectPositionUpdate &update,
+		bool *is_keyframe)
+{
+	// Jumps have to arrive
+	bool keyframe = !m_has_keyframe || !update.do_interpolate ||
+		m_keyframe_age >= POSITION_KEYFRAME_INTERVAL;
+
+	v3s16 position, velocity, acceleration;
+	if (!keyframe) {
+		keyframe = !quantize_delta(update.position - m_keyframe.position, &position) ||
+			!quantize_delta(update.velocity - m_keyframe.velocity, &velocity) ||
+			!quantize_delta(update.acceleration - m_keyframe.acceleration, &acceleration);
+	}
+
+	*is_keyframe = keyframe;
+	if (keyframe) {
+		m_has_keyframe = true;
+		m_keyframe_id++;
+		m_keyframe_age = 0;
+		m_keyframe = update;
+		m_keyframe.position = round_v3f1000(update.position);
+		m_keyframe.velocity = round_v3f1000(update.velocity);
+		m_keyframe.acceleration = round_v3f1000(update.acceleration);
+		m_keyframe.yaw = round_f1000(update.yaw);
+		m_keyframe.update_interval = round_f1000(update.update_interval);
+		return position_keyframe(m_keyframe_id, true, m_keyframe);
+	}
+
+	u8 fields = 0;
+	if (update.do_interpolate)
+		fields |= POSITION_DELTA_INTERPOLATE;
+	if (update.is_movement_end)
+		fields |= POSITION_DELTA_MOVEMENT_END;
+	if (velocity != v3s16(0,0,0))
+		fields |= POSITION_DELTA_VELOCITY;
+	if (acceleration != v3s16(0,0,0))
+		fields |= POSITION_DELTA_ACCELERATION;
+	if (round_f1000(update.yaw) != m_keyframe.yaw)
+		fields |= POSITION_DELTA_YAW;
+	if (round_f1000(update.update_interval) != m_keyframe.update_interval)
+		fields |= POSITION_DELTA_INTERVAL;
+
+	std::ostringstream os(std::ios::binary);
+	writeU8(os, GENERIC_CMD_UPDATE_POSITION_DELTA);
+	writeU8(os, m_keyframe_id);
+	writeU8(os, fields);
+	writeV3S16(os, position);
+	if (fields & POSITION_DELTA_VELOCITY)
+		writeV3S16(os, velocity);
+	if (fields & POSITION_DELTA_ACCELERATION)
+		writeV3S16(os, acceleration);
+	if (fields & POSITION_DELTA_YAW)
+		writeU16(os, quantize_yaw(update.yaw));
+	if (fields & POSITION_DELTA_INTERVAL)
+		writeF1000(os, update.update_interval);
+	return os.str();
+}
+
+std::string PositionUpdateEncoder::getKeyframe() const
+{
+	if (!m_has_keyframe)
+		return "";
+	return position_keyframe(m_keyframe_id, false, m_keyframe);
+}
+
+PositionUpdateDecoder::PositionUpdateDecoder():
+	m_has_keyframe(false),
+	m_keyframe_id(0)
+{
+}
+
+bool PositionUpdateDecoder::read(u8 cmd, std::istream &is,
+		ObjectPositionUpdate *update)
+{
+	if (cmd == GENERIC_CMD_UPDATE_POSITION_KEYFRAME) {
+		m_has_keyframe = true;
+		m_keyframe_id = readU8(is);
+		bool apply = readU8(is);
+		m_keyframe.position = readV3F1000(is);
+		m_keyframe.velocity = readV3F1000(is);
+		m_keyframe.acceleration = readV3F1000(is);
+		m_keyframe.yaw = readF1000(is);
+		m_keyframe.do_interpolate = readU8(is);
+		m_keyframe.is_movement_end = readU8(is);
+		m_keyframe.update_interval = readF1000(is);
+		*update = m_keyframe;
+		return apply;
+	}
+
+	u8 keyframe_id = readU8(is);
+	// The keyframe was not received yet, or a newer one was
+	if (!m_has_keyframe || keyframe_id != m_keyframe_id)
+		return false;
+
+	u8 fields = readU8(is);
+	*update = m_keyframe;
+	update->do_interpolate = fields & POSITION_DELTA_INTERPOLATE;
+	update->is_movement_end = fields & POSITION_DELTA_MOVEMENT_END;
+	update->position += dequantize_delta(readV3S16(is));
+	if (fields & POSITION_DELTA_VELOCITY)
+		update->velocity += dequantize_delta(readV3S16(is));
+	if (fields & POSITION_DELTA_ACCELERATION)
+		update->acceleration += dequantize_delta(readV3S16(is));
+	if (fields & POSITION_DELTA_YAW)
+		update->yaw = dequantize_yaw(readU16(is));
+	if (fields & POSITION_DELTA_INTERVAL)
+		update->update_interval = readF1000(is);
+	return true;
+}
+
 std::string gob_cmd_set_texture_mod(const std::string &mod)
 {
 	std::ostringstream os(std::ios::binary);
@@ -35,7 +35,9 @@ enum GenericCMD {
 	GENERIC_CMD_SET_BONE_POSITION,
 	GENERIC_CMD_ATTACH_TO,
 	GENERIC_CMD_SET_PHYSICS_OVERRIDE,
-	GENERIC_CMD_UPDATE_NAMETAG_ATTRIBUTES
+	GENERIC_CMD_UPDATE_NAMETAG_ATTRIBUTES,
+	GENERIC_CMD_UPDATE_POSITION_KEYFRAME,
+	GENERIC_CMD_UPDATE_POSITION_DELTA
 };
 
 #include "object_properties.h"
@@ -52,6 +54,63 @@ std::string gob_cmd_update_position(
 	f32 update_interval
 );
 
+struct ObjectPositionUpdate
+{
+	ObjectPositionUpdate();
+
+	v3f position;
+	v3f velocity;
+	v3f acceleration;
+	f32 yaw;
+	bool do_interpolate;
+	bool is_movement_end;
+	f32 update_interval;
+};
+
+/*
+	Encodes the position updates of an object as keyframes, which carry
+	full values and are sent reliably, and deltas against the last keyframe,
+	which are quantized and sent unreliably. A lost delta doesn't affect the
+	ones after it, and clients ignore deltas until they have their keyframe.
+*/
+class PositionUpdateEncoder
+{
+public:
+	PositionUpdateEncoder();
+
+	void step(f32 dtime) { m_keyframe_age += dtime; }
+
+	// Sets *is_keyframe if the returned message has to be sent reliably
+	std::string encode(const ObjectPositionUpdate &update, bool *is_keyframe);
+
+	// Gives the last keyframe to a client that starts to see the object,
+	// without moving it. Empty if no keyframe was made yet.
+	std::string getKeyframe() const;
+
+private:
+	bool m_has_keyframe;
+	u8 m_keyframe_id;
+	f32 m_keyframe_age;
+	// As the clients read it
+	ObjectPositionUpdate m_keyframe;
+};
+
+class PositionUpdateDecoder
+{
+public:
+	PositionUpdateDecoder();
+
+	// Reads a GENERIC_CMD_UPDATE_POSITION_KEYFRAME or
+	// GENERIC_CMD_UPDATE_POSITION_DELTA message following the command.
+	// Returns false if the object should not be moved.
+	bool read(u8 cmd, std::istream &is, ObjectPositionUpdate *update);
+
+private:
+	bool m_has_keyframe;
+	u8 m_keyframe_id;
+	ObjectPositionUpdate m_keyframe;
+};
+
 std::string gob_cmd_set_texture_mod(const std::string &mod);
 
 std::string gob_cmd_set_sprite(
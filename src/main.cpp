@@ -200,8 +200,9 @@ int main(int argc, char *argv[])
 
 #ifndef __ANDROID__
 	// Run unit tests
-	if (cmd_args.getFlag("run-unittests")) {
-		return run_tests();
+	if (cmd_args.getFlag("run-unittests") ||
+			cmd_args.getFlag("run-benchmarks")) {
+		return run_tests(cmd_args.getFlag("run-benchmarks"));
 	}
 #endif
 
@@ -275,6 +276,8 @@ static void set_allowed_options(OptionList *allowed_options)
 			_("Set network port (UDP)"))));
 	allowed_options->insert(std::make_pair("run-unittests", ValueSpec(VALUETYPE_FLAG,
 			_("Run the unit tests and exit"))));
+	allowed_options->insert(std::make_pair("run-benchmarks", ValueSpec(VALUETYPE_FLAG,
+			_("Run the unit tests and benchmarks and exit"))));
 	allowed_options->insert(std::make_pair("map-dir", ValueSpec(VALUETYPE_STRING,
 			_("Same as --world (deprecated)"))));
 	allowed_options->insert(std::make_pair("world", ValueSpec(VALUETYPE_STRING,
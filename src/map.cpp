@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapblock.h"
 #include "filesys.h"
 #include "voxel.h"
+#include "voxelalgorithms.h"
 #include "porting.h"
 #include "serialization.h"
 #include "nodemetadata.h"
@@ -42,6 +43,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "database.h"
 #include "database-dummy.h"
 #include "database-sqlite3.h"
+#include "map_saver.h"
+#include "util/cpp11_container.h"
+#include "util/workerpool.h"
 #include <deque>
 #include <queue>
 #if USE_LEVELDB
@@ -56,6 +60,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define PP(x) "("<<(x).X<<","<<(x).Y<<","<<(x).Z<<")"
 
+// Most blocks ServerMap::finishPrefetch() keeps around
+#define PREFETCH_CACHE_MAX 4096
+
 
 /*
 	Map
@@ -68,12 +75,17 @@ Map::Map(std::ostream &dout, IGameDef *gamedef):
 	m_transforming_liquid_loop_count_multiplier(1.0f),
 	m_unprocessed_count(0),
 	m_inc_trending_up_start_time(0),
-	m_queue_size_timer_started(false)
+	m_queue_size_timer_started(false),
+	m_liquid_pool(NULL),
+	m_lighting_window(new voxalgo::LightingWindow())
 {
 }
 
 Map::~Map()
 {
+	delete m_liquid_pool;
+	delete m_lighting_window;
+
 	/*
 		Free all MapSectors
 	*/
@@ -139,16 +151,6 @@ MapSector * Map::getSectorNoGenerate(v2s16 p)
 	return sector;
 }
 
-MapBlock * Map::getBlockNoCreateNoEx(v3s16 p3d)
-{
-	v2s16 p2d(p3d.X, p3d.Z);
-	MapSector * sector = getSectorNoGenerateNoEx(p2d);
-	if(sector == NULL)
-		return NULL;
-	MapBlock *block = sector->getBlockNoCreateNoEx(p3d.Y);
-	return block;
-}
-
 MapBlock * Map::getBlockNoCreate(v3s16 p3d)
 {
 	MapBlock *block = getBlockNoCreateNoEx(p3d);
@@ -413,20 +415,6 @@ void Map::unspreadLight(enum LightBank bank,
 		unspreadLight(bank, unlighted_nodes, light_sources, modified_blocks);
 }
 
-/*
-	A single-node wrapper of the above
-*/
-void Map::unLightNeighbors(enum LightBank bank,
-		v3s16 pos, u8 lightwas,
-		std::set<v3s16> & light_sources,
-		std::map<v3s16, MapBlock*>  & modified_blocks)
-{
-	std::map<v3s16, u8> from_nodes;
-	from_nodes[pos] = lightwas;
-
-	unspreadLight(bank, from_nodes, light_sources, modified_blocks);
-}
-
 /*
 	Lights neighbors of from_nodes, collects all them and then
 	goes on recursively.
@@ -568,108 +556,6 @@ void Map::spreadLight(enum LightBank bank,
 		spreadLight(bank, lighted_nodes, modified_blocks);
 }
 
-/*
-	A single-node source variation of the above.
-*/
-void Map::lightNeighbors(enum LightBank bank,
-		v3s16 pos,
-		std::map<v3s16, MapBlock*> & modified_blocks)
-{
-	std::set<v3s16> from_nodes;
-	from_nodes.insert(pos);
-	spreadLight(bank, from_nodes, modified_blocks);
-}
-
-v3s16 Map::getBrightestNeighbour(enum LightBank bank, v3s16 p)
-{
-	INodeDefManager *nodemgr = m_gamedef->ndef();
-
-	v3s16 dirs[6] = {
-		v3s16(0,0,1), // back
-		v3s16(0,1,0), // top
-		v3s16(1,0,0), // right
-		v3s16(0,0,-1), // front
-		v3s16(0,-1,0), // bottom
-		v3s16(-1,0,0), // left
-	};
-
-	u8 brightest_light = 0;
-	v3s16 brightest_pos(0,0,0);
-	bool found_something = false;
-
-	// Loop through 6 neighbors
-	for(u16 i=0; i<6; i++){
-		// Get the position of the neighbor node
-		v3s16 n2pos = p + dirs[i];
-		MapNode n2;
-		bool is_valid_position;
-		n2 = getNodeNoEx(n2pos, &is_valid_position);
-		if (!is_valid_position)
-			continue;
-
-		if(n2.getLight(bank, nodemgr) > brightest_light || found_something == false){
-			brightest_light = n2.getLight(bank, nodemgr);
-			brightest_pos = n2pos;
-			found_something = true;
-		}
-	}
-
-	if(found_something == false)
-		throw InvalidPositionException();
-
-	return brightest_pos;
-}
-
-/*
-	Propagates sunlight down from a node.
-	Starting point gets sunlight.
-
-	Returns the lowest y value of where the sunlight went.
-
-	Mud is turned into grass in where the sunlight stops.
-*/
-s16 Map::propagateSunlight(v3s16 start,
-		std::map<v3s16, MapBlock*> & modified_blocks)
-{
-	INodeDefManager *nodemgr = m_gamedef->ndef();
-
-	s16 y = start.Y;
-	for(; ; y--)
-	{
-		v3s16 pos(start.X, y, start.Z);
-
-		v3s16 blockpos = getNodeBlockPos(pos);
-		MapBlock *block;
-		try{
-			block = getBlockNoCreate(blockpos);
-		}
-		catch(InvalidPositionException &e)
-		{
-			break;
-		}
-
-		v3s16 relpos = pos - blockpos*MAP_BLOCKSIZE;
-		bool is_valid_position;
-		MapNode n = block->getNode(relpos, &is_valid_position);
-		if (!is_valid_position)
-			break;
-
-		if(nodemgr->get(n).sunlight_propagates)
-		{
-			n.setLight(LIGHTBANK_DAY, LIGHT_SUN, nodemgr);
-			block->setNode(relpos, n);
-
-			modified_blocks[blockpos] = block;
-		}
-		else
-		{
-			// Sunlight goes no further
-			break;
-		}
-	}
-	return y + 1;
-}
-
 void Map::updateLighting(enum LightBank bank,
 		std::map<v3s16, MapBlock*> & a_blocks,
 		std::map<v3s16, MapBlock*> & modified_blocks)
@@ -934,78 +820,15 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 	m_dout<<"Map::addNodeAndUpdate(): p=("
 			<<p.X<<","<<p.Y<<","<<p.Z<<")"<<std::endl;*/
 
-	/*
-		From this node to nodes underneath:
-		If lighting is sunlight (1.0), unlight neighbours and
-		set lighting to 0.
-		Else discontinue.
-	*/
-
-	v3s16 toppos = p + v3s16(0,1,0);
-	//v3s16 bottompos = p + v3s16(0,-1,0);
-
-	bool node_under_sunlight = true;
-	std::set<v3s16> light_sources;
-
 	/*
 		Collect old node for rollback
 	*/
 	RollbackNode rollback_oldnode(this, p, m_gamedef);
 
-	/*
-		If there is a node at top and it doesn't have sunlight,
-		there has not been any sunlight going down.
-
-		Otherwise there probably is.
-	*/
-
-	bool is_valid_position;
-	MapNode topnode = getNodeNoEx(toppos, &is_valid_position);
-
-	if(is_valid_position && topnode.getLight(LIGHTBANK_DAY, ndef) != LIGHT_SUN)
-		node_under_sunlight = false;
-
-	/*
-		Remove all light that has come out of this node
-	*/
-
-	enum LightBank banks[] =
-	{
-		LIGHTBANK_DAY,
-		LIGHTBANK_NIGHT
-	};
-	for(s32 i=0; i<2; i++)
-	{
-		enum LightBank bank = banks[i];
-
-		u8 lightwas = getNodeNoEx(p).getLight(bank, ndef);
-
-		// Add the block of the added node to modified_blocks
-		v3s16 blockpos = getNodeBlockPos(p);
-		MapBlock * block = getBlockNoCreate(blockpos);
-		assert(block != NULL);
-		modified_blocks[blockpos] = block;
-
-		assert(isValidPosition(p));
-
-		// Unlight neighbours of node.
-		// This means setting light of all consequent dimmer nodes
-		// to 0.
-		// This also collects the nodes at the border which will spread
-		// light again into this.
-		unLightNeighbors(bank, p, lightwas, light_sources, modified_blocks);
-
-		n.setLight(bank, 0, ndef);
-	}
-
-	/*
-		If node lets sunlight through and is under sunlight, it has
-		sunlight too.
-	*/
-	if(node_under_sunlight && ndef->get(n).sunlight_propagates)
-	{
-		n.setLight(LIGHTBANK_DAY, LIGHT_SUN, ndef);
-	}
+	// Throws InvalidPositionException if the node isn't there
+	v3s16 blockpos = getNodeBlockPos(p);
+	MapBlock *block = getBlockNoCreate(blockpos);
+	MapNode oldnode = getNodeNoEx(p);
 
 	/*
 		Remove node metadata
@@ -1015,53 +838,14 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 	}
 
 	/*
-		Set the node on the map
+		Set the node on the map and light the area around it again.
+		This also takes sunlight from or gives it to the nodes under it.
 	*/
-
 	setNode(p, n);
+	m_lighting_window->updateNode(this, ndef, p, oldnode, modified_blocks);
 
-	/*
-		If node is under sunlight and doesn't let sunlight through,
-		take all sunlighted nodes under it and clear light from them
-		and from where the light has been spread.
-		TODO: This could be optimized by mass-unlighting instead
-			  of looping
-	*/
-	if(node_under_sunlight && !ndef->get(n).sunlight_propagates)
-	{
-		s16 y = p.Y - 1;
-		for(;; y--){
-			//m_dout<<"y="<<y<<std::endl;
-			v3s16 n2pos(p.X, y, p.Z);
-
-			MapNode n2;
-
-			n2 = getNodeNoEx(n2pos, &is_valid_position);
-			if (!is_valid_position)
-				break;
-
-			if(n2.getLight(LIGHTBANK_DAY, ndef) == LIGHT_SUN)
-			{
-				unLightNeighbors(LIGHTBANK_DAY,
-						n2pos, n2.getLight(LIGHTBANK_DAY, ndef),
-						light_sources, modified_blocks);
-				n2.setLight(LIGHTBANK_DAY, 0, ndef);
-				setNode(n2pos, n2);
-			}
-			else
-				break;
-		}
-	}
-
-	for(s32 i=0; i<2; i++)
-	{
-		enum LightBank bank = banks[i];
-
-		/*
-			Spread light from all nodes that might be capable of doing so
-		*/
-		spreadLight(bank, light_sources, modified_blocks);
-	}
+	// Add the block of the added node to modified_blocks
+	modified_blocks[blockpos] = block;
 
 	/*
 		Update information about whether day and night light differ
@@ -1101,6 +885,7 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 	{
 		v3s16 p2 = p + dirs[i];
 
+		bool is_valid_position;
 		MapNode n2 = getNodeNoEx(p2, &is_valid_position);
 		if(is_valid_position
 				&& (ndef->get(n2).isLiquid() || n2.getContent() == CONTENT_AIR))
@@ -1121,10 +906,6 @@ void Map::removeNodeAndUpdate(v3s16 p,
 	m_dout<<"Map::removeNodeAndUpdate(): p=("
 			<<p.X<<","<<p.Y<<","<<p.Z<<")"<<std::endl;*/
 
-	bool node_under_sunlight = true;
-
-	v3s16 toppos = p + v3s16(0,1,0);
-
 	// Node will be replaced with this
 	content_t replace_material = CONTENT_AIR;
 
@@ -1133,34 +914,10 @@ void Map::removeNodeAndUpdate(v3s16 p,
 	*/
 	RollbackNode rollback_oldnode(this, p, m_gamedef);
 
-	/*
-		If there is a node at top and it doesn't have sunlight,
-		there will be no sunlight going down.
-	*/
-	bool is_valid_position;
-	MapNode topnode = getNodeNoEx(toppos, &is_valid_position);
-
-	if(is_valid_position && topnode.getLight(LIGHTBANK_DAY, ndef) != LIGHT_SUN)
-		node_under_sunlight = false;
-
-	std::set<v3s16> light_sources;
-
-	enum LightBank banks[] =
-	{
-		LIGHTBANK_DAY,
-		LIGHTBANK_NIGHT
-	};
-	for(s32 i=0; i<2; i++)
-	{
-		enum LightBank bank = banks[i];
-
-		/*
-			Unlight neighbors (in case the node is a light source)
-		*/
-		unLightNeighbors(bank, p,
-				getNodeNoEx(p).getLight(bank, ndef),
-				light_sources, modified_blocks);
-	}
+	// Throws InvalidPositionException if the node isn't there
+	v3s16 blockpos = getNodeBlockPos(p);
+	MapBlock *block = getBlockNoCreate(blockpos);
+	MapNode oldnode = getNodeNoEx(p);
 
 	/*
 		Remove node metadata
@@ -1169,78 +926,17 @@ void Map::removeNodeAndUpdate(v3s16 p,
 	removeNodeMetadata(p);
 
 	/*
-		Remove the node.
-		This also clears the lighting.
+		Remove the node and light the area around it again.
+		Sunlight goes down from it if it was under sunlight.
 	*/
 
 	MapNode n(replace_material);
 	setNode(p, n);
-
-	for(s32 i=0; i<2; i++)
-	{
-		enum LightBank bank = banks[i];
-
-		/*
-			Recalculate lighting
-		*/
-		spreadLight(bank, light_sources, modified_blocks);
-	}
+	m_lighting_window->updateNode(this, ndef, p, oldnode, modified_blocks);
 
 	// Add the block of the removed node to modified_blocks
-	v3s16 blockpos = getNodeBlockPos(p);
-	MapBlock * block = getBlockNoCreate(blockpos);
-	assert(block != NULL);
 	modified_blocks[blockpos] = block;
 
-	/*
-		If the removed node was under sunlight, propagate the
-		sunlight down from it and then light all neighbors
-		of the propagated blocks.
-	*/
-	if(node_under_sunlight)
-	{
-		s16 ybottom = propagateSunlight(p, modified_blocks);
-		/*m_dout<<"Node was under sunlight. "
-				"Propagating sunlight";
-		m_dout<<" -> ybottom="<<ybottom<<std::endl;*/
-		s16 y = p.Y;
-		for(; y >= ybottom; y--)
-		{
-			v3s16 p2(p.X, y, p.Z);
-			/*m_dout<<"lighting neighbors of node ("
-					<<p2.X<<","<<p2.Y<<","<<p2.Z<<")"
-					<<std::endl;*/
-			lightNeighbors(LIGHTBANK_DAY, p2, modified_blocks);
-		}
-	}
-	else
-	{
-		// Set the lighting of this node to 0
-		// TODO: Is this needed? Lighting is cleared up there already.
-		MapNode n = getNodeNoEx(p, &is_valid_position);
-		if (is_valid_position) {
-			n.setLight(LIGHTBANK_DAY, 0, ndef);
-			setNode(p, n);
-		} else {
-			FATAL_ERROR("Invalid position");
-		}
-	}
-
-	for(s32 i=0; i<2; i++)
-	{
-		enum LightBank bank = banks[i];
-
-		// Get the brightest neighbour node and propagate light from it
-		v3s16 n2p = getBrightestNeighbour(bank, p);
-		try{
-			//MapNode n2 = getNode(n2p);
-			lightNeighbors(bank, n2p, modified_blocks);
-		}
-		catch(InvalidPositionException &e)
-		{
-		}
-	}
-
 	/*
 		Update information about whether day and night light differ
 	*/
@@ -1609,6 +1305,223 @@ struct NodeNeighbor {
 	{ }
 };
 
+/*
+	Where transforming liquid nodes reads and writes nodes, and what it
+	leaves to do afterwards.  Blocks are found through the block index,
+	which several threads may read at once.
+*/
+class LiquidRegion
+{
+public:
+	LiquidRegion(Map *map):
+		m_map(map),
+		m_last_block(NULL),
+		m_has_last_block(false)
+	{}
+
+	MapBlock *getBlock(v3s16 blockpos)
+	{
+		if (!m_has_last_block || blockpos != m_last_blockpos) {
+			m_last_block = m_map->getBlockNoCreateNoEx(blockpos);
+			m_last_blockpos = blockpos;
+			m_has_last_block = true;
+		}
+		return m_last_block;
+	}
+
+	MapNode getNode(v3s16 p)
+	{
+		v3s16 blockpos = getNodeBlockPos(p);
+		MapBlock *block = getBlock(blockpos);
+		if (block == NULL)
+			return MapNode(CONTENT_IGNORE);
+		return block->getNodeNoEx(p - blockpos * MAP_BLOCKSIZE);
+	}
+
+	void setNode(v3s16 p, MapNode &n)
+	{
+		// Refused and reported by the map
+		if (n.getContent() == CONTENT_IGNORE) {
+			m_map->setNode(p, n);
+			return;
+		}
+		v3s16 blockpos = getNodeBlockPos(p);
+		MapBlock *block = getBlock(blockpos);
+		if (block == NULL)
+			throw InvalidPositionException();
+		block->setNodeNoCheck(p - blockpos * MAP_BLOCKSIZE, n);
+	}
+
+	// Nodes to add to the queue, in order
+	std::vector<v3s16> queued;
+	std::map<v3s16, MapBlock *> modified_blocks;
+	// Those that require a lighting update (due to lava)
+	std::map<v3s16, MapBlock *> lighting_modified_blocks;
+
+private:
+	Map *m_map;
+	v3s16 m_last_blockpos;
+	MapBlock *m_last_block;
+	bool m_has_last_block;
+};
+
+/*
+	Transforming liquids in parallel
+
+	The batch of queued nodes is split into regions of whole blocks, which
+	are transformed on the worker pool in queue order.  A node next to
+	another region reads a node there, so it waits until the neighbouring
+	nodes that come earlier in the queue are done, and the later ones wait
+	for it.  This gives the same nodes as transforming them one by one.
+	The nodes that get queued are added afterwards in the original order.
+*/
+
+// Regions are this many blocks wide
+#define LIQUID_REGION_SIZE 2
+
+static inline u64 liquid_pos_key(v3s16 p)
+{
+	return (u64)(u16)p.X | ((u64)(u16)p.Y << 16) | ((u64)(u16)p.Z << 32);
+}
+
+static inline v3s16 liquid_region_pos(v3s16 p)
+{
+	return getContainerPos(p, MAP_BLOCKSIZE * LIQUID_REGION_SIZE);
+}
+
+struct LiquidEntry
+{
+	v3s16 p;
+	u32 region;
+	// Position among the entries of the region
+	u32 region_index;
+	// Range of LiquidRegionJob::deps: entries next to this one in other
+	// regions that come earlier in the queue
+	u32 deps_begin;
+	u32 deps_end;
+	// Range of LiquidRegion::queued
+	u32 queued_begin;
+	u32 queued_end;
+	bool must_reflow;
+};
+
+class LiquidRegionJob;
+
+struct LiquidBatch
+{
+	enum Phase {
+		INDEX_ENTRIES,
+		FIND_DEPENDENCIES,
+		TRANSFORM
+	};
+
+	bool findEntry(v3s16 p, u32 *index) const;
+
+	Phase phase;
+	// In queue order
+	std::vector<LiquidEntry> entries;
+	std::vector<LiquidRegionJob *> regions;
+	// Key = packed region position
+	UNORDERED_MAP<u64, u32> region_of_pos;
+	// How many entries each region had transformed when the round started
+	std::vector<u32> done_counts;
+};
+
+class LiquidRegionJob : public WorkerJob
+{
+public:
+	LiquidRegionJob(Map *map, LiquidBatch *batch, v3s16 pos):
+		region(map),
+		next_entry(0),
+		m_map(map),
+		m_batch(batch),
+		m_pos(pos)
+	{}
+
+	void run();
+
+	LiquidRegion region;
+	// Batch entries in this region, in queue order
+	std::vector<u32> entries;
+	u32 next_entry;
+	// Key = packed node position, value = batch entry
+	UNORDERED_MAP<u64, u32> entry_of_pos;
+	std::vector<u32> deps;
+
+private:
+	void findDependencies();
+	void transform();
+
+	Map *m_map;
+	LiquidBatch *m_batch;
+	v3s16 m_pos;
+};
+
+bool LiquidBatch::findEntry(v3s16 p, u32 *index) const
+{
+	UNORDERED_MAP<u64, u32>::const_iterator r =
+		region_of_pos.find(liquid_pos_key(liquid_region_pos(p)));
+	if (r == region_of_pos.end())
+		return false;
+	const UNORDERED_MAP<u64, u32> &entry_of_pos = regions[r->second]->entry_of_pos;
+	UNORDERED_MAP<u64, u32>::const_iterator e =
+		entry_of_pos.find(liquid_pos_key(p));
+	if (e == entry_of_pos.end())
+		return false;
+	*index = e->second;
+	return true;
+}
+
+void LiquidRegionJob::run()
+{
+	switch (m_batch->phase) {
+	case LiquidBatch::INDEX_ENTRIES:
+		for (size_t i = 0; i < entries.size(); i++)
+			entry_of_pos[liquid_pos_key(m_batch->entries[entries[i]].p)] = entries[i];
+		break;
+	case LiquidBatch::FIND_DEPENDENCIES:
+		findDependencies();
+		break;
+	case LiquidBatch::TRANSFORM:
+		transform();
+		break;
+	}
+}
+
+void LiquidRegionJob::findDependencies()
+{
+	for (size_t i = 0; i < entries.size(); i++) {
+		LiquidEntry &e = m_batch->entries[entries[i]];
+		e.deps_begin = deps.size();
+		for (u16 d = 0; d < 6; d++) {
+			v3s16 p = e.p + g_6dirs[d];
+			u32 other;
+			if (liquid_region_pos(p) != m_pos &&
+					m_batch->findEntry(p, &other) && other < entries[i])
+				deps.push_back(other);
+		}
+		e.deps_end = deps.size();
+	}
+}
+
+void LiquidRegionJob::transform()
+{
+	while (next_entry < entries.size()) {
+		LiquidEntry &e = m_batch->entries[entries[next_entry]];
+		for (u32 i = e.deps_begin; i < e.deps_end; i++) {
+			const LiquidEntry &dep = m_batch->entries[deps[i]];
+			// Wait for the next round
+			if (dep.region_index >= m_batch->done_counts[dep.region])
+				return;
+		}
+
+		e.queued_begin = region.queued.size();
+		e.must_reflow = m_map->transformLiquidNode(e.p, region);
+		e.queued_end = region.queued.size();
+		next_entry++;
+	}
+}
+
 void Map::transforming_liquid_add(v3s16 p) {
         m_transforming_liquid.push_back(p);
 }
@@ -1617,15 +1530,347 @@ s32 Map::transforming_liquid_size() {
         return m_transforming_liquid.size();
 }
 
-void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks)
+bool Map::transformLiquidNode(v3s16 p0, LiquidRegion &region)
 {
-
 	INodeDefManager *nodemgr = m_gamedef->ndef();
 
+	// whether, due to viscosity, the node has not reached its max level height
+	bool must_reflow = false;
+
+	MapNode n0 = region.getNode(p0);
+
+	/*
+		Collect information about current node
+	 */
+	s8 liquid_level = -1;
+	content_t liquid_kind = CONTENT_IGNORE;
+	content_t floodable_node = CONTENT_AIR;
+	const ContentFeatures &cf = nodemgr->get(n0);
+	LiquidType liquid_type = cf.liquid_type;
+	switch (liquid_type) {
+		case LIQUID_SOURCE:
+			liquid_level = LIQUID_LEVEL_SOURCE;
+			liquid_kind = nodemgr->getId(cf.liquid_alternative_flowing);
+			break;
+		case LIQUID_FLOWING:
+			liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
+			liquid_kind = n0.getContent();
+			break;
+		case LIQUID_NONE:
+			// if this node is 'floodable', it *could* be transformed
+			// into a liquid, otherwise, continue with the next node.
+			if (!cf.floodable)
+				return false;
+			floodable_node = n0.getContent();
+			liquid_kind = CONTENT_AIR;
+			break;
+	}
+
+	/*
+		Collect information about the environment
+	 */
+	const v3s16 *dirs = g_6dirs;
+	NodeNeighbor sources[6]; // surrounding sources
+	int num_sources = 0;
+	NodeNeighbor flows[6]; // surrounding flowing liquid nodes
+	int num_flows = 0;
+	NodeNeighbor airs[6]; // surrounding air
+	int num_airs = 0;
+	NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
+	int num_neutrals = 0;
+	bool flowing_down = false;
+	for (u16 i = 0; i < 6; i++) {
+		NeighborType nt = NEIGHBOR_SAME_LEVEL;
+		switch (i) {
+			case 1:
+				nt = NEIGHBOR_UPPER;
+				break;
+			case 4:
+				nt = NEIGHBOR_LOWER;
+				break;
+		}
+		v3s16 npos = p0 + dirs[i];
+		NodeNeighbor nb(region.getNode(npos), nt, npos);
+		const ContentFeatures &cfnb = nodemgr->get(nb.n);
+		switch (nodemgr->get(nb.n.getContent()).liquid_type) {
+			case LIQUID_NONE:
+				if (cfnb.floodable) {
+					airs[num_airs++] = nb;
+					// if the current node is a water source the neighbor
+					// should be enqueded for transformation regardless of whether the
+					// current node changes or not.
+					if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
+						region.queued.push_back(npos);
+					// if the current node happens to be a flowing node, it will start to flow down here.
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				} else {
+					neutrals[num_neutrals++] = nb;
+					// If neutral below is ignore prevent water spreading outwards
+					if (nb.t == NEIGHBOR_LOWER &&
+							nb.n.getContent() == CONTENT_IGNORE)
+						flowing_down = true;
+				}
+				break;
+			case LIQUID_SOURCE:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = nodemgr->getId(cfnb.liquid_alternative_flowing);
+				if (nodemgr->getId(cfnb.liquid_alternative_flowing) != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					// Do not count bottom source, it will screw things up
+					if(dirs[i].Y != -1)
+						sources[num_sources++] = nb;
+				}
+				break;
+			case LIQUID_FLOWING:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = nodemgr->getId(cfnb.liquid_alternative_flowing);
+				if (nodemgr->getId(cfnb.liquid_alternative_flowing) != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					flows[num_flows++] = nb;
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				}
+				break;
+		}
+	}
+
+	/*
+		decide on the type (and possibly level) of the current node
+	 */
+	content_t new_node_content;
+	s8 new_node_level = -1;
+	s8 max_node_level = -1;
+
+	u8 range = nodemgr->get(liquid_kind).liquid_range;
+	if (range > LIQUID_LEVEL_MAX + 1)
+		range = LIQUID_LEVEL_MAX + 1;
+
+	if ((num_sources >= 2 && nodemgr->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
+		// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
+		// or the flowing alternative of the first of the surrounding sources (if it's air), so
+		// it's perfectly safe to use liquid_kind here to determine the new node content.
+		new_node_content = nodemgr->getId(nodemgr->get(liquid_kind).liquid_alternative_source);
+	} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
+		// liquid_kind is set properly, see above
+		max_node_level = new_node_level = LIQUID_LEVEL_MAX;
+		if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+	} else {
+		// no surrounding sources, so get the maximum level that can flow into this node
+		for (u16 i = 0; i < num_flows; i++) {
+			u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
+			switch (flows[i].t) {
+				case NEIGHBOR_UPPER:
+					if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
+						max_node_level = LIQUID_LEVEL_MAX;
+						if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
+							max_node_level = nb_liquid_level + WATER_DROP_BOOST;
+					} else if (nb_liquid_level > max_node_level) {
+						max_node_level = nb_liquid_level;
+					}
+					break;
+				case NEIGHBOR_LOWER:
+					break;
+				case NEIGHBOR_SAME_LEVEL:
+					if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
+							nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
+						max_node_level = nb_liquid_level - 1;
+					break;
+			}
+		}
+
+		u8 viscosity = nodemgr->get(liquid_kind).liquid_viscosity;
+		if (viscosity > 1 && max_node_level != liquid_level) {
+			// amount to gain, limited by viscosity
+			// must be at least 1 in absolute value
+			s8 level_inc = max_node_level - liquid_level;
+			if (level_inc < -viscosity || level_inc > viscosity)
+				new_node_level = liquid_level + level_inc/viscosity;
+			else if (level_inc < 0)
+				new_node_level = liquid_level - 1;
+			else if (level_inc > 0)
+				new_node_level = liquid_level + 1;
+			if (new_node_level != max_node_level)
+				must_reflow = true;
+		} else {
+			new_node_level = max_node_level;
+		}
+
+		if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+
+	}
+
+	/*
+		check if anything has changed. if not, just return.
+	 */
+	if (new_node_content == n0.getContent() &&
+			(nodemgr->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
+			((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
+			((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
+			== flowing_down)))
+		return must_reflow;
+
+
+	/*
+		update the current node
+	 */
+	MapNode n00 = n0;
+	//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
+	if (nodemgr->get(new_node_content).liquid_type == LIQUID_FLOWING) {
+		// set level to last 3 bits, flowing down bit to 4th bit
+		n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
+	} else {
+		// set the liquid level and flow bit to 0
+		n0.param2 = ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
+	}
+	n0.setContent(new_node_content);
+
+	// Find out whether there is a suspect for this action
+	std::string suspect;
+	if (m_gamedef->rollback())
+		suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
+
+	if (m_gamedef->rollback() && !suspect.empty()) {
+		// Blame suspect
+		RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
+		// Get old node for rollback
+		RollbackNode rollback_oldnode(this, p0, m_gamedef);
+		// Set node
+		setNode(p0, n0);
+		// Report
+		RollbackNode rollback_newnode(this, p0, m_gamedef);
+		RollbackAction action;
+		action.setSetNode(p0, rollback_oldnode, rollback_newnode);
+		m_gamedef->rollback()->reportAction(action);
+	} else {
+		// Set node
+		region.setNode(p0, n0);
+	}
+
+	v3s16 blockpos = getNodeBlockPos(p0);
+	MapBlock *block = region.getBlock(blockpos);
+	if (block != NULL) {
+		region.modified_blocks[blockpos] = block;
+		// If new or old node emits light, MapBlock requires lighting update
+		if (nodemgr->get(n0).light_source != 0 ||
+				nodemgr->get(n00).light_source != 0)
+			region.lighting_modified_blocks[block->getPos()] = block;
+	}
+
+	/*
+		enqueue neighbors for update if neccessary
+	 */
+	switch (nodemgr->get(n0.getContent()).liquid_type) {
+		case LIQUID_SOURCE:
+		case LIQUID_FLOWING:
+			// make sure source flows into all neighboring nodes
+			for (u16 i = 0; i < num_flows; i++)
+				if (flows[i].t != NEIGHBOR_UPPER)
+					region.queued.push_back(flows[i].p);
+			for (u16 i = 0; i < num_airs; i++)
+				if (airs[i].t != NEIGHBOR_UPPER)
+					region.queued.push_back(airs[i].p);
+			break;
+		case LIQUID_NONE:
+			// this flow has turned to air; neighboring flows might need to do the same
+			for (u16 i = 0; i < num_flows; i++)
+				region.queued.push_back(flows[i].p);
+			break;
+	}
+
+	return must_reflow;
+}
+
+void Map::transformLiquidsParallel(u32 count, std::deque<v3s16> &must_reflow,
+		std::map<v3s16, MapBlock*> &modified_blocks,
+		std::map<v3s16, MapBlock*> &lighting_modified_blocks)
+{
+	LiquidBatch batch;
+	batch.entries.resize(count);
+	for (u32 i = 0; i < count; i++) {
+		LiquidEntry &e = batch.entries[i];
+		e.p = m_transforming_liquid.front();
+		m_transforming_liquid.pop_front();
+
+		v3s16 region_pos = liquid_region_pos(e.p);
+		u64 key = liquid_pos_key(region_pos);
+		UNORDERED_MAP<u64, u32>::iterator r = batch.region_of_pos.find(key);
+		if (r == batch.region_of_pos.end()) {
+			r = batch.region_of_pos.insert(
+				std::make_pair(key, (u32)batch.regions.size())).first;
+			batch.regions.push_back(new LiquidRegionJob(this, &batch, region_pos));
+		}
+		LiquidRegionJob *region = batch.regions[r->second];
+		e.region = r->second;
+		e.region_index = region->entries.size();
+		e.deps_begin = e.deps_end = 0;
+		e.queued_begin = e.queued_end = 0;
+		e.must_reflow = false;
+		region->entries.push_back(i);
+	}
+
+	std::vector<WorkerJob *> jobs(batch.regions.begin(), batch.regions.end());
+	batch.phase = LiquidBatch::INDEX_ENTRIES;
+	m_liquid_pool->run(jobs);
+	batch.phase = LiquidBatch::FIND_DEPENDENCIES;
+	m_liquid_pool->run(jobs);
+
+	// Every round transforms at least the first entry left in the queue
+	batch.phase = LiquidBatch::TRANSFORM;
+	batch.done_counts.resize(batch.regions.size());
+	while (!jobs.empty()) {
+		for (size_t i = 0; i < batch.regions.size(); i++)
+			batch.done_counts[i] = batch.regions[i]->next_entry;
+		m_liquid_pool->run(jobs);
+
+		size_t num_left = 0;
+		for (size_t i = 0; i < jobs.size(); i++) {
+			LiquidRegionJob *region = (LiquidRegionJob *)jobs[i];
+			if (region->next_entry < region->entries.size())
+				jobs[num_left++] = region;
+		}
+		jobs.resize(num_left);
+	}
+
+	for (u32 i = 0; i < count; i++) {
+		const LiquidEntry &e = batch.entries[i];
+		const LiquidRegion &region = batch.regions[e.region]->region;
+		for (u32 j = e.queued_begin; j < e.queued_end; j++) {
+			// Nodes after this one in the batch were still queued
+			u32 other;
+			if (batch.findEntry(region.queued[j], &other) && other > i)
+				continue;
+			m_transforming_liquid.push_back(region.queued[j]);
+		}
+		if (e.must_reflow)
+			must_reflow.push_back(e.p);
+	}
+
+	for (size_t i = 0; i < batch.regions.size(); i++) {
+		LiquidRegion &region = batch.regions[i]->region;
+		modified_blocks.insert(region.modified_blocks.begin(),
+			region.modified_blocks.end());
+		lighting_modified_blocks.insert(region.lighting_modified_blocks.begin(),
+			region.lighting_modified_blocks.end());
+		delete batch.regions[i];
+	}
+}
+
+void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks)
+{
 	DSTACK(FUNCTION_NAME);
 	//TimeTaker timer("transformLiquids()");
 
-	u32 loopcount = 0;
 	u32 initial_size = m_transforming_liquid.size();
 
 	/*if(initial_size != 0)
@@ -1657,271 +1902,40 @@ void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks)
 	loop_max *= m_transforming_liquid_loop_count_multiplier;
 #endif
 
-	while (m_transforming_liquid.size() != 0)
-	{
-		// This should be done here so that it is done when continue is used
-		if (loopcount >= initial_size || loopcount >= loop_max)
-			break;
-		loopcount++;
-
-		/*
-			Get a queued transforming liquid node
-		*/
-		v3s16 p0 = m_transforming_liquid.front();
-		m_transforming_liquid.pop_front();
-
-		MapNode n0 = getNodeNoEx(p0);
+	// Nodes queued while transforming go after the initial ones
+	u32 count = MYMIN(initial_size, loop_max);
 
-		/*
-			Collect information about current node
-		 */
-		s8 liquid_level = -1;
-		content_t liquid_kind = CONTENT_IGNORE;
-		content_t floodable_node = CONTENT_AIR;
-		const ContentFeatures &cf = nodemgr->get(n0);
-		LiquidType liquid_type = cf.liquid_type;
-		switch (liquid_type) {
-			case LIQUID_SOURCE:
-				liquid_level = LIQUID_LEVEL_SOURCE;
-				liquid_kind = nodemgr->getId(cf.liquid_alternative_flowing);
-				break;
-			case LIQUID_FLOWING:
-				liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
-				liquid_kind = n0.getContent();
-				break;
-			case LIQUID_NONE:
-				// if this node is 'floodable', it *could* be transformed
-				// into a liquid, otherwise, continue with the next node.
-				if (!cf.floodable)
-					continue;
-				floodable_node = n0.getContent();
-				liquid_kind = CONTENT_AIR;
-				break;
+	// Rollback wants the actions one by one
+	u16 num_threads = g_settings->getU16("num_liquid_threads");
+	if (num_threads > 0 && m_gamedef->rollback() == NULL) {
+		if (m_liquid_pool == NULL ||
+				m_liquid_pool->getThreadCount() != num_threads) {
+			delete m_liquid_pool;
+			m_liquid_pool = new WorkerPool("Liquid", num_threads);
 		}
+		transformLiquidsParallel(count, must_reflow, modified_blocks,
+			lighting_modified_blocks);
+	} else {
+		LiquidRegion region(this);
+		for (u32 i = 0; i < count; i++) {
+			/*
+				Get a queued transforming liquid node
+			*/
+			v3s16 p0 = m_transforming_liquid.front();
+			m_transforming_liquid.pop_front();
 
-		/*
-			Collect information about the environment
-		 */
-		const v3s16 *dirs = g_6dirs;
-		NodeNeighbor sources[6]; // surrounding sources
-		int num_sources = 0;
-		NodeNeighbor flows[6]; // surrounding flowing liquid nodes
-		int num_flows = 0;
-		NodeNeighbor airs[6]; // surrounding air
-		int num_airs = 0;
-		NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
-		int num_neutrals = 0;
-		bool flowing_down = false;
-		for (u16 i = 0; i < 6; i++) {
-			NeighborType nt = NEIGHBOR_SAME_LEVEL;
-			switch (i) {
-				case 1:
-					nt = NEIGHBOR_UPPER;
-					break;
-				case 4:
-					nt = NEIGHBOR_LOWER;
-					break;
-			}
-			v3s16 npos = p0 + dirs[i];
-			NodeNeighbor nb(getNodeNoEx(npos), nt, npos);
-			const ContentFeatures &cfnb = nodemgr->get(nb.n);
-			switch (nodemgr->get(nb.n.getContent()).liquid_type) {
-				case LIQUID_NONE:
-					if (cfnb.floodable) {
-						airs[num_airs++] = nb;
-						// if the current node is a water source the neighbor
-						// should be enqueded for transformation regardless of whether the
-						// current node changes or not.
-						if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
-							m_transforming_liquid.push_back(npos);
-						// if the current node happens to be a flowing node, it will start to flow down here.
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					} else {
-						neutrals[num_neutrals++] = nb;
-						// If neutral below is ignore prevent water spreading outwards
-						if (nb.t == NEIGHBOR_LOWER &&
-								nb.n.getContent() == CONTENT_IGNORE)
-							flowing_down = true;
-					}
-					break;
-				case LIQUID_SOURCE:
-					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-					if (liquid_kind == CONTENT_AIR)
-						liquid_kind = nodemgr->getId(cfnb.liquid_alternative_flowing);
-					if (nodemgr->getId(cfnb.liquid_alternative_flowing) != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						// Do not count bottom source, it will screw things up
-						if(dirs[i].Y != -1)
-							sources[num_sources++] = nb;
-					}
-					break;
-				case LIQUID_FLOWING:
-					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-					if (liquid_kind == CONTENT_AIR)
-						liquid_kind = nodemgr->getId(cfnb.liquid_alternative_flowing);
-					if (nodemgr->getId(cfnb.liquid_alternative_flowing) != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						flows[num_flows++] = nb;
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					}
-					break;
-			}
-		}
-
-		/*
-			decide on the type (and possibly level) of the current node
-		 */
-		content_t new_node_content;
-		s8 new_node_level = -1;
-		s8 max_node_level = -1;
-
-		u8 range = nodemgr->get(liquid_kind).liquid_range;
-		if (range > LIQUID_LEVEL_MAX + 1)
-			range = LIQUID_LEVEL_MAX + 1;
-
-		if ((num_sources >= 2 && nodemgr->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
-			// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
-			// or the flowing alternative of the first of the surrounding sources (if it's air), so
-			// it's perfectly safe to use liquid_kind here to determine the new node content.
-			new_node_content = nodemgr->getId(nodemgr->get(liquid_kind).liquid_alternative_source);
-		} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
-			// liquid_kind is set properly, see above
-			max_node_level = new_node_level = LIQUID_LEVEL_MAX;
-			if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
-		} else {
-			// no surrounding sources, so get the maximum level that can flow into this node
-			for (u16 i = 0; i < num_flows; i++) {
-				u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
-				switch (flows[i].t) {
-					case NEIGHBOR_UPPER:
-						if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
-							max_node_level = LIQUID_LEVEL_MAX;
-							if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
-								max_node_level = nb_liquid_level + WATER_DROP_BOOST;
-						} else if (nb_liquid_level > max_node_level) {
-							max_node_level = nb_liquid_level;
-						}
-						break;
-					case NEIGHBOR_LOWER:
-						break;
-					case NEIGHBOR_SAME_LEVEL:
-						if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
-								nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
-							max_node_level = nb_liquid_level - 1;
-						break;
-				}
-			}
-
-			u8 viscosity = nodemgr->get(liquid_kind).liquid_viscosity;
-			if (viscosity > 1 && max_node_level != liquid_level) {
-				// amount to gain, limited by viscosity
-				// must be at least 1 in absolute value
-				s8 level_inc = max_node_level - liquid_level;
-				if (level_inc < -viscosity || level_inc > viscosity)
-					new_node_level = liquid_level + level_inc/viscosity;
-				else if (level_inc < 0)
-					new_node_level = liquid_level - 1;
-				else if (level_inc > 0)
-					new_node_level = liquid_level + 1;
-				if (new_node_level != max_node_level)
-					must_reflow.push_back(p0);
-			} else {
-				new_node_level = max_node_level;
-			}
-
-			if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
-
-		}
-
-		/*
-			check if anything has changed. if not, just continue with the next node.
-		 */
-		if (new_node_content == n0.getContent() &&
-				(nodemgr->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
-				((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
-				((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
-				== flowing_down)))
-			continue;
-
-
-		/*
-			update the current node
-		 */
-		MapNode n00 = n0;
-		//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
-		if (nodemgr->get(new_node_content).liquid_type == LIQUID_FLOWING) {
-			// set level to last 3 bits, flowing down bit to 4th bit
-			n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
-		} else {
-			// set the liquid level and flow bit to 0
-			n0.param2 = ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
-		}
-		n0.setContent(new_node_content);
-
-		// Find out whether there is a suspect for this action
-		std::string suspect;
-		if (m_gamedef->rollback())
-			suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
-
-		if (m_gamedef->rollback() && !suspect.empty()) {
-			// Blame suspect
-			RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
-			// Get old node for rollback
-			RollbackNode rollback_oldnode(this, p0, m_gamedef);
-			// Set node
-			setNode(p0, n0);
-			// Report
-			RollbackNode rollback_newnode(this, p0, m_gamedef);
-			RollbackAction action;
-			action.setSetNode(p0, rollback_oldnode, rollback_newnode);
-			m_gamedef->rollback()->reportAction(action);
-		} else {
-			// Set node
-			setNode(p0, n0);
-		}
+			if (transformLiquidNode(p0, region))
+				must_reflow.push_back(p0);
 
-		v3s16 blockpos = getNodeBlockPos(p0);
-		MapBlock *block = getBlockNoCreateNoEx(blockpos);
-		if (block != NULL) {
-			modified_blocks[blockpos] =  block;
-			// If new or old node emits light, MapBlock requires lighting update
-			if (nodemgr->get(n0).light_source != 0 ||
-					nodemgr->get(n00).light_source != 0)
-				lighting_modified_blocks[block->getPos()] = block;
-		}
-
-		/*
-			enqueue neighbors for update if neccessary
-		 */
-		switch (nodemgr->get(n0.getContent()).liquid_type) {
-			case LIQUID_SOURCE:
-			case LIQUID_FLOWING:
-				// make sure source flows into all neighboring nodes
-				for (u16 i = 0; i < num_flows; i++)
-					if (flows[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(flows[i].p);
-				for (u16 i = 0; i < num_airs; i++)
-					if (airs[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(airs[i].p);
-				break;
-			case LIQUID_NONE:
-				// this flow has turned to air; neighboring flows might need to do the same
-				for (u16 i = 0; i < num_flows; i++)
-					m_transforming_liquid.push_back(flows[i].p);
-				break;
+			for (size_t j = 0; j < region.queued.size(); j++)
+				m_transforming_liquid.push_back(region.queued[j]);
+			region.queued.clear();
 		}
+		modified_blocks.insert(region.modified_blocks.begin(),
+			region.modified_blocks.end());
+		lighting_modified_blocks.insert(region.lighting_modified_blocks.begin(),
+			region.lighting_modified_blocks.end());
 	}
-	//infostream<<"Map::transformLiquids(): loopcount="<<loopcount<<std::endl;
 
 	for (std::deque<v3s16>::iterator iter = must_reflow.begin(); iter != must_reflow.end(); ++iter)
 		m_transforming_liquid.push_back(*iter);
@@ -2054,6 +2068,7 @@ bool Map::setNodeMetadata(v3s16 p, NodeMetadata *meta)
 		return false;
 	}
 	block->m_node_metadata.set(p_rel, meta);
+	block->expireNetworkCache();
 	return true;
 }
 
@@ -2069,6 +2084,7 @@ void Map::removeNodeMetadata(v3s16 p)
 		return;
 	}
 	block->m_node_metadata.remove(p_rel);
+	block->expireNetworkCache();
 }
 
 NodeTimer Map::getNodeTimer(v3s16 p)
@@ -2154,6 +2170,15 @@ ServerMap::ServerMap(std::string savedir, IGameDef *gamedef, EmergeManager *emer
 	std::string backend = conf.get("backend");
 	dbase = createDatabase(backend, savedir, conf);
 
+	// The codec may be chosen per world; blocks record their codec, so
+	// it can be changed at any time
+	std::string codec = conf.exists("map_compression_codec") ?
+		conf.get("map_compression_codec") :
+		g_settings->get("map_compression_codec");
+	m_block_codec = getCompressionCodecSetting(codec);
+	m_saver = new MapSaver(dbase, g_settings->getU16("num_map_save_threads"));
+	m_save_count = 0;
+
 	if (!conf.updateConfigFile(conf_path.c_str()))
 		errorstream << "ServerMap::ServerMap(): Failed to update world.mt!" << std::endl;
 
@@ -2237,6 +2262,7 @@ ServerMap::~ServerMap()
 	/*
 		Close database if it was opened
 	*/
+	delete m_saver;
 	delete dbase;
 
 #if 0
@@ -2985,6 +3011,8 @@ void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 		errorstream << "Map::listAllLoadableBlocks(): Result will be missing "
 				<< "all blocks that are stored in flat files." << std::endl;
 	}
+	m_saver->flush();
+	MutexAutoLock lock(m_saver->getDatabaseMutex());
 	dbase->listAllLoadableBlocks(dst);
 }
 
@@ -3208,17 +3236,37 @@ Database *ServerMap::createDatabase(
 
 void ServerMap::beginSave()
 {
-	dbase->beginSave();
+	m_saver->beginSave();
 }
 
 void ServerMap::endSave()
 {
-	dbase->endSave();
+	m_saver->endSave();
 }
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
-	return saveBlock(block, dbase);
+	v3s16 p3d = block->getPos();
+
+	// Dummy blocks are not written
+	if (block->isDummy()) {
+		warningstream << "saveBlock: Not writing dummy block "
+			<< PP(p3d) << std::endl;
+		return true;
+	}
+
+	/*
+		Only copy the block here, it is serialized, compressed and
+		written by the saver. The block counts as saved from now on;
+		write errors are logged by the saver.
+	*/
+	MapBlockSnapshot *s = new MapBlockSnapshot;
+	block->snapshot(*s, ser_ver_for_codec(m_block_codec), m_block_codec);
+	m_saver->enqueue(s);
+	m_prefetched.erase(p3d);
+	m_save_count++;
+	block->resetModified();
+	return true;
 }
 
 bool ServerMap::saveBlock(MapBlock *block, Database *db)
@@ -3404,7 +3452,17 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 	v2s16 p2d(blockpos.X, blockpos.Z);
 
 	std::string ret;
-	dbase->loadBlock(blockpos, &ret);
+	std::map<v3s16, std::string>::iterator it = m_prefetched.find(blockpos);
+	if (it != m_prefetched.end()) {
+		ret.swap(it->second);
+		m_prefetched.erase(it);
+	} else {
+		// A newer version of the block may still be on its way to the
+		// database
+		m_saver->waitFor(blockpos);
+		MutexAutoLock lock(m_saver->getDatabaseMutex());
+		dbase->loadBlock(blockpos, &ret);
+	}
 	if (ret != "") {
 		loadBlock(&ret, blockpos, createSector(p2d), false);
 		return getBlockNoCreateNoEx(blockpos);
@@ -3468,10 +3526,63 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 	return getBlockNoCreateNoEx(blockpos);
 }
 
+u32 ServerMap::startPrefetch(const std::vector<v3s16> &positions,
+		std::vector<v3s16> *wanted)
+{
+	for (size_t i = 0; i < positions.size(); i++) {
+		const v3s16 &p = positions[i];
+		// Blocks that are being saved are loaded the usual way later
+		if (getBlockNoCreateNoEx(p) ||
+				m_prefetched.find(p) != m_prefetched.end() ||
+				m_saver->isPending(p))
+			continue;
+		wanted->push_back(p);
+	}
+	return m_save_count;
+}
+
+void ServerMap::readPrefetch(const std::vector<v3s16> &wanted,
+		std::vector<std::string> *blocks)
+{
+	if (wanted.empty())
+		return;
+
+	MutexAutoLock lock(m_saver->getDatabaseMutex());
+	dbase->loadBlocks(wanted, *blocks);
+}
+
+void ServerMap::finishPrefetch(const std::vector<v3s16> &wanted,
+		std::vector<std::string> *blocks, u32 save_count)
+{
+	// A block may have been written after it was read, the data could be
+	// outdated then
+	if (wanted.empty() || save_count != m_save_count)
+		return;
+
+	// Forget about blocks read ahead earlier that were never loaded
+	if (m_prefetched.size() + wanted.size() > PREFETCH_CACHE_MAX)
+		m_prefetched.clear();
+
+	for (size_t i = 0; i < wanted.size(); i++) {
+		const v3s16 &p = wanted[i];
+		// Loaded or read by another thread meanwhile
+		if (getBlockNoCreateNoEx(p) ||
+				m_prefetched.find(p) != m_prefetched.end())
+			continue;
+		m_prefetched[p].swap((*blocks)[i]);
+	}
+}
+
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
-	if (!dbase->deleteBlock(blockpos))
-		return false;
+	m_prefetched.erase(blockpos);
+	m_save_count++;
+	m_saver->waitFor(blockpos);
+	{
+		MutexAutoLock lock(m_saver->getDatabaseMutex());
+		if (!dbase->deleteBlock(blockpos))
+			return false;
+	}
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
 	if (block) {
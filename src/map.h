@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <set>
 #include <map>
 #include <list>
+#include <deque>
 
 #include "irrlichttypes_bloated.h"
 #include "mapnode.h"
@@ -34,9 +35,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/container.h"
 #include "nodetimer.h"
 #include "map_settings_manager.h"
+#include "mapblockindex.h"
 
 class Settings;
 class Database;
+class MapSaver;
 class ClientMap;
 class MapSector;
 class ServerMapSector;
@@ -46,7 +49,12 @@ class IGameDef;
 class IRollbackManager;
 class EmergeManager;
 class ServerEnvironment;
+class LiquidRegion;
+class WorkerPool;
 struct BlockMakeData;
+namespace voxalgo {
+	class LightingWindow;
+}
 
 /*
 	MapEditEvent
@@ -185,8 +193,16 @@ class Map /*: public NodeContainer*/
 
 	// Returns InvalidPositionException if not found
 	MapBlock * getBlockNoCreate(v3s16 p);
-	// Returns NULL if not found
-	MapBlock * getBlockNoCreateNoEx(v3s16 p);
+	/*
+		Returns NULL if not found.
+		Can be called from several threads at once as long as no block is
+		added or removed meanwhile, e.g. while the thread holding the
+		environment lock waits for them.
+	*/
+	MapBlock * getBlockNoCreateNoEx(v3s16 p) const
+	{
+		return m_block_index.get(p);
+	}
 
 	/* Server overrides */
 	virtual MapBlock * emergeBlock(v3s16 p, bool create_blank=true)
@@ -210,24 +226,10 @@ class Map /*: public NodeContainer*/
 			std::set<v3s16> & light_sources,
 			std::map<v3s16, MapBlock*> & modified_blocks);
 
-	void unLightNeighbors(enum LightBank bank,
-			v3s16 pos, u8 lightwas,
-			std::set<v3s16> & light_sources,
-			std::map<v3s16, MapBlock*> & modified_blocks);
-
 	void spreadLight(enum LightBank bank,
 			std::set<v3s16> & from_nodes,
 			std::map<v3s16, MapBlock*> & modified_blocks);
 
-	void lightNeighbors(enum LightBank bank,
-			v3s16 pos,
-			std::map<v3s16, MapBlock*> & modified_blocks);
-
-	v3s16 getBrightestNeighbour(enum LightBank bank, v3s16 p);
-
-	s16 propagateSunlight(v3s16 start,
-			std::map<v3s16, MapBlock*> & modified_blocks);
-
 	void updateLighting(enum LightBank bank,
 			std::map<v3s16, MapBlock*>  & a_blocks,
 			std::map<v3s16, MapBlock*> & modified_blocks);
@@ -343,6 +345,7 @@ class Map /*: public NodeContainer*/
 
 protected:
 	friend class LuaVoxelManip;
+	friend class LiquidRegionJob;
 
 	std::ostream &m_dout; // A bit deprecated, could be removed
 
@@ -352,6 +355,11 @@ class Map /*: public NodeContainer*/
 
 	std::map<v2s16, MapSector*> m_sectors;
 
+	// All blocks of all sectors, for fast lookup by position.
+	// Kept up to date by MapSector.
+	MapBlockIndex m_block_index;
+	friend class MapSector;
+
 	// Be sure to set this to NULL when the cached sector is deleted
 	MapSector *m_sector_cache;
 	v2s16 m_sector_cache_p;
@@ -364,6 +372,16 @@ class Map /*: public NodeContainer*/
 	u32 m_unprocessed_count;
 	u32 m_inc_trending_up_start_time; // milliseconds
 	bool m_queue_size_timer_started;
+	// Created when liquids are first transformed in parallel
+	WorkerPool *m_liquid_pool;
+	// Buffers for relighting around added and removed nodes
+	voxalgo::LightingWindow *m_lighting_window;
+
+	// Returns true if the node has to be queued again after this step
+	bool transformLiquidNode(v3s16 p0, LiquidRegion &region);
+	void transformLiquidsParallel(u32 count, std::deque<v3s16> &must_reflow,
+		std::map<v3s16, MapBlock*> &modified_blocks,
+		std::map<v3s16, MapBlock*> &lighting_modified_blocks);
 
 	DISABLE_CLASS_COPY(Map);
 };
@@ -484,11 +502,28 @@ class ServerMap : public Map
 	// Returns true if sector now resides in memory
 	//bool deFlushSector(v2s16 p2d);
 
+	// Queues the block for saving, it may be written to the database later
 	bool saveBlock(MapBlock *block);
+	// Writes the block to db right away
 	static bool saveBlock(MapBlock *block, Database *db);
 	// This will generate a sector with getSector if not found.
 	void loadBlock(std::string sectordir, std::string blockfile, MapSector *sector, bool save_after_load=false);
 	MapBlock* loadBlock(v3s16 p);
+	/*
+		Reading blocks ahead from the database in one go, so that loading
+		them later doesn't need to access it. Only the reading itself
+		runs without the environment lock:
+		startPrefetch() picks the blocks that aren't loaded yet, requires
+		env lock held. Returns the value to pass to finishPrefetch().
+		readPrefetch() reads them, doesn't need the env lock.
+		finishPrefetch() keeps the results, requires env lock held.
+	*/
+	u32 startPrefetch(const std::vector<v3s16> &positions,
+			std::vector<v3s16> *wanted);
+	void readPrefetch(const std::vector<v3s16> &wanted,
+			std::vector<std::string> *blocks);
+	void finishPrefetch(const std::vector<v3s16> &wanted,
+			std::vector<std::string> *blocks, u32 save_count);
 	// Database version
 	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
 
@@ -527,6 +562,16 @@ class ServerMap : public Map
 	*/
 	bool m_map_metadata_changed;
 	Database *dbase;
+	// Writes the blocks to dbase
+	MapSaver *m_saver;
+	// Codec that blocks are compressed with when saving
+	CompressionCodec m_block_codec;
+	// Data of blocks read ahead by readPrefetch(), "" if not in dbase.
+	// Entries are removed when loaded, saved or deleted.
+	std::map<v3s16, std::string> m_prefetched;
+	// Counts saved and deleted blocks, so that blocks read ahead while
+	// one was written are thrown away
+	u32 m_save_count;
 };
 
 
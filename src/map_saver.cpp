@@ -0,0 +1,303 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "map_saver.h"
+#include "database.h"
+#include "debug.h"
+#include "log.h"
+#include "mapblock.h"
+#include "threading/event.h"
+#include "threading/mutex_auto_lock.h"
+#include "threading/thread.h"
+#include "util/string.h"
+#include <sstream>
+
+// Most blocks the writer puts into one transaction
+#define WRITE_BATCH_SIZE 256
+// How long the threads wait for work before checking whether to stop
+#define QUEUE_WAIT_MS 100
+
+class MapSaverThread : public Thread
+{
+public:
+	MapSaverThread(MapSaver *saver, const std::string &name) :
+		Thread(name),
+		m_saver(saver)
+	{}
+
+	void *run()
+	{
+		DSTACK(FUNCTION_NAME);
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while (!stopRequested()) {
+			MapSaver::Job *job =
+				m_saver->m_serialize_queue.pop_frontNoEx(QUEUE_WAIT_MS);
+			if (job == NULL)
+				continue;
+			MapSaver::serializeJob(job);
+			m_saver->m_write_queue.push_back(job);
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return NULL;
+	}
+
+private:
+	MapSaver *m_saver;
+};
+
+class MapWriterThread : public Thread
+{
+public:
+	MapWriterThread(MapSaver *saver) :
+		Thread("MapWriter"),
+		m_saver(saver)
+	{}
+
+	void *run()
+	{
+		DSTACK(FUNCTION_NAME);
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		std::vector<MapSaver::Job *> jobs;
+		while (!stopRequested()) {
+			MapSaver::Job *job =
+				m_saver->m_write_queue.pop_frontNoEx(QUEUE_WAIT_MS);
+			if (job == NULL)
+				continue;
+
+			// Take whatever else is ready too
+			jobs.clear();
+			do {
+				jobs.push_back(job);
+				if (jobs.size() >= WRITE_BATCH_SIZE)
+					break;
+			} while ((job = m_saver->m_write_queue.pop_frontNoEx(0)) != NULL);
+
+			m_saver->writeJobs(jobs);
+			for (size_t i = 0; i < jobs.size(); i++)
+				delete jobs[i];
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return NULL;
+	}
+
+private:
+	MapSaver *m_saver;
+};
+
+
+MapSaver::MapSaver(Database *db, u16 num_threads) :
+	m_db(db),
+	m_next_seq(0),
+	m_writer(NULL)
+{
+	if (num_threads == 0)
+		return;
+
+	m_writer = new MapWriterThread(this);
+	if (!m_writer->start()) {
+		errorstream << "MapSaver: failed to start writer thread, "
+			"saving blocks synchronously" << std::endl;
+		delete m_writer;
+		m_writer = NULL;
+		return;
+	}
+
+	for (u16 i = 0; i != num_threads; i++) {
+		MapSaverThread *thread = new MapSaverThread(this,
+			"MapSaver" + itos(i));
+		if (!thread->start()) {
+			errorstream << "MapSaver: failed to start thread \"MapSaver"
+				<< i << "\"" << std::endl;
+			delete thread;
+			break;
+		}
+		m_serializers.push_back(thread);
+	}
+
+	if (m_serializers.empty()) {
+		m_writer->stop();
+		m_writer->wait();
+		delete m_writer;
+		m_writer = NULL;
+	}
+}
+
+
+MapSaver::~MapSaver()
+{
+	flush();
+
+	for (size_t i = 0; i != m_serializers.size(); i++)
+		m_serializers[i]->stop();
+	for (size_t i = 0; i != m_serializers.size(); i++) {
+		m_serializers[i]->wait();
+		delete m_serializers[i];
+	}
+
+	if (m_writer) {
+		m_writer->stop();
+		m_writer->wait();
+		delete m_writer;
+	}
+}
+
+
+void MapSaver::enqueue(MapBlockSnapshot *s)
+{
+	Job *job = new Job;
+	job->snapshot = s;
+	job->pos = s->pos;
+
+	if (!isAsync()) {
+		job->seq = 0;
+		serializeJob(job);
+		{
+			MutexAutoLock lock(m_db_mutex);
+			if (!m_db->saveBlock(job->pos, job->data))
+				errorstream << "MapSaver: failed to save block "
+					<< PP(job->pos) << std::endl;
+		}
+		delete job;
+		return;
+	}
+
+	{
+		MutexAutoLock lock(m_pending_mutex);
+		job->seq = m_next_seq++;
+		m_pending[job->pos] = job->seq;
+	}
+	m_serialize_queue.push_back(job);
+}
+
+
+void MapSaver::beginSave()
+{
+	if (isAsync())
+		return;
+	MutexAutoLock lock(m_db_mutex);
+	m_db->beginSave();
+}
+
+
+void MapSaver::endSave()
+{
+	if (isAsync())
+		return;
+	MutexAutoLock lock(m_db_mutex);
+	m_db->endSave();
+}
+
+
+bool MapSaver::isPending(v3s16 p)
+{
+	MutexAutoLock lock(m_pending_mutex);
+	return m_pending.find(p) != m_pending.end();
+}
+
+
+void MapSaver::waitFor(v3s16 p)
+{
+	Event written;
+	for (;;) {
+		{
+			MutexAutoLock lock(m_pending_mutex);
+			if (m_pending.find(p) == m_pending.end())
+				return;
+			m_written_events.push_back(&written);
+		}
+		written.wait();
+	}
+}
+
+
+void MapSaver::flush()
+{
+	Event written;
+	for (;;) {
+		{
+			MutexAutoLock lock(m_pending_mutex);
+			if (m_pending.empty())
+				return;
+			m_written_events.push_back(&written);
+		}
+		written.wait();
+	}
+}
+
+
+void MapSaver::serializeJob(Job *job)
+{
+	/*
+		[0] u8 serialization version
+		[1] data
+	*/
+	std::ostringstream o(std::ios_base::binary);
+	u8 version = job->snapshot->version;
+	o.write((char *)&version, 1);
+	job->snapshot->serialize(o);
+	job->data = o.str();
+
+	delete job->snapshot;
+	job->snapshot = NULL;
+}
+
+
+void MapSaver::writeJobs(const std::vector<Job *> &jobs)
+{
+	std::vector<Job *> current;
+	{
+		MutexAutoLock lock(m_pending_mutex);
+		for (size_t i = 0; i < jobs.size(); i++) {
+			std::map<v3s16, u32>::iterator it = m_pending.find(jobs[i]->pos);
+			// A newer snapshot is on its way, or already written
+			if (it != m_pending.end() && it->second == jobs[i]->seq)
+				current.push_back(jobs[i]);
+		}
+	}
+
+	{
+		MutexAutoLock lock(m_db_mutex);
+		m_db->beginSave();
+		for (size_t i = 0; i < current.size(); i++) {
+			if (!m_db->saveBlock(current[i]->pos, current[i]->data))
+				errorstream << "MapSaver: failed to save block "
+					<< PP(current[i]->pos) << std::endl;
+		}
+		m_db->endSave();
+	}
+
+	MutexAutoLock lock(m_pending_mutex);
+	for (size_t i = 0; i < current.size(); i++) {
+		std::map<v3s16, u32>::iterator it = m_pending.find(current[i]->pos);
+		// Keep the entry if the block was enqueued again meanwhile
+		if (it != m_pending.end() && it->second == current[i]->seq)
+			m_pending.erase(it);
+	}
+
+	// Wake up everyone waiting, to check whether their blocks were written
+	for (size_t i = 0; i < m_written_events.size(); i++)
+		m_written_events[i]->signal();
+	m_written_events.clear();
+}
@@ -0,0 +1,109 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef MAP_SAVER_HEADER
+#define MAP_SAVER_HEADER
+
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+#include "threading/mutex.h"
+#include "util/container.h"
+#include <map>
+#include <string>
+#include <vector>
+
+class Database;
+class Event;
+struct MapBlockSnapshot;
+class MapSaverThread;
+class MapWriterThread;
+
+/*
+	Writes snapshots of map blocks to the database.
+
+	With threads, the snapshots are serialized and compressed by a set of
+	serializer threads and written by a single writer thread, which puts
+	as many blocks as are ready into one database transaction.
+	Without threads, enqueue() writes the block right away.
+
+	All other access to the database has to be done while holding
+	getDatabaseMutex(), and after waiting for pending writes of the
+	blocks concerned.
+*/
+class MapSaver
+{
+public:
+	MapSaver(Database *db, u16 num_threads);
+	// Writes everything that is still pending
+	~MapSaver();
+
+	bool isAsync() const { return !m_serializers.empty(); }
+
+	// Takes ownership of s. Replaces an older snapshot of the same block
+	// that hasn't been written yet.
+	void enqueue(MapBlockSnapshot *s);
+
+	// Transactions for synchronous saving, the writer thread manages its own
+	void beginSave();
+	void endSave();
+
+	bool isPending(v3s16 p);
+	// Blocks until the block at p has been written
+	void waitFor(v3s16 p);
+	// Blocks until everything enqueued so far has been written
+	void flush();
+
+	Mutex &getDatabaseMutex() { return m_db_mutex; }
+
+private:
+	friend class MapSaverThread;
+	friend class MapWriterThread;
+
+	struct Job
+	{
+		MapBlockSnapshot *snapshot;
+		v3s16 pos;
+		// Newer snapshots of a block have higher sequence numbers
+		u32 seq;
+		std::string data;
+	};
+
+	// Serializes the snapshot of job into job->data and frees it
+	static void serializeJob(Job *job);
+	// Writes jobs that are still the latest for their block, in one
+	// transaction
+	void writeJobs(const std::vector<Job *> &jobs);
+
+	Database *m_db;
+	Mutex m_db_mutex;
+
+	// Latest sequence number of each block that hasn't been written yet
+	std::map<v3s16, u32> m_pending;
+	u32 m_next_seq;
+	// Signaled after each write, for waitFor() and flush()
+	std::vector<Event *> m_written_events;
+	Mutex m_pending_mutex;
+
+	MutexedQueue<Job *> m_serialize_queue;
+	MutexedQueue<Job *> m_write_queue;
+	std::vector<MapSaverThread *> m_serializers;
+	MapWriterThread *m_writer;
+};
+
+#endif
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mapblock.h"
 
+#include <algorithm>
 #include <sstream>
 #include "map.h"
 #include "light.h"
@@ -81,7 +82,8 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 		m_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
 		m_disk_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
 		m_usage_timer(0),
-		m_refcount(0)
+		m_refcount(0),
+		m_contents_expired(true)
 {
 	data = NULL;
 	if(dummy == false)
@@ -181,6 +183,9 @@ bool MapBlock::propagateSunlight(std::set<v3s16> & light_sources,
 {
 	INodeDefManager *nodemgr = m_gamedef->ndef();
 
+	// Light values are changed in place below
+	expireNetworkCache();
+
 	// Whether the sunlight at the top of the bottom block is valid
 	bool block_below_is_valid = true;
 
@@ -362,8 +367,35 @@ void MapBlock::copyTo(VoxelManipulator &dst)
 			getPosRelative(), data_size);
 }
 
+void MapBlock::copyTo(MapNode *dst, const VoxelArea &area)
+{
+	if (data == NULL)
+		return;
+
+	v3s16 p0 = getPosRelative();
+	v3s16 min(MYMAX(area.MinEdge.X, p0.X), MYMAX(area.MinEdge.Y, p0.Y),
+		MYMAX(area.MinEdge.Z, p0.Z));
+	v3s16 max(MYMIN(area.MaxEdge.X, p0.X + MAP_BLOCKSIZE - 1),
+		MYMIN(area.MaxEdge.Y, p0.Y + MAP_BLOCKSIZE - 1),
+		MYMIN(area.MaxEdge.Z, p0.Z + MAP_BLOCKSIZE - 1));
+	if (min.X > max.X || min.Y > max.Y || min.Z > max.Z)
+		return;
+
+	// Row by row, like VoxelManipulator::copyFrom()
+	s16 row_size = max.X - min.X + 1;
+	for (s16 z = min.Z; z <= max.Z; z++)
+	for (s16 y = min.Y; y <= max.Y; y++) {
+		const MapNode *src = &data[(z - p0.Z) * zstride
+			+ (y - p0.Y) * ystride + (min.X - p0.X)];
+		std::copy(src, src + row_size, &dst[area.index(min.X, y, z)]);
+	}
+}
+
 void MapBlock::copyFrom(VoxelManipulator &dst)
 {
+	expireNetworkCache();
+	expireContents();
+
 	v3s16 data_size(MAP_BLOCKSIZE, MAP_BLOCKSIZE, MAP_BLOCKSIZE);
 	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
 
@@ -422,6 +454,8 @@ void MapBlock::expireDayNightDiff()
 {
 	//INodeDefManager *nodemgr = m_gamedef->ndef();
 
+	expireNetworkCache();
+
 	if(data == NULL){
 		m_day_night_differs = false;
 		m_day_night_differs_expired = false;
@@ -462,15 +496,15 @@ s16 MapBlock::getGroundLevel(v2s16 p2d)
 */
 // List relevant id-name pairs for ids in the block using nodedef
 // Renumbers the content IDs (starting at 0 and incrementing
-// use static memory requires about 65535 * sizeof(int) ram in order to be
+// use a flat table, which requires about 65535 * sizeof(int) ram in order to be
 // sure we can handle all content ids. But it's absolutely worth it as it's
 // a speedup of 4 for one of the major time consuming functions on storing
-// mapblocks.
-static content_t getBlockNodeIdMapping_mapping[USHRT_MAX + 1];
+// mapblocks. The table is not static since blocks may be saved from
+// several threads at once.
 static void getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
 		INodeDefManager *nodedef)
 {
-	memset(getBlockNodeIdMapping_mapping, 0xFF, (USHRT_MAX + 1) * sizeof(content_t));
+	std::vector<content_t> mapping(USHRT_MAX + 1, 0xFFFF);
 
 	std::set<content_t> unknown_contents;
 	content_t id_counter = 0;
@@ -479,14 +513,14 @@ static void getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
 		content_t id = CONTENT_IGNORE;
 
 		// Try to find an existing mapping
-		if (getBlockNodeIdMapping_mapping[global_id] != 0xFFFF) {
-			id = getBlockNodeIdMapping_mapping[global_id];
+		if (mapping[global_id] != 0xFFFF) {
+			id = mapping[global_id];
 		}
 		else
 		{
 			// We have to assign a new mapping
 			id = id_counter++;
-			getBlockNodeIdMapping_mapping[global_id] = id;
+			mapping[global_id] = id;
 
 			const ContentFeatures &f = nodedef->get(global_id);
 			const std::string &name = f.name;
@@ -554,7 +588,19 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 	}
 }
 
-void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
+// Older versions have no room for the codec, they always use zlib
+static void writeCompressionCodec(std::ostream &os, u8 version,
+		CompressionCodec codec)
+{
+	if(version >= SER_FMT_VER_COMPRESSION_CODEC)
+		writeU8(os, codec);
+	else
+		FATAL_ERROR_IF(codec != COMPRESSION_ZLIB,
+			"Compression codec needs a newer serialization version");
+}
+
+void MapBlock::serialize(std::ostream &os, u8 version, bool disk,
+		CompressionCodec codec)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
@@ -566,7 +612,67 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 
 	FATAL_ERROR_IF(version < SER_FMT_VER_LOWEST_WRITE, "Serialisation version error");
 
-	// First byte
+	if(disk)
+	{
+		MapBlockSnapshot s;
+		snapshot(s, version, codec);
+		s.serialize(os);
+		return;
+	}
+
+	writeU8(os, getSerializationFlags());
+	writeCompressionCodec(os, version, codec);
+
+	/*
+		Bulk node data
+	*/
+	u8 content_width = 2;
+	u8 params_width = 2;
+	writeU8(os, content_width);
+	writeU8(os, params_width);
+	MapNode::serializeBulk(os, version, data, nodecount,
+			content_width, params_width, true, codec);
+
+	/*
+		Node metadata
+	*/
+	std::ostringstream oss(std::ios_base::binary);
+	m_node_metadata.serialize(oss);
+	compressWithCodec(codec, oss.str(), os);
+}
+
+void MapBlock::snapshot(MapBlockSnapshot &dst, u8 version,
+		CompressionCodec codec)
+{
+	if(data == NULL)
+	{
+		throw SerializationError("ERROR: Not writing dummy block.");
+	}
+
+	dst.pos = m_pos;
+	dst.version = version;
+	dst.codec = codec;
+	dst.flags = getSerializationFlags();
+	dst.nodes.assign(data, data + nodecount);
+
+	std::ostringstream meta_os(std::ios_base::binary);
+	m_node_metadata.serialize(meta_os);
+	dst.node_metadata = meta_os.str();
+
+	std::ostringstream timers_os(std::ios_base::binary);
+	m_node_timers.serialize(timers_os, version);
+	dst.node_timers = timers_os.str();
+
+	std::ostringstream objects_os(std::ios_base::binary);
+	m_static_objects.serialize(objects_os);
+	dst.static_objects = objects_os.str();
+
+	dst.timestamp = getTimestamp();
+	dst.ndef = m_gamedef->ndef();
+}
+
+u8 MapBlock::getSerializationFlags()
+{
 	u8 flags = 0;
 	if(is_underground)
 		flags |= 0x01;
@@ -576,67 +682,53 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 		flags |= 0x04;
 	if(m_generated == false)
 		flags |= 0x08;
+	return flags;
+}
+
+void MapBlockSnapshot::serialize(std::ostream &os)
+{
+	// First byte
 	writeU8(os, flags);
+	writeCompressionCodec(os, version, codec);
 
 	/*
 		Bulk node data
 	*/
 	NameIdMapping nimap;
-	if(disk)
-	{
-		MapNode *tmp_nodes = new MapNode[nodecount];
-		for(u32 i=0; i<nodecount; i++)
-			tmp_nodes[i] = data[i];
-		getBlockNodeIdMapping(&nimap, tmp_nodes, m_gamedef->ndef());
-
-		u8 content_width = 2;
-		u8 params_width = 2;
-		writeU8(os, content_width);
-		writeU8(os, params_width);
-		MapNode::serializeBulk(os, version, tmp_nodes, nodecount,
-				content_width, params_width, true);
-		delete[] tmp_nodes;
-	}
-	else
-	{
-		u8 content_width = 2;
-		u8 params_width = 2;
-		writeU8(os, content_width);
-		writeU8(os, params_width);
-		MapNode::serializeBulk(os, version, data, nodecount,
-				content_width, params_width, true);
-	}
+	getBlockNodeIdMapping(&nimap, &nodes[0], ndef);
+
+	u8 content_width = 2;
+	u8 params_width = 2;
+	writeU8(os, content_width);
+	writeU8(os, params_width);
+	MapNode::serializeBulk(os, version, &nodes[0], nodes.size(),
+			content_width, params_width, true, codec);
 
 	/*
 		Node metadata
 	*/
-	std::ostringstream oss(std::ios_base::binary);
-	m_node_metadata.serialize(oss);
-	compressZlib(oss.str(), os);
+	compressWithCodec(codec, node_metadata, os);
 
 	/*
 		Data that goes to disk, but not the network
 	*/
-	if(disk)
-	{
-		if(version <= 24){
-			// Node timers
-			m_node_timers.serialize(os, version);
-		}
+	if(version <= 24){
+		// Node timers
+		os << node_timers;
+	}
 
-		// Static objects
-		m_static_objects.serialize(os);
+	// Static objects
+	os << static_objects;
 
-		// Timestamp
-		writeU32(os, getTimestamp());
+	// Timestamp
+	writeU32(os, timestamp);
 
-		// Write block-specific node definition id mapping
-		nimap.serialize(os);
+	// Write block-specific node definition id mapping
+	nimap.serialize(os);
 
-		if(version >= 25){
-			// Node timers
-			m_node_timers.serialize(os, version);
-		}
+	if(version >= 25){
+		// Node timers
+		os << node_timers;
 	}
 }
 
@@ -662,6 +754,9 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())<<std::endl);
 
+	expireNetworkCache();
+	expireContents();
+
 	m_day_night_differs_expired = false;
 
 	if(version <= 21)
@@ -676,6 +771,16 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	m_lighting_expired = (flags & 0x04) ? true : false;
 	m_generated = (flags & 0x08) ? false : true;
 
+	CompressionCodec codec = COMPRESSION_ZLIB;
+	if(version >= SER_FMT_VER_COMPRESSION_CODEC)
+	{
+		u8 codec_id = readU8(is);
+		if(codec_id >= COMPRESSION_CODEC_COUNT)
+			throw SerializationError("MapBlock::deSerialize(): "
+					"unknown compression codec");
+		codec = (CompressionCodec)codec_id;
+	}
+
 	/*
 		Bulk node data
 	*/
@@ -688,7 +793,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	if(params_width != 2)
 		throw SerializationError("MapBlock::deSerialize(): invalid params_width");
 	MapNode::deSerializeBulk(is, version, data, nodecount,
-			content_width, params_width, true);
+			content_width, params_width, true, codec);
 
 	/*
 		NodeMetadata
@@ -698,7 +803,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	// Ignore errors
 	try {
 		std::ostringstream oss(std::ios_base::binary);
-		decompressZlib(is, oss);
+		decompressWithCodec(codec, is, oss);
 		std::istringstream iss(oss.str(), std::ios_base::binary);
 		if (version >= 23)
 			m_node_metadata.deSerialize(iss, m_gamedef->idef());
@@ -757,6 +862,60 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 			<<": Done."<<std::endl);
 }
 
+SharedSlice<u8> MapBlock::getNetworkSerialization(u8 version,
+		u16 net_proto_version, CompressionCodec codec)
+{
+	// Older clients only know zlib
+	if (version < SER_FMT_VER_COMPRESSION_CODEC)
+		codec = COMPRESSION_ZLIB;
+
+	for (std::vector<NetworkCacheEntry>::iterator
+			it = m_network_cache.begin();
+			it != m_network_cache.end(); ++it) {
+		if (it->version == version &&
+				it->net_proto_version == net_proto_version &&
+				it->codec == codec)
+			return it->data;
+	}
+
+	std::ostringstream os(std::ios_base::binary);
+	serialize(os, version, false, codec);
+	serializeNetworkSpecific(os, net_proto_version);
+
+	std::string s = os.str();
+	NetworkCacheEntry entry;
+	entry.version = version;
+	entry.net_proto_version = net_proto_version;
+	entry.codec = codec;
+	entry.data = SharedSlice<u8>((const u8 *)s.c_str(), s.size());
+	m_network_cache.push_back(entry);
+	return entry.data;
+}
+
+const std::vector<content_t> &MapBlock::getContents()
+{
+	if (!m_contents_expired)
+		return m_contents;
+
+	m_contents.clear();
+	m_contents_expired = false;
+	if (data == NULL)
+		return m_contents;
+
+	// Blocks usually hold only a handful of contents; skip runs of equal
+	// nodes before doing the linear search in addContent()
+	content_t last = data[0].getContent();
+	addContent(last);
+	for (u32 i = 1; i < nodecount; i++) {
+		content_t c = data[i].getContent();
+		if (c != last) {
+			addContent(c);
+			last = c;
+		}
+	}
+	return m_contents;
+}
+
 void MapBlock::deSerializeNetworkSpecific(std::istream &is)
 {
 	try {
@@ -31,6 +31,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodetimer.h"
 #include "modifiedstate.h"
 #include "util/numeric.h" // getContainerPos
+#include "util/pointer.h"
 #include "settings.h"
 
 class Map;
@@ -38,6 +39,8 @@ class NodeMetadataList;
 class IGameDef;
 class MapBlockMesh;
 class VoxelManipulator;
+class VoxelArea;
+class INodeDefManager;
 
 #define BLOCK_TIMESTAMP_UNDEFINED 0xffffffff
 
@@ -123,6 +126,38 @@ class NodeContainer
 #define MOD_REASON_EXPIRE_DAYNIGHTDIFF       (1 << 18)
 #define MOD_REASON_UNKNOWN                   (1 << 19)
 
+// Modifications that do not change the over-the-network block format
+#define MOD_REASON_NETWORK_INVARIANT \
+	(MOD_REASON_SET_TIMESTAMP | MOD_REASON_CLEAR_ALL_OBJECTS | \
+	MOD_REASON_BLOCK_EXPIRED | MOD_REASON_ADD_ACTIVE_OBJECT_RAW | \
+	MOD_REASON_REMOVE_OBJECTS_REMOVE | MOD_REASON_REMOVE_OBJECTS_DEACTIVATE | \
+	MOD_REASON_TOO_MANY_OBJECTS | MOD_REASON_STATIC_DATA_ADDED | \
+	MOD_REASON_STATIC_DATA_REMOVED | MOD_REASON_STATIC_DATA_CHANGED)
+
+/*
+	Everything MapBlock::serialize() writes to disk, copied out of the
+	block so that it can be serialized and compressed without access to
+	the block, e.g. on another thread.
+*/
+struct MapBlockSnapshot
+{
+	v3s16 pos;
+	u8 version;
+	CompressionCodec codec;
+	u8 flags;
+	std::vector<MapNode> nodes;
+	// Not compressed yet
+	std::string node_metadata;
+	std::string node_timers;
+	std::string static_objects;
+	u32 timestamp;
+	INodeDefManager *ndef;
+
+	// Writes the block in the on-disk format without the version byte.
+	// Changes the content ids of nodes, so this can only be done once.
+	void serialize(std::ostream &os);
+};
+
 ////
 //// MapBlock itself
 ////
@@ -149,6 +184,7 @@ class MapBlock /*: public NodeContainer*/
 		data = new MapNode[nodecount];
 		for (u32 i = 0; i < nodecount; i++)
 			data[i] = MapNode(CONTENT_IGNORE);
+		expireContents();
 
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REALLOCATE);
 	}
@@ -158,6 +194,9 @@ class MapBlock /*: public NodeContainer*/
 	////
 	void raiseModified(u32 mod, u32 reason=MOD_REASON_UNKNOWN)
 	{
+		if ((reason & ~MOD_REASON_NETWORK_INVARIANT) != 0)
+			expireNetworkCache();
+
 		if (mod > m_modified) {
 			m_modified = mod;
 			m_modified_reason = reason;
@@ -315,6 +354,7 @@ class MapBlock /*: public NodeContainer*/
 			throw InvalidPositionException();
 
 		data[z * zstride + y * ystride + x] = n;
+		addContent(n.getContent());
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
 	}
 
@@ -347,6 +387,7 @@ class MapBlock /*: public NodeContainer*/
 			throw InvalidPositionException();
 
 		data[z * zstride + y * ystride + x] = n;
+		addContent(n.getContent());
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE_NO_CHECK);
 	}
 
@@ -376,6 +417,9 @@ class MapBlock /*: public NodeContainer*/
 	// Copies data to VoxelManipulator to getPosRelative()
 	void copyTo(VoxelManipulator &dst);
 
+	// Copies the nodes that are in area to dst, an array of the size of area
+	void copyTo(MapNode *dst, const VoxelArea &area);
+
 	// Copies data from VoxelManipulator getPosRelative()
 	void copyFrom(VoxelManipulator &dst);
 
@@ -505,7 +549,12 @@ class MapBlock /*: public NodeContainer*/
 	// These don't write or read version by itself
 	// Set disk to true for on-disk format, false for over-the-network format
 	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
-	void serialize(std::ostream &os, u8 version, bool disk);
+	// Precondition: codec is zlib or version >= SER_FMT_VER_COMPRESSION_CODEC
+	void serialize(std::ostream &os, u8 version, bool disk,
+			CompressionCodec codec = COMPRESSION_ZLIB);
+	// Copies what serialize() with disk set would write into dst
+	void snapshot(MapBlockSnapshot &dst, u8 version,
+			CompressionCodec codec = COMPRESSION_ZLIB);
 	// If disk == true: In addition to doing other things, will add
 	// unknown blocks from id-name mapping to wndef
 	void deSerialize(std::istream &is, u8 version, bool disk);
@@ -513,6 +562,43 @@ class MapBlock /*: public NodeContainer*/
 	void serializeNetworkSpecific(std::ostream &os, u16 net_proto_version);
 	void deSerializeNetworkSpecific(std::istream &is);
 
+	/*
+		Returns serialize(os, version, false, codec) followed by
+		serializeNetworkSpecific(os, net_proto_version), as sent in
+		TOCLIENT_BLOCKDATA. Versions that can't store the codec use zlib.
+
+		The result is cached per (version, net_proto_version, codec) until
+		the block is modified, so a block that is sent to many clients is
+		only serialized and compressed once. The packets sending it share
+		the cached data instead of copying it.
+	*/
+	SharedSlice<u8> getNetworkSerialization(u8 version, u16 net_proto_version,
+			CompressionCodec codec = COMPRESSION_ZLIB);
+
+	// Drops all cached network serializations of this block.
+	// Must be called whenever data that goes to the network is changed
+	// without a call to raiseModified().
+	inline void expireNetworkCache()
+	{
+		m_network_cache.clear();
+	}
+
+	/*
+		Content tracking
+	*/
+
+	// Returns the distinct contents of the block. The list is rebuilt lazily
+	// and may still contain contents that have since been overwritten, so it
+	// is only good for ruling contents out.
+	const std::vector<content_t> &getContents();
+
+	// Must be called whenever node data is replaced without going through
+	// setNode() or setNodeNoCheck().
+	inline void expireContents()
+	{
+		m_contents_expired = true;
+	}
+
 private:
 	/*
 		Private methods
@@ -520,6 +606,9 @@ class MapBlock /*: public NodeContainer*/
 
 	void deSerialize_pre22(std::istream &is, u8 version, bool disk);
 
+	// The first byte of the serialized block
+	u8 getSerializationFlags();
+
 	/*
 		Used only internally, because changes can't be tracked
 	*/
@@ -537,6 +626,16 @@ class MapBlock /*: public NodeContainer*/
 		return getNodeRef(p.X, p.Y, p.Z);
 	}
 
+	inline void addContent(content_t c)
+	{
+		if (m_contents_expired)
+			return;
+		for (size_t i = 0; i < m_contents.size(); i++)
+			if (m_contents[i] == c)
+				return;
+		m_contents.push_back(c);
+	}
+
 public:
 	/*
 		Public member variables
@@ -633,6 +732,25 @@ class MapBlock /*: public NodeContainer*/
 		the list of blocks to be drawn.
 	*/
 	int m_refcount;
+
+	/*
+		Cached results of getNetworkSerialization(). There usually is only
+		one entry since all clients tend to use the same versions.
+	*/
+	struct NetworkCacheEntry
+	{
+		u8 version;
+		u16 net_proto_version;
+		CompressionCodec codec;
+		SharedSlice<u8> data;
+	};
+	std::vector<NetworkCacheEntry> m_network_cache;
+
+	/*
+		Distinct contents of the block, see getContents().
+	*/
+	std::vector<content_t> m_contents;
+	bool m_contents_expired;
 };
 
 typedef std::vector<MapBlock*> MapBlockVect;
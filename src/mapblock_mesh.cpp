@@ -30,6 +30,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "noise.h"
 #include "shader.h"
 #include "settings.h"
+#include "threading/mutex.h"
+#include "threading/mutex_auto_lock.h"
 #include "util/directiontables.h"
 #include <IMeshManipulator.h>
 
@@ -43,93 +45,98 @@ static void applyFacesShading(video::SColor &color, const float factor)
 	MeshMakeData
 */
 
+/*
+	The node arrays are filled by the main thread and freed by the mesh
+	update threads, so they are kept in a pool for all threads
+*/
+#define MESH_NODES_POOL_MAX 64
+
+static Mutex g_mesh_nodes_pool_mutex;
+static std::vector<MapNode *> g_mesh_nodes_pool;
+
+static MapNode *take_mesh_nodes()
+{
+	{
+		MutexAutoLock lock(g_mesh_nodes_pool_mutex);
+		if (!g_mesh_nodes_pool.empty()) {
+			MapNode *nodes = g_mesh_nodes_pool.back();
+			g_mesh_nodes_pool.pop_back();
+			return nodes;
+		}
+	}
+	return new MapNode[MESH_NODES_VOLUME];
+}
+
+static void give_back_mesh_nodes(MapNode *nodes)
+{
+	{
+		MutexAutoLock lock(g_mesh_nodes_pool_mutex);
+		if (g_mesh_nodes_pool.size() < MESH_NODES_POOL_MAX) {
+			g_mesh_nodes_pool.push_back(nodes);
+			return;
+		}
+	}
+	delete[] nodes;
+}
+
 MeshMakeData::MeshMakeData(IGameDef *gamedef, bool use_shaders,
 		bool use_tangent_vertices):
-	m_vmanip(),
+	m_nodes(NULL),
 	m_blockpos(-1337,-1337,-1337),
 	m_crack_pos_relative(-1337, -1337, -1337),
 	m_smooth_lighting(false),
+	m_merge_faces(true),
 	m_show_hud(false),
 	m_gamedef(gamedef),
 	m_use_shaders(use_shaders),
 	m_use_tangent_vertices(use_tangent_vertices)
 {}
 
+MeshMakeData::~MeshMakeData()
+{
+	if (m_nodes)
+		give_back_mesh_nodes(m_nodes);
+}
+
+void MeshMakeData::allocateNodes()
+{
+	if (!m_nodes)
+		m_nodes = take_mesh_nodes();
+
+	v3s16 blockpos_nodes = m_blockpos * MAP_BLOCKSIZE;
+	m_nodes_area = VoxelArea(blockpos_nodes - v3s16(1,1,1),
+		blockpos_nodes + v3s16(1,1,1) * MAP_BLOCKSIZE);
+}
+
 void MeshMakeData::fill(MapBlock *block)
 {
 	m_blockpos = block->getPos();
-
-	v3s16 blockpos_nodes = m_blockpos*MAP_BLOCKSIZE;
+	allocateNodes();
 
 	/*
-		Copy data
+		Copy the block, and the nodes of its neighbors next to it
 	*/
+	for (s32 i = 0; i < MESH_NODES_VOLUME; i++)
+		m_nodes[i] = MapNode(CONTENT_IGNORE);
 
-	// Allocate this block + neighbors
-	m_vmanip.clear();
-	VoxelArea voxel_area(blockpos_nodes - v3s16(1,1,1) * MAP_BLOCKSIZE,
-			blockpos_nodes + v3s16(1,1,1) * MAP_BLOCKSIZE*2-v3s16(1,1,1));
-	m_vmanip.addArea(voxel_area);
-
-	{
-		//TimeTaker timer("copy central block data");
-		// 0ms
-
-		// Copy our data
-		block->copyTo(m_vmanip);
-	}
-	{
-		//TimeTaker timer("copy neighbor block data");
-		// 0ms
-
-		/*
-			Copy neighbors. This is lightning fast.
-			Copying only the borders would be *very* slow.
-		*/
+	block->copyTo(m_nodes, m_nodes_area);
 
-		// Get map
-		Map *map = block->getParent();
-
-		for(u16 i=0; i<26; i++)
-		{
-			const v3s16 &dir = g_26dirs[i];
-			v3s16 bp = m_blockpos + dir;
-			MapBlock *b = map->getBlockNoCreateNoEx(bp);
-			if(b)
-				b->copyTo(m_vmanip);
-		}
+	Map *map = block->getParent();
+	for (u16 i = 0; i < 26; i++) {
+		MapBlock *b = map->getBlockNoCreateNoEx(m_blockpos + g_26dirs[i]);
+		if (b)
+			b->copyTo(m_nodes, m_nodes_area);
 	}
 }
 
 void MeshMakeData::fillSingleNode(MapNode *node)
 {
 	m_blockpos = v3s16(0,0,0);
+	allocateNodes();
 
-	v3s16 blockpos_nodes = v3s16(0,0,0);
-	VoxelArea area(blockpos_nodes-v3s16(1,1,1)*MAP_BLOCKSIZE,
-			blockpos_nodes+v3s16(1,1,1)*MAP_BLOCKSIZE*2-v3s16(1,1,1));
-	s32 volume = area.getVolume();
-	s32 our_node_index = area.index(1,1,1);
-
-	// Allocate this block + neighbors
-	m_vmanip.clear();
-	m_vmanip.addArea(area);
-
-	// Fill in data
-	MapNode *data = new MapNode[volume];
-	for(s32 i = 0; i < volume; i++)
-	{
-		if(i == our_node_index)
-		{
-			data[i] = *node;
-		}
-		else
-		{
-			data[i] = MapNode(CONTENT_AIR, LIGHT_MAX, 0);
-		}
-	}
-	m_vmanip.copyFrom(data, area, area.MinEdge, area.MinEdge, area.getExtent());
-	delete[] data;
+	for (s32 i = 0; i < MESH_NODES_VOLUME; i++)
+		m_nodes[i] = MapNode(CONTENT_AIR, LIGHT_MAX, 0);
+	m_nodes[nodeIndex(v3s16(1,1,1))] = *node;
 }
 
 void MeshMakeData::setCrack(int crack_level, v3s16 crack_pos)
@@ -143,6 +150,11 @@ void MeshMakeData::setSmoothLighting(bool smooth_lighting)
 	m_smooth_lighting = smooth_lighting;
 }
 
+void MeshMakeData::setMergeFaces(bool merge_faces)
+{
+	m_merge_faces = merge_faces;
+}
+
 /*
 	Light and vertex color functions
 */
@@ -243,7 +255,7 @@ static u16 getSmoothLightCombined(v3s16 p, MeshMakeData *data)
 
 	for (u32 i = 0; i < 8; i++)
 	{
-		const MapNode &n = data->m_vmanip.getNodeRefUnsafeCheckFlags(p - dirs8[i]);
+		MapNode n = data->getNodeNoEx(p - dirs8[i]);
 
 		// if it's CONTENT_IGNORE we can't do any light calculations
 		if (n.getContent() == CONTENT_IGNORE) {
@@ -424,12 +436,6 @@ static void getNodeVertexDirs(v3s16 dir, v3s16 *vertex_dirs)
 	}
 }
 
-struct FastFace
-{
-	TileSpec tile;
-	video::S3DVertex vertices[4]; // Precalculated vertices
-};
-
 static void makeFastFace(TileSpec tile, u16 li0, u16 li1, u16 li2, u16 li3,
 		v3f p, v3s16 dir, v3f scale, u8 light_source, std::vector<FastFace> &dest)
 {
@@ -574,10 +580,11 @@ static void makeFastFace(TileSpec tile, u16 li0, u16 li1, u16 li2, u16 li3,
 		vertex_pos[i] += pos;
 	}
 
-	f32 abs_scale = 1.0;
-	if     (scale.X < 0.999 || scale.X > 1.001) abs_scale = scale.X;
-	else if(scale.Y < 0.999 || scale.Y > 1.001) abs_scale = scale.Y;
-	else if(scale.Z < 0.999 || scale.Z > 1.001) abs_scale = scale.Z;
+	// The texture is repeated along the sides of faces of several nodes
+	v3s16 u_dir = vertex_dirs[0] - vertex_dirs[1];
+	v3s16 v_dir = vertex_dirs[1] - vertex_dirs[2];
+	f32 u_scale = u_dir.X != 0 ? scale.X : u_dir.Y != 0 ? scale.Y : scale.Z;
+	f32 v_scale = v_dir.X != 0 ? scale.X : v_dir.Y != 0 ? scale.Y : scale.Z;
 
 	v3f normal(dir.X, dir.Y, dir.Z);
 
@@ -589,16 +596,16 @@ static void makeFastFace(TileSpec tile, u16 li0, u16 li1, u16 li2, u16 li3,
 
 	face.vertices[0] = video::S3DVertex(vertex_pos[0], normal,
 			MapBlock_LightColor(alpha, li0, light_source),
-			core::vector2d<f32>(x0+w*abs_scale, y0+h));
+			core::vector2d<f32>(x0+w*u_scale, y0+h*v_scale));
 	face.vertices[1] = video::S3DVertex(vertex_pos[1], normal,
 			MapBlock_LightColor(alpha, li1, light_source),
-			core::vector2d<f32>(x0, y0+h));
+			core::vector2d<f32>(x0, y0+h*v_scale));
 	face.vertices[2] = video::S3DVertex(vertex_pos[2], normal,
 			MapBlock_LightColor(alpha, li2, light_source),
 			core::vector2d<f32>(x0, y0));
 	face.vertices[3] = video::S3DVertex(vertex_pos[3], normal,
 			MapBlock_LightColor(alpha, li3, light_source),
-			core::vector2d<f32>(x0+w*abs_scale, y0));
+			core::vector2d<f32>(x0+w*u_scale, y0));
 
 	face.tile = tile;
 }
@@ -752,11 +759,10 @@ static void getTileInfo(
 		u8 &light_source
 	)
 {
-	VoxelManipulator &vmanip = data->m_vmanip;
 	INodeDefManager *ndef = data->m_gamedef->ndef();
 	v3s16 blockpos_nodes = data->m_blockpos * MAP_BLOCKSIZE;
 
-	MapNode &n0 = vmanip.getNodeRefUnsafe(blockpos_nodes + p);
+	const MapNode &n0 = data->getNodeRefUnsafe(blockpos_nodes + p);
 
 	// Don't even try to get n1 if n0 is already CONTENT_IGNORE
 	if (n0.getContent() == CONTENT_IGNORE) {
@@ -764,7 +770,7 @@ static void getTileInfo(
 		return;
 	}
 
-	const MapNode &n1 = vmanip.getNodeRefUnsafeCheckFlags(blockpos_nodes + p + face_dir);
+	const MapNode &n1 = data->getNodeRefUnsafe(blockpos_nodes + p + face_dir);
 
 	if (n1.getContent() == CONTENT_IGNORE) {
 		makes_face = false;
@@ -824,200 +830,216 @@ static void getTileInfo(
 }
 
 /*
-	startpos:
-	translate_dir: unit vector with only one of x, y or z
-	face_dir: unit vector with only one of x, y or z
+	The face of a node towards face_dir, as returned by getTileInfo()
+*/
+struct FastFaceInfo
+{
+	bool makes_face;
+	// Part of a face that is made already
+	bool merged;
+	v3s16 p_corrected;
+	v3s16 face_dir_corrected;
+	u16 lights[4];
+	TileSpec tile;
+	u8 light_source;
+};
+
+/*
+	Whether face b can be drawn together with face a, when b is offset
+	nodes away from a
+*/
+static bool canMergeFaces(MeshMakeData *data, const FastFaceInfo &a,
+		const FastFaceInfo &b, v3s16 offset)
+{
+	return data->m_merge_faces
+			&& b.makes_face
+			&& !b.merged
+			&& b.p_corrected == a.p_corrected + offset
+			&& b.face_dir_corrected == a.face_dir_corrected
+			&& b.lights[0] == a.lights[0]
+			&& b.lights[1] == a.lights[1]
+			&& b.lights[2] == a.lights[2]
+			&& b.lights[3] == a.lights[3]
+			&& b.tile == a.tile
+			&& a.tile.rotation == 0
+			&& b.light_source == a.light_source
+			&& (a.tile.material_flags & MATERIAL_FLAG_TILEABLE_HORIZONTAL)
+			&& (a.tile.material_flags & MATERIAL_FLAG_TILEABLE_VERTICAL);
+}
+
+/*
+	Makes the faces of a layer of the block, which has rows along
+	translate_dir and columns along column_dir.  Equal faces next to each
+	other are made into a single rectangle: as wide along a row as they
+	go, then as far along the columns as the whole width matches.
+
+	startpos: corner of the layer
+	translate_dir, column_dir, face_dir: unit vectors with only one of
+	x, y or z
+	faces: space for MAP_BLOCKSIZE * MAP_BLOCKSIZE faces
 */
-static void updateFastFaceRow(
+static void updateFastFaceLayer(
 		MeshMakeData *data,
 		v3s16 startpos,
 		v3s16 translate_dir,
-		v3f translate_dir_f,
+		v3s16 column_dir,
 		v3s16 face_dir,
-		v3f face_dir_f,
+		std::vector<FastFaceInfo> &faces,
 		std::vector<FastFace> &dest)
 {
-	v3s16 p = startpos;
-
-	u16 continuous_tiles_count = 1;
-
-	bool makes_face = false;
-	v3s16 p_corrected;
-	v3s16 face_dir_corrected;
-	u16 lights[4] = {0,0,0,0};
-	TileSpec tile;
-	u8 light_source = 0;
-	getTileInfo(data, p, face_dir,
-			makes_face, p_corrected, face_dir_corrected,
-			lights, tile, light_source);
+	for (u16 v = 0; v < MAP_BLOCKSIZE; v++)
+	for (u16 u = 0; u < MAP_BLOCKSIZE; u++) {
+		FastFaceInfo &face = faces[v * MAP_BLOCKSIZE + u];
+		face.merged = false;
+		getTileInfo(data, startpos + translate_dir * u + column_dir * v,
+				face_dir, face.makes_face, face.p_corrected,
+				face.face_dir_corrected, face.lights, face.tile,
+				face.light_source);
+	}
 
-	for(u16 j=0; j<MAP_BLOCKSIZE; j++)
-	{
-		// If tiling can be done, this is set to false in the next step
-		bool next_is_different = true;
+	for (u16 v = 0; v < MAP_BLOCKSIZE; v++)
+	for (u16 u = 0; u < MAP_BLOCKSIZE; u++) {
+		FastFaceInfo &face = faces[v * MAP_BLOCKSIZE + u];
+		if (!face.makes_face || face.merged)
+			continue;
 
-		v3s16 p_next;
+		u16 width = 1;
+		while (u + width < MAP_BLOCKSIZE && canMergeFaces(data, face,
+				faces[v * MAP_BLOCKSIZE + u + width],
+				translate_dir * width))
+			width++;
+
+		u16 height = 1;
+		for (; v + height < MAP_BLOCKSIZE; height++) {
+			u16 i = 0;
+			while (i < width && canMergeFaces(data, face,
+					faces[(v + height) * MAP_BLOCKSIZE + u + i],
+					translate_dir * i + column_dir * height))
+				i++;
+			if (i < width)
+				break;
+		}
 
-		bool next_makes_face = false;
-		v3s16 next_p_corrected;
-		v3s16 next_face_dir_corrected;
-		u16 next_lights[4] = {0,0,0,0};
-		TileSpec next_tile;
-		u8 next_light_source = 0;
+		for (u16 j = 0; j < height; j++)
+		for (u16 i = 0; i < width; i++)
+			faces[(v + j) * MAP_BLOCKSIZE + u + i].merged = true;
+
+		// Center point of the rectangle
+		v3f pf(face.p_corrected.X, face.p_corrected.Y, face.p_corrected.Z);
+		v3f translate_dir_f(translate_dir.X, translate_dir.Y, translate_dir.Z);
+		v3f column_dir_f(column_dir.X, column_dir.Y, column_dir.Z);
+		v3f sp = pf + (width - 1) / 2.0f * translate_dir_f
+			+ (height - 1) / 2.0f * column_dir_f;
+		v3f scale = v3f(1, 1, 1) + (width - 1) * translate_dir_f
+			+ (height - 1) * column_dir_f;
+
+		makeFastFace(face.tile, face.lights[0], face.lights[1],
+				face.lights[2], face.lights[3], sp,
+				face.face_dir_corrected, scale, face.light_source, dest);
+
+		g_profiler->avg("Meshgen: faces drawn by tiling", 0);
+		for (int i = 1; i < width * height; i++)
+			g_profiler->avg("Meshgen: faces drawn by tiling", 1);
+	}
+}
 
-		// If at last position, there is nothing to compare to and
-		// the face must be drawn anyway
-		if(j != MAP_BLOCKSIZE - 1)
-		{
-			p_next = p + translate_dir;
-
-			getTileInfo(data, p_next, face_dir,
-					next_makes_face, next_p_corrected,
-					next_face_dir_corrected, next_lights,
-					next_tile, next_light_source);
-
-			if(next_makes_face == makes_face
-					&& next_p_corrected == p_corrected + translate_dir
-					&& next_face_dir_corrected == face_dir_corrected
-					&& next_lights[0] == lights[0]
-					&& next_lights[1] == lights[1]
-					&& next_lights[2] == lights[2]
-					&& next_lights[3] == lights[3]
-					&& next_tile == tile
-					&& tile.rotation == 0
-					&& next_light_source == light_source
-					&& (tile.material_flags & MATERIAL_FLAG_TILEABLE_HORIZONTAL)
-					&& (tile.material_flags & MATERIAL_FLAG_TILEABLE_VERTICAL)) {
-				next_is_different = false;
-				continuous_tiles_count++;
-			} else {
-				/*if(makes_face){
-					g_profiler->add("Meshgen: diff: next_makes_face != makes_face",
-							next_makes_face != makes_face ? 1 : 0);
-					g_profiler->add("Meshgen: diff: n_p_corr != p_corr + t_dir",
-							(next_p_corrected != p_corrected + translate_dir) ? 1 : 0);
-					g_profiler->add("Meshgen: diff: next_f_dir_corr != f_dir_corr",
-							next_face_dir_corrected != face_dir_corrected ? 1 : 0);
-					g_profiler->add("Meshgen: diff: next_lights[] != lights[]",
-							(next_lights[0] != lights[0] ||
-							next_lights[0] != lights[0] ||
-							next_lights[0] != lights[0] ||
-							next_lights[0] != lights[0]) ? 1 : 0);
-					g_profiler->add("Meshgen: diff: !(next_tile == tile)",
-							!(next_tile == tile) ? 1 : 0);
-				}*/
-			}
-			/*g_profiler->add("Meshgen: Total faces checked", 1);
-			if(makes_face)
-				g_profiler->add("Meshgen: Total makes_face checked", 1);*/
-		} else {
-			/*if(makes_face)
-				g_profiler->add("Meshgen: diff: last position", 1);*/
+/*
+	Marks the layers with faces that the node at p (relative to the block)
+	is next to, or lights with smooth lighting
+*/
+static void markLayersOfNode(v3s16 p, bool changed[3][MAP_BLOCKSIZE])
+{
+	s16 coords[3] = {p.Y, p.X, p.Z};
+	for (u16 axis = 0; axis < 3; axis++) {
+		for (s16 layer = coords[axis] - 1; layer <= coords[axis]; layer++) {
+			if (layer >= 0 && layer < MAP_BLOCKSIZE)
+				changed[axis][layer] = true;
 		}
+	}
+}
 
-		if(next_is_different)
-		{
-			/*
-				Create a face if there should be one
-			*/
-			if(makes_face)
-			{
-				// Floating point conversion of the position vector
-				v3f pf(p_corrected.X, p_corrected.Y, p_corrected.Z);
-				// Center point of face (kind of)
-				v3f sp = pf - ((f32)continuous_tiles_count / 2.0 - 0.5) * translate_dir_f;
-				v3f scale(1,1,1);
-
-				if(translate_dir.X != 0) {
-					scale.X = continuous_tiles_count;
-				}
-				if(translate_dir.Y != 0) {
-					scale.Y = continuous_tiles_count;
-				}
-				if(translate_dir.Z != 0) {
-					scale.Z = continuous_tiles_count;
-				}
+/*
+	Finds the layers of the cached faces whose nodes changed since.
+	All of them if there is nothing cached that the faces can be reused of.
+*/
+static void findChangedLayers(MeshMakeData *data,
+		const MapBlockMeshCache *cache, bool changed[3][MAP_BLOCKSIZE])
+{
+	bool all = cache->nodes.size() != MESH_NODES_VOLUME ||
+		cache->smooth_lighting != data->m_smooth_lighting ||
+		cache->merge_faces != data->m_merge_faces;
 
-				makeFastFace(tile, lights[0], lights[1], lights[2], lights[3],
-						sp, face_dir_corrected, scale, light_source,
-						dest);
+	for (u16 axis = 0; axis < 3; axis++)
+	for (u16 layer = 0; layer < MAP_BLOCKSIZE; layer++)
+		changed[axis][layer] = all;
 
-				g_profiler->avg("Meshgen: faces drawn by tiling", 0);
-				for(int i = 1; i < continuous_tiles_count; i++){
-					g_profiler->avg("Meshgen: faces drawn by tiling", 1);
-				}
-			}
+	if (all)
+		return;
 
-			continuous_tiles_count = 1;
-		}
+	if (data->m_crack_pos_relative != cache->crack_pos_relative) {
+		markLayersOfNode(data->m_crack_pos_relative, changed);
+		markLayersOfNode(cache->crack_pos_relative, changed);
+	}
 
-		makes_face = next_makes_face;
-		p_corrected = next_p_corrected;
-		face_dir_corrected = next_face_dir_corrected;
-		lights[0] = next_lights[0];
-		lights[1] = next_lights[1];
-		lights[2] = next_lights[2];
-		lights[3] = next_lights[3];
-		tile = next_tile;
-		light_source = next_light_source;
-		p = p_next;
+	u32 i = 0;
+	v3s16 p;
+	for (p.Z = -1; p.Z <= MAP_BLOCKSIZE; p.Z++)
+	for (p.Y = -1; p.Y <= MAP_BLOCKSIZE; p.Y++)
+	for (p.X = -1; p.X <= MAP_BLOCKSIZE; p.X++, i++) {
+		if (!(data->m_nodes[i] == cache->nodes[i]))
+			markLayersOfNode(p, changed);
 	}
 }
 
+/*
+	Makes the faces of the layers of the block that changed since the
+	faces in cache were made, and keeps the nodes for the next time.
+*/
 static void updateAllFastFaceRows(MeshMakeData *data,
-		std::vector<FastFace> &dest)
+		MapBlockMeshCache *cache)
 {
 	/*
-		Go through every y,z and get top(y+) faces in rows of x+
+		Top (y+) faces in rows of x+, right (x+) faces in rows of z+ and
+		back (z+) faces in rows of x+
 	*/
-	for(s16 y = 0; y < MAP_BLOCKSIZE; y++) {
-		for(s16 z = 0; z < MAP_BLOCKSIZE; z++) {
-			updateFastFaceRow(data,
-					v3s16(0,y,z),
-					v3s16(1,0,0), //dir
-					v3f  (1,0,0),
-					v3s16(0,1,0), //face dir
-					v3f  (0,1,0),
-					dest);
-		}
+	static const v3s16 face_dirs[3] =
+		{v3s16(0,1,0), v3s16(1,0,0), v3s16(0,0,1)};
+	static const v3s16 translate_dirs[3] =
+		{v3s16(1,0,0), v3s16(0,0,1), v3s16(1,0,0)};
+	static const v3s16 column_dirs[3] =
+		{v3s16(0,0,1), v3s16(0,1,0), v3s16(0,1,0)};
+
+	bool changed[3][MAP_BLOCKSIZE];
+	findChangedLayers(data, cache, changed);
+
+	std::vector<FastFaceInfo> faces(MAP_BLOCKSIZE * MAP_BLOCKSIZE);
+	u32 layers_made = 0;
+
+	for (u16 axis = 0; axis < 3; axis++)
+	for (s16 layer = 0; layer < MAP_BLOCKSIZE; layer++) {
+		if (!changed[axis][layer])
+			continue;
+		std::vector<FastFace> &dest = cache->layers[axis][layer];
+		dest.clear();
+		updateFastFaceLayer(data,
+				face_dirs[axis] * layer,
+				translate_dirs[axis],
+				column_dirs[axis],
+				face_dirs[axis],
+				faces, dest);
+		layers_made++;
 	}
 
-	/*
-		Go through every x,y and get right(x+) faces in rows of z+
-	*/
-	for(s16 x = 0; x < MAP_BLOCKSIZE; x++) {
-		for(s16 y = 0; y < MAP_BLOCKSIZE; y++) {
-			updateFastFaceRow(data,
-					v3s16(x,y,0),
-					v3s16(0,0,1), //dir
-					v3f  (0,0,1),
-					v3s16(1,0,0), //face dir
-					v3f  (1,0,0),
-					dest);
-		}
-	}
+	g_profiler->avg("Meshgen: face layers made", layers_made);
 
-	/*
-		Go through every y,z and get back(z+) faces in rows of x+
-	*/
-	for(s16 z = 0; z < MAP_BLOCKSIZE; z++) {
-		for(s16 y = 0; y < MAP_BLOCKSIZE; y++) {
-			updateFastFaceRow(data,
-					v3s16(0,y,z),
-					v3s16(1,0,0), //dir
-					v3f  (1,0,0),
-					v3s16(0,0,1), //face dir
-					v3f  (0,0,1),
-					dest);
-		}
-	}
+	cache->nodes.assign(data->m_nodes, data->m_nodes + MESH_NODES_VOLUME);
+	cache->crack_pos_relative = data->m_crack_pos_relative;
+	cache->smooth_lighting = data->m_smooth_lighting;
+	cache->merge_faces = data->m_merge_faces;
 }
 
-/*
-	MapBlockMesh
-*/
-
-MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset):
+MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset,
+		MapBlockMeshCache *cache):
 	m_mesh(new scene::SMesh()),
 	m_minimap_mapblock(NULL),
 	m_gamedef(data->m_gamedef),
@@ -1036,16 +1058,17 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset):
 	
 	if (g_settings->getBool("enable_minimap")) {
 		m_minimap_mapblock = new MinimapMapblock;
-		m_minimap_mapblock->getMinimapNodes(
-			&data->m_vmanip, data->m_blockpos * MAP_BLOCKSIZE);
+		m_minimap_mapblock->getMinimapNodes(data);
 	}
 
 	// 4-21ms for MAP_BLOCKSIZE=16  (NOTE: probably outdated)
 	// 24-155ms for MAP_BLOCKSIZE=32  (NOTE: probably outdated)
 	//TimeTaker timer1("MapBlockMesh()");
 
-	std::vector<FastFace> fastfaces_new;
-	fastfaces_new.reserve(512);
+	// Without a cache all faces are made, into one that is thrown away
+	MapBlockMeshCache own_cache;
+	if (cache == NULL)
+		cache = &own_cache;
 
 	/*
 		We are including the faces of the trailing edges of the block.
@@ -1057,7 +1080,7 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset):
 	{
 		// 4-23ms for MAP_BLOCKSIZE=16  (NOTE: probably outdated)
 		//TimeTaker timer2("updateAllFastFaceRows()");
-		updateAllFastFaceRows(data, fastfaces_new);
+		updateAllFastFaceRows(data, cache);
 	}
 	// End of slow part
 
@@ -1072,8 +1095,10 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset):
 		// (NOTE: probably outdated)
 		//TimeTaker timer2("MeshCollector building");
 
-		for (u32 i = 0; i < fastfaces_new.size(); i++) {
-			FastFace &f = fastfaces_new[i];
+		for (u16 axis = 0; axis < 3; axis++)
+		for (u16 layer = 0; layer < MAP_BLOCKSIZE; layer++)
+		for (u32 i = 0; i < cache->layers[axis][layer].size(); i++) {
+			const FastFace &f = cache->layers[axis][layer][i];
 
 			const u16 indices[] = {0,1,2,2,3,0};
 			const u16 indices_alternate[] = {0,1,3,2,3,1};
@@ -22,8 +22,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "irrlichttypes_extrabloated.h"
 #include "client/tile.h"
+#include "constants.h"
 #include "voxel.h"
+#include "util/basic_macros.h"
 #include <map>
+#include <vector>
 
 class IGameDef;
 class IShaderSource;
@@ -36,12 +39,21 @@ class IShaderSource;
 class MapBlock;
 struct MinimapMapblock;
 
+// The nodes a mesh is made of: its block and one node around it
+#define MESH_NODES_SIZE (MAP_BLOCKSIZE + 2)
+#define MESH_NODES_VOLUME (MESH_NODES_SIZE * MESH_NODES_SIZE * MESH_NODES_SIZE)
+
 struct MeshMakeData
 {
-	VoxelManipulator m_vmanip;
+	// MESH_NODES_VOLUME nodes from m_nodes_area.MinEdge on.  Nodes of
+	// neighbors that aren't loaded are CONTENT_IGNORE.
+	MapNode *m_nodes;
+	VoxelArea m_nodes_area;
 	v3s16 m_blockpos;
 	v3s16 m_crack_pos_relative;
 	bool m_smooth_lighting;
+	// Whether equal faces next to each other are made into one rectangle
+	bool m_merge_faces;
 	bool m_show_hud;
 
 	IGameDef *m_gamedef;
@@ -50,10 +62,29 @@ struct MeshMakeData
 
 	MeshMakeData(IGameDef *gamedef, bool use_shaders,
 			bool use_tangent_vertices = false);
+	~MeshMakeData();
+
+	/*
+		Node at p, or CONTENT_IGNORE outside of the nodes of the mesh
+	*/
+	MapNode getNodeNoEx(v3s16 p) const
+	{
+		if (!m_nodes_area.contains(p))
+			return MapNode(CONTENT_IGNORE);
+		return m_nodes[nodeIndex(p)];
+	}
+
+	/*
+		p must be in the block or next to it
+	*/
+	const MapNode &getNodeRefUnsafe(v3s16 p) const
+	{
+		return m_nodes[nodeIndex(p)];
+	}
 
 	/*
-		Copy central data directly from block, and other data from
-		parent of block.
+		Copy the nodes of block, and the ones next to it from the
+		neighbors of block.
 	*/
 	void fill(MapBlock *block);
 
@@ -71,6 +102,53 @@ struct MeshMakeData
 		Enable or disable smooth lighting
 	*/
 	void setSmoothLighting(bool smooth_lighting);
+
+	/*
+		Enable or disable merging equal faces next to each other.  Without
+		it the mesh looks the same, with a face for every node.
+	*/
+	void setMergeFaces(bool merge_faces);
+
+private:
+	s32 nodeIndex(v3s16 p) const
+	{
+		p -= m_nodes_area.MinEdge;
+		return (p.Z * MESH_NODES_SIZE + p.Y) * MESH_NODES_SIZE + p.X;
+	}
+
+	// Takes m_nodes from the pool and sets the area of the block
+	void allocateNodes();
+
+	DISABLE_CLASS_COPY(MeshMakeData);
+};
+
+struct FastFace
+{
+	TileSpec tile;
+	video::S3DVertex vertices[4]; // Precalculated vertices
+};
+
+/*
+	The faces of a block mesh between the layers of its nodes, and the
+	nodes they were made of.  The next mesh of the block only makes the
+	faces next to nodes that changed again, e.g. after a node is dug.
+*/
+struct MapBlockMeshCache
+{
+	// Nodes of the MeshMakeData, empty if nothing is cached
+	std::vector<MapNode> nodes;
+	v3s16 crack_pos_relative;
+	bool smooth_lighting;
+	bool merge_faces;
+	// Faces between layer i and i+1 of the block along Y, X and Z
+	std::vector<FastFace> layers[3][MAP_BLOCKSIZE];
+
+	MapBlockMeshCache():
+		crack_pos_relative(-1337, -1337, -1337),
+		smooth_lighting(false),
+		merge_faces(true)
+	{
+	}
 };
 
 /*
@@ -88,7 +166,9 @@ class MapBlockMesh
 {
 public:
 	// Builds the mesh given
-	MapBlockMesh(MeshMakeData *data, v3s16 camera_offset);
+	// If cache is given, the faces of it are used and it is updated
+	MapBlockMesh(MeshMakeData *data, v3s16 camera_offset,
+			MapBlockMeshCache *cache = NULL);
 	~MapBlockMesh();
 
 	// Main animation function, parameters:
@@ -0,0 +1,119 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mapblockindex.h"
+
+#define MIN_CAPACITY 64
+
+MapBlockIndex::MapBlockIndex()
+{
+	resize(MIN_CAPACITY);
+}
+
+void MapBlockIndex::insert(v3s16 p, MapBlock *block)
+{
+	if (block == NULL) {
+		remove(p);
+		return;
+	}
+
+	// Keep the load factor at or below 1/2
+	if ((m_count + 1) * 2 > m_entries.size())
+		resize(m_entries.size() * 2);
+
+	u64 key = packPos(p);
+	size_t i = slotOf(key);
+	while (m_entries[i].block != NULL) {
+		if (m_entries[i].key == key) {
+			m_entries[i].block = block;
+			return;
+		}
+		i = (i + 1) & m_mask;
+	}
+	m_entries[i].key = key;
+	m_entries[i].block = block;
+	m_count++;
+}
+
+void MapBlockIndex::remove(v3s16 p)
+{
+	u64 key = packPos(p);
+	size_t i = slotOf(key);
+	for (;; i = (i + 1) & m_mask) {
+		if (m_entries[i].block == NULL)
+			return;
+		if (m_entries[i].key == key)
+			break;
+	}
+
+	/*
+		Shift following entries of the probe sequence back instead of
+		leaving a tombstone, so that lookups never get slower over time.
+	*/
+	size_t hole = i;
+	for (size_t j = (i + 1) & m_mask; m_entries[j].block != NULL;
+			j = (j + 1) & m_mask) {
+		size_t home = slotOf(m_entries[j].key);
+		// Move j into the hole unless its home slot lies cyclically
+		// in (hole, j]
+		bool stays = (hole <= j) ? (hole < home && home <= j) :
+				(hole < home || home <= j);
+		if (stays)
+			continue;
+		m_entries[hole] = m_entries[j];
+		hole = j;
+	}
+	m_entries[hole].block = NULL;
+	m_count--;
+
+	if (m_entries.size() > MIN_CAPACITY && m_count * 8 < m_entries.size())
+		resize(m_entries.size() / 2);
+}
+
+void MapBlockIndex::clear()
+{
+	m_entries.clear();
+	resize(MIN_CAPACITY);
+}
+
+void MapBlockIndex::resize(size_t capacity)
+{
+	std::vector<Entry> old;
+	old.swap(m_entries);
+
+	Entry empty;
+	empty.key = 0;
+	empty.block = NULL;
+	m_entries.resize(capacity, empty);
+	m_mask = capacity - 1;
+	m_shift = 64;
+	for (size_t c = capacity; c > 1; c >>= 1)
+		m_shift--;
+	m_count = 0;
+
+	for (size_t i = 0; i < old.size(); i++) {
+		if (old[i].block == NULL)
+			continue;
+		size_t j = slotOf(old[i].key);
+		while (m_entries[j].block != NULL)
+			j = (j + 1) & m_mask;
+		m_entries[j] = old[i];
+		m_count++;
+	}
+}
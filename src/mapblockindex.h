@@ -0,0 +1,89 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef MAPBLOCKINDEX_HEADER
+#define MAPBLOCKINDEX_HEADER
+
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+#include <vector>
+
+class MapBlock;
+
+/*
+	Hash table from block position to MapBlock, using open addressing
+	with linear probing.
+
+	Lookups don't modify the table, so they may be done from several
+	threads at once as long as nothing is inserted or removed meanwhile.
+*/
+class MapBlockIndex
+{
+public:
+	MapBlockIndex();
+
+	// Returns NULL if there is no block at p
+	inline MapBlock *get(v3s16 p) const
+	{
+		u64 key = packPos(p);
+		for (size_t i = slotOf(key);; i = (i + 1) & m_mask) {
+			const Entry &e = m_entries[i];
+			if (e.block == NULL)
+				return NULL;
+			if (e.key == key)
+				return e.block;
+		}
+	}
+
+	// Replaces the block at p if there already is one
+	void insert(v3s16 p, MapBlock *block);
+	// Does nothing if there is no block at p
+	void remove(v3s16 p);
+	void clear();
+
+	size_t size() const { return m_count; }
+
+private:
+	struct Entry
+	{
+		u64 key;
+		// NULL if the slot is free
+		MapBlock *block;
+	};
+
+	static inline u64 packPos(v3s16 p)
+	{
+		return (u64)(u16)p.X | ((u64)(u16)p.Y << 16) | ((u64)(u16)p.Z << 32);
+	}
+
+	inline size_t slotOf(u64 key) const
+	{
+		// Fibonacci hashing spreads neighbouring positions over the table
+		return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> m_shift);
+	}
+
+	void resize(size_t capacity);
+
+	std::vector<Entry> m_entries;
+	size_t m_count;
+	size_t m_mask;
+	u8 m_shift;
+};
+
+#endif
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mapsector.h"
 #include "exceptions.h"
+#include "map.h"
 #include "mapblock.h"
 #include "serialization.h"
 
@@ -45,6 +46,8 @@ void MapSector::deleteBlocks()
 	for(std::map<s16, MapBlock*>::iterator i = m_blocks.begin();
 		i != m_blocks.end(); ++i)
 	{
+		if(m_parent)
+			m_parent->m_block_index.remove(i->second->getPos());
 		delete i->second;
 	}
 
@@ -99,6 +102,8 @@ MapBlock * MapSector::createBlankBlock(s16 y)
 	MapBlock *block = createBlankBlockNoInsert(y);
 
 	m_blocks[y] = block;
+	if(m_parent)
+		m_parent->m_block_index.insert(block->getPos(), block);
 
 	return block;
 }
@@ -117,6 +122,8 @@ void MapSector::insertBlock(MapBlock *block)
 
 	// Insert into container
 	m_blocks[block_y] = block;
+	if(m_parent)
+		m_parent->m_block_index.insert(block->getPos(), block);
 }
 
 void MapSector::deleteBlock(MapBlock *block)
@@ -128,6 +135,8 @@ void MapSector::deleteBlock(MapBlock *block)
 
 	// Remove from container
 	m_blocks.erase(block_y);
+	if(m_parent)
+		m_parent->m_block_index.remove(block->getPos());
 
 	// Delete
 	delete block;
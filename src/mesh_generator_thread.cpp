@@ -0,0 +1,313 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mesh_generator_thread.h"
+#include "mapblock_mesh.h"
+#include "profiler.h"
+#include "settings.h"
+#include "util/numeric.h"
+#include "util/string.h"
+#include <algorithm>
+
+/*
+	QueuedMeshUpdate
+*/
+
+QueuedMeshUpdate::QueuedMeshUpdate():
+	p(-1337,-1337,-1337),
+	data(NULL),
+	ack_block_to_server(false),
+	urgent(false),
+	seq(0)
+{
+}
+
+QueuedMeshUpdate::~QueuedMeshUpdate()
+{
+	if(data)
+		delete data;
+}
+
+/*
+	MeshUpdateQueue
+*/
+
+MeshUpdateQueue::MeshUpdateQueue():
+	m_camera_block(0,0,0),
+	m_next_seq(0)
+{
+}
+
+MeshUpdateQueue::~MeshUpdateQueue()
+{
+	MutexAutoLock lock(m_mutex);
+
+	for (UNORDERED_MAP<u64, QueuedMeshUpdate *>::iterator
+			i = m_queue.begin(); i != m_queue.end(); ++i)
+		delete i->second;
+}
+
+void MeshUpdateQueue::addBlock(v3s16 p, MeshMakeData *data,
+		bool ack_block_to_server, bool urgent)
+{
+	DSTACK(FUNCTION_NAME);
+
+	assert(data);	// pre-condition
+
+	MutexAutoLock lock(m_mutex);
+
+	QueuedMeshUpdate *&q = m_queue[blockKey(p)];
+	if (q) {
+		// Update the data of the queued block
+		delete q->data;
+		q->data = data;
+		if (ack_block_to_server)
+			q->ack_block_to_server = true;
+		if (urgent && !q->urgent) {
+			q->urgent = true;
+			pushHeap(q);
+		}
+		return;
+	}
+
+	q = new QueuedMeshUpdate;
+	q->p = p;
+	q->data = data;
+	q->ack_block_to_server = ack_block_to_server;
+	q->urgent = urgent;
+	pushHeap(q);
+}
+
+QueuedMeshUpdate *MeshUpdateQueue::pop()
+{
+	MutexAutoLock lock(m_mutex);
+
+	while (!m_heap.empty()) {
+		std::pop_heap(m_heap.begin(), m_heap.end());
+		HeapEntry entry = m_heap.back();
+		m_heap.pop_back();
+
+		u64 key = blockKey(entry.p);
+		UNORDERED_MAP<u64, QueuedMeshUpdate *>::iterator it = m_queue.find(key);
+		if (it == m_queue.end() || it->second->seq != entry.seq)
+			continue;
+
+		// Queued again while being meshed; done() queues it up again
+		if (m_in_progress.find(key) != m_in_progress.end())
+			continue;
+
+		QueuedMeshUpdate *q = it->second;
+		m_queue.erase(it);
+		m_in_progress.insert(key);
+		return q;
+	}
+
+	return NULL;
+}
+
+void MeshUpdateQueue::done(v3s16 p)
+{
+	MutexAutoLock lock(m_mutex);
+
+	u64 key = blockKey(p);
+	m_in_progress.erase(key);
+
+	UNORDERED_MAP<u64, QueuedMeshUpdate *>::iterator it = m_queue.find(key);
+	if (it != m_queue.end())
+		pushHeap(it->second);
+}
+
+void MeshUpdateQueue::setCameraBlock(v3s16 blockpos)
+{
+	MutexAutoLock lock(m_mutex);
+
+	if (blockpos == m_camera_block)
+		return;
+
+	m_camera_block = blockpos;
+
+	m_heap.clear();
+	for (UNORDERED_MAP<u64, QueuedMeshUpdate *>::iterator
+			i = m_queue.begin(); i != m_queue.end(); ++i) {
+		QueuedMeshUpdate *q = i->second;
+		v3s16 d = q->p - m_camera_block;
+
+		HeapEntry entry;
+		entry.urgent = q->urgent;
+		entry.distance = d.X * d.X + d.Y * d.Y + d.Z * d.Z;
+		entry.seq = q->seq;
+		entry.p = q->p;
+		m_heap.push_back(entry);
+	}
+	std::make_heap(m_heap.begin(), m_heap.end());
+}
+
+void MeshUpdateQueue::pushHeap(QueuedMeshUpdate *q)
+{
+	v3s16 d = q->p - m_camera_block;
+
+	q->seq = m_next_seq++;
+
+	HeapEntry entry;
+	entry.urgent = q->urgent;
+	entry.distance = d.X * d.X + d.Y * d.Y + d.Z * d.Z;
+	entry.seq = q->seq;
+	entry.p = q->p;
+	m_heap.push_back(entry);
+	std::push_heap(m_heap.begin(), m_heap.end());
+}
+
+/*
+	MeshUpdateWorkerThread
+*/
+
+MeshUpdateWorkerThread::MeshUpdateWorkerThread(MeshUpdateManager *manager,
+		u16 id):
+	UpdateThread("Mesh" + itos(id)),
+	m_manager(manager)
+{
+}
+
+void MeshUpdateWorkerThread::doUpdate()
+{
+	QueuedMeshUpdate *q;
+	while ((q = m_manager->m_queue_in.pop())) {
+
+		ScopeProfiler sp(g_profiler, "Client: Mesh making");
+
+		MapBlockMeshCache *cache = m_manager->takeCache(q->p);
+		MapBlockMesh *mesh_new = new MapBlockMesh(q->data,
+			m_manager->m_camera_offset, cache);
+		m_manager->giveBackCache(q->p, cache);
+
+		MeshUpdateResult r;
+		r.p = q->p;
+		r.mesh = mesh_new;
+		r.ack_block_to_server = q->ack_block_to_server;
+
+		// Before done(), so a newer mesh of the block can't overtake it
+		m_manager->m_queue_out.push_back(r);
+		m_manager->m_queue_in.done(q->p);
+
+		delete q;
+
+		if (stopRequested())
+			break;
+	}
+}
+
+/*
+	MeshUpdateManager
+*/
+
+MeshUpdateManager::MeshUpdateManager(u16 num_threads):
+	m_camera_offset(0,0,0),
+	m_caches_used(0)
+{
+	if (num_threads == 0)
+		num_threads = g_settings->getU16("mesh_generation_threads");
+	if (num_threads == 0)
+		num_threads = MYMAX(Thread::getNumberOfProcessors(), 2) - 1;
+
+	for (u16 i = 0; i < num_threads; i++)
+		m_workers.push_back(new MeshUpdateWorkerThread(this, i));
+}
+
+MeshUpdateManager::~MeshUpdateManager()
+{
+	stop();
+	wait();
+	for (size_t i = 0; i < m_workers.size(); i++)
+		delete m_workers[i];
+
+	for (std::map<v3s16, CachedMesh>::iterator
+			i = m_caches.begin(); i != m_caches.end(); ++i)
+		delete i->second.cache;
+}
+
+void MeshUpdateManager::enqueueUpdate(v3s16 p, MeshMakeData *data,
+		bool ack_block_to_server, bool urgent)
+{
+	m_queue_in.addBlock(p, data, ack_block_to_server, urgent);
+
+	// Idle ones take it, the others find nothing left
+	for (size_t i = 0; i < m_workers.size(); i++)
+		m_workers[i]->deferUpdate();
+}
+
+void MeshUpdateManager::start()
+{
+	for (size_t i = 0; i < m_workers.size(); i++)
+		m_workers[i]->start();
+}
+
+void MeshUpdateManager::stop()
+{
+	for (size_t i = 0; i < m_workers.size(); i++)
+		m_workers[i]->stop();
+}
+
+void MeshUpdateManager::wait()
+{
+	for (size_t i = 0; i < m_workers.size(); i++)
+		m_workers[i]->wait();
+}
+
+bool MeshUpdateManager::isRunning()
+{
+	for (size_t i = 0; i < m_workers.size(); i++) {
+		if (m_workers[i]->isRunning())
+			return true;
+	}
+	return false;
+}
+
+MapBlockMeshCache *MeshUpdateManager::takeCache(v3s16 p)
+{
+	MutexAutoLock lock(m_caches_mutex);
+
+	std::map<v3s16, CachedMesh>::iterator it = m_caches.find(p);
+	if (it == m_caches.end())
+		return new MapBlockMeshCache;
+
+	MapBlockMeshCache *cache = it->second.cache;
+	m_caches.erase(it);
+	return cache;
+}
+
+void MeshUpdateManager::giveBackCache(v3s16 p, MapBlockMeshCache *cache)
+{
+	MutexAutoLock lock(m_caches_mutex);
+
+	CachedMesh &cached = m_caches[p];
+	cached.cache = cache;
+	cached.last_used = m_caches_used++;
+
+	if (m_caches.size() <= MESH_CACHE_MAX_BLOCKS)
+		return;
+
+	std::map<v3s16, CachedMesh>::iterator oldest = m_caches.begin();
+	for (std::map<v3s16, CachedMesh>::iterator
+			i = m_caches.begin(); i != m_caches.end(); ++i) {
+		if (i->second.last_used < oldest->second.last_used)
+			oldest = i;
+	}
+	delete oldest->second.cache;
+	m_caches.erase(oldest);
+}
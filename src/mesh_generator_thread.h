@@ -0,0 +1,199 @@
+/*
+Minetest
+Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef MESH_GENERATOR_THREAD_HEADER
+#define MESH_GENERATOR_THREAD_HEADER
+
+#include "irrlichttypes_bloated.h"
+#include "threading/mutex.h"
+#include "util/container.h"
+#include "util/cpp11_container.h"
+#include "util/thread.h"
+#include <map>
+#include <vector>
+
+struct MeshMakeData;
+class MapBlockMesh;
+struct MapBlockMeshCache;
+
+// The blocks meshed last whose faces are kept for their next meshes
+#define MESH_CACHE_MAX_BLOCKS 64
+
+struct QueuedMeshUpdate
+{
+	v3s16 p;
+	MeshMakeData *data;
+	bool ack_block_to_server;
+	bool urgent;
+	// Of the heap entry that is current
+	u32 seq;
+
+	QueuedMeshUpdate();
+	~QueuedMeshUpdate();
+};
+
+/*
+	A thread-safe queue of mesh update tasks.  Urgent ones are taken first,
+	then the ones closest to the camera.  A block is given to one thread at
+	a time, so the meshes of a block are finished in the order they were
+	queued.
+*/
+class MeshUpdateQueue
+{
+public:
+	MeshUpdateQueue();
+
+	~MeshUpdateQueue();
+
+	/*
+		If the block is queued already, its data is replaced
+	*/
+	void addBlock(v3s16 p, MeshMakeData *data,
+			bool ack_block_to_server, bool urgent);
+
+	// Returned pointer must be deleted, and done() called for its block
+	// Returns NULL if there is nothing to take
+	QueuedMeshUpdate *pop();
+
+	// The mesh of a block returned by pop() is finished
+	void done(v3s16 p);
+
+	// The queue is sorted by the distance to this block
+	void setCameraBlock(v3s16 blockpos);
+
+	u32 size()
+	{
+		MutexAutoLock lock(m_mutex);
+		return m_queue.size();
+	}
+
+private:
+	struct HeapEntry {
+		bool urgent;
+		u32 distance;
+		u32 seq;
+		v3s16 p;
+
+		// Less important ones compare smaller
+		bool operator < (const HeapEntry &other) const
+		{
+			if (urgent != other.urgent)
+				return other.urgent;
+			if (distance != other.distance)
+				return distance > other.distance;
+			return seq > other.seq;
+		}
+	};
+
+	static u64 blockKey(v3s16 p)
+	{
+		return ((u64)(u16)p.X << 32) | ((u64)(u16)p.Y << 16) | (u16)p.Z;
+	}
+
+	void pushHeap(QueuedMeshUpdate *q);
+
+	UNORDERED_MAP<u64, QueuedMeshUpdate *> m_queue;
+	// Blocks taken by pop() that are not done yet
+	UNORDERED_SET<u64> m_in_progress;
+	// Entries of blocks taken meanwhile or queued again are skipped
+	std::vector<HeapEntry> m_heap;
+	v3s16 m_camera_block;
+	u32 m_next_seq;
+	Mutex m_mutex;
+};
+
+struct MeshUpdateResult
+{
+	v3s16 p;
+	MapBlockMesh *mesh;
+	bool ack_block_to_server;
+
+	MeshUpdateResult():
+		p(-1338,-1338,-1338),
+		mesh(NULL),
+		ack_block_to_server(false)
+	{
+	}
+};
+
+class MeshUpdateManager;
+
+class MeshUpdateWorkerThread : public UpdateThread
+{
+public:
+	MeshUpdateWorkerThread(MeshUpdateManager *manager, u16 id);
+
+protected:
+	virtual void doUpdate();
+
+private:
+	MeshUpdateManager *m_manager;
+};
+
+/*
+	Builds the meshes of blocks on a pool of worker threads.
+	The results are taken from m_queue_out by the main thread.
+*/
+class MeshUpdateManager
+{
+public:
+	// 0 threads uses the mesh_generation_threads setting
+	MeshUpdateManager(u16 num_threads = 0);
+	~MeshUpdateManager();
+
+	void enqueueUpdate(v3s16 p, MeshMakeData *data,
+			bool ack_block_to_server, bool urgent);
+
+	void updateCameraBlock(v3s16 blockpos)
+	{ m_queue_in.setCameraBlock(blockpos); }
+
+	u16 getThreadCount() const { return m_workers.size(); }
+
+	void start();
+	void stop();
+	void wait();
+	bool isRunning();
+
+	MutexedQueue<MeshUpdateResult> m_queue_out;
+
+	v3s16 m_camera_offset;
+
+private:
+	friend class MeshUpdateWorkerThread;
+
+	struct CachedMesh {
+		MapBlockMeshCache *cache;
+		u32 last_used;
+	};
+
+	// The cache of the block, or a new one.  It is only used by the
+	// thread that meshes the block, until it is given back.
+	MapBlockMeshCache *takeCache(v3s16 p);
+	// Drops the least recently used ones beyond MESH_CACHE_MAX_BLOCKS
+	void giveBackCache(v3s16 p, MapBlockMeshCache *cache);
+
+	MeshUpdateQueue m_queue_in;
+	std::vector<MeshUpdateWorkerThread *> m_workers;
+
+	std::map<v3s16, CachedMesh> m_caches;
+	u32 m_caches_used;
+	Mutex m_caches_mutex;
+};
+
+#endif
@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "threading/mutex_auto_lock.h"
 #include "threading/semaphore.h"
 #include "clientmap.h"
+#include "mapblock_mesh.h"
 #include "settings.h"
 #include "nodedef.h"
 #include "porting.h"
@@ -602,8 +603,9 @@ void Mapper::updateActiveMarkers ()
 //// MinimapMapblock
 ////
 
-void MinimapMapblock::getMinimapNodes(VoxelManipulator *vmanip, v3s16 pos)
+void MinimapMapblock::getMinimapNodes(const MeshMakeData *mesh_data)
 {
+	v3s16 pos = mesh_data->m_blockpos * MAP_BLOCKSIZE;
 
 	for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
 	for (s16 z = 0; z < MAP_BLOCKSIZE; z++) {
@@ -613,7 +615,7 @@ void MinimapMapblock::getMinimapNodes(VoxelManipulator *vmanip, v3s16 pos)
 
 		for (s16 y = MAP_BLOCKSIZE -1; y >= 0; y--) {
 			v3s16 p(x, y, z);
-			MapNode n = vmanip->getNodeNoEx(pos + p);
+			MapNode n = mesh_data->getNodeRefUnsafe(pos + p);
 			if (!surface_found && n.getContent() != CONTENT_AIR) {
 				mmpixel->height = y;
 				mmpixel->id = n.getContent();
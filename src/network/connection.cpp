@@ -82,99 +82,103 @@ static u8 readChannel(u8 *packetdata)
 {
 	return readU8(&packetdata[6]);
 }
+static u16 readPeerId(const BufferedPacket &p)
+{
+	return p.getU16(4);
+}
+static u8 readChannel(const BufferedPacket &p)
+{
+	return p.getU8(6);
+}
+
+void BufferedPacket::copyTo(u8 *dst, u32 offset, u32 size) const
+{
+	u32 header_size = getHeaderSize();
+	if (offset < header_size) {
+		u32 from_header = MYMIN(size, header_size - offset);
+		memcpy(dst, &header[header_start + offset], from_header);
+		dst += from_header;
+		offset += from_header;
+		size -= from_header;
+	}
+	if (size != 0)
+		memcpy(dst, &payload[offset - header_size], size);
+}
 
-BufferedPacket makePacket(Address &address, u8 *data, u32 datasize,
+BufferedPacket makePacket(Address &address, const BufferedPacket &data,
 		u32 protocol_id, u16 sender_peer_id, u8 channel)
 {
-	u32 packet_size = datasize + BASE_HEADER_SIZE;
-	BufferedPacket p(packet_size);
+	BufferedPacket p = data;
 	p.address = address;
 
-	writeU32(&p.data[0], protocol_id);
-	writeU16(&p.data[4], sender_peer_id);
-	writeU8(&p.data[6], channel);
-
-	memcpy(&p.data[BASE_HEADER_SIZE], data, datasize);
+	u8 *header = p.prependHeader(BASE_HEADER_SIZE);
+	writeU32(&header[0], protocol_id);
+	writeU16(&header[4], sender_peer_id);
+	writeU8(&header[6], channel);
 
 	return p;
 }
 
-BufferedPacket makePacket(Address &address, SharedBuffer<u8> &data,
-		u32 protocol_id, u16 sender_peer_id, u8 channel)
+BufferedPacket makeOriginalPacket(
+		const BufferedPacket &data)
 {
-	return makePacket(address, *data, data.getSize(),
-			protocol_id, sender_peer_id, channel);
-}
-
-SharedBuffer<u8> makeOriginalPacket(
-		SharedBuffer<u8> data)
-{
-	u32 header_size = 1;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
-
-	writeU8(&(b[0]), TYPE_ORIGINAL);
-	if (data.getSize() > 0) {
-		memcpy(&(b[header_size]), *data, data.getSize());
-	}
-	return b;
+	BufferedPacket p = data;
+	writeU8(p.prependHeader(ORIGINAL_HEADER_SIZE), TYPE_ORIGINAL);
+	return p;
 }
 
-std::list<SharedBuffer<u8> > makeSplitPacket(
-		SharedBuffer<u8> data,
+std::list<BufferedPacket> makeSplitPacket(
+		const BufferedPacket &data,
 		u32 chunksize_max,
 		u16 seqnum)
 {
 	// Chunk packets, containing the TYPE_SPLIT header
-	std::list<SharedBuffer<u8> > chunks;
+	std::list<BufferedPacket> chunks;
 
-	u32 chunk_header_size = 7;
-	u32 maximum_data_size = chunksize_max - chunk_header_size;
+	u32 maximum_data_size = chunksize_max - SPLIT_HEADER_SIZE;
+	u32 data_size = data.getSize();
+	u32 prefix_size = data.getHeaderSize();
+	u16 chunk_count = (data_size + maximum_data_size - 1) / maximum_data_size;
 	u32 start = 0;
-	u32 end = 0;
-	u32 chunk_num = 0;
-	u16 chunk_count = 0;
-	do{
-		end = start + maximum_data_size - 1;
-		if (end > data.getSize() - 1)
-			end = data.getSize() - 1;
-
-		u32 payload_size = end - start + 1;
-		u32 packet_size = chunk_header_size + payload_size;
-
-		SharedBuffer<u8> chunk(packet_size);
-
-		writeU8(&chunk[0], TYPE_SPLIT);
-		writeU16(&chunk[1], seqnum);
-		// [3] u16 chunk_count is written at next stage
-		writeU16(&chunk[5], chunk_num);
-		memcpy(&chunk[chunk_header_size], &data[start], payload_size);
+	u16 chunk_num = 0;
+	do {
+		u32 end = MYMIN(start + maximum_data_size, data_size);
+
+		// The part of the chunk in the payload of data is shared, only the
+		// part in its headers is copied
+		u32 from_payload = end > prefix_size ?
+			end - MYMAX(start, prefix_size) : 0;
+		u32 from_header = end - start - from_payload;
+
+		BufferedPacket chunk;
+		if (from_payload != 0)
+			chunk.payload = data.payload.slice(
+				end - from_payload - prefix_size, from_payload);
+		data.copyTo(chunk.prependHeader(from_header), start, from_header);
+
+		u8 *header = chunk.prependHeader(SPLIT_HEADER_SIZE);
+		writeU8(&header[0], TYPE_SPLIT);
+		writeU16(&header[1], seqnum);
+		writeU16(&header[3], chunk_count);
+		writeU16(&header[5], chunk_num);
 
 		chunks.push_back(chunk);
-		chunk_count++;
 
-		start = end + 1;
+		start = end;
 		chunk_num++;
 	}
-	while(end != data.getSize() - 1);
-
-	for(std::list<SharedBuffer<u8> >::iterator i = chunks.begin();
-		i != chunks.end(); ++i)
-	{
-		// Write chunk_count
-		writeU16(&((*i)[3]), chunk_count);
-	}
+	while(start < data_size);
 
 	return chunks;
 }
 
-std::list<SharedBuffer<u8> > makeAutoSplitPacket(
-		SharedBuffer<u8> data,
+std::list<BufferedPacket> makeAutoSplitPacket(
+		const BufferedPacket &data,
 		u32 chunksize_max,
 		u16 &split_seqnum)
 {
 	u32 original_header_size = 1;
-	std::list<SharedBuffer<u8> > list;
+	std::list<BufferedPacket> list;
 	if (data.getSize() + original_header_size > chunksize_max)
 	{
 		list = makeSplitPacket(data, chunksize_max, split_seqnum);
@@ -188,20 +192,17 @@ std::list<SharedBuffer<u8> > makeAutoSplitPacket(
 	return list;
 }
 
-SharedBuffer<u8> makeReliablePacket(
-		SharedBuffer<u8> data,
+BufferedPacket makeReliablePacket(
+		const BufferedPacket &data,
 		u16 seqnum)
 {
-	u32 header_size = 3;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
+	BufferedPacket p = data;
 
-	writeU8(&b[0], TYPE_RELIABLE);
-	writeU16(&b[1], seqnum);
+	u8 *header = p.prependHeader(RELIABLE_HEADER_SIZE);
+	writeU8(&header[0], TYPE_RELIABLE);
+	writeU16(&header[1], seqnum);
 
-	memcpy(&b[header_size], *data, data.getSize());
-
-	return b;
+	return p;
 }
 
 /*
@@ -219,7 +220,7 @@ void ReliablePacketBuffer::print()
 		i != m_list.end();
 		++i)
 	{
-		u16 s = readU16(&(i->data[BASE_HEADER_SIZE+1]));
+		u16 s = i->getU16(BASE_HEADER_SIZE+1);
 		LOG(dout_con<<index<< ":" << s << std::endl);
 		index++;
 	}
@@ -245,7 +246,7 @@ RPBSearchResult ReliablePacketBuffer::findPacket(u16 seqnum)
 	std::list<BufferedPacket>::iterator i = m_list.begin();
 	for(; i != m_list.end(); ++i)
 	{
-		u16 s = readU16(&(i->data[BASE_HEADER_SIZE+1]));
+		u16 s = i->getU16(BASE_HEADER_SIZE+1);
 		/*dout_con<<"findPacket(): finding seqnum="<<seqnum
 				<<", comparing to s="<<s<<std::endl;*/
 		if (s == seqnum)
@@ -263,7 +264,7 @@ bool ReliablePacketBuffer::getFirstSeqnum(u16& result)
 	if (m_list.empty())
 		return false;
 	BufferedPacket p = *m_list.begin();
-	result = readU16(&p.data[BASE_HEADER_SIZE+1]);
+	result = p.getU16(BASE_HEADER_SIZE+1);
 	return true;
 }
 
@@ -280,7 +281,7 @@ BufferedPacket ReliablePacketBuffer::popFirst()
 		m_oldest_non_answered_ack = 0;
 	} else {
 		m_oldest_non_answered_ack =
-				readU16(&(*m_list.begin()).data[BASE_HEADER_SIZE+1]);
+				m_list.begin()->getU16(BASE_HEADER_SIZE+1);
 	}
 	return p;
 }
@@ -299,7 +300,7 @@ BufferedPacket ReliablePacketBuffer::popSeqnum(u16 seqnum)
 	RPBSearchResult next = r;
 	++next;
 	if (next != notFound()) {
-		u16 s = readU16(&(next->data[BASE_HEADER_SIZE+1]));
+		u16 s = next->getU16(BASE_HEADER_SIZE+1);
 		m_oldest_non_answered_ack = s;
 	}
 
@@ -309,24 +310,24 @@ BufferedPacket ReliablePacketBuffer::popSeqnum(u16 seqnum)
 	if (m_list_size == 0)
 	{ m_oldest_non_answered_ack = 0; }
 	else
-	{ m_oldest_non_answered_ack = readU16(&(*m_list.begin()).data[BASE_HEADER_SIZE+1]);	}
+	{ m_oldest_non_answered_ack = m_list.begin()->getU16(BASE_HEADER_SIZE+1);	}
 	return p;
 }
 void ReliablePacketBuffer::insert(BufferedPacket &p,u16 next_expected)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	if (p.data.getSize() < BASE_HEADER_SIZE + 3) {
+	if (p.getSize() < BASE_HEADER_SIZE + 3) {
 		errorstream << "ReliablePacketBuffer::insert(): Invalid data size for "
 			"reliable packet" << std::endl;
 		return;
 	}
-	u8 type = readU8(&p.data[BASE_HEADER_SIZE + 0]);
+	u8 type = p.getU8(BASE_HEADER_SIZE + 0);
 	if (type != TYPE_RELIABLE) {
 		errorstream << "ReliablePacketBuffer::insert(): type is not reliable"
 			<< std::endl;
 		return;
 	}
-	u16 seqnum = readU16(&p.data[BASE_HEADER_SIZE + 1]);
+	u16 seqnum = p.getU16(BASE_HEADER_SIZE + 1);
 
 	if (!seqnum_in_window(seqnum, next_expected, MAX_RELIABLE_WINDOW_SIZE)) {
 		errorstream << "ReliablePacketBuffer::insert(): seqnum is outside of "
@@ -355,7 +356,7 @@ void ReliablePacketBuffer::insert(BufferedPacket &p,u16 next_expected)
 	// Otherwise find the right place
 	std::list<BufferedPacket>::iterator i = m_list.begin();
 	// Find the first packet in the list which has a higher seqnum
-	u16 s = readU16(&(i->data[BASE_HEADER_SIZE+1]));
+	u16 s = i->getU16(BASE_HEADER_SIZE+1);
 
 	/* case seqnum is smaller then next_expected seqnum */
 	/* this is true e.g. on wrap around */
@@ -363,7 +364,7 @@ void ReliablePacketBuffer::insert(BufferedPacket &p,u16 next_expected)
 		while(((s < seqnum) || (s >= next_expected)) && (i != m_list.end())) {
 			++i;
 			if (i != m_list.end())
-				s = readU16(&(i->data[BASE_HEADER_SIZE+1]));
+				s = i->getU16(BASE_HEADER_SIZE+1);
 		}
 	}
 	/* non wrap around case (at least for incoming and next_expected */
@@ -372,14 +373,14 @@ void ReliablePacketBuffer::insert(BufferedPacket &p,u16 next_expected)
 		while(((s < seqnum) && (s >= next_expected)) && (i != m_list.end())) {
 			++i;
 			if (i != m_list.end())
-				s = readU16(&(i->data[BASE_HEADER_SIZE+1]));
+				s = i->getU16(BASE_HEADER_SIZE+1);
 		}
 	}
 
 	if (s == seqnum) {
 		if (
-			(readU16(&(i->data[BASE_HEADER_SIZE+1])) != seqnum) ||
-			(i->data.getSize() != p.data.getSize()) ||
+			(i->getU16(BASE_HEADER_SIZE+1) != seqnum) ||
+			(i->getSize() != p.getSize()) ||
 			(i->address != p.address)
 			)
 		{
@@ -388,10 +389,10 @@ void ReliablePacketBuffer::insert(BufferedPacket &p,u16 next_expected)
 					"Duplicated seqnum %d non matching packet detected:\n",
 					seqnum);
 			fprintf(stderr, "Old: seqnum: %05d size: %04d, address: %s\n",
-					readU16(&(i->data[BASE_HEADER_SIZE+1])),i->data.getSize(),
+					i->getU16(BASE_HEADER_SIZE+1),i->getSize(),
 					i->address.serializeString().c_str());
 			fprintf(stderr, "New: seqnum: %05d size: %04u, address: %s\n",
-					readU16(&(p.data[BASE_HEADER_SIZE+1])),p.data.getSize(),
+					p.getU16(BASE_HEADER_SIZE+1),p.getSize(),
 					p.address.serializeString().c_str());
 			throw IncomingDataCorruption("duplicated packet isn't same as original one");
 		}
@@ -409,7 +410,7 @@ void ReliablePacketBuffer::insert(BufferedPacket &p,u16 next_expected)
 	}
 
 	/* update last packet number */
-	m_oldest_non_answered_ack = readU16(&(*m_list.begin()).data[BASE_HEADER_SIZE+1]);
+	m_oldest_non_answered_ack = m_list.begin()->getU16(BASE_HEADER_SIZE+1);
 }
 
 void ReliablePacketBuffer::incrementTimeouts(float dtime)
@@ -463,15 +464,15 @@ IncomingSplitBuffer::~IncomingSplitBuffer()
 SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacket &p, bool reliable)
 {
 	MutexAutoLock listlock(m_map_mutex);
-	u32 headersize = BASE_HEADER_SIZE + 7;
-	if (p.data.getSize() < headersize) {
+	u32 headersize = BASE_HEADER_SIZE + SPLIT_HEADER_SIZE;
+	if (p.getSize() < headersize) {
 		errorstream << "Invalid data size for split packet" << std::endl;
 		return SharedBuffer<u8>();
 	}
-	u8 type = readU8(&p.data[BASE_HEADER_SIZE+0]);
-	u16 seqnum = readU16(&p.data[BASE_HEADER_SIZE+1]);
-	u16 chunk_count = readU16(&p.data[BASE_HEADER_SIZE+3]);
-	u16 chunk_num = readU16(&p.data[BASE_HEADER_SIZE+5]);
+	u8 type = p.getU8(BASE_HEADER_SIZE+0);
+	u16 seqnum = p.getU16(BASE_HEADER_SIZE+1);
+	u16 chunk_count = p.getU16(BASE_HEADER_SIZE+3);
+	u16 chunk_num = p.getU16(BASE_HEADER_SIZE+5);
 
 	if (type != TYPE_SPLIT) {
 		errorstream << "IncomingSplitBuffer::insert(): type is not split"
@@ -507,9 +508,9 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacket &p, bool reliable)
 		return SharedBuffer<u8>();
 
 	// Cut chunk data out of packet
-	u32 chunkdatasize = p.data.getSize() - headersize;
+	u32 chunkdatasize = p.getSize() - headersize;
 	SharedBuffer<u8> chunkdata(chunkdatasize);
-	memcpy(*chunkdata, &(p.data[headersize]), chunkdatasize);
+	p.copyTo(*chunkdata, headersize, chunkdatasize);
 
 	// Set chunk data in buffer
 	sp->chunks[chunk_num] = chunkdata;
@@ -1110,7 +1111,7 @@ bool UDPPeer::processReliableSendCommand(
 
 	sanity_check(c.data.getSize() < MAX_RELIABLE_WINDOW_SIZE*512);
 
-	std::list<SharedBuffer<u8> > originals;
+	std::list<BufferedPacket> originals;
 	u16 split_sequence_number = channels[c.channelnum].readNextSplitSeqNum();
 
 	if (c.raw)
@@ -1127,7 +1128,7 @@ bool UDPPeer::processReliableSendCommand(
 	std::queue<BufferedPacket> toadd;
 	volatile u16 initial_sequence_number = 0;
 
-	for(std::list<SharedBuffer<u8> >::iterator i = originals.begin();
+	for(std::list<BufferedPacket>::iterator i = originals.begin();
 		i != originals.end(); ++i)
 	{
 		u16 seqnum = channels[c.channelnum].getOutgoingSequenceNumber(have_sequence_number);
@@ -1142,7 +1143,7 @@ bool UDPPeer::processReliableSendCommand(
 			have_initial_sequence_number = true;
 		}
 
-		SharedBuffer<u8> reliable = makeReliablePacket(*i, seqnum);
+		BufferedPacket reliable = makeReliablePacket(*i, seqnum);
 
 		// Add base headers and make a packet
 		BufferedPacket p = con::makePacket(address, reliable,
@@ -1160,7 +1161,7 @@ bool UDPPeer::processReliableSendCommand(
 //			LOG(dout_con<<connection->getDesc()
 //					<< " queuing reliable packet for peer_id: " << c.peer_id
 //					<< " channel: " << (c.channelnum&0xFF)
-//					<< " seqnum: " << readU16(&p.data[BASE_HEADER_SIZE+1])
+//					<< " seqnum: " << p.getU16(BASE_HEADER_SIZE+1)
 //					<< std::endl)
 			channels[c.channelnum].queued_reliables.push(p);
 			pcount++;
@@ -1266,8 +1267,11 @@ ConnectionSendThread::ConnectionSendThread(unsigned int max_packet_size,
 	m_timeout(timeout),
 	m_max_commands_per_iteration(1),
 	m_max_data_packets_per_iteration(g_settings->getU16("max_packets_per_iteration")),
-	m_max_packets_requeued(256)
+	m_max_packets_requeued(256),
+	m_max_datagrams_per_syscall(MYMAX(1,
+		g_settings->getU16("max_datagrams_per_syscall")))
 {
+	m_send_batch.reserve(m_max_datagrams_per_syscall);
 }
 
 void * ConnectionSendThread::run()
@@ -1319,6 +1323,8 @@ void * ConnectionSendThread::run()
 		/* send non reliable packets */
 		sendPackets(dtime);
 
+		flushSendBatch();
+
 		END_DEBUG_EXCEPTION_HANDLER
 	}
 
@@ -1435,11 +1441,11 @@ void ConnectionSendThread::runTimeouts(float dtime)
 			for(std::list<BufferedPacket>::iterator k = timed_outs.begin();
 				k != timed_outs.end(); ++k)
 			{
-				u16 peer_id = readPeerId(*(k->data));
-				u8 channelnum  = readChannel(*(k->data));
-				u16 seqnum  = readU16(&(k->data[BASE_HEADER_SIZE+1]));
+				u16 peer_id = readPeerId(*k);
+				u8 channelnum  = readChannel(*k);
+				u16 seqnum  = k->getU16(BASE_HEADER_SIZE+1);
 
-				channel->UpdateBytesLost(k->data.getSize());
+				channel->UpdateBytesLost(k->getSize());
 				k->resend_count++;
 
 				if (k-> resend_count > MAX_RELIABLE_RETRY) {
@@ -1505,11 +1511,19 @@ void ConnectionSendThread::runTimeouts(float dtime)
 
 void ConnectionSendThread::rawSend(const BufferedPacket &packet)
 {
+	if (m_max_datagrams_per_syscall > 1) {
+		m_send_batch.push_back(packet);
+		if (m_send_batch.size() >= m_max_datagrams_per_syscall)
+			flushSendBatch();
+		return;
+	}
+
 	try{
-		m_connection->m_udpSocket.Send(packet.address, *packet.data,
-				packet.data.getSize());
+		m_connection->m_udpSocket.Send(packet.address,
+				packet.getHeader(), packet.getHeaderSize(),
+				*packet.payload, packet.payload.getSize());
 		LOG(dout_con <<m_connection->getDesc()
-				<< " rawSend: " << packet.data.getSize()
+				<< " rawSend: " << packet.getSize()
 				<< " bytes sent" << std::endl);
 	} catch(SendFailedException &e) {
 		LOG(derr_con<<m_connection->getDesc()
@@ -1518,6 +1532,36 @@ void ConnectionSendThread::rawSend(const BufferedPacket &packet)
 	}
 }
 
+void ConnectionSendThread::flushSendBatch()
+{
+	if (m_send_batch.empty())
+		return;
+
+	m_send_datagrams.resize(m_send_batch.size());
+	for (size_t i = 0; i < m_send_batch.size(); i++) {
+		const BufferedPacket &p = m_send_batch[i];
+		UDPDatagram &d = m_send_datagrams[i];
+		d.destination = p.address;
+		d.header = p.getHeader();
+		d.header_size = p.getHeaderSize();
+		d.data = *p.payload;
+		d.size = p.payload.getSize();
+	}
+
+	int sent = m_connection->m_udpSocket.Send(&m_send_datagrams[0],
+			m_send_datagrams.size());
+	LOG(dout_con<<m_connection->getDesc()
+			<<" flushSendBatch: " << sent << " packets sent" << std::endl);
+	if (sent != (int)m_send_batch.size()) {
+		LOG(derr_con<<m_connection->getDesc()
+				<<"Connection::flushSendBatch(): "
+				<< m_send_batch.size() - sent << " packets failed to send"
+				<<std::endl);
+	}
+
+	m_send_batch.clear();
+}
+
 void ConnectionSendThread::sendAsPacketReliable(BufferedPacket& p, Channel* channel)
 {
 	try{
@@ -1539,7 +1583,7 @@ void ConnectionSendThread::sendAsPacketReliable(BufferedPacket& p, Channel* chan
 }
 
 bool ConnectionSendThread::rawSendAsPacket(u16 peer_id, u8 channelnum,
-		SharedBuffer<u8> data, bool reliable)
+		const BufferedPacket &data, bool reliable)
 {
 	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
 	if (!peer) {
@@ -1560,7 +1604,7 @@ bool ConnectionSendThread::rawSendAsPacket(u16 peer_id, u8 channelnum,
 		if (!have_sequence_number_for_raw_packet)
 			return false;
 
-		SharedBuffer<u8> reliable = makeReliablePacket(data, seqnum);
+		BufferedPacket reliable = makeReliablePacket(data, seqnum);
 		Address peer_address;
 		peer->getAddress(MTP_MINETEST_RELIABLE_UDP, peer_address);
 
@@ -1810,7 +1854,7 @@ void ConnectionSendThread::disconnect_peer(u16 peer_id)
 }
 
 void ConnectionSendThread::send(u16 peer_id, u8 channelnum,
-		SharedBuffer<u8> data)
+		const BufferedPacket &data)
 {
 	assert(channelnum < CHANNEL_COUNT); // Pre-condition
 
@@ -1831,17 +1875,16 @@ void ConnectionSendThread::send(u16 peer_id, u8 channelnum,
 	u16 split_sequence_number = peer->getNextSplitSequenceNumber(channelnum);
 
 	u32 chunksize_max = m_max_packet_size - BASE_HEADER_SIZE;
-	std::list<SharedBuffer<u8> > originals;
+	std::list<BufferedPacket> originals;
 
 	originals = makeAutoSplitPacket(data, chunksize_max,split_sequence_number);
 
 	peer->setNextSplitSequenceNumber(channelnum,split_sequence_number);
 
-	for(std::list<SharedBuffer<u8> >::iterator i = originals.begin();
+	for(std::list<BufferedPacket>::iterator i = originals.begin();
 		i != originals.end(); ++i)
 	{
-		SharedBuffer<u8> original = *i;
-		sendAsPacket(peer_id, channelnum, original);
+		sendAsPacket(peer_id, channelnum, *i);
 	}
 }
 
@@ -1854,7 +1897,7 @@ void ConnectionSendThread::sendReliable(ConnectionCommand &c)
 	peer->PutReliableSendCommand(c,m_max_packet_size);
 }
 
-void ConnectionSendThread::sendToAll(u8 channelnum, SharedBuffer<u8> data)
+void ConnectionSendThread::sendToAll(u8 channelnum, const BufferedPacket &data)
 {
 	std::list<u16> peerids = m_connection->getPeerIDs();
 
@@ -1958,7 +2001,7 @@ void ConnectionSendThread::sendPackets(float dtime)
 				LOG(dout_con<<m_connection->getDesc()
 						<<" INFO: sending a queued reliable packet "
 						<<" channel: " << i
-						<<", seqnum: " << readU16(&p.data[BASE_HEADER_SIZE+1])
+						<<", seqnum: " << p.getU16(BASE_HEADER_SIZE+1)
 						<< std::endl);
 				sendAsPacketReliable(p,channel);
 				peer->m_increment_packets_remaining--;
@@ -2024,7 +2067,7 @@ void ConnectionSendThread::sendPackets(float dtime)
 }
 
 void ConnectionSendThread::sendAsPacket(u16 peer_id, u8 channelnum,
-		SharedBuffer<u8> data, bool ack)
+		const BufferedPacket &data, bool ack)
 {
 	OutgoingPacket packet(peer_id, channelnum, data, false, ack);
 	m_outgoing_queue.push(packet);
@@ -2032,7 +2075,9 @@ void ConnectionSendThread::sendAsPacket(u16 peer_id, u8 channelnum,
 
 ConnectionReceiveThread::ConnectionReceiveThread(unsigned int max_packet_size) :
 	Thread("ConnectionReceive"),
-	m_connection(NULL)
+	m_connection(NULL),
+	m_max_datagrams_per_syscall(MYMAX(1,
+		g_settings->getU16("max_datagrams_per_syscall")))
 {
 }
 
@@ -2131,7 +2176,9 @@ void ConnectionReceiveThread::receive()
 	// theoretical reliable upper boundary of a udp packet for all IPv6 enabled
 	// infrastructure
 	unsigned int packet_maxsize = 1500;
-	SharedBuffer<u8> packetdata(packet_maxsize);
+	m_recv_buffer.resize(packet_maxsize * m_max_datagrams_per_syscall);
+	m_recv_senders.resize(m_max_datagrams_per_syscall);
+	m_recv_sizes.resize(m_max_datagrams_per_syscall);
 
 	bool packet_queued = true;
 
@@ -2142,141 +2189,161 @@ void ConnectionReceiveThread::receive()
 	while( (loop_count < 10) &&
 			(m_connection->m_udpSocket.WaitData(50))) {
 		loop_count++;
-		try {
+		if (packet_queued) {
+			putEventsFromBuffers();
+			packet_queued = false;
+		}
+
+		int count = m_connection->m_udpSocket.Receive(&m_recv_senders[0],
+				&m_recv_buffer[0], packet_maxsize, &m_recv_sizes[0],
+				m_max_datagrams_per_syscall);
+
+		for (int i = 0; i < count; i++) {
 			if (packet_queued) {
-				bool data_left = true;
-				u16 peer_id;
-				SharedBuffer<u8> resultdata;
-				while(data_left) {
-					try {
-						data_left = getFromBuffers(peer_id, resultdata);
-						if (data_left) {
-							ConnectionEvent e;
-							e.dataReceived(peer_id, resultdata);
-							m_connection->putEvent(e);
-						}
-					}
-					catch(ProcessedSilentlyException &e) {
-						/* try reading again */
-					}
-				}
+				putEventsFromBuffers();
 				packet_queued = false;
 			}
+			packet_queued = receivePacket(m_recv_senders[i],
+					&m_recv_buffer[i * packet_maxsize], m_recv_sizes[i]);
+		}
+	}
+}
 
-			Address sender;
-			s32 received_size = m_connection->m_udpSocket.Receive(sender, *packetdata, packet_maxsize);
-
-			if ((received_size < BASE_HEADER_SIZE) ||
-				(readU32(&packetdata[0]) != m_connection->GetProtocolID()))
-			{
-				LOG(derr_con<<m_connection->getDesc()
-						<<"Receive(): Invalid incoming packet, "
-						<<"size: " << received_size
-						<<", protocol: "
-						<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
-						<< std::endl);
-				continue;
-			}
+bool ConnectionReceiveThread::receivePacket(Address &sender,
+		u8 *packetdata, s32 received_size)
+{
+	try {
+		if ((received_size < BASE_HEADER_SIZE) ||
+			(readU32(&packetdata[0]) != m_connection->GetProtocolID()))
+		{
+			LOG(derr_con<<m_connection->getDesc()
+					<<"Receive(): Invalid incoming packet, "
+					<<"size: " << received_size
+					<<", protocol: "
+					<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
+					<< std::endl);
+			return false;
+		}
 
-			u16 peer_id          = readPeerId(*packetdata);
-			u8 channelnum        = readChannel(*packetdata);
+		u16 peer_id          = readPeerId(packetdata);
+		u8 channelnum        = readChannel(packetdata);
 
-			if (channelnum > CHANNEL_COUNT-1) {
-				LOG(derr_con<<m_connection->getDesc()
-						<<"Receive(): Invalid channel "<<channelnum<<std::endl);
-				throw InvalidIncomingDataException("Channel doesn't exist");
-			}
+		if (channelnum > CHANNEL_COUNT-1) {
+			LOG(derr_con<<m_connection->getDesc()
+					<<"Receive(): Invalid channel "<<channelnum<<std::endl);
+			throw InvalidIncomingDataException("Channel doesn't exist");
+		}
 
-			/* Try to identify peer by sender address (may happen on join) */
-			if (peer_id == PEER_ID_INEXISTENT) {
-				peer_id = m_connection->lookupPeer(sender);
-				// We do not have to remind the peer of its
-				// peer id as the CONTROLTYPE_SET_PEER_ID
-				// command was sent reliably.
-			}
+		/* Try to identify peer by sender address (may happen on join) */
+		if (peer_id == PEER_ID_INEXISTENT) {
+			peer_id = m_connection->lookupPeer(sender);
+			// We do not have to remind the peer of its
+			// peer id as the CONTROLTYPE_SET_PEER_ID
+			// command was sent reliably.
+		}
 
-			/* The peer was not found in our lists. Add it. */
-			if (peer_id == PEER_ID_INEXISTENT) {
-				peer_id = m_connection->createPeer(sender, MTP_MINETEST_RELIABLE_UDP, 0);
-			}
+		/* The peer was not found in our lists. Add it. */
+		if (peer_id == PEER_ID_INEXISTENT) {
+			peer_id = m_connection->createPeer(sender, MTP_MINETEST_RELIABLE_UDP, 0);
+		}
 
-			PeerHelper peer = m_connection->getPeerNoEx(peer_id);
+		PeerHelper peer = m_connection->getPeerNoEx(peer_id);
 
-			if (!peer) {
-				LOG(dout_con<<m_connection->getDesc()
-						<<" got packet from unknown peer_id: "
-						<<peer_id<<" Ignoring."<<std::endl);
-				continue;
-			}
+		if (!peer) {
+			LOG(dout_con<<m_connection->getDesc()
+					<<" got packet from unknown peer_id: "
+					<<peer_id<<" Ignoring."<<std::endl);
+			return false;
+		}
 
-			// Validate peer address
+		// Validate peer address
 
-			Address peer_address;
+		Address peer_address;
 
-			if (peer->getAddress(MTP_UDP, peer_address)) {
-				if (peer_address != sender) {
-					LOG(derr_con<<m_connection->getDesc()
-							<<m_connection->getDesc()
-							<<" Peer "<<peer_id<<" sending from different address."
-							" Ignoring."<<std::endl);
-					continue;
-				}
+		if (peer->getAddress(MTP_UDP, peer_address)) {
+			if (peer_address != sender) {
+				LOG(derr_con<<m_connection->getDesc()
+						<<m_connection->getDesc()
+						<<" Peer "<<peer_id<<" sending from different address."
+						" Ignoring."<<std::endl);
+				return false;
 			}
-			else {
-
-				bool invalid_address = true;
-				if (invalid_address) {
-					LOG(derr_con<<m_connection->getDesc()
-							<<m_connection->getDesc()
-							<<" Peer "<<peer_id<<" unknown."
-							" Ignoring."<<std::endl);
-					continue;
-				}
+		}
+		else {
+
+			bool invalid_address = true;
+			if (invalid_address) {
+				LOG(derr_con<<m_connection->getDesc()
+						<<m_connection->getDesc()
+						<<" Peer "<<peer_id<<" unknown."
+						" Ignoring."<<std::endl);
+				return false;
 			}
+		}
 
-			peer->ResetTimeout();
+		peer->ResetTimeout();
 
-			Channel *channel = 0;
+		Channel *channel = 0;
 
-			if (dynamic_cast<UDPPeer*>(&peer) != 0)
-			{
-				channel = &(dynamic_cast<UDPPeer*>(&peer)->channels[channelnum]);
-			}
+		if (dynamic_cast<UDPPeer*>(&peer) != 0)
+		{
+			channel = &(dynamic_cast<UDPPeer*>(&peer)->channels[channelnum]);
+		}
 
-			if (channel != 0) {
-				channel->UpdateBytesReceived(received_size);
-			}
+		if (channel != 0) {
+			channel->UpdateBytesReceived(received_size);
+		}
 
-			// Throw the received packet to channel->processPacket()
+		// Throw the received packet to channel->processPacket()
 
-			// Make a new SharedBuffer from the data without the base headers
-			SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
-			memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
-					strippeddata.getSize());
+		// Make a new SharedBuffer from the data without the base headers
+		SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
+		memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
+				strippeddata.getSize());
 
-			try{
-				// Process it (the result is some data with no headers made by us)
-				SharedBuffer<u8> resultdata = processPacket
-						(channel, strippeddata, peer_id, channelnum, false);
+		try{
+			// Process it (the result is some data with no headers made by us)
+			SharedBuffer<u8> resultdata = processPacket
+					(channel, strippeddata, peer_id, channelnum, false);
 
-				LOG(dout_con<<m_connection->getDesc()
-						<<" ProcessPacket from peer_id: " << peer_id
-						<< ",channel: " << (channelnum & 0xFF) << ", returned "
-						<< resultdata.getSize() << " bytes" <<std::endl);
+			LOG(dout_con<<m_connection->getDesc()
+					<<" ProcessPacket from peer_id: " << peer_id
+					<< ",channel: " << (channelnum & 0xFF) << ", returned "
+					<< resultdata.getSize() << " bytes" <<std::endl);
 
+			ConnectionEvent e;
+			e.dataReceived(peer_id, resultdata);
+			m_connection->putEvent(e);
+		}
+		catch(ProcessedSilentlyException &e) {
+		}
+		catch(ProcessedQueued &e) {
+			return true;
+		}
+	}
+	catch(InvalidIncomingDataException &e) {
+	}
+	catch(ProcessedSilentlyException &e) {
+	}
+	return false;
+}
+
+void ConnectionReceiveThread::putEventsFromBuffers()
+{
+	bool data_left = true;
+	u16 peer_id;
+	SharedBuffer<u8> resultdata;
+	while(data_left) {
+		try {
+			data_left = getFromBuffers(peer_id, resultdata);
+			if (data_left) {
 				ConnectionEvent e;
 				e.dataReceived(peer_id, resultdata);
 				m_connection->putEvent(e);
 			}
-			catch(ProcessedSilentlyException &e) {
-			}
-			catch(ProcessedQueued &e) {
-				packet_queued = true;
-			}
-		}
-		catch(InvalidIncomingDataException &e) {
 		}
 		catch(ProcessedSilentlyException &e) {
+			/* try reading again */
 		}
 	}
 }
@@ -2316,9 +2383,9 @@ bool ConnectionReceiveThread::checkIncomingBuffers(Channel *channel,
 		if (firstseqnum == channel->readNextIncomingSeqNum())
 		{
 			BufferedPacket p = channel->incoming_reliables.popFirst();
-			peer_id = readPeerId(*p.data);
-			u8 channelnum = readChannel(*p.data);
-			u16 seqnum = readU16(&p.data[BASE_HEADER_SIZE+1]);
+			peer_id = readPeerId(p);
+			u8 channelnum = readChannel(p);
+			u16 seqnum = p.getU16(BASE_HEADER_SIZE+1);
 
 			LOG(dout_con<<m_connection->getDesc()
 					<<"UNBUFFERING TYPE_RELIABLE"
@@ -2331,8 +2398,8 @@ bool ConnectionReceiveThread::checkIncomingBuffers(Channel *channel,
 
 			u32 headers_size = BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE;
 			// Get out the inside packet and re-process it
-			SharedBuffer<u8> payload(p.data.getSize() - headers_size);
-			memcpy(*payload, &p.data[headers_size], payload.getSize());
+			SharedBuffer<u8> payload(p.getSize() - headers_size);
+			p.copyTo(*payload, headers_size, payload.getSize());
 
 			dst = processPacket(channel, payload, peer_id, channelnum, true);
 			return true;
@@ -2413,7 +2480,7 @@ SharedBuffer<u8> ConnectionReceiveThread::processPacket(Channel *channel,
 					}
 				}
 				//put bytes for max bandwidth calculation
-				channel->UpdateBytesSent(p.data.getSize(),1);
+				channel->UpdateBytesSent(p.getSize(),1);
 				if (channel->outgoing_reliables_sent.size() == 0)
 				{
 					m_connection->TriggerSend();
@@ -162,52 +162,6 @@ inline bool seqnum_in_window(u16 seqnum, u16 next,u16 window_size)
 	}
 }
 
-struct BufferedPacket
-{
-	BufferedPacket(u8 *a_data, u32 a_size):
-		data(a_data, a_size), time(0.0), totaltime(0.0), absolute_send_time(-1),
-		resend_count(0)
-	{}
-	BufferedPacket(u32 a_size):
-		data(a_size), time(0.0), totaltime(0.0), absolute_send_time(-1),
-		resend_count(0)
-	{}
-	Buffer<u8> data; // Data of the packet, including headers
-	float time; // Seconds from buffering the packet or re-sending
-	float totaltime; // Seconds from buffering the packet
-	unsigned int absolute_send_time;
-	Address address; // Sender or destination
-	unsigned int resend_count;
-};
-
-// This adds the base headers to the data and makes a packet out of it
-BufferedPacket makePacket(Address &address, u8 *data, u32 datasize,
-		u32 protocol_id, u16 sender_peer_id, u8 channel);
-BufferedPacket makePacket(Address &address, SharedBuffer<u8> &data,
-		u32 protocol_id, u16 sender_peer_id, u8 channel);
-
-// Add the TYPE_ORIGINAL header to the data
-SharedBuffer<u8> makeOriginalPacket(
-		SharedBuffer<u8> data);
-
-// Split data in chunks and add TYPE_SPLIT headers to them
-std::list<SharedBuffer<u8> > makeSplitPacket(
-		SharedBuffer<u8> data,
-		u32 chunksize_max,
-		u16 seqnum);
-
-// Depending on size, make a TYPE_ORIGINAL or TYPE_SPLIT packet
-// Increments split_seqnum if a split packet is made
-std::list<SharedBuffer<u8> > makeAutoSplitPacket(
-		SharedBuffer<u8> data,
-		u32 chunksize_max,
-		u16 &split_seqnum);
-
-// Add the TYPE_RELIABLE header to the data
-SharedBuffer<u8> makeReliablePacket(
-		SharedBuffer<u8> data,
-		u16 seqnum);
-
 struct IncomingSplitPacket
 {
 	IncomingSplitPacket()
@@ -297,6 +251,7 @@ data.
 	[5] u16 chunk_num
 */
 #define TYPE_SPLIT 2
+#define SPLIT_HEADER_SIZE 7
 /*
 RELIABLE: Delivery of all RELIABLE packets shall be forced by ACKs,
 and they shall be delivered in the same order as sent. This is done
@@ -312,6 +267,102 @@ with a buffer in the receiving and transmitting end.
 #define RELIABLE_HEADER_SIZE 3
 #define SEQNUM_INITIAL 65500
 
+/*
+	Room for headers in front of the payload of a BufferedPacket: the base,
+	reliable and split headers, and the start of a NetworkPacket
+*/
+#define PACKET_HEADER_ROOM (BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE + \
+		SPLIT_HEADER_SIZE + NETWORKPACKET_MAX_SEND_PREFIX)
+
+/*
+	A packet, or the data a packet is made of.
+
+	The headers are kept apart from the payload. Headers are added in front
+	of the packet as it is made, while the payload is shared by all packets
+	made of the same data and handed to the socket as it is.
+*/
+struct BufferedPacket
+{
+	BufferedPacket():
+		header_start(PACKET_HEADER_ROOM), time(0.0), totaltime(0.0),
+		absolute_send_time(-1), resend_count(0)
+	{}
+	// Copies the data
+	BufferedPacket(const u8 *a_data, u32 a_size):
+		header_start(PACKET_HEADER_ROOM), payload(a_data, a_size), time(0.0),
+		totaltime(0.0), absolute_send_time(-1), resend_count(0)
+	{}
+	BufferedPacket(const SharedBuffer<u8> &a_data):
+		header_start(PACKET_HEADER_ROOM), payload(*a_data, a_data.getSize()),
+		time(0.0), totaltime(0.0), absolute_send_time(-1), resend_count(0)
+	{}
+	BufferedPacket(const SharedSlice<u8> &a_payload):
+		header_start(PACKET_HEADER_ROOM), payload(a_payload), time(0.0),
+		totaltime(0.0), absolute_send_time(-1), resend_count(0)
+	{}
+
+	// Makes room for size bytes of headers in front of the packet, and
+	// returns where to write them
+	u8 *prependHeader(u32 size)
+	{
+		FATAL_ERROR_IF(size > header_start, "Out of packet header room");
+		header_start -= size;
+		return &header[header_start];
+	}
+	const u8 *getHeader() const { return &header[header_start]; }
+	u32 getHeaderSize() const { return PACKET_HEADER_ROOM - header_start; }
+	u32 getSize() const { return getHeaderSize() + payload.getSize(); }
+
+	// These read the packet as one piece, headers and payload
+	u8 getU8(u32 offset) const
+	{
+		u32 header_size = getHeaderSize();
+		if (offset < header_size)
+			return header[header_start + offset];
+		return payload[offset - header_size];
+	}
+	u16 getU16(u32 offset) const
+	{
+		return ((u16)getU8(offset) << 8) | getU8(offset + 1);
+	}
+	void copyTo(u8 *dst, u32 offset, u32 size) const;
+
+	u8 header[PACKET_HEADER_ROOM];
+	u32 header_start; // The headers are header[header_start...]
+	SharedSlice<u8> payload;
+	float time; // Seconds from buffering the packet or re-sending
+	float totaltime; // Seconds from buffering the packet
+	unsigned int absolute_send_time;
+	Address address; // Sender or destination
+	unsigned int resend_count;
+};
+
+// This adds the base headers to the data and makes a packet out of it
+BufferedPacket makePacket(Address &address, const BufferedPacket &data,
+		u32 protocol_id, u16 sender_peer_id, u8 channel);
+
+// Add the TYPE_ORIGINAL header to the data
+BufferedPacket makeOriginalPacket(
+		const BufferedPacket &data);
+
+// Split data in chunks and add TYPE_SPLIT headers to them
+std::list<BufferedPacket> makeSplitPacket(
+		const BufferedPacket &data,
+		u32 chunksize_max,
+		u16 seqnum);
+
+// Depending on size, make a TYPE_ORIGINAL or TYPE_SPLIT packet
+// Increments split_seqnum if a split packet is made
+std::list<BufferedPacket> makeAutoSplitPacket(
+		const BufferedPacket &data,
+		u32 chunksize_max,
+		u16 &split_seqnum);
+
+// Add the TYPE_RELIABLE header to the data
+BufferedPacket makeReliablePacket(
+		const BufferedPacket &data,
+		u16 seqnum);
+
 /*
 	A buffer which stores reliable packets and sorts them internally
 	for fast access to the smallest one.
@@ -379,11 +430,11 @@ struct OutgoingPacket
 {
 	u16 peer_id;
 	u8 channelnum;
-	SharedBuffer<u8> data;
+	BufferedPacket data;
 	bool reliable;
 	bool ack;
 
-	OutgoingPacket(u16 peer_id_, u8 channelnum_, SharedBuffer<u8> data_,
+	OutgoingPacket(u16 peer_id_, u8 channelnum_, const BufferedPacket &data_,
 			bool reliable_,bool ack_=false):
 		peer_id(peer_id_),
 		channelnum(channelnum_),
@@ -413,7 +464,7 @@ struct ConnectionCommand
 	Address address;
 	u16 peer_id;
 	u8 channelnum;
-	Buffer<u8> data;
+	BufferedPacket data;
 	bool reliable;
 	bool raw;
 
@@ -444,7 +495,11 @@ struct ConnectionCommand
 		type = CONNCMD_SEND;
 		peer_id = peer_id_;
 		channelnum = channelnum_;
-		data = pkt->oldForgePacket();
+		// The data of pkt is shared, only the start of it is copied
+		u8 prefix[NETWORKPACKET_MAX_SEND_PREFIX];
+		u32 prefix_size = pkt->getSendPrefix(prefix);
+		data = BufferedPacket(pkt->getSendData());
+		memcpy(data.prependHeader(prefix_size), prefix, prefix_size);
 		reliable = reliable_;
 	}
 
@@ -920,9 +975,11 @@ class ConnectionSendThread : public Thread {
 
 private:
 	void runTimeouts    (float dtime);
+	// Sends the packet, or adds it to the batch if batching is enabled
 	void rawSend        (const BufferedPacket &packet);
+	void flushSendBatch ();
 	bool rawSendAsPacket(u16 peer_id, u8 channelnum,
-							SharedBuffer<u8> data, bool reliable);
+							const BufferedPacket &data, bool reliable);
 
 	void processReliableCommand (ConnectionCommand &c);
 	void processNonReliableCommand (ConnectionCommand &c);
@@ -931,16 +988,16 @@ class ConnectionSendThread : public Thread {
 	void disconnect     ();
 	void disconnect_peer(u16 peer_id);
 	void send           (u16 peer_id, u8 channelnum,
-							SharedBuffer<u8> data);
+							const BufferedPacket &data);
 	void sendReliable   (ConnectionCommand &c);
 	void sendToAll      (u8 channelnum,
-							SharedBuffer<u8> data);
+							const BufferedPacket &data);
 	void sendToAllReliable(ConnectionCommand &c);
 
 	void sendPackets    (float dtime);
 
 	void sendAsPacket   (u16 peer_id, u8 channelnum,
-							SharedBuffer<u8> data,bool ack=false);
+							const BufferedPacket &data,bool ack=false);
 
 	void sendAsPacketReliable(BufferedPacket& p, Channel* channel);
 
@@ -956,6 +1013,11 @@ class ConnectionSendThread : public Thread {
 	unsigned int          m_max_commands_per_iteration;
 	unsigned int          m_max_data_packets_per_iteration;
 	unsigned int          m_max_packets_requeued;
+
+	// Packets passed to rawSend() that haven't been sent yet
+	unsigned int          m_max_datagrams_per_syscall;
+	std::vector<BufferedPacket> m_send_batch;
+	std::vector<UDPDatagram> m_send_datagrams;
 };
 
 class ConnectionReceiveThread : public Thread {
@@ -972,6 +1034,14 @@ class ConnectionReceiveThread : public Thread {
 private:
 	void receive();
 
+	// Handles a packet read from the socket. Returns true if it was put
+	// into a buffer, so that getFromBuffers() may return something new.
+	bool receivePacket(Address &sender, u8 *packetdata,
+			s32 received_size);
+
+	// Turns everything getFromBuffers() returns into events
+	void putEventsFromBuffers();
+
 	// Returns next data from a buffer if possible
 	// If found, returns true; if not, false.
 	// If found, sets peer_id and dst
@@ -994,6 +1064,12 @@ class ConnectionReceiveThread : public Thread {
 
 
 	Connection*           m_connection;
+
+	// Datagrams read by one Receive() call
+	unsigned int          m_max_datagrams_per_syscall;
+	std::vector<u8>       m_recv_buffer;
+	std::vector<Address>  m_recv_senders;
+	std::vector<int>      m_recv_sizes;
 };
 
 class Connection
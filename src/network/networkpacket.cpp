@@ -76,6 +76,7 @@ void NetworkPacket::putRawString(const char* src, u32 len)
 		m_datasize = m_read_offset + len;
 		m_data.resize(m_datasize);
 	}
+	m_send_data = SharedSlice<u8>();
 
 	if (len == 0)
 		return;
@@ -84,6 +85,13 @@ void NetworkPacket::putRawString(const char* src, u32 len)
 	m_read_offset += len;
 }
 
+void NetworkPacket::putSharedData(const SharedSlice<u8> &data)
+{
+	assert(m_shared_data.getSize() == 0);
+	m_shared_data = data;
+	m_send_data = SharedSlice<u8>();
+}
+
 NetworkPacket& NetworkPacket::operator>>(std::string& dst)
 {
 	checkReadOffset(m_read_offset, 2);
@@ -512,12 +520,41 @@ NetworkPacket& NetworkPacket::operator<<(video::SColor src)
 
 Buffer<u8> NetworkPacket::oldForgePacket()
 {
-	Buffer<u8> sb(m_datasize + 2);
+	Buffer<u8> sb(m_datasize + m_shared_data.getSize() + 2);
 	writeU16(&sb[0], m_command);
 
 	u8* datas = getU8Ptr(0);
 
 	if (datas != NULL)
 		memcpy(&sb[2], datas, m_datasize);
+	if (m_shared_data.getSize() != 0)
+		memcpy(&sb[2 + m_datasize], *m_shared_data, m_shared_data.getSize());
 	return sb;
 }
+
+u32 NetworkPacket::getSendPrefix(u8 *dst)
+{
+	writeU16(&dst[0], m_command);
+	if (!isSmall())
+		return 2;
+
+	if (m_datasize != 0)
+		memcpy(&dst[2], &m_data[0], m_datasize);
+	return 2 + m_datasize;
+}
+
+SharedSlice<u8> NetworkPacket::getSendData()
+{
+	if (isSmall())
+		return m_shared_data;
+
+	if (m_send_data.getSize() == 0) {
+		std::vector<u8> data;
+		data.reserve(m_datasize + m_shared_data.getSize());
+		data.insert(data.end(), m_data.begin(), m_data.begin() + m_datasize);
+		data.insert(data.end(), *m_shared_data,
+			*m_shared_data + m_shared_data.getSize());
+		m_send_data = SharedSlice<u8>(data);
+	}
+	return m_send_data;
+}
@@ -24,6 +24,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/numeric.h"
 #include "networkprotocol.h"
 
+// Most bytes NetworkPacket::getSendPrefix() writes
+#define NETWORKPACKET_MAX_SEND_PREFIX 16
+
 class NetworkPacket
 {
 
@@ -46,6 +49,9 @@ class NetworkPacket
 		char* getString(u32 from_offset);
 		// major difference to putCString(): doesn't write len into the buffer
 		void putRawString(const char* src, u32 len);
+		// Appends data without copying it. It is sent with the packet but
+		// can't be read through it, and nothing can be put after it.
+		void putSharedData(const SharedSlice<u8> &data);
 
 		NetworkPacket& operator>>(std::string& dst);
 		NetworkPacket& operator<<(std::string src);
@@ -110,6 +116,15 @@ class NetworkPacket
 
 		// Temp, we remove SharedBuffer when migration finished
 		Buffer<u8> oldForgePacket();
+
+		/*
+			For sending: the command and data of the packet are the bytes
+			written by getSendPrefix(), followed by getSendData().
+			Small packets and shared data aren't copied, the rest of large
+			packets is copied once and shared by all sends of the packet.
+		*/
+		u32 getSendPrefix(u8 *dst);
+		SharedSlice<u8> getSendData();
 private:
 		void checkReadOffset(u32 from_offset, u32 field_size);
 
@@ -119,9 +134,16 @@ class NetworkPacket
 				m_datasize = m_read_offset + field_size;
 				m_data.resize(m_datasize);
 			}
+			m_send_data = SharedSlice<u8>();
 		}
 
+		// Whether getSendPrefix() holds all of m_data
+		bool isSmall() { return 2 + m_datasize <= NETWORKPACKET_MAX_SEND_PREFIX; }
+
 		std::vector<u8> m_data;
+		SharedSlice<u8> m_shared_data;
+		// Copy of the packet made by getSendData()
+		SharedSlice<u8> m_send_data;
 		u32 m_datasize;
 		u32 m_read_offset;
 		u16 m_command;
@@ -138,9 +138,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 		Add nodedef v3 - connected nodeboxes
 	PROTOCOL_VERSION 28:
 		CPT2_MESHOPTIONS
+	PROTOCOL_VERSION 29:
+		Add GENERIC_CMD_UPDATE_POSITION_KEYFRAME and
+		GENERIC_CMD_UPDATE_POSITION_DELTA, sent instead of
+		GENERIC_CMD_UPDATE_POSITION
 */
 
-#define LATEST_PROTOCOL_VERSION 28
+#define LATEST_PROTOCOL_VERSION 29
 
 // Server's supported network protocol range
 #define SERVER_PROTOCOL_VERSION_MIN 13
@@ -171,7 +175,7 @@ enum ToClientCommand
 		Sent after TOSERVER_INIT.
 
 		u8 deployed serialisation version
-		u16 deployed network compression mode
+		u16 deployed network compression mode (NetProtoCompressionMode flags)
 		u16 deployed protocol version
 		u32 supported auth methods
 		std::string username that should be used for legacy hash (for proper casing)
@@ -613,7 +617,7 @@ enum ToServerCommand
 		Sent first after connected.
 
 		u8 serialisation version (=SER_FMT_VER_HIGHEST_READ)
-		u16 supported network compression modes
+		u16 supported network compression modes (NetProtoCompressionMode flags)
 		u16 minimum supported network protocol version
 		u16 maximum supported network protocol version
 		std::string player name
@@ -910,6 +914,10 @@ enum AccessDeniedCode {
 
 enum NetProtoCompressionMode {
 	NETPROTO_COMPRESSION_NONE = 0,
+	// Map blocks compressed with these codecs can be read, the bits are
+	// 1 << CompressionCodec. Without them blocks are sent with zlib.
+	NETPROTO_COMPRESSION_BLOCK_LZ4 = 1 << 1,
+	NETPROTO_COMPRESSION_BLOCK_ZSTD = 1 << 2,
 };
 
 const static std::string accessDeniedStrings[SERVER_ACCESSDENIED_MAX] = {
@@ -278,7 +278,8 @@ void Server::handleCommand_Init(NetworkPacket* pkt)
 	NetworkPacket resp_pkt(TOCLIENT_HELLO, 1 + 4
 		+ legacyPlayerNameCasing.size(), pkt->getPeerId());
 
-	u16 depl_compress_mode = NETPROTO_COMPRESSION_NONE;
+	// Codecs that both sides can compress map blocks with
+	u16 depl_compress_mode = supp_compr_modes & getSupportedCompressionCodecs();
 	resp_pkt << depl_serial_v << depl_compress_mode << net_proto_version
 		<< auth_mechs << legacyPlayerNameCasing;
 
@@ -32,20 +32,18 @@
 #include "util/string.h"
 #include "exceptions.h"
 
+// SSE2 and AVX2 kernels, picked at runtime
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || \
+		__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+	#define NOISE_X86_KERNELS
+	#include <immintrin.h>
+#endif
+
 #define NOISE_MAGIC_X    1619
 #define NOISE_MAGIC_Y    31337
 #define NOISE_MAGIC_Z    52591
 #define NOISE_MAGIC_SEED 1013
 
-typedef float (*Interp2dFxn)(
-		float v00, float v10, float v01, float v11,
-		float x, float y);
-
-typedef float (*Interp3dFxn)(
-		float v000, float v100, float v010, float v110,
-		float v001, float v101, float v011, float v111,
-		float x, float y, float z);
-
 float cos_lookup[16] = {
 	1.0,  0.9238,  0.7071,  0.3826, 0, -0.3826, -0.7071, -0.9238,
 	1.0, -0.9238, -0.7071, -0.3826, 0,  0.3826,  0.7071,  0.9238
@@ -165,23 +163,26 @@ s32 PcgRandom::randNormalDist(s32 min, s32 max, int num_trials)
 
 ///////////////////////////////////////////////////////////////////////////////
 
-float noise2d(int x, int y, s32 seed)
+static inline float noise_hash(u32 n)
 {
-	unsigned int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
+	n &= 0x7fffffff;
 	n = (n >> 13) ^ n;
 	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
 	return 1.f - (float)(int)n / 0x40000000;
 }
 
 
+float noise2d(int x, int y, s32 seed)
+{
+	return noise_hash(NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y
+			+ NOISE_MAGIC_SEED * seed);
+}
+
+
 float noise3d(int x, int y, int z, s32 seed)
 {
-	unsigned int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y + NOISE_MAGIC_Z * z
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
-	n = (n >> 13) ^ n;
-	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
-	return 1.f - (float)(int)n / 0x40000000;
+	return noise_hash(NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y + NOISE_MAGIC_Z * z
+			+ NOISE_MAGIC_SEED * seed);
 }
 
 
@@ -425,6 +426,307 @@ float NoisePerlin3D(NoiseParams *np, float x, float y, float z, s32 seed)
 }
 
 
+///////////////////////// [ Noise map kernels ] ////////////////////////////
+
+/*
+	The noise maps are computed in rows along x by these kernels:
+	- lattice:  count lattice points, the first one with the hash input n0
+	- interpX:  a lattice row interpolated at the cells and weights of the
+	            samples along x
+	- lerp2D:   two rows of those interpolated along y
+	- lerp3D:   four of them interpolated along y and z
+	The SIMD ones do the same operations in the same order as the scalar
+	ones, so they only differ where -ffast-math lets the compiler reorder.
+*/
+struct NoiseKernels {
+	void (*lattice)(float *out, u32 count, u32 n0);
+	void (*interpX)(float *out, const float *row,
+		const u32 *cell, const float *weight, u32 count);
+	void (*lerp2D)(float *out, const float *a, const float *b,
+		float t, u32 count);
+	void (*lerp3D)(float *out, const float *a, const float *b,
+		const float *c, const float *d, float ty, float tz, u32 count);
+};
+
+
+static void lattice_scalar(float *out, u32 count, u32 n0)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = noise_hash(n0 + NOISE_MAGIC_X * i);
+}
+
+
+static void interp_x_scalar(float *out, const float *row,
+	const u32 *cell, const float *weight, u32 count)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = linearInterpolation(row[cell[i]], row[cell[i] + 1], weight[i]);
+}
+
+
+static void lerp_2d_scalar(float *out, const float *a, const float *b,
+	float t, u32 count)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = linearInterpolation(a[i], b[i], t);
+}
+
+
+static void lerp_3d_scalar(float *out, const float *a, const float *b,
+	const float *c, const float *d, float ty, float tz, u32 count)
+{
+	for (u32 i = 0; i != count; i++) {
+		float u = linearInterpolation(a[i], b[i], ty);
+		float v = linearInterpolation(c[i], d[i], ty);
+		out[i] = linearInterpolation(u, v, tz);
+	}
+}
+
+
+#ifdef NOISE_X86_KERNELS
+
+// SSE2 has no 32 bit multiplication keeping the low halves
+__attribute__((target("sse2")))
+static inline __m128i mullo_epi32_sse2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(
+		_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+
+__attribute__((target("sse2")))
+static void lattice_sse2(float *out, u32 count, u32 n0)
+{
+	const __m128i mask  = _mm_set1_epi32(0x7fffffff);
+	const __m128i mul   = _mm_set1_epi32(60493);
+	const __m128i add1  = _mm_set1_epi32(19990303);
+	const __m128i add2  = _mm_set1_epi32(1376312589);
+	const __m128i step  = _mm_set1_epi32(4 * NOISE_MAGIC_X);
+	const __m128 scale  = _mm_set1_ps(1.f / 0x40000000);
+	const __m128 one    = _mm_set1_ps(1.f);
+	__m128i base = _mm_setr_epi32(n0, n0 + NOISE_MAGIC_X,
+		n0 + 2 * NOISE_MAGIC_X, n0 + 3 * NOISE_MAGIC_X);
+
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i n = _mm_and_si128(base, mask);
+		n = _mm_xor_si128(_mm_srli_epi32(n, 13), n);
+		__m128i t = mullo_epi32_sse2(mullo_epi32_sse2(n, n), mul);
+		t = mullo_epi32_sse2(n, _mm_add_epi32(t, add1));
+		n = _mm_and_si128(_mm_add_epi32(t, add2), mask);
+		_mm_storeu_ps(out + i,
+			_mm_sub_ps(one, _mm_mul_ps(_mm_cvtepi32_ps(n), scale)));
+		base = _mm_add_epi32(base, step);
+	}
+	for (; i != count; i++)
+		out[i] = noise_hash(n0 + NOISE_MAGIC_X * i);
+}
+
+
+__attribute__((target("sse2")))
+static void interp_x_sse2(float *out, const float *row,
+	const u32 *cell, const float *weight, u32 count)
+{
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const u32 *c = cell + i;
+		__m128 v0 = _mm_setr_ps(row[c[0]], row[c[1]], row[c[2]], row[c[3]]);
+		__m128 v1 = _mm_setr_ps(row[c[0] + 1], row[c[1] + 1],
+			row[c[2] + 1], row[c[3] + 1]);
+		__m128 t = _mm_loadu_ps(weight + i);
+		_mm_storeu_ps(out + i,
+			_mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), t)));
+	}
+	for (; i != count; i++)
+		out[i] = linearInterpolation(row[cell[i]], row[cell[i] + 1], weight[i]);
+}
+
+
+__attribute__((target("sse2")))
+static void lerp_2d_sse2(float *out, const float *a, const float *b,
+	float t, u32 count)
+{
+	const __m128 vt = _mm_set1_ps(t);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 va = _mm_loadu_ps(a + i);
+		__m128 vb = _mm_loadu_ps(b + i);
+		_mm_storeu_ps(out + i,
+			_mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), vt)));
+	}
+	for (; i != count; i++)
+		out[i] = linearInterpolation(a[i], b[i], t);
+}
+
+
+__attribute__((target("sse2")))
+static void lerp_3d_sse2(float *out, const float *a, const float *b,
+	const float *c, const float *d, float ty, float tz, u32 count)
+{
+	const __m128 vty = _mm_set1_ps(ty);
+	const __m128 vtz = _mm_set1_ps(tz);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 va = _mm_loadu_ps(a + i);
+		__m128 vb = _mm_loadu_ps(b + i);
+		__m128 vc = _mm_loadu_ps(c + i);
+		__m128 vd = _mm_loadu_ps(d + i);
+		__m128 u = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), vty));
+		__m128 v = _mm_add_ps(vc, _mm_mul_ps(_mm_sub_ps(vd, vc), vty));
+		_mm_storeu_ps(out + i,
+			_mm_add_ps(u, _mm_mul_ps(_mm_sub_ps(v, u), vtz)));
+	}
+	for (; i != count; i++) {
+		float u = linearInterpolation(a[i], b[i], ty);
+		float v = linearInterpolation(c[i], d[i], ty);
+		out[i] = linearInterpolation(u, v, tz);
+	}
+}
+
+
+__attribute__((target("avx2")))
+static void lattice_avx2(float *out, u32 count, u32 n0)
+{
+	const __m256i mask  = _mm256_set1_epi32(0x7fffffff);
+	const __m256i mul   = _mm256_set1_epi32(60493);
+	const __m256i add1  = _mm256_set1_epi32(19990303);
+	const __m256i add2  = _mm256_set1_epi32(1376312589);
+	const __m256i step  = _mm256_set1_epi32(8 * NOISE_MAGIC_X);
+	const __m256 scale  = _mm256_set1_ps(1.f / 0x40000000);
+	const __m256 one    = _mm256_set1_ps(1.f);
+	__m256i base = _mm256_add_epi32(_mm256_set1_epi32(n0),
+		_mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+			_mm256_set1_epi32(NOISE_MAGIC_X)));
+
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i n = _mm256_and_si256(base, mask);
+		n = _mm256_xor_si256(_mm256_srli_epi32(n, 13), n);
+		__m256i t = _mm256_mullo_epi32(_mm256_mullo_epi32(n, n), mul);
+		t = _mm256_mullo_epi32(n, _mm256_add_epi32(t, add1));
+		n = _mm256_and_si256(_mm256_add_epi32(t, add2), mask);
+		_mm256_storeu_ps(out + i,
+			_mm256_sub_ps(one, _mm256_mul_ps(_mm256_cvtepi32_ps(n), scale)));
+		base = _mm256_add_epi32(base, step);
+	}
+	for (; i != count; i++)
+		out[i] = noise_hash(n0 + NOISE_MAGIC_X * i);
+}
+
+
+__attribute__((target("avx2")))
+static void interp_x_avx2(float *out, const float *row,
+	const u32 *cell, const float *weight, u32 count)
+{
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i c = _mm256_loadu_si256((const __m256i *)(cell + i));
+		__m256 v0 = _mm256_i32gather_ps(row, c, 4);
+		__m256 v1 = _mm256_i32gather_ps(row + 1, c, 4);
+		__m256 t = _mm256_loadu_ps(weight + i);
+		_mm256_storeu_ps(out + i,
+			_mm256_add_ps(v0, _mm256_mul_ps(_mm256_sub_ps(v1, v0), t)));
+	}
+	for (; i != count; i++)
+		out[i] = linearInterpolation(row[cell[i]], row[cell[i] + 1], weight[i]);
+}
+
+
+__attribute__((target("avx2")))
+static void lerp_2d_avx2(float *out, const float *a, const float *b,
+	float t, u32 count)
+{
+	const __m256 vt = _mm256_set1_ps(t);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 va = _mm256_loadu_ps(a + i);
+		__m256 vb = _mm256_loadu_ps(b + i);
+		_mm256_storeu_ps(out + i,
+			_mm256_add_ps(va, _mm256_mul_ps(_mm256_sub_ps(vb, va), vt)));
+	}
+	for (; i != count; i++)
+		out[i] = linearInterpolation(a[i], b[i], t);
+}
+
+
+__attribute__((target("avx2")))
+static void lerp_3d_avx2(float *out, const float *a, const float *b,
+	const float *c, const float *d, float ty, float tz, u32 count)
+{
+	const __m256 vty = _mm256_set1_ps(ty);
+	const __m256 vtz = _mm256_set1_ps(tz);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 va = _mm256_loadu_ps(a + i);
+		__m256 vb = _mm256_loadu_ps(b + i);
+		__m256 vc = _mm256_loadu_ps(c + i);
+		__m256 vd = _mm256_loadu_ps(d + i);
+		__m256 u = _mm256_add_ps(va, _mm256_mul_ps(_mm256_sub_ps(vb, va), vty));
+		__m256 v = _mm256_add_ps(vc, _mm256_mul_ps(_mm256_sub_ps(vd, vc), vty));
+		_mm256_storeu_ps(out + i,
+			_mm256_add_ps(u, _mm256_mul_ps(_mm256_sub_ps(v, u), vtz)));
+	}
+	for (; i != count; i++) {
+		float u = linearInterpolation(a[i], b[i], ty);
+		float v = linearInterpolation(c[i], d[i], ty);
+		out[i] = linearInterpolation(u, v, tz);
+	}
+}
+
+#endif
+
+
+// Indexed by NoiseSimd
+static const NoiseKernels noise_kernels[] = {
+	{lattice_scalar, interp_x_scalar, lerp_2d_scalar, lerp_3d_scalar},
+#ifdef NOISE_X86_KERNELS
+	{lattice_sse2,   interp_x_sse2,   lerp_2d_sse2,   lerp_3d_sse2},
+	{lattice_avx2,   interp_x_avx2,   lerp_2d_avx2,   lerp_3d_avx2},
+#else
+	{lattice_scalar, interp_x_scalar, lerp_2d_scalar, lerp_3d_scalar},
+	{lattice_scalar, interp_x_scalar, lerp_2d_scalar, lerp_3d_scalar},
+#endif
+};
+
+
+NoiseSimd noise_simd_supported()
+{
+#ifdef NOISE_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return NOISE_SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return NOISE_SIMD_SSE2;
+#endif
+	return NOISE_SIMD_NONE;
+}
+
+
+// Lattice cell and interpolation weight of each sample along an axis,
+// stepping like the interpolation of single noise values does
+static void noise_axis(u32 *cell, float *weight, u32 count,
+	float start, float step, bool eased)
+{
+	float t = start;
+	u32 c = 0;
+	for (u32 i = 0; i != count; i++) {
+		cell[i]   = c;
+		weight[i] = eased ? easeCurve(t) : t;
+
+		t += step;
+		if (t >= 1.0) {
+			t -= 1.0;
+			c++;
+		}
+	}
+}
+
+///////////////////////// [ Noise maps ] ////////////////////////////
+
+
 Noise::Noise(NoiseParams *np_, s32 seed, u32 sx, u32 sy, u32 sz)
 {
 	memcpy(&np, np_, sizeof(np));
@@ -433,9 +735,15 @@ Noise::Noise(NoiseParams *np_, s32 seed, u32 sx, u32 sy, u32 sz)
 	this->sy   = sy;
 	this->sz   = sz;
 
+	this->simd = noise_simd_supported();
+
+	this->noise_buf    = NULL;
 	this->persist_buf  = NULL;
 	this->gradient_buf = NULL;
 	this->result       = NULL;
+	this->cell_buf     = NULL;
+	this->weight_buf   = NULL;
+	this->xinterp_buf  = NULL;
 
 	allocBuffers();
 }
@@ -447,6 +755,9 @@ Noise::~Noise()
 	delete[] persist_buf;
 	delete[] noise_buf;
 	delete[] result;
+	delete[] cell_buf;
+	delete[] weight_buf;
+	delete[] xinterp_buf;
 }
 
 
@@ -459,18 +770,21 @@ void Noise::allocBuffers()
 	if (sz < 1)
 		sz = 1;
 
-	this->noise_buf = NULL;
 	resizeNoiseBuf(sz > 1);
 
 	delete[] gradient_buf;
 	delete[] persist_buf;
 	delete[] result;
+	delete[] cell_buf;
+	delete[] weight_buf;
 
 	try {
 		size_t bufsize = sx * sy * sz;
 		this->persist_buf  = NULL;
 		this->gradient_buf = new float[bufsize];
 		this->result       = new float[bufsize];
+		this->cell_buf     = new u32[sx + sy + sz];
+		this->weight_buf   = new float[sx + sy + sz];
 	} catch (std::bad_alloc &e) {
 		throw InvalidNoiseParamsException();
 	}
@@ -528,9 +842,17 @@ void Noise::resizeNoiseBuf(bool is3d)
 	size_t nly = (size_t)ceil(num_noise_points_y) + 3;
 	size_t nlz = is3d ? (size_t)ceil(num_noise_points_z) + 3 : 1;
 
+	// The samples step at most one lattice cell at a time, so the cells
+	// they are in span at most one point more than there are samples
+	nlx = MYMIN(nlx, (size_t)sx + 1);
+	nly = MYMIN(nly, (size_t)sy + 1);
+	nlz = MYMIN(nlz, (size_t)sz + 1);
+
 	delete[] noise_buf;
+	delete[] xinterp_buf;
 	try {
-		noise_buf = new float[nlx * nly * nlz];
+		noise_buf   = new float[nlx * nly * nlz];
+		xinterp_buf = new float[2 * nly * sx];
 	} catch (std::bad_alloc &e) {
 		throw InvalidNoiseParamsException();
 	}
@@ -538,95 +860,74 @@ void Noise::resizeNoiseBuf(bool is3d)
 
 
 /*
- * NB:  This algorithm is not optimal in terms of space complexity.  The entire
- * integer lattice of noise points could be done as 2 lines instead, and for 3D,
- * 2 lines + 2 planes.
- * However, this would require the noise calls to be interposed with the
- * interpolation loops, which may trash the icache, leading to lower overall
- * performance.
- * Another optimization that could save half as many noise calls is to carry over
- * values from the previous noise lattice as midpoints in the new lattice for the
- * next octave.
+ * The lattice is interpolated along x one row at a time, and these rows are
+ * then interpolated along y and z for every row of samples.  Rows of samples
+ * in the same lattice cell share the interpolated lattice rows, and all of it
+ * runs on whole rows, which the SIMD kernels can work on.
  */
-#define idx(x, y) ((y) * nlx + (x))
 void Noise::gradientMap2D(
 		float x, float y,
 		float step_x, float step_y,
 		s32 seed)
 {
-	float v00, v01, v10, v11, u, v, orig_u;
-	u32 index, i, j, noisex, noisey;
-	u32 nlx, nly;
+	const NoiseKernels &kernels = noise_kernels[simd];
+	u32 *cell_x = cell_buf;
+	u32 *cell_y = cell_buf + sx;
+	float *weight_x = weight_buf;
+	float *weight_y = weight_buf + sx;
+	u32 j, nlx, nly;
 	s32 x0, y0;
+	float u, v;
 
 	bool eased = np.flags & (NOISE_FLAG_DEFAULTS | NOISE_FLAG_EASED);
-	Interp2dFxn interpolate = eased ?
-		biLinearInterpolation : biLinearInterpolationNoEase;
 
 	x0 = floor(x);
 	y0 = floor(y);
 	u = x - (float)x0;
 	v = y - (float)y0;
-	orig_u = u;
 
-	//calculate noise point lattice
-	nlx = (u32)(u + sx * step_x) + 2;
-	nly = (u32)(v + sy * step_y) + 2;
-	index = 0;
+	noise_axis(cell_x, weight_x, sx, u, step_x, eased);
+	noise_axis(cell_y, weight_y, sy, v, step_y, eased);
+
+	//calculate the noise points of the lattice cells the samples are in
+	nlx = cell_x[sx - 1] + 2;
+	nly = cell_y[sy - 1] + 2;
 	for (j = 0; j != nly; j++)
-		for (i = 0; i != nlx; i++)
-			noise_buf[index++] = noise2d(x0 + i, y0 + j, seed);
+		kernels.lattice(&noise_buf[j * nlx], nlx, NOISE_MAGIC_X * x0 +
+			NOISE_MAGIC_Y * (y0 + j) + NOISE_MAGIC_SEED * seed);
 
-	//calculate interpolations
-	index  = 0;
-	noisey = 0;
-	for (j = 0; j != sy; j++) {
-		v00 = noise_buf[idx(0, noisey)];
-		v10 = noise_buf[idx(1, noisey)];
-		v01 = noise_buf[idx(0, noisey + 1)];
-		v11 = noise_buf[idx(1, noisey + 1)];
-
-		u = orig_u;
-		noisex = 0;
-		for (i = 0; i != sx; i++) {
-			gradient_buf[index++] = interpolate(v00, v10, v01, v11, u, v);
-
-			u += step_x;
-			if (u >= 1.0) {
-				u -= 1.0;
-				noisex++;
-				v00 = v10;
-				v01 = v11;
-				v10 = noise_buf[idx(noisex + 1, noisey)];
-				v11 = noise_buf[idx(noisex + 1, noisey + 1)];
-			}
-		}
+	//interpolate the lattice rows along x, then the samples along y
+	for (j = 0; j != nly; j++)
+		kernels.interpX(&xinterp_buf[j * sx], &noise_buf[j * nlx],
+			cell_x, weight_x, sx);
 
-		v += step_y;
-		if (v >= 1.0) {
-			v -= 1.0;
-			noisey++;
-		}
+	for (j = 0; j != sy; j++) {
+		kernels.lerp2D(&gradient_buf[j * sx],
+			&xinterp_buf[cell_y[j] * sx], &xinterp_buf[(cell_y[j] + 1) * sx],
+			weight_y[j], sx);
 	}
 }
-#undef idx
 
 
-#define idx(x, y, z) ((z) * nly * nlx + (y) * nlx + (x))
 void Noise::gradientMap3D(
 		float x, float y, float z,
 		float step_x, float step_y, float step_z,
 		s32 seed)
 {
-	float v000, v010, v100, v110;
-	float v001, v011, v101, v111;
-	float u, v, w, orig_u, orig_v;
-	u32 index, i, j, k, noisex, noisey, noisez;
-	u32 nlx, nly, nlz;
+	const NoiseKernels &kernels = noise_kernels[simd];
+	u32 *cell_x = cell_buf;
+	u32 *cell_y = cell_buf + sx;
+	u32 *cell_z = cell_buf + sx + sy;
+	float *weight_x = weight_buf;
+	float *weight_y = weight_buf + sx;
+	float *weight_z = weight_buf + sx + sy;
+	float *planes[2];
+	s32 plane_z[2];
+	u32 index, j, k, nlx, nly, nlz;
 	s32 x0, y0, z0;
+	float u, v, w;
 
-	Interp3dFxn interpolate = (np.flags & NOISE_FLAG_EASED) ?
-		triLinearInterpolation : triLinearInterpolationNoEase;
+	bool eased = np.flags & NOISE_FLAG_EASED;
 
 	x0 = floor(x);
 	y0 = floor(y);
@@ -634,74 +935,55 @@ void Noise::gradientMap3D(
 	u = x - (float)x0;
 	v = y - (float)y0;
 	w = z - (float)z0;
-	orig_u = u;
-	orig_v = v;
 
-	//calculate noise point lattice
-	nlx = (u32)(u + sx * step_x) + 2;
-	nly = (u32)(v + sy * step_y) + 2;
-	nlz = (u32)(w + sz * step_z) + 2;
-	index = 0;
+	noise_axis(cell_x, weight_x, sx, u, step_x, eased);
+	noise_axis(cell_y, weight_y, sy, v, step_y, eased);
+	noise_axis(cell_z, weight_z, sz, w, step_z, eased);
+
+	//calculate the noise points of the lattice cells the samples are in
+	nlx = cell_x[sx - 1] + 2;
+	nly = cell_y[sy - 1] + 2;
+	nlz = cell_z[sz - 1] + 2;
 	for (k = 0; k != nlz; k++)
 		for (j = 0; j != nly; j++)
-			for (i = 0; i != nlx; i++)
-				noise_buf[index++] = noise3d(x0 + i, y0 + j, z0 + k, seed);
+			kernels.lattice(&noise_buf[(k * nly + j) * nlx], nlx,
+				NOISE_MAGIC_X * x0 + NOISE_MAGIC_Y * (y0 + j) +
+				NOISE_MAGIC_Z * (z0 + k) + NOISE_MAGIC_SEED * seed);
 
-	//calculate interpolations
-	index  = 0;
-	noisey = 0;
-	noisez = 0;
-	for (k = 0; k != sz; k++) {
-		v = orig_v;
-		noisey = 0;
-		for (j = 0; j != sy; j++) {
-			v000 = noise_buf[idx(0, noisey,     noisez)];
-			v100 = noise_buf[idx(1, noisey,     noisez)];
-			v010 = noise_buf[idx(0, noisey + 1, noisez)];
-			v110 = noise_buf[idx(1, noisey + 1, noisez)];
-			v001 = noise_buf[idx(0, noisey,     noisez + 1)];
-			v101 = noise_buf[idx(1, noisey,     noisez + 1)];
-			v011 = noise_buf[idx(0, noisey + 1, noisez + 1)];
-			v111 = noise_buf[idx(1, noisey + 1, noisez + 1)];
-
-			u = orig_u;
-			noisex = 0;
-			for (i = 0; i != sx; i++) {
-				gradient_buf[index++] = interpolate(
-					v000, v100, v010, v110,
-					v001, v101, v011, v111,
-					u, v, w);
-
-				u += step_x;
-				if (u >= 1.0) {
-					u -= 1.0;
-					noisex++;
-					v000 = v100;
-					v010 = v110;
-					v100 = noise_buf[idx(noisex + 1, noisey,     noisez)];
-					v110 = noise_buf[idx(noisex + 1, noisey + 1, noisez)];
-					v001 = v101;
-					v011 = v111;
-					v101 = noise_buf[idx(noisex + 1, noisey,     noisez + 1)];
-					v111 = noise_buf[idx(noisex + 1, noisey + 1, noisez + 1)];
-				}
-			}
+	//interpolate the lattice along x for the two planes of the samples'
+	//cells in z, then the samples along y and z
+	planes[0] = xinterp_buf;
+	planes[1] = xinterp_buf + nly * sx;
+	plane_z[0] = -1;
+	plane_z[1] = -1;
 
-			v += step_y;
-			if (v >= 1.0) {
-				v -= 1.0;
-				noisey++;
-			}
+	index = 0;
+	for (k = 0; k != sz; k++) {
+		s32 nz = cell_z[k];
+		for (s32 lz = nz; lz != nz + 2; lz++) {
+			if (plane_z[0] == lz || plane_z[1] == lz)
+				continue;
+
+			// Replace the plane the samples are done with
+			u32 p = (plane_z[0] == nz || plane_z[0] == nz + 1) ? 1 : 0;
+			for (j = 0; j != nly; j++)
+				kernels.interpX(&planes[p][j * sx],
+					&noise_buf[(lz * nly + j) * nlx], cell_x, weight_x, sx);
+			plane_z[p] = lz;
 		}
 
-		w += step_z;
-		if (w >= 1.0) {
-			w -= 1.0;
-			noisez++;
+		float *p0 = planes[plane_z[0] == nz ? 0 : 1];
+		float *p1 = planes[plane_z[0] == nz ? 1 : 0];
+		for (j = 0; j != sy; j++) {
+			u32 ny = cell_y[j];
+			kernels.lerp3D(&gradient_buf[index],
+				&p0[ny * sx], &p0[(ny + 1) * sx],
+				&p1[ny * sx], &p1[(ny + 1) * sx],
+				weight_y[j], weight_z[k], sx);
+			index += sx;
 		}
 	}
 }
-#undef idx
 
 
 float *Noise::perlinMap2D(float x, float y, float *persistence_map)
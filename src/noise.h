@@ -139,6 +139,18 @@ struct NoiseParams {
 };
 
 
+// Instruction sets the noise maps can be computed with.  They all give the
+// same results, up to the rounding differences -ffast-math allows.
+enum NoiseSimd {
+	NOISE_SIMD_NONE,
+	NOISE_SIMD_SSE2,
+	NOISE_SIMD_AVX2,
+};
+
+// The best one of them this CPU has
+NoiseSimd noise_simd_supported();
+
+
 // Convenience macros for getting/setting NoiseParams in Settings as a string
 // WARNING:  Deprecated, use Settings::getNoiseParamsFromValue() instead
 #define NOISEPARAMS_FMT_STR "f,f,v3,s32,u16,f"
@@ -156,6 +168,8 @@ class Noise {
 	float *gradient_buf;
 	float *persist_buf;
 	float *result;
+	// Must not be above noise_simd_supported()
+	NoiseSimd simd;
 
 	Noise(NoiseParams *np, s32 seed, u32 sx, u32 sy, u32 sz=1);
 	~Noise();
@@ -196,6 +210,12 @@ class Noise {
 	}
 
 private:
+	// Lattice cell and interpolation weight of the samples along x, y, z
+	u32 *cell_buf;
+	float *weight_buf;
+	// Two planes of lattice rows interpolated along x
+	float *xinterp_buf;
+
 	void allocBuffers();
 	void resizeNoiseBuf(bool is3d);
 	void updateResults(float g, float *gmap, float *persistence_map, size_t bufsize);
@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "environment.h"
 #include "mapgen.h"
 #include "lua_api/l_env.h"
+#include "lua_api/l_vmanip.h"
 #include "server.h"
 
 void ScriptApiEnv::environment_OnGenerated(v3s16 minp, v3s16 maxp,
@@ -38,7 +39,14 @@ void ScriptApiEnv::environment_OnGenerated(v3s16 minp, v3s16 maxp,
 	push_v3s16(L, minp);
 	push_v3s16(L, maxp);
 	lua_pushnumber(L, blockseed);
-	runCallbacks(3, RUN_CALLBACKS_MODE_FIRST);
+	try {
+		runCallbacks(3, RUN_CALLBACKS_MODE_FIRST);
+	} catch (LuaError &e) {
+		LuaVoxelManip::invalidateMapgenObjects(L);
+		throw;
+	}
+	// The VoxelManips from get_mapgen_object() are deleted with the chunk
+	LuaVoxelManip::invalidateMapgenObjects(L);
 }
 
 void ScriptApiEnv::environment_Step(float dtime)
@@ -46,17 +46,11 @@ struct EnumString ModApiEnvMod::es_ClearObjectsMode[] =
 ///////////////////////////////////////////////////////////////////////////////
 
 
-void LuaABM::trigger(ServerEnvironment *env, v3s16 p, MapNode n,
-		u32 active_object_count, u32 active_object_count_wider)
+// Pushes the action of registered_abms[m_id], with the origin set to the ABM
+void LuaABM::pushAction(ServerEnvironment *env)
 {
 	GameScripting *scriptIface = env->getScriptIface();
-	scriptIface->realityCheck();
-
 	lua_State *L = scriptIface->getStack();
-	sanity_check(lua_checkstack(L, 20));
-	StackUnroller stack_unroller(L);
-
-	int error_handler = PUSH_ERROR_HANDLER(L);
 
 	// Get registered_abms
 	lua_getglobal(L, "core");
@@ -73,11 +67,27 @@ void LuaABM::trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 
 	scriptIface->setOriginFromTable(-1);
 
-	// Call action
+	// Get action
 	luaL_checktype(L, -1, LUA_TTABLE);
 	lua_getfield(L, -1, "action");
 	luaL_checktype(L, -1, LUA_TFUNCTION);
 	lua_remove(L, -2); // Remove registered_abms[m_id]
+}
+
+void LuaABM::trigger(ServerEnvironment *env, v3s16 p, MapNode n,
+		u32 active_object_count, u32 active_object_count_wider)
+{
+	GameScripting *scriptIface = env->getScriptIface();
+	scriptIface->realityCheck();
+
+	lua_State *L = scriptIface->getStack();
+	sanity_check(lua_checkstack(L, 20));
+	StackUnroller stack_unroller(L);
+
+	int error_handler = PUSH_ERROR_HANDLER(L);
+
+	// Call action
+	pushAction(env);
 	push_v3s16(L, p);
 	pushnode(L, n, env->getGameDef()->ndef());
 	lua_pushnumber(L, active_object_count);
@@ -90,6 +100,47 @@ void LuaABM::trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 	lua_pop(L, 1); // Pop error handler
 }
 
+// Like trigger(), but looks the action up only once for all candidates
+void LuaABM::triggerBatch(ServerEnvironment *env,
+		const ABMTriggerCandidate *candidates, u32 count,
+		ABMTriggerContext &context)
+{
+	GameScripting *scriptIface = env->getScriptIface();
+	scriptIface->realityCheck();
+
+	lua_State *L = scriptIface->getStack();
+	sanity_check(lua_checkstack(L, 20));
+	StackUnroller stack_unroller(L);
+
+	int error_handler = PUSH_ERROR_HANDLER(L);
+
+	pushAction(env);
+	int action = lua_gettop(L);
+
+	INodeDefManager *ndef = env->getGameDef()->ndef();
+	for (u32 i = 0; i < count; i++) {
+		const ABMTriggerCandidate &c = candidates[i];
+		MapNode n;
+		if (!context.getCurrentNode(c, &n))
+			continue;
+
+		// Call action
+		lua_pushvalue(L, action);
+		push_v3s16(L, c.p);
+		pushnode(L, n, ndef);
+		lua_pushnumber(L, context.active_object_count);
+		lua_pushnumber(L, context.active_object_count_wider);
+
+		int result = lua_pcall(L, 4, 0, error_handler);
+		if (result)
+			scriptIface->scriptError(result, "LuaABM::triggerBatch");
+
+		context.triggered();
+	}
+
+	lua_pop(L, 2); // Pop action and error handler
+}
+
 void LuaLBM::trigger(ServerEnvironment *env, v3s16 p, MapNode n)
 {
 	GameScripting *scriptIface = env->getScriptIface();
@@ -186,6 +186,8 @@ class LuaABM : public ActiveBlockModifier {
 	float m_trigger_interval;
 	u32 m_trigger_chance;
 	bool m_simple_catch_up;
+
+	void pushAction(ServerEnvironment *env);
 public:
 	LuaABM(lua_State *L, int id,
 			const std::set<std::string> &trigger_contents,
@@ -221,6 +223,9 @@ class LuaABM : public ActiveBlockModifier {
 	}
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 			u32 active_object_count, u32 active_object_count_wider);
+	virtual void triggerBatch(ServerEnvironment *env,
+			const ABMTriggerCandidate *candidates, u32 count,
+			ABMTriggerContext &context);
 };
 
 class LuaLBM : public LoadingBlockModifierDef
@@ -596,3 +596,9 @@ void ModApiItemMod::Initialize(lua_State *L, int top)
 	API_FCT(get_content_id);
 	API_FCT(get_name_from_content_id);
 }
+
+void ModApiItemMod::InitializeEmerge(lua_State *L, int top)
+{
+	API_FCT(get_content_id);
+	API_FCT(get_name_from_content_id);
+}
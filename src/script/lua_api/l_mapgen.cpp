@@ -504,10 +504,7 @@ int ModApiMapgen::l_get_mapgen_object(lua_State *L)
 		MMVManip *vm = mg->vm;
 
 		// VoxelManip object
-		LuaVoxelManip *o = new LuaVoxelManip(vm, true);
-		*(void **)(lua_newuserdata(L, sizeof(void *))) = o;
-		luaL_getmetatable(L, "VoxelManip");
-		lua_setmetatable(L, -2);
+		LuaVoxelManip::pushMapgenObject(L, vm);
 
 		// emerged min pos
 		push_v3s16(L, vm->m_area.MinEdge);
@@ -1183,6 +1180,31 @@ int ModApiMapgen::l_register_schematic(lua_State *L)
 }
 
 
+// register_mapgen_script(path)
+int ModApiMapgen::l_register_mapgen_script(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	std::string path = luaL_checkstring(L, 1);
+	CHECK_SECURE_PATH_OPTIONAL(L, path.c_str());
+
+	if (!fs::PathExists(path))
+		throw LuaError("register_mapgen_script: file " + path + " not found");
+
+	// Only set while the mods load, before the emerge threads start
+	lua_rawgeti(L, LUA_REGISTRYINDEX, CUSTOM_RIDX_CURRENT_MOD_NAME);
+	if (!lua_isstring(L, -1))
+		throw LuaError("register_mapgen_script may only be called at load time");
+
+	MapgenScript script;
+	script.mod_name = lua_tostring(L, -1);
+	script.path     = path;
+	getServer(L)->getEmergeManager()->mapgen_scripts.push_back(script);
+
+	return 0;
+}
+
+
 // clear_registered_biomes()
 int ModApiMapgen::l_clear_registered_biomes(lua_State *L)
 {
@@ -1498,6 +1520,7 @@ void ModApiMapgen::Initialize(lua_State *L, int top)
 	API_FCT(register_decoration);
 	API_FCT(register_ore);
 	API_FCT(register_schematic);
+	API_FCT(register_mapgen_script);
 
 	API_FCT(clear_registered_biomes);
 	API_FCT(clear_registered_decorations);
@@ -1511,3 +1534,18 @@ void ModApiMapgen::Initialize(lua_State *L, int top)
 	API_FCT(place_schematic_on_vmanip);
 	API_FCT(serialize_schematic);
 }
+
+void ModApiMapgen::InitializeEmerge(lua_State *L, int top)
+{
+	API_FCT(get_biome_id);
+	API_FCT(get_mapgen_object);
+
+	API_FCT(get_mapgen_params);
+	API_FCT(get_mapgen_setting);
+	API_FCT(get_mapgen_setting_noiseparams);
+	API_FCT(get_noiseparams);
+	API_FCT(get_gen_notify);
+
+	API_FCT(generate_ores);
+	API_FCT(generate_decorations);
+}
@@ -76,6 +76,10 @@ class ModApiMapgen : public ModApiBase {
 	// register_schematic({schematic}, replacements={})
 	static int l_register_schematic(lua_State *L);
 
+	// register_mapgen_script(path)
+	// runs the script in the Lua environment of every emerge thread
+	static int l_register_mapgen_script(lua_State *L);
+
 	// clear_registered_biomes()
 	static int l_clear_registered_biomes(lua_State *L);
 
@@ -109,6 +113,7 @@ class ModApiMapgen : public ModApiBase {
 
 public:
 	static void Initialize(lua_State *L, int top);
+	static void InitializeEmerge(lua_State *L, int top);
 
 	static struct EnumString es_BiomeTerrainType[];
 	static struct EnumString es_DecorationType[];
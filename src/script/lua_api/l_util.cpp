@@ -498,6 +498,29 @@ void ModApiUtil::Initialize(lua_State *L, int top)
 	API_FCT(decode_base64);
 }
 
+void ModApiUtil::InitializeEmerge(lua_State *L, int top)
+{
+	API_FCT(log);
+
+	API_FCT(get_us_time);
+
+	API_FCT(setting_get);
+	API_FCT(setting_getbool);
+
+	API_FCT(parse_json);
+	API_FCT(write_json);
+
+	API_FCT(is_yes);
+
+	API_FCT(get_builtin_path);
+
+	API_FCT(compress);
+	API_FCT(decompress);
+
+	API_FCT(encode_base64);
+	API_FCT(decode_base64);
+}
+
 void ModApiUtil::InitializeAsync(AsyncEngine& engine)
 {
 	ASYNC_API_FCT(log);
@@ -106,6 +106,7 @@ class ModApiUtil : public ModApiBase {
 
 public:
 	static void Initialize(lua_State *L, int top);
+	static void InitializeEmerge(lua_State *L, int top);
 
 	static void InitializeAsync(AsyncEngine& engine);
 
@@ -20,10 +20,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "lua_api/l_vmanip.h"
 #include "lua_api/l_internal.h"
+#include "config.h"
 #include "common/c_content.h"
 #include "common/c_converter.h"
 #include "emerge.h"
 #include "environment.h"
+#include "log.h"
 #include "map.h"
 #include "server.h"
 #include "mapgen.h"
@@ -41,6 +43,10 @@ int LuaVoxelManip::l_read_from_map(lua_State *L)
 {
 	MAP_LOCK_REQUIRED;
 
+	// There is no map to read in the mapgen environment
+	if (getEnv(L) == NULL)
+		return 0;
+
 	LuaVoxelManip *o = checkobject(L, 1);
 	MMVManip *vm = o->vm;
 
@@ -108,6 +114,10 @@ int LuaVoxelManip::l_write_to_map(lua_State *L)
 {
 	MAP_LOCK_REQUIRED;
 
+	// In the mapgen environment the emerge thread writes the chunk
+	if (getEnv(L) == NULL)
+		return 0;
+
 	LuaVoxelManip *o = checkobject(L, 1);
 	MMVManip *vm = o->vm;
 
@@ -146,10 +156,18 @@ int LuaVoxelManip::l_set_node_at(lua_State *L)
 
 int LuaVoxelManip::l_update_liquids(lua_State *L)
 {
-	GET_ENV_PTR;
+	MAP_LOCK_REQUIRED;
 
 	LuaVoxelManip *o = checkobject(L, 1);
 
+	// The mapgen environment of an emerge thread has no map to queue them in
+	ServerEnvironment *env = (ServerEnvironment *)getEnv(L);
+	if (env == NULL) {
+		warningstream << "VoxelManip:update_liquids() does nothing in "
+			"mapgen scripts" << std::endl;
+		return 0;
+	}
+
 	Map *map = &(env->getMap());
 	INodeDefManager *ndef = getServer(L)->getNodeDefManager();
 	MMVManip *vm = o->vm;
@@ -314,14 +332,38 @@ int LuaVoxelManip::l_set_param2_data(lua_State *L)
 	return 0;
 }
 
-int LuaVoxelManip::l_update_map(lua_State *L)
+int LuaVoxelManip::l_get_data_buffer(lua_State *L)
 {
-	GET_ENV_PTR;
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer::bind(L, 1, 2, VOXEL_BUFFER_CONTENT);
+	return 1;
+}
 
+int LuaVoxelManip::l_get_light_buffer(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer::bind(L, 1, 2, VOXEL_BUFFER_PARAM1);
+	return 1;
+}
+
+int LuaVoxelManip::l_get_param2_buffer(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer::bind(L, 1, 2, VOXEL_BUFFER_PARAM2);
+	return 1;
+}
+
+int LuaVoxelManip::l_update_map(lua_State *L)
+{
 	LuaVoxelManip *o = checkobject(L, 1);
 	if (o->is_mapgen_vm)
 		return 0;
 
+	GET_ENV_PTR;
+
 	Map *map = &(env->getMap());
 
 	// TODO: Optimize this by using Mapgen::calcLighting() instead
@@ -426,7 +468,56 @@ LuaVoxelManip *LuaVoxelManip::checkobject(lua_State *L, int narg)
 	if (!ud)
 		luaL_typerror(L, narg, className);
 
-	return *(LuaVoxelManip **)ud;  // unbox pointer
+	LuaVoxelManip *o = *(LuaVoxelManip **)ud;  // unbox pointer
+	if (!o->vm)
+		throw LuaError("VoxelManip of a mapgen chunk used after the chunk was finished");
+	return o;
+}
+
+void LuaVoxelManip::pushMapgenObject(lua_State *L, MMVManip *mmvm)
+{
+	// The VoxelManip of the mapgen, left alone by the garbage collector
+	LuaVoxelManip *o = new LuaVoxelManip(mmvm, true);
+	*(void **)(lua_newuserdata(L, sizeof(void *))) = o;
+	luaL_getmetatable(L, className);
+	lua_setmetatable(L, -2);
+
+	// Remember it in a table with weak keys until the chunk is finished
+	lua_rawgeti(L, LUA_REGISTRYINDEX, CUSTOM_RIDX_MAPGEN_VMANIPS);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_newtable(L);
+		lua_pushstring(L, "k");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+		lua_pushvalue(L, -1);
+		lua_rawseti(L, LUA_REGISTRYINDEX, CUSTOM_RIDX_MAPGEN_VMANIPS);
+	}
+	lua_pushvalue(L, -2);
+	lua_pushboolean(L, true);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+}
+
+void LuaVoxelManip::invalidateMapgenObjects(lua_State *L)
+{
+	lua_rawgeti(L, LUA_REGISTRYINDEX, CUSTOM_RIDX_MAPGEN_VMANIPS);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		return;
+	}
+
+	lua_pushnil(L);
+	while (lua_next(L, -2) != 0) {
+		lua_pop(L, 1); // Pop value
+		LuaVoxelManip *o = *(LuaVoxelManip **)lua_touserdata(L, -1);
+		o->vm = NULL;
+	}
+	lua_pop(L, 1);
+
+	lua_pushnil(L);
+	lua_rawseti(L, LUA_REGISTRYINDEX, CUSTOM_RIDX_MAPGEN_VMANIPS);
 }
 
 void LuaVoxelManip::Register(lua_State *L)
@@ -473,7 +564,230 @@ const luaL_reg LuaVoxelManip::methods[] = {
 	luamethod(LuaVoxelManip, set_light_data),
 	luamethod(LuaVoxelManip, get_param2_data),
 	luamethod(LuaVoxelManip, set_param2_data),
+	luamethod(LuaVoxelManip, get_data_buffer),
+	luamethod(LuaVoxelManip, get_light_buffer),
+	luamethod(LuaVoxelManip, get_param2_buffer),
 	luamethod(LuaVoxelManip, was_modified),
 	luamethod(LuaVoxelManip, get_emerged_area),
 	{0,0}
 };
+
+/*
+  LuaVoxelBuffer
+ */
+
+// garbage collector
+int LuaVoxelBuffer::gc_object(lua_State *L)
+{
+	LuaVoxelBuffer *o = *(LuaVoxelBuffer **)(lua_touserdata(L, 1));
+	luaL_unref(L, LUA_REGISTRYINDEX, o->vm_ref);
+	delete o;
+
+	return 0;
+}
+
+MMVManip *LuaVoxelBuffer::checkVManip()
+{
+	if (!vm->vm)
+		throw LuaError("VoxelBuffer of a mapgen chunk used after the chunk "
+			"was finished; bind it to the new VoxelManip first");
+	return vm->vm;
+}
+
+u32 LuaVoxelBuffer::getVolume()
+{
+	MMVManip *mmvm = checkVManip();
+	// The VoxelManip might have been read again since the buffer was bound
+	return mmvm->m_data ? mmvm->m_area.getVolume() : 0;
+}
+
+// __index(self, key)
+// Node values by flat array index, and the methods
+int LuaVoxelBuffer::mt_index(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	// Metamethods only get called with a VoxelBuffer, as the metatable is
+	// hidden: no need to check it on every node
+	LuaVoxelBuffer *o = *(LuaVoxelBuffer **)(lua_touserdata(L, 1));
+
+	if (lua_type(L, 2) != LUA_TNUMBER) {
+		lua_pushvalue(L, 2);
+		lua_rawget(L, lua_upvalueindex(1));
+		return 1;
+	}
+
+	lua_Integer i = lua_tointeger(L, 2) - 1;
+	if (i < 0 || i >= (lua_Integer)o->getVolume())
+		return 0;
+
+	const MapNode &n = o->vm->vm->m_data[i];
+	switch (o->field) {
+	case VOXEL_BUFFER_CONTENT:
+		lua_pushinteger(L, n.getContent());
+		break;
+	case VOXEL_BUFFER_PARAM1:
+		lua_pushinteger(L, n.param1);
+		break;
+	case VOXEL_BUFFER_PARAM2:
+		lua_pushinteger(L, n.param2);
+		break;
+	}
+	return 1;
+}
+
+// __newindex(self, index, value)
+int LuaVoxelBuffer::mt_newindex(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = *(LuaVoxelBuffer **)(lua_touserdata(L, 1));
+	lua_Integer i     = luaL_checkinteger(L, 2) - 1;
+	lua_Integer value = luaL_checkinteger(L, 3);
+
+	if (i < 0 || i >= (lua_Integer)o->getVolume())
+		throw LuaError("VoxelBuffer index out of VoxelManipulator bounds");
+
+	MapNode &n = o->vm->vm->m_data[i];
+	switch (o->field) {
+	case VOXEL_BUFFER_CONTENT:
+		n.setContent(value);
+		break;
+	case VOXEL_BUFFER_PARAM1:
+		n.param1 = value;
+		break;
+	case VOXEL_BUFFER_PARAM2:
+		n.param2 = value;
+		break;
+	}
+	return 0;
+}
+
+// __len(self)
+int LuaVoxelBuffer::mt_len(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = *(LuaVoxelBuffer **)(lua_touserdata(L, 1));
+	lua_pushinteger(L, o->getVolume());
+	return 1;
+}
+
+// get_pointer(self) -> pointer to the field of the first node, stride in bytes
+int LuaVoxelBuffer::l_get_pointer(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+
+	// Only of use with the LuaJIT FFI
+#if USE_LUAJIT
+	MapNode *data = o->checkVManip()->m_data;
+	if (data == NULL)
+		return 0;
+
+	switch (o->field) {
+	case VOXEL_BUFFER_CONTENT:
+		lua_pushlightuserdata(L, &data->param0);
+		break;
+	case VOXEL_BUFFER_PARAM1:
+		lua_pushlightuserdata(L, &data->param1);
+		break;
+	case VOXEL_BUFFER_PARAM2:
+		lua_pushlightuserdata(L, &data->param2);
+		break;
+	}
+	lua_pushinteger(L, sizeof(MapNode));
+	return 2;
+#else
+	o->checkVManip();
+	lua_pushnil(L);
+	return 1;
+#endif
+}
+
+LuaVoxelBuffer::LuaVoxelBuffer() :
+	vm_ref(LUA_NOREF),
+	vm(NULL),
+	field(VOXEL_BUFFER_CONTENT)
+{
+}
+
+void LuaVoxelBuffer::bind(lua_State *L, int narg_vm, int narg_buffer,
+	VoxelBufferField field)
+{
+	LuaVoxelManip *vm = LuaVoxelManip::checkobject(L, narg_vm);
+
+	LuaVoxelBuffer *o = NULL;
+	if (lua_isuserdata(L, narg_buffer)) {
+		o = checkobject(L, narg_buffer);
+		lua_pushvalue(L, narg_buffer);
+	} else {
+		o = new LuaVoxelBuffer();
+		*(void **)(lua_newuserdata(L, sizeof(void *))) = o;
+		luaL_getmetatable(L, className);
+		lua_setmetatable(L, -2);
+	}
+
+	luaL_unref(L, LUA_REGISTRYINDEX, o->vm_ref);
+	lua_pushvalue(L, narg_vm);
+	o->vm_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	o->vm     = vm;
+	o->field  = field;
+}
+
+LuaVoxelBuffer *LuaVoxelBuffer::checkobject(lua_State *L, int narg)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	luaL_checktype(L, narg, LUA_TUSERDATA);
+
+	void *ud = luaL_checkudata(L, narg, className);
+	if (!ud)
+		luaL_typerror(L, narg, className);
+
+	return *(LuaVoxelBuffer **)ud;  // unbox pointer
+}
+
+void LuaVoxelBuffer::Register(lua_State *L)
+{
+	lua_newtable(L);
+	int methodtable = lua_gettop(L);
+	luaL_newmetatable(L, className);
+	int metatable = lua_gettop(L);
+
+	lua_pushliteral(L, "__metatable");
+	lua_pushvalue(L, methodtable);
+	lua_settable(L, metatable);  // hide metatable from Lua getmetatable()
+
+	// Numeric keys are node values, the others are looked up in methodtable
+	lua_pushliteral(L, "__index");
+	lua_pushvalue(L, methodtable);
+	lua_pushcclosure(L, mt_index, 1);
+	lua_settable(L, metatable);
+
+	lua_pushliteral(L, "__newindex");
+	lua_pushcfunction(L, mt_newindex);
+	lua_settable(L, metatable);
+
+	lua_pushliteral(L, "__len");
+	lua_pushcfunction(L, mt_len);
+	lua_settable(L, metatable);
+
+	lua_pushliteral(L, "__gc");
+	lua_pushcfunction(L, gc_object);
+	lua_settable(L, metatable);
+
+	lua_pop(L, 1);  // drop metatable
+
+	luaL_openlib(L, 0, methods, 0);  // fill methodtable
+	lua_pop(L, 1);  // drop methodtable
+
+	// Only created by VoxelManip:get_*_buffer()
+}
+
+const char LuaVoxelBuffer::className[] = "VoxelBuffer";
+const luaL_reg LuaVoxelBuffer::methods[] = {
+	luamethod(LuaVoxelBuffer, get_pointer),
+	{0,0}
+};
@@ -60,10 +60,15 @@ class LuaVoxelManip : public ModApiBase {
 	static int l_get_param2_data(lua_State *L);
 	static int l_set_param2_data(lua_State *L);
 
+	static int l_get_data_buffer(lua_State *L);
+	static int l_get_light_buffer(lua_State *L);
+	static int l_get_param2_buffer(lua_State *L);
+
 	static int l_was_modified(lua_State *L);
 	static int l_get_emerged_area(lua_State *L);
 
 public:
+	// NULL once the mapgen chunk of a mapgen VoxelManip is finished
 	MMVManip *vm;
 
 	LuaVoxelManip(MMVManip *mmvm, bool is_mapgen_vm);
@@ -77,6 +82,56 @@ class LuaVoxelManip : public ModApiBase {
 
 	static LuaVoxelManip *checkobject(lua_State *L, int narg);
 
+	// Leaves a VoxelManip of the chunk being generated on top of stack
+	static void pushMapgenObject(lua_State *L, MMVManip *mmvm);
+	// Called when the chunk is finished and its MMVManip deleted. Makes
+	// the mapgen VoxelManips pushed since the last call unusable.
+	static void invalidateMapgenObjects(lua_State *L);
+
+	static void Register(lua_State *L);
+};
+
+enum VoxelBufferField {
+	VOXEL_BUFFER_CONTENT,
+	VOXEL_BUFFER_PARAM1,
+	VOXEL_BUFFER_PARAM2,
+};
+
+/*
+  VoxelBuffer: a view of one field of the nodes of a VoxelManip, without
+  copying them to a table
+ */
+class LuaVoxelBuffer : public ModApiBase {
+private:
+	// Registry reference to the VoxelManip, so it lives as long as the buffer
+	int vm_ref;
+	LuaVoxelManip *vm;
+	VoxelBufferField field;
+
+	static const char className[];
+	static const luaL_reg methods[];
+
+	static int gc_object(lua_State *L);
+	static int mt_index(lua_State *L);
+	static int mt_newindex(lua_State *L);
+	static int mt_len(lua_State *L);
+
+	static int l_get_pointer(lua_State *L);
+
+	// Throws if the mapgen chunk of the VoxelManip is finished
+	MMVManip *checkVManip();
+	u32 getVolume();
+
+public:
+	LuaVoxelBuffer();
+
+	// Binds the buffer at index narg_buffer, or a new one if there is none,
+	// to the VoxelManip at index narg_vm and leaves it on top of stack
+	static void bind(lua_State *L, int narg_vm, int narg_buffer,
+		VoxelBufferField field);
+
+	static LuaVoxelBuffer *checkobject(lua_State *L, int narg);
+
 	static void Register(lua_State *L);
 };
 
@@ -0,0 +1,113 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "scripting_emerge.h"
+#include "emerge.h"
+#include "filesys.h"
+#include "log.h"
+#include "server.h"
+#include "settings.h"
+#include "cpp_api/s_internal.h"
+#include "common/c_converter.h"
+#include "lua_api/l_base.h"
+#include "lua_api/l_item.h"
+#include "lua_api/l_mapgen.h"
+#include "lua_api/l_noise.h"
+#include "lua_api/l_util.h"
+#include "lua_api/l_vmanip.h"
+
+extern "C" {
+#include "lualib.h"
+}
+
+EmergeScripting::EmergeScripting(Server *server)
+{
+	// The node definitions and the emerge manager are only read
+	// from here; there is no environment
+	setServer(server);
+
+	SCRIPTAPI_PRECHECKHEADER
+
+	if (g_settings->getBool("secure.enable_security")) {
+		initializeSecurity();
+	}
+
+	lua_getglobal(L, "core");
+	int top = lua_gettop(L);
+
+	// Initialize our lua_api modules
+	InitializeModApi(L, top);
+	lua_pop(L, 1);
+
+	// Push builtin initialization type
+	lua_pushstring(L, "mapgen");
+	lua_setglobal(L, "INIT");
+
+	infostream << "SCRIPTAPI: Initialized mapgen modules" << std::endl;
+}
+
+void EmergeScripting::InitializeModApi(lua_State *L, int top)
+{
+	// Initialize mod api modules
+	ModApiItemMod::InitializeEmerge(L, top);
+	ModApiMapgen::InitializeEmerge(L, top);
+	ModApiUtil::InitializeEmerge(L, top);
+
+	// Register reference classes (userdata)
+	LuaPerlinNoise::Register(L);
+	LuaPerlinNoiseMap::Register(L);
+	LuaPseudoRandom::Register(L);
+	LuaPcgRandom::Register(L);
+	LuaSecureRandom::Register(L);
+	LuaVoxelManip::Register(L);
+	LuaVoxelBuffer::Register(L);
+}
+
+void EmergeScripting::loadScripts(const std::vector<MapgenScript> &scripts)
+{
+	loadMod(getServer()->getBuiltinLuaPath() + DIR_DELIM "init.lua",
+		BUILTIN_MOD_NAME);
+
+	for (size_t i = 0; i != scripts.size(); i++)
+		loadMod(scripts[i].path, scripts[i].mod_name);
+}
+
+void EmergeScripting::on_generated(MMVManip *vm, v3s16 minp, v3s16 maxp,
+	u32 blockseed)
+{
+	SCRIPTAPI_PRECHECKHEADER
+
+	int error_handler = PUSH_ERROR_HANDLER(L);
+
+	lua_getglobal(L, "core");
+	lua_getfield(L, -1, "run_on_generated");
+	lua_remove(L, -2);
+	luaL_checktype(L, -1, LUA_TFUNCTION);
+
+	LuaVoxelManip::pushMapgenObject(L, vm);
+	push_v3s16(L, minp);
+	push_v3s16(L, maxp);
+	lua_pushnumber(L, blockseed);
+
+	int result = lua_pcall(L, 4, 0, error_handler);
+	// The chunk is finished after this, also if a callback failed
+	LuaVoxelManip::invalidateMapgenObjects(L);
+	PCALL_RES(result);
+	lua_pop(L, 1); // Pop error handler
+}
@@ -0,0 +1,57 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef SCRIPTING_EMERGE_H_
+#define SCRIPTING_EMERGE_H_
+
+#include <vector>
+#include "cpp_api/s_base.h"
+#include "cpp_api/s_security.h"
+#include "irr_v3d.h"
+
+class MMVManip;
+struct MapgenScript;
+
+/*****************************************************************************/
+/* Scripting <-> Emerge thread Interface                                     */
+/*****************************************************************************/
+
+/*
+	Lua environment of an emerge thread.  It only sees the mapchunk being
+	generated, so the scripts run without the environment lock.
+*/
+class EmergeScripting :
+		virtual public ScriptApiBase,
+		public ScriptApiSecurity
+{
+public:
+	EmergeScripting(Server *server);
+
+	// These throw a ModError on failure
+	void loadScripts(const std::vector<MapgenScript> &scripts);
+
+	// Runs the registered on_generated callbacks on the VoxelManip of the
+	// mapchunk, before it is written to the map
+	void on_generated(MMVManip *vm, v3s16 minp, v3s16 maxp, u32 blockseed);
+
+private:
+	void InitializeModApi(lua_State *L, int top);
+};
+
+#endif /* SCRIPTING_EMERGE_H_ */
@@ -102,6 +102,7 @@ void GameScripting::InitializeModApi(lua_State *L, int top)
 	LuaPcgRandom::Register(L);
 	LuaSecureRandom::Register(L);
 	LuaVoxelManip::Register(L);
+	LuaVoxelBuffer::Register(L);
 	NodeMetaRef::Register(L);
 	NodeTimerRef::Register(L);
 	ObjectRef::Register(L);
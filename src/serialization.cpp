@@ -19,11 +19,24 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "serialization.h"
 
+#include "log.h"
 #include "util/serialize.h"
 #ifdef _WIN32
 	#define ZLIB_WINAPI
 #endif
 #include "zlib.h"
+#include "config.h"
+#if USE_LZ4
+	#include <lz4.h>
+#endif
+#if USE_ZSTD
+	#include <zstd.h>
+#endif
+#include <vector>
+
+// Refuse to decompress more than this, to not run out of memory on
+// corrupted data
+#define CODEC_MAX_RAW_SIZE (256 * 1024 * 1024)
 
 /* report a zlib or i/o error */
 void zerr(int ret)
@@ -186,6 +199,188 @@ void decompressZlib(std::istream &is, std::ostream &os)
 	inflateEnd(&z);
 }
 
+bool compressionCodecSupported(CompressionCodec codec)
+{
+	switch (codec) {
+	case COMPRESSION_ZLIB:
+		return true;
+#if USE_LZ4
+	case COMPRESSION_LZ4:
+		return true;
+#endif
+#if USE_ZSTD
+	case COMPRESSION_ZSTD:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+u16 getSupportedCompressionCodecs()
+{
+	u16 codecs = 0;
+	for (int i = COMPRESSION_ZLIB + 1; i < COMPRESSION_CODEC_COUNT; i++) {
+		if (compressionCodecSupported((CompressionCodec)i))
+			codecs |= 1 << i;
+	}
+	return codecs;
+}
+
+const char *compressionCodecName(CompressionCodec codec)
+{
+	switch (codec) {
+	case COMPRESSION_ZLIB:
+		return "zlib";
+	case COMPRESSION_LZ4:
+		return "lz4";
+	case COMPRESSION_ZSTD:
+		return "zstd";
+	default:
+		return "unknown";
+	}
+}
+
+bool parseCompressionCodec(const std::string &name, CompressionCodec *codec)
+{
+	for (int i = 0; i < COMPRESSION_CODEC_COUNT; i++) {
+		if (name == compressionCodecName((CompressionCodec)i)) {
+			*codec = (CompressionCodec)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+CompressionCodec getCompressionCodecSetting(const std::string &name)
+{
+	CompressionCodec codec;
+	if (!parseCompressionCodec(name, &codec)) {
+		warningstream << "Unknown compression codec \"" << name
+			<< "\", using zlib" << std::endl;
+		return COMPRESSION_ZLIB;
+	}
+	if (!compressionCodecSupported(codec)) {
+		warningstream << "Compression codec \"" << name
+			<< "\" isn't supported by this build, using zlib" << std::endl;
+		return COMPRESSION_ZLIB;
+	}
+	return codec;
+}
+
+static void compressWithCodec(CompressionCodec codec, const char *data,
+	size_t size, std::ostream &os)
+{
+	std::vector<char> buf;
+	size_t compressed_size = 0;
+
+	switch (codec) {
+	case COMPRESSION_ZLIB:
+		compressZlib(std::string(data, size), os);
+		return;
+#if USE_LZ4
+	case COMPRESSION_LZ4: {
+		buf.resize(LZ4_compressBound(size));
+		int ret = LZ4_compress_default(data, &buf[0], size, buf.size());
+		if (ret <= 0)
+			throw SerializationError("compressWithCodec: LZ4 failed");
+		compressed_size = ret;
+		break;
+	}
+#endif
+#if USE_ZSTD
+	case COMPRESSION_ZSTD: {
+		buf.resize(ZSTD_compressBound(size));
+		// Level 0 is zstd's default
+		size_t ret = ZSTD_compress(&buf[0], buf.size(), data, size, 0);
+		if (ZSTD_isError(ret))
+			throw SerializationError(std::string("compressWithCodec: ") +
+				ZSTD_getErrorName(ret));
+		compressed_size = ret;
+		break;
+	}
+#endif
+	default:
+		throw SerializationError(std::string("compressWithCodec: ") +
+			compressionCodecName(codec) + " not supported by this build");
+	}
+
+	writeU32(os, size);
+	writeU32(os, compressed_size);
+	os.write(&buf[0], compressed_size);
+}
+
+void compressWithCodec(CompressionCodec codec, SharedBuffer<u8> data,
+	std::ostream &os)
+{
+	if (codec == COMPRESSION_ZLIB) {
+		compressZlib(data, os);
+		return;
+	}
+	compressWithCodec(codec, (const char *)*data, data.getSize(), os);
+}
+
+void compressWithCodec(CompressionCodec codec, const std::string &data,
+	std::ostream &os)
+{
+	compressWithCodec(codec, data.c_str(), data.size(), os);
+}
+
+void decompressWithCodec(CompressionCodec codec, std::istream &is,
+	std::ostream &os)
+{
+	if (codec == COMPRESSION_ZLIB) {
+		decompressZlib(is, os);
+		return;
+	}
+	if (!compressionCodecSupported(codec)) {
+		throw SerializationError(std::string("decompressWithCodec: ") +
+			compressionCodecName(codec) + " not supported by this build");
+	}
+
+	u32 raw_size = readU32(is);
+	u32 compressed_size = readU32(is);
+	if (raw_size > CODEC_MAX_RAW_SIZE || compressed_size > CODEC_MAX_RAW_SIZE)
+		throw SerializationError("decompressWithCodec: invalid size");
+
+	std::vector<char> in(compressed_size + 1);
+	is.read(&in[0], compressed_size);
+	if (is.gcount() != (std::streamsize)compressed_size)
+		throw SerializationError("decompressWithCodec: stream ended halfway");
+
+	std::vector<char> out(raw_size + 1);
+	size_t decompressed_size = 0;
+	switch (codec) {
+#if USE_LZ4
+	case COMPRESSION_LZ4: {
+		int ret = LZ4_decompress_safe(&in[0], &out[0], compressed_size,
+			raw_size);
+		if (ret < 0)
+			throw SerializationError("decompressWithCodec: LZ4 failed");
+		decompressed_size = ret;
+		break;
+	}
+#endif
+#if USE_ZSTD
+	case COMPRESSION_ZSTD: {
+		size_t ret = ZSTD_decompress(&out[0], raw_size, &in[0],
+			compressed_size);
+		if (ZSTD_isError(ret))
+			throw SerializationError(std::string("decompressWithCodec: ") +
+				ZSTD_getErrorName(ret));
+		decompressed_size = ret;
+		break;
+	}
+#endif
+	default:
+		break;
+	}
+
+	if (decompressed_size != raw_size)
+		throw SerializationError("decompressWithCodec: invalid size");
+	os.write(&out[0], raw_size);
+}
+
 void compress(SharedBuffer<u8> data, std::ostream &os, u8 version)
 {
 	if(version >= 11)
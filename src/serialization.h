@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "irrlichttypes.h"
 #include "exceptions.h"
 #include <iostream>
+#include <string>
 #include "util/pointer.h"
 
 /*
@@ -62,13 +63,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	24: 16-bit node ids and node timers (never released as stable)
 	25: Improved node timer format
 	26: Never written; read the same as 25
+	27: Compression codec of MapBlocks is stored, see CompressionCodec
 */
 // This represents an uninitialized or invalid format
 #define SER_FMT_VER_INVALID 255
 // Highest supported serialization version
-#define SER_FMT_VER_HIGHEST_READ 26
-// Saved on disk version
+#define SER_FMT_VER_HIGHEST_READ 27
+// Saved on disk version for blocks compressed with zlib
 #define SER_FMT_VER_HIGHEST_WRITE 25
+// Lowest version that can use a compression codec other than zlib
+#define SER_FMT_VER_COMPRESSION_CODEC 27
 // Lowest supported serialization version
 #define SER_FMT_VER_LOWEST_READ 0
 // Lowest serialization version for writing
@@ -88,6 +92,47 @@ void compressZlib(SharedBuffer<u8> data, std::ostream &os, int level = -1);
 void compressZlib(const std::string &data, std::ostream &os, int level = -1);
 void decompressZlib(std::istream &is, std::ostream &os);
 
+/*
+	Compression codecs for map blocks. The ids are stored in serialized
+	blocks, so they must never change.
+*/
+enum CompressionCodec
+{
+	COMPRESSION_ZLIB = 0,
+	// Fast
+	COMPRESSION_LZ4 = 1,
+	// Better ratio than zlib, faster too
+	COMPRESSION_ZSTD = 2,
+	COMPRESSION_CODEC_COUNT
+};
+
+// Whether this build can compress and decompress with codec
+bool compressionCodecSupported(CompressionCodec codec);
+// Has bit (1 << codec) set for every codec besides zlib that this build
+// supports; clients send it as their supported network compression modes
+u16 getSupportedCompressionCodecs();
+const char *compressionCodecName(CompressionCodec codec);
+// Returns false if name isn't a known codec
+bool parseCompressionCodec(const std::string &name, CompressionCodec *codec);
+// For settings: falls back to zlib with a warning if name isn't a codec
+// supported by this build
+CompressionCodec getCompressionCodecSetting(const std::string &name);
+// Serialization version to write blocks compressed with codec in
+inline u8 ser_ver_for_codec(CompressionCodec codec)
+{
+	return codec == COMPRESSION_ZLIB ? SER_FMT_VER_HIGHEST_WRITE :
+		SER_FMT_VER_COMPRESSION_CODEC;
+}
+
+// The output of LZ4 and Zstandard is prefixed with its size, so that
+// several compressed parts can follow each other in a stream like zlib's
+void compressWithCodec(CompressionCodec codec, SharedBuffer<u8> data,
+	std::ostream &os);
+void compressWithCodec(CompressionCodec codec, const std::string &data,
+	std::ostream &os);
+void decompressWithCodec(CompressionCodec codec, std::istream &is,
+	std::ostream &os);
+
 // These choose between zlib and a self-made one according to version
 void compress(SharedBuffer<u8> data, std::ostream &os, u8 version);
 //void compress(const std::string &data, std::ostream &os, u8 version);
@@ -58,6 +58,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "rollback.h"
 #include "util/serialize.h"
 #include "util/thread.h"
+#include "util/workerpool.h"
 #include "defaultsettings.h"
 #include "util/base64.h"
 #include "util/sha1.h"
@@ -71,6 +72,32 @@ class ClientNotFoundException : public BaseException
 	{}
 };
 
+// Serialized active object messages, as sent in TOCLIENT_ACTIVE_OBJECT_MESSAGES
+struct ObjectMessageData
+{
+	std::string reliable;
+	std::string unreliable;
+};
+
+static void serialize_object_messages(const std::vector<ActiveObjectMessage> &messages,
+		u16 protocol_version, ObjectMessageData &data)
+{
+	for (size_t i = 0; i < messages.size(); i++) {
+		const ActiveObjectMessage &aom = messages[i];
+		if (protocol_version < aom.min_protocol_version ||
+				protocol_version > aom.max_protocol_version)
+			continue;
+
+		std::string &stream = aom.reliable ? data.reliable : data.unreliable;
+		// Add object id
+		char buf[2];
+		writeU16((u8*)&buf[0], aom.id);
+		stream.append(buf, 2);
+		// Add data
+		stream += serializeString(aom.datastring);
+	}
+}
+
 class ServerThread : public Thread
 {
 public:
@@ -165,6 +192,7 @@ Server::Server(
 	m_rollback(NULL),
 	m_enable_rollback_recording(false),
 	m_emerge(NULL),
+	m_block_selection_pool(NULL),
 	m_script(NULL),
 	m_itemdef(createItemDefManager()),
 	m_nodedef(createNodeDefManager()),
@@ -217,6 +245,13 @@ Server::Server(
 	// Create emerge manager
 	m_emerge = new EmergeManager(this);
 
+	// Create block selection threads; none means selecting on this thread
+	m_block_selection_pool = new WorkerPool("BlockSelection",
+		g_settings->getU16("num_block_selection_threads"));
+
+	m_network_block_codec = getCompressionCodecSetting(
+		g_settings->get("network_compression_codec"));
+
 	// Create ban manager
 	std::string ban_path = m_path_world + DIR_DELIM "ipban.txt";
 	m_banmanager = new BanManager(ban_path);
@@ -402,6 +437,7 @@ Server::~Server()
 	m_emerge->stopThreads();
 
 	// Delete things in the reverse order of creation
+	delete m_block_selection_pool;
 	delete m_emerge;
 	delete m_env;
 	delete m_rollback;
@@ -734,8 +770,8 @@ void Server::AsyncRunStep(bool initial_step)
 				// Remove from known objects
 				client->m_known_objects.erase(id);
 
-				if(obj && obj->m_known_by_count > 0)
-					obj->m_known_by_count--;
+				if(obj)
+					obj->removeKnownByPeer(client->peer_id);
 				removed_objects.pop();
 			}
 
@@ -771,7 +807,7 @@ void Server::AsyncRunStep(bool initial_step)
 				client->m_known_objects.insert(id);
 
 				if(obj)
-					obj->m_known_by_count++;
+					obj->addKnownByPeer(client->peer_id);
 
 				added_objects.pop();
 			}
@@ -792,88 +828,65 @@ void Server::AsyncRunStep(bool initial_step)
 		MutexAutoLock envlock(m_env_mutex);
 		ScopeProfiler sp(g_profiler, "Server: sending object messages");
 
-		// Key = object id
-		// Value = data sent by object
-		std::map<u16, std::vector<ActiveObjectMessage>* > buffered_messages;
-
-		// Get active object messages from environment
+		/*
+			Collect the messages of each object, in the order the
+			objects sent them. Key = object id.
+		*/
+		std::map<u16, std::vector<ActiveObjectMessage> > object_messages;
 		for(;;) {
 			ActiveObjectMessage aom = m_env->getActiveObjectMessage();
 			if (aom.id == 0)
 				break;
-
-			std::vector<ActiveObjectMessage>* message_list = NULL;
-			std::map<u16, std::vector<ActiveObjectMessage>* >::iterator n;
-			n = buffered_messages.find(aom.id);
-			if (n == buffered_messages.end()) {
-				message_list = new std::vector<ActiveObjectMessage>;
-				buffered_messages[aom.id] = message_list;
-			}
-			else {
-				message_list = n->second;
-			}
-			message_list->push_back(aom);
+			object_messages[aom.id].push_back(aom);
 		}
 
+		/*
+			Route the data of every object to the peers that know it,
+			serializing it once per protocol version of those peers.
+			Key = peer id.
+		*/
+		std::map<u16, ObjectMessageData> peer_data;
 		m_clients.lock();
-		std::map<u16, RemoteClient*> clients = m_clients.getClientList();
-		// Route data to every client
-		for (std::map<u16, RemoteClient*>::iterator
-			i = clients.begin();
-			i != clients.end(); ++i) {
-			RemoteClient *client = i->second;
-			std::string reliable_data;
-			std::string unreliable_data;
-			// Go through all objects in message buffer
-			for (std::map<u16, std::vector<ActiveObjectMessage>* >::iterator
-					j = buffered_messages.begin();
-					j != buffered_messages.end(); ++j) {
-				// If object is not known by client, skip it
-				u16 id = j->first;
-				if (client->m_known_objects.find(id) == client->m_known_objects.end())
+		for (std::map<u16, std::vector<ActiveObjectMessage> >::iterator
+				i = object_messages.begin(); i != object_messages.end(); ++i) {
+			ServerActiveObject *obj = m_env->getActiveObject(i->first);
+			if (obj == NULL)
+				continue;
+
+			// Key = protocol version
+			std::map<u16, ObjectMessageData> object_data;
+			for (size_t j = 0; j < obj->m_known_by_peers.size(); j++) {
+				u16 peer_id = obj->m_known_by_peers[j];
+				// The peer may have left since it got to know the object
+				RemoteClient *client = m_clients.lockedGetClientNoEx(
+						peer_id, CS_Invalid);
+				if (client == NULL)
 					continue;
 
-				// Get message list of object
-				std::vector<ActiveObjectMessage>* list = j->second;
-				// Go through every message
-				for (std::vector<ActiveObjectMessage>::iterator
-						k = list->begin(); k != list->end(); ++k) {
-					// Compose the full new data with header
-					ActiveObjectMessage aom = *k;
-					std::string new_data;
-					// Add object id
-					char buf[2];
-					writeU16((u8*)&buf[0], aom.id);
-					new_data.append(buf, 2);
-					// Add data
-					new_data += serializeString(aom.datastring);
-					// Add data to buffer
-					if(aom.reliable)
-						reliable_data += new_data;
-					else
-						unreliable_data += new_data;
+				std::map<u16, ObjectMessageData>::iterator data =
+						object_data.find(client->net_proto_version);
+				if (data == object_data.end()) {
+					data = object_data.insert(std::make_pair(
+							client->net_proto_version, ObjectMessageData())).first;
+					serialize_object_messages(i->second,
+							client->net_proto_version, data->second);
 				}
+				peer_data[peer_id].reliable += data->second.reliable;
+				peer_data[peer_id].unreliable += data->second.unreliable;
 			}
-			/*
-				reliable_data and unreliable_data are now ready.
-				Send them.
-			*/
-			if(reliable_data.size() > 0) {
-				SendActiveObjectMessages(client->peer_id, reliable_data);
+		}
+
+		for (std::map<u16, ObjectMessageData>::iterator
+				i = peer_data.begin(); i != peer_data.end(); ++i) {
+			if(i->second.reliable.size() > 0) {
+				SendActiveObjectMessages(i->first, i->second.reliable);
 			}
 
-			if(unreliable_data.size() > 0) {
-				SendActiveObjectMessages(client->peer_id, unreliable_data, false);
+			if(i->second.unreliable.size() > 0) {
+				SendActiveObjectMessages(i->first, i->second.unreliable, false);
 			}
 		}
 		m_clients.unlock();
-
-		// Clear buffered_messages
-		for(std::map<u16, std::vector<ActiveObjectMessage>* >::iterator
-				i = buffered_messages.begin();
-				i != buffered_messages.end(); ++i) {
-			delete i->second;
-		}
 	}
 
 	/*
@@ -2122,28 +2135,59 @@ void Server::setBlockNotSent(v3s16 p)
 	m_clients.unlock();
 }
 
-void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver, u16 net_proto_version)
+void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver, u16 net_proto_version,
+		CompressionCodec codec)
 {
 	DSTACK(FUNCTION_NAME);
 
 	v3s16 p = block->getPos();
 
 	/*
-		Create a packet with the block in the right format
+		Create a packet with the block in the right format.
+		The serialized block is shared between all clients using the
+		same versions and only rebuilt after the block is modified.
+		It isn't copied into the packet, the connection sends it as it is.
 	*/
 
-	std::ostringstream os(std::ios_base::binary);
-	block->serialize(os, ver, false);
-	block->serializeNetworkSpecific(os, net_proto_version);
-	std::string s = os.str();
+	SharedSlice<u8> data = block->getNetworkSerialization(ver,
+		net_proto_version, codec);
 
-	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + 2 + s.size(), peer_id);
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2, peer_id);
 
 	pkt << p;
-	pkt.putRawString(s.c_str(), s.size());
+	pkt.putSharedData(data);
 	Send(&pkt);
 }
 
+/*
+	Selects the blocks to send to one client; see Server::SendBlocks()
+*/
+class BlockSelectionJob : public WorkerJob
+{
+public:
+	BlockSelectionJob(RemoteClient *client, ServerEnvironment *env,
+			EmergeManager *emerge, float dtime):
+		m_client(client),
+		m_env(env),
+		m_emerge(emerge),
+		m_dtime(dtime)
+	{}
+
+	void run()
+	{
+		m_client->GetNextBlocks(m_env, m_emerge, m_dtime, dest, used_blocks);
+	}
+
+	std::vector<PrioritySortedBlockTransfer> dest;
+	std::vector<MapBlock *> used_blocks;
+
+private:
+	RemoteClient *m_client;
+	ServerEnvironment *m_env;
+	EmergeManager *m_emerge;
+	float m_dtime;
+};
+
 void Server::SendBlocks(float dtime)
 {
 	DSTACK(FUNCTION_NAME);
@@ -2161,6 +2205,8 @@ void Server::SendBlocks(float dtime)
 		ScopeProfiler sp(g_profiler, "Server: selecting blocks for sending");
 
 		std::vector<u16> clients = m_clients.getClientIDs();
+		std::vector<WorkerJob *> jobs;
+		std::vector<v3s16> player_positions;
 
 		m_clients.lock();
 		for(std::vector<u16>::iterator i = clients.begin();
@@ -2171,9 +2217,35 @@ void Server::SendBlocks(float dtime)
 				continue;
 
 			total_sending += client->SendingCount();
-			client->GetNextBlocks(m_env,m_emerge, dtime, queue);
+			jobs.push_back(new BlockSelectionJob(client, m_env, m_emerge, dtime));
+
+			Player *player = m_env->getPlayer(*i);
+			if (player != NULL)
+				player_positions.push_back(getNodeBlockPos(
+					floatToInt(player->getPosition(), BS)));
 		}
+
+		// The blocks the clients are about to ask for go first
+		m_emerge->setPlayerPositions(player_positions);
+
+		// Neither the map nor the clients change until this returns,
+		// so the clients can look at the map in parallel
+		m_block_selection_pool->run(jobs);
 		m_clients.unlock();
+
+		for (std::vector<WorkerJob *>::iterator i = jobs.begin();
+				i != jobs.end(); ++i) {
+			BlockSelectionJob *job = (BlockSelectionJob *)*i;
+
+			queue.insert(queue.end(), job->dest.begin(), job->dest.end());
+
+			// Reset usage timer, these blocks will be of use in the future
+			for (std::vector<MapBlock *>::iterator j = job->used_blocks.begin();
+					j != job->used_blocks.end(); ++j)
+				(*j)->resetUsageTimer();
+
+			delete job;
+		}
 	}
 
 	// Sort.
@@ -2206,7 +2278,11 @@ void Server::SendBlocks(float dtime)
 		if(!client)
 			continue;
 
-		SendBlockNoLock(q.peer_id, block, client->serialization_version, client->net_proto_version);
+		// Clients built without the codec get zlib
+		CompressionCodec codec = client->canReceiveBlockCodec(m_network_block_codec) ?
+			m_network_block_codec : COMPRESSION_ZLIB;
+		SendBlockNoLock(q.peer_id, block, client->serialization_version,
+			client->net_proto_version, codec);
 
 		client->SentBlock(q.pos);
 		total_sending++;
@@ -57,6 +57,7 @@ class GameScripting;
 class ServerEnvironment;
 struct SimpleSoundSpec;
 class ServerThread;
+class WorkerPool;
 
 enum ClientDeletionReason {
 	CDR_LEAVE,
@@ -438,7 +439,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void setBlockNotSent(v3s16 p);
 
 	// Environment and Connection must be locked when called
-	void SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver, u16 net_proto_version);
+	void SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver, u16 net_proto_version,
+			CompressionCodec codec);
 
 	// Sends blocks to clients (locks env and con on its own)
 	void SendBlocks(float dtime);
@@ -552,6 +554,13 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// Emerge manager
 	EmergeManager *m_emerge;
 
+	// Runs block selection for the clients in SendBlocks()
+	WorkerPool *m_block_selection_pool;
+
+	// Codec that blocks sent to clients are compressed with, if they
+	// can read it
+	CompressionCodec m_network_block_codec;
+
 	// Scripting
 	// Envlock and conlock should be locked when using Lua
 	GameScripting *m_script;
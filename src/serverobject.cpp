@@ -18,13 +18,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "serverobject.h"
+#include <algorithm>
 #include <fstream>
 #include "inventory.h"
 #include "constants.h" // BS
+#include "environment.h"
 
 ServerActiveObject::ServerActiveObject(ServerEnvironment *env, v3f pos):
 	ActiveObject(0),
-	m_known_by_count(0),
 	m_removed(false),
 	m_pending_deactivation(false),
 	m_static_exists(false),
@@ -38,6 +39,28 @@ ServerActiveObject::~ServerActiveObject()
 {
 }
 
+void ServerActiveObject::addKnownByPeer(u16 peer_id)
+{
+	if (std::find(m_known_by_peers.begin(), m_known_by_peers.end(),
+			peer_id) == m_known_by_peers.end())
+		m_known_by_peers.push_back(peer_id);
+}
+
+void ServerActiveObject::removeKnownByPeer(u16 peer_id)
+{
+	std::vector<u16>::iterator i = std::find(m_known_by_peers.begin(),
+		m_known_by_peers.end(), peer_id);
+	if (i != m_known_by_peers.end())
+		m_known_by_peers.erase(i);
+}
+
+void ServerActiveObject::setBasePosition(v3f pos)
+{
+	m_base_position = pos;
+	if (m_env)
+		m_env->activeObjectMoved(this);
+}
+
 ServerActiveObject* ServerActiveObject::create(ActiveObjectType type,
 		ServerEnvironment *env, u16 id, v3f pos,
 		const std::string &data)
@@ -79,7 +79,8 @@ class ServerActiveObject : public ActiveObject
 		Some simple getters/setters
 	*/
 	v3f getBasePosition(){ return m_base_position; }
-	void setBasePosition(v3f pos){ m_base_position = pos; }
+	// Keeps the object index of the environment up to date
+	void setBasePosition(v3f pos);
 	ServerEnvironment* getEnv(){ return m_env; }
 	
 	/*
@@ -191,11 +192,13 @@ class ServerActiveObject : public ActiveObject
 	virtual bool setWieldedItem(const ItemStack &item);
 
 	/*
-		Number of players which know about this object. Object won't be
-		deleted until this is 0 to keep the id preserved for the right
+		Peers of the players which know about this object. Object won't be
+		deleted until this is empty to keep the id preserved for the right
 		object.
 	*/
-	u16 m_known_by_count;
+	std::vector<u16> m_known_by_peers;
+	void addKnownByPeer(u16 peer_id);
+	void removeKnownByPeer(u16 peer_id);
 
 	/*
 		- Whether this object is to be removed when nobody knows about
@@ -214,7 +217,7 @@ class ServerActiveObject : public ActiveObject
 		reserved for some client.
 
 		The environment checks this periodically. If this is true and also
-		m_known_by_count is true, object is deleted from the active object
+		m_known_by_peers is empty, object is deleted from the active object
 		list.
 	*/
 	bool m_pending_deactivation;
@@ -242,6 +245,7 @@ class ServerActiveObject : public ActiveObject
 	static void registerType(u16 type, Factory f);
 
 	ServerEnvironment *m_env;
+	// Only change this through setBasePosition()
 	v3f m_base_position;
 
 private:
@@ -401,9 +401,9 @@ u32 ShaderSource::getShader(const std::string &name,
 	} else {
 		/*errorstream<<"getShader(): Queued: name=\""<<name<<"\""<<std::endl;*/
 
-		// We're gonna ask the result to be put into here
-
-		static ResultQueue<std::string, u32, u8, u8> result_queue;
+		// We're gonna ask the result to be put into here.  Each call has
+		// its own, as mesh update threads wait for shaders at the same time.
+		ResultQueue<std::string, u32, u8, u8> result_queue;
 
 		// Throw a request in
 		m_get_shader_queue.add(name, 0, 0, &result_queue);
@@ -411,18 +411,7 @@ u32 ShaderSource::getShader(const std::string &name,
 		/* infostream<<"Waiting for shader from main thread, name=\""
 				<<name<<"\""<<std::endl;*/
 
-		while(true) {
-			GetResult<std::string, u32, u8, u8>
-				result = result_queue.pop_frontNoEx();
-
-			if (result.key == name) {
-				return result.item;
-			}
-			else {
-				errorstream << "Got shader with invalid name: " << result.key << std::endl;
-			}
-		}
-
+		return result_queue.pop_frontNoEx().item;
 	}
 
 	infostream<<"getShader(): Failed"<<std::endl;
@@ -50,6 +50,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #else
 	#include <sys/types.h>
 	#include <sys/socket.h>
+	#include <sys/uio.h>
 	#include <netinet/in.h>
 	#include <fcntl.h>
 	#include <netdb.h>
@@ -412,6 +413,12 @@ void UDPSocket::Bind(Address addr)
 }
 
 void UDPSocket::Send(const Address & destination, const void * data, int size)
+{
+	Send(destination, NULL, 0, data, size);
+}
+
+void UDPSocket::Send(const Address & destination, const void * header,
+		int header_size, const void * data, int size)
 {
 	bool dumping_packet = false; // for INTERNET_SIMULATOR
 
@@ -422,18 +429,20 @@ void UDPSocket::Send(const Address & destination, const void * data, int size)
 		// Print packet destination and size
 		dstream << (int)m_handle << " -> ";
 		destination.print(&dstream);
-		dstream << ", size=" << size;
+		dstream << ", size=" << header_size + size;
 
 		// Print packet contents
 		dstream << ", data=";
-		for(int i = 0; i < size && i < 20; i++) {
+		for(int i = 0; i < header_size + size && i < 20; i++) {
 			if(i % 2 == 0)
 				dstream << " ";
-			unsigned int a = ((const unsigned char *)data)[i];
+			unsigned int a = i < header_size ?
+				((const unsigned char *)header)[i] :
+				((const unsigned char *)data)[i - header_size];
 			dstream << std::hex << std::setw(2) << std::setfill('0') << a;
 		}
 
-		if(size > 20)
+		if(header_size + size > 20)
 			dstream << "...";
 
 		if(dumping_packet)
@@ -452,23 +461,149 @@ void UDPSocket::Send(const Address & destination, const void * data, int size)
 	if(destination.getFamily() != m_addr_family)
 		throw SendFailedException("Address family mismatch");
 
-	int sent;
+	struct sockaddr_in6 address6;
+	struct sockaddr_in address4;
+	struct sockaddr *address;
+	socklen_t address_len;
 	if(m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address = destination.getAddress6();
-		address.sin6_port = htons(destination.getPort());
-		sent = sendto(m_handle, (const char *)data, size,
-				0, (struct sockaddr *)&address, sizeof(struct sockaddr_in6));
+		address6 = destination.getAddress6();
+		address6.sin6_port = htons(destination.getPort());
+		address = (struct sockaddr *)&address6;
+		address_len = sizeof(struct sockaddr_in6);
 	} else {
-		struct sockaddr_in address = destination.getAddress();
-		address.sin_port = htons(destination.getPort());
-		sent = sendto(m_handle, (const char *)data, size,
-				0, (struct sockaddr *)&address, sizeof(struct sockaddr_in));
+		address4 = destination.getAddress();
+		address4.sin_port = htons(destination.getPort());
+		address = (struct sockaddr *)&address4;
+		address_len = sizeof(struct sockaddr_in);
 	}
 
-	if(sent != size)
+	// Hand both parts to the system, which gathers them into the datagram
+	int sent;
+#ifdef _WIN32
+	WSABUF bufs[2];
+	bufs[0].buf = (char *)header;
+	bufs[0].len = header_size;
+	bufs[1].buf = (char *)data;
+	bufs[1].len = size;
+	DWORD bytes_sent = 0;
+	if (WSASendTo(m_handle, header_size ? bufs : &bufs[1],
+			header_size ? 2 : 1, &bytes_sent, 0, address, address_len,
+			NULL, NULL) != 0)
+		sent = -1;
+	else
+		sent = bytes_sent;
+#else
+	struct iovec iov[2];
+	iov[0].iov_base = (void *)header;
+	iov[0].iov_len = header_size;
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = size;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = address;
+	msg.msg_namelen = address_len;
+	msg.msg_iov = header_size ? iov : &iov[1];
+	msg.msg_iovlen = header_size ? 2 : 1;
+	sent = sendmsg(m_handle, &msg, 0);
+#endif
+
+	if(sent != header_size + size)
 		throw SendFailedException("Failed to send packet");
 }
 
+#if HAVE_SOCKET_BATCHING
+// Fills in the socket address of an Address, returns its length
+static socklen_t get_sockaddr(const Address &address,
+		struct sockaddr_storage *storage)
+{
+	memset(storage, 0, sizeof(*storage));
+	if (address.getFamily() == AF_INET6) {
+		struct sockaddr_in6 *address6 = (struct sockaddr_in6 *)storage;
+		*address6 = address.getAddress6();
+		address6->sin6_port = htons(address.getPort());
+		return sizeof(struct sockaddr_in6);
+	}
+	struct sockaddr_in *address4 = (struct sockaddr_in *)storage;
+	*address4 = address.getAddress();
+	address4->sin_port = htons(address.getPort());
+	return sizeof(struct sockaddr_in);
+}
+
+static Address get_address(const struct sockaddr_storage *storage)
+{
+	if (storage->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *address6 =
+			(const struct sockaddr_in6 *)storage;
+		IPv6AddressBytes bytes;
+		memcpy(bytes.bytes, address6->sin6_addr.s6_addr, 16);
+		return Address(&bytes, ntohs(address6->sin6_port));
+	}
+	const struct sockaddr_in *address4 = (const struct sockaddr_in *)storage;
+	return Address(ntohl(address4->sin_addr.s_addr),
+		ntohs(address4->sin_port));
+}
+#endif
+
+int UDPSocket::Send(const UDPDatagram * datagrams, int count)
+{
+	int sent = 0;
+
+#if HAVE_SOCKET_BATCHING
+	// The simulator and the debug output work on single datagrams
+	if (!INTERNET_SIMULATOR && !socket_enable_debug_output) {
+		m_send_msgs.resize(count);
+		m_send_iovs.resize(count * 2);
+		m_send_addrs.resize(count);
+
+		int n = 0;
+		for (int i = 0; i < count; i++) {
+			const UDPDatagram &d = datagrams[i];
+			if (d.destination.getFamily() != m_addr_family)
+				continue;
+
+			struct iovec *iov = &m_send_iovs[n * 2];
+			iov[0].iov_base = (void *)d.header;
+			iov[0].iov_len = d.header_size;
+			iov[1].iov_base = (void *)d.data;
+			iov[1].iov_len = d.size;
+
+			memset(&m_send_msgs[n], 0, sizeof(m_send_msgs[n]));
+			struct msghdr &msg = m_send_msgs[n].msg_hdr;
+			msg.msg_name = &m_send_addrs[n];
+			msg.msg_namelen = get_sockaddr(d.destination, &m_send_addrs[n]);
+			msg.msg_iov = d.header_size ? iov : &iov[1];
+			msg.msg_iovlen = d.header_size ? 2 : 1;
+			n++;
+		}
+
+		int i = 0;
+		while (i < n) {
+			int result = sendmmsg(m_handle, &m_send_msgs[i], n - i, 0);
+			if (result < 0 && errno == EINTR)
+				continue;
+			if (result <= 0) {
+				// Datagram i failed, go on with the ones after it
+				i++;
+				continue;
+			}
+			sent += result;
+			i += result;
+		}
+		return sent;
+	}
+#endif
+
+	for (int i = 0; i < count; i++) {
+		const UDPDatagram &d = datagrams[i];
+		try {
+			Send(d.destination, d.header, d.header_size, d.data, d.size);
+			sent++;
+		} catch (SendFailedException &e) {
+		}
+	}
+	return sent;
+}
+
 int UDPSocket::Receive(Address & sender, void *data, int size)
 {
 	// Return on timeout
@@ -532,6 +667,49 @@ int UDPSocket::Receive(Address & sender, void *data, int size)
 	return received;
 }
 
+int UDPSocket::Receive(Address * senders, void * data, int size,
+		int * sizes, int count)
+{
+#if HAVE_SOCKET_BATCHING
+	if (count > 1 && !socket_enable_debug_output) {
+		if (WaitData(m_timeout_ms) == false)
+			return 0;
+
+		m_recv_msgs.resize(count);
+		m_recv_iovs.resize(count);
+		m_recv_addrs.resize(count);
+		for (int i = 0; i < count; i++) {
+			m_recv_iovs[i].iov_base = (char *)data + i * size;
+			m_recv_iovs[i].iov_len = size;
+			memset(&m_recv_msgs[i], 0, sizeof(m_recv_msgs[i]));
+			struct msghdr &msg = m_recv_msgs[i].msg_hdr;
+			msg.msg_name = &m_recv_addrs[i];
+			msg.msg_namelen = sizeof(m_recv_addrs[i]);
+			msg.msg_iov = &m_recv_iovs[i];
+			msg.msg_iovlen = 1;
+		}
+
+		// Only take what is already there
+		int received = recvmmsg(m_handle, &m_recv_msgs[0], count, MSG_DONTWAIT,
+				NULL);
+		if (received < 0)
+			return 0;
+
+		for (int i = 0; i < received; i++) {
+			senders[i] = get_address(&m_recv_addrs[i]);
+			sizes[i] = m_recv_msgs[i].msg_len;
+		}
+		return received;
+	}
+#endif
+
+	int received = Receive(senders[0], data, size);
+	if (received < 0)
+		return 0;
+	sizes[0] = received;
+	return 1;
+}
+
 int UDPSocket::GetHandle()
 {
 	return m_handle;
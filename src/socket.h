@@ -32,14 +32,23 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	#include <ws2tcpip.h>
 #else
 	#include <sys/socket.h>
+	#include <sys/uio.h>
 	#include <netinet/in.h>
 #endif
 
 #include <ostream>
 #include <string.h>
+#include <vector>
 #include "irrlichttypes.h"
 #include "exceptions.h"
 
+// Whether UDPSocket can move several datagrams with one system call
+#if defined(__linux__) && !defined(__ANDROID__)
+	#define HAVE_SOCKET_BATCHING 1
+#else
+	#define HAVE_SOCKET_BATCHING 0
+#endif
+
 extern bool socket_enable_debug_output;
 
 class SocketException : public BaseException
@@ -112,6 +121,16 @@ class Address
 	u16 m_port; // Port is separate from sockaddr structures
 };
 
+// A datagram made of a header followed by data, see UDPSocket::Send
+struct UDPDatagram
+{
+	Address destination;
+	const void *header;
+	int header_size;
+	const void *data;
+	int size;
+};
+
 class UDPSocket
 {
 public:
@@ -125,8 +144,19 @@ class UDPSocket
 	//void Close();
 	//bool IsOpen();
 	void Send(const Address & destination, const void * data, int size);
+	// Sends header and data as one datagram, without joining them first
+	void Send(const Address & destination, const void * header,
+			int header_size, const void * data, int size);
+	// Sends count datagrams, several per system call where possible.
+	// Returns how many of them were sent.
+	int Send(const UDPDatagram * datagrams, int count);
 	// Returns -1 if there is no data
 	int Receive(Address & sender, void * data, int size);
+	// Receives up to count datagrams, several per system call where
+	// possible. Datagram i is put at data + i * size and its size into
+	// sizes[i]. Returns how many were received, 0 if there is no data.
+	int Receive(Address * senders, void * data, int size, int * sizes,
+			int count);
 	int GetHandle(); // For debugging purposes only
 	void setTimeoutMs(int timeout_ms);
 	// Returns true if there is data, false if timeout occurred
@@ -135,6 +165,17 @@ class UDPSocket
 	int m_handle;
 	int m_timeout_ms;
 	int m_addr_family;
+
+#if HAVE_SOCKET_BATCHING
+	// Scratch space for sendmmsg and recvmmsg, separate as sending and
+	// receiving may happen in different threads
+	std::vector<struct mmsghdr> m_send_msgs;
+	std::vector<struct iovec> m_send_iovs;
+	std::vector<struct sockaddr_storage> m_send_addrs;
+	std::vector<struct mmsghdr> m_recv_msgs;
+	std::vector<struct iovec> m_recv_iovs;
+	std::vector<struct sockaddr_storage> m_recv_addrs;
+#endif
 };
 
 #endif
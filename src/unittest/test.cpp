@@ -23,6 +23,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 #include "itemdef.h"
 #include "gamedef.h"
+#include "map.h"
+#include "mapsector.h"
 
 content_t t_CONTENT_STONE;
 content_t t_CONTENT_GRASS;
@@ -30,6 +32,7 @@ content_t t_CONTENT_TORCH;
 content_t t_CONTENT_WATER;
 content_t t_CONTENT_LAVA;
 content_t t_CONTENT_BRICK;
+content_t t_CONTENT_WATER_FLOWING;
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -77,6 +80,14 @@ TestGameDef::TestGameDef()
 {
 	m_itemdef = createItemDefManager();
 	m_nodedef = createNodeDefManager();
+	m_craftdef = NULL;
+	m_texturesrc = NULL;
+	m_shadersrc = NULL;
+	m_soundmgr = NULL;
+	m_eventmgr = NULL;
+	m_scenemgr = NULL;
+	m_rollbackmgr = NULL;
+	m_emergemgr = NULL;
 
 	defineSomeNodes();
 }
@@ -162,6 +173,8 @@ void TestGameDef::defineSomeNodes()
 	f.alpha = 128;
 	f.liquid_type = LIQUID_SOURCE;
 	f.liquid_viscosity = 4;
+	f.liquid_alternative_flowing = "default:water_flowing";
+	f.liquid_alternative_source = "default:water";
 	f.is_ground_content = true;
 	f.groups["liquids"] = 3;
 	for(int i = 0; i < 6; i++)
@@ -209,16 +222,68 @@ void TestGameDef::defineSomeNodes()
 	f.is_ground_content = true;
 	idef->registerItem(itemdef);
 	t_CONTENT_BRICK = ndef->set(f.name, f);
+
+	//// Flowing water
+	itemdef = ItemDefinition();
+	itemdef.type = ITEM_NODE;
+	itemdef.name = "default:water_flowing";
+	f = ContentFeatures();
+	f.name = itemdef.name;
+	f.alpha = 128;
+	f.param_type_2 = CPT2_FLOWINGLIQUID;
+	f.liquid_type = LIQUID_FLOWING;
+	f.liquid_viscosity = 4;
+	f.liquid_alternative_flowing = "default:water_flowing";
+	f.liquid_alternative_source = "default:water";
+	for(int i = 0; i < 6; i++)
+		f.tiledef[i].name = "default_water.png";
+	idef->registerItem(itemdef);
+	t_CONTENT_WATER_FLOWING = ndef->set(f.name, f);
+}
+
+////
+//// Test maps
+////
+
+Map *make_test_map(IGameDef *gamedef, s16 radius, s16 y_min, s16 y_max,
+	TestTerrain &terrain)
+{
+	Map *map = new Map(dstream, gamedef);
+
+	std::map<v2s16, MapSector *> *sectors = map->getSectorsPtr();
+	for (s16 z = -radius; z < radius; z++)
+	for (s16 x = -radius; x < radius; x++) {
+		v2s16 p2d(x, z);
+		MapSector *sector = new ServerMapSector(map, p2d, gamedef);
+		(*sectors)[p2d] = sector;
+		for (s16 y = y_min; y <= y_max; y++)
+			sector->createBlankBlock(y);
+	}
+
+	const s16 r = radius * MAP_BLOCKSIZE;
+	for (s16 z = -r; z < r; z++)
+	for (s16 x = -r; x < r; x++) {
+		s16 ground = terrain.getGroundHeight(x, z);
+		for (s16 y = y_min * MAP_BLOCKSIZE;
+				y < (y_max + 1) * MAP_BLOCKSIZE; y++) {
+			v3s16 p(x, y, z);
+			MapNode n = terrain.getNode(p, ground);
+			map->setNode(p, n);
+		}
+	}
+	return map;
 }
 
 ////
 //// run_tests
 ////
 
-bool run_tests()
+bool run_tests(bool run_benchmarks)
 {
 	DSTACK(FUNCTION_NAME);
 
+	TestManager::runBenchmarks() = run_benchmarks;
+
 	u32 t1 = porting::getTime(PRECISION_MILLI);
 	TestGameDef gamedef;
 
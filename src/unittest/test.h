@@ -50,6 +50,13 @@ class TestFailedException : public std::exception {
 	rawstream << #fxn << " - " << tdiff << "ms" << std::endl;                 \
 } while (0)
 
+// Runs a benchmark like a unit test, but only with --run-benchmarks, as
+// benchmarks take long and their timings are only printed
+#define BENCH(...) do {                                                       \
+	if (TestManager::runBenchmarks())                                         \
+		TEST(__VA_ARGS__);                                                    \
+} while (0)
+
 // Asserts the specified condition is true, or fails the current unit test
 #define UASSERT(x) do {                                         \
 	if (!(x)) {                                                 \
@@ -132,6 +139,13 @@ class TestManager {
 	{
 		getTestModules().push_back(module);
 	}
+
+	// Whether BENCH() runs the benchmarks
+	static bool &runBenchmarks()
+	{
+		static bool m_run_benchmarks = false;
+		return m_run_benchmarks;
+	}
 };
 
 // A few item and node definitions for those tests that need them
@@ -141,7 +155,28 @@ extern content_t t_CONTENT_TORCH;
 extern content_t t_CONTENT_WATER;
 extern content_t t_CONTENT_LAVA;
 extern content_t t_CONTENT_BRICK;
+extern content_t t_CONTENT_WATER_FLOWING;
+
+class Map;
+
+/*
+	Terrain of a test map, given by the height of the ground in each column
+	and the node at each height of it.
+*/
+class TestTerrain {
+public:
+	virtual ~TestTerrain() {}
+
+	// Called once for each column, in the order of z and then x
+	virtual s16 getGroundHeight(s16 x, s16 z) = 0;
+	virtual MapNode getNode(v3s16 p, s16 ground) = 0;
+};
+
+// Makes a Map of the blocks from -radius to radius - 1 in x and z, and
+// from y_min to y_max, with all their nodes set from terrain
+Map *make_test_map(IGameDef *gamedef, s16 radius, s16 y_min, s16 y_max,
+	TestTerrain &terrain);
 
-bool run_tests();
+bool run_tests(bool run_benchmarks);
 
 #endif
@@ -0,0 +1,514 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "environment.h"
+#include "gamedef.h"
+#include "map.h"
+#include "mapblock.h"
+#include "mapsector.h"
+#include "noise.h"
+#include "voxel.h"
+
+#define BENCH_MAP_RADIUS 2
+#define BENCH_PASSES 10
+
+class TestABM : public TestBase {
+public:
+	TestABM() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestABM"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testBlockContents(IGameDef *gamedef);
+	void testContentLookup();
+	void testNeighborWindow();
+	void testFindCandidates();
+	void testTriggerCandidates();
+	void benchScanMapLookup();
+	void benchScanContentLookup();
+
+	void makeMap(IGameDef *gamedef);
+	u32 countCandidatesReference();
+
+	Map *m_map;
+	u32 m_expected_candidates;
+};
+
+static TestABM g_test_instance;
+
+void TestABM::runTests(IGameDef *gamedef)
+{
+	TEST(testBlockContents, gamedef);
+
+	makeMap(gamedef);
+	m_expected_candidates = countCandidatesReference();
+
+	TEST(testContentLookup);
+	TEST(testNeighborWindow);
+	TEST(testFindCandidates);
+	TEST(testTriggerCandidates);
+
+	// Compare these two to see how the ABM node scan performs
+	BENCH(benchScanMapLookup);
+	BENCH(benchScanContentLookup);
+
+	delete m_map;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+	The test ABMs: stone next to water, and grass anywhere.
+*/
+
+static ActiveABM make_aabm(content_t neighbor)
+{
+	ActiveABM aabm;
+	aabm.abm = NULL;
+	aabm.chance = 1;
+	if (neighbor != CONTENT_IGNORE) {
+		aabm.required_neighbors.resize(neighbor + 1, false);
+		aabm.required_neighbors[neighbor] = true;
+	}
+	return aabm;
+}
+
+static void add_test_abms(ABMContentLookup &lookup)
+{
+	std::set<content_t> contents;
+	contents.insert(t_CONTENT_STONE);
+	lookup.addABM(make_aabm(t_CONTENT_WATER), contents);
+
+	contents.clear();
+	contents.insert(t_CONTENT_GRASS);
+	lookup.addABM(make_aabm(CONTENT_IGNORE), contents);
+}
+
+/*
+	Records what it is triggered on. Replaces the nodes it triggers on
+	at x = 0 with water if replace_map is set.
+*/
+class RecordingABM : public ActiveBlockModifier
+{
+public:
+	RecordingABM(): replace_map(NULL) {}
+
+	std::set<std::string> getTriggerContents()
+	{ return std::set<std::string>(); }
+	float getTriggerInterval() { return 1; }
+	u32 getTriggerChance() { return 1; }
+	bool getSimpleCatchUp() { return false; }
+
+	void trigger(ServerEnvironment *env, v3s16 p, MapNode n)
+	{
+		positions.push_back(p);
+		nodes.push_back(n);
+		if (replace_map != NULL && p.X == 0) {
+			MapNode water(t_CONTENT_WATER);
+			replace_map->setNode(p, water);
+		}
+	}
+
+	void triggerBatch(ServerEnvironment *env,
+			const ABMTriggerCandidate *candidates, u32 count,
+			ABMTriggerContext &context)
+	{
+		batches.push_back(count);
+		ActiveBlockModifier::triggerBatch(env, candidates, count, context);
+	}
+
+	Map *replace_map;
+	std::vector<u32> batches;
+	std::vector<v3s16> positions;
+	std::vector<MapNode> nodes;
+};
+
+static ActiveABM make_aabm(RecordingABM *abm)
+{
+	ActiveABM aabm = make_aabm(CONTENT_IGNORE);
+	aabm.abm = abm;
+	return aabm;
+}
+
+static u32 scan_index(v3s16 p)
+{
+	// The order ABMContentLookup::findCandidates() goes through a block
+	p -= getContainerPos(p, MAP_BLOCKSIZE) * MAP_BLOCKSIZE;
+	return (p.X * MAP_BLOCKSIZE + p.Y) * MAP_BLOCKSIZE + p.Z;
+}
+
+void TestABM::makeMap(IGameDef *gamedef)
+{
+	m_map = new Map(dstream, gamedef);
+	PseudoRandom pr(1234);
+
+	std::map<v2s16, MapSector *> *sectors = m_map->getSectorsPtr();
+	for (s16 z = -BENCH_MAP_RADIUS; z <= BENCH_MAP_RADIUS; z++)
+	for (s16 x = -BENCH_MAP_RADIUS; x <= BENCH_MAP_RADIUS; x++) {
+		v2s16 p2d(x, z);
+		MapSector *sector = new ServerMapSector(m_map, p2d, gamedef);
+		(*sectors)[p2d] = sector;
+
+		for (s16 y = -BENCH_MAP_RADIUS; y <= BENCH_MAP_RADIUS; y++) {
+			MapBlock *block = sector->createBlankBlock(y);
+			v3s16 p0;
+			for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++)
+			for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+			for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++) {
+				s16 y_abs = y * MAP_BLOCKSIZE + p0.Y;
+				content_t c = CONTENT_AIR;
+				if (y_abs < 0)
+					c = pr.range(0, 31) == 0 ?
+						t_CONTENT_WATER : t_CONTENT_STONE;
+				else if (y_abs == 0)
+					c = t_CONTENT_GRASS;
+				MapNode n(c);
+				block->setNodeNoCheck(p0, n);
+			}
+		}
+	}
+}
+
+// The scan as it used to be done, going through the map for each neighbor
+u32 TestABM::countCandidatesReference()
+{
+	std::map<content_t, std::vector<content_t> > aabms;
+	aabms[t_CONTENT_STONE].push_back(t_CONTENT_WATER);
+	aabms[t_CONTENT_GRASS].push_back(CONTENT_IGNORE);
+
+	u32 count = 0;
+	std::map<v2s16, MapSector *> *sectors = m_map->getSectorsPtr();
+	for (std::map<v2s16, MapSector *>::iterator it = sectors->begin();
+			it != sectors->end(); ++it) {
+		MapBlockVect blocks;
+		it->second->getBlocks(blocks);
+		for (size_t b = 0; b < blocks.size(); b++) {
+			MapBlock *block = blocks[b];
+			v3s16 p0;
+			for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++)
+			for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+			for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++) {
+				content_t c = block->getNodeNoEx(p0).getContent();
+				std::map<content_t, std::vector<content_t> >::iterator j =
+						aabms.find(c);
+				if (j == aabms.end())
+					continue;
+				v3s16 p = p0 + block->getPosRelative();
+				for (size_t i = 0; i < j->second.size(); i++) {
+					if (j->second[i] == CONTENT_IGNORE) {
+						count++;
+						continue;
+					}
+					std::set<content_t> required_neighbors;
+					required_neighbors.insert(j->second[i]);
+					v3s16 p1;
+					for (p1.X = p.X - 1; p1.X <= p.X + 1; p1.X++)
+					for (p1.Y = p.Y - 1; p1.Y <= p.Y + 1; p1.Y++)
+					for (p1.Z = p.Z - 1; p1.Z <= p.Z + 1; p1.Z++) {
+						if (p1 == p)
+							continue;
+						content_t c1 = m_map->getNodeNoEx(p1).getContent();
+						if (required_neighbors.find(c1) !=
+								required_neighbors.end()) {
+							count++;
+							goto next_abm;
+						}
+					}
+next_abm:;
+				}
+			}
+		}
+	}
+	return count;
+}
+
+static u32 count_candidates(Map *map, ABMContentLookup &lookup,
+		ABMNeighborWindow &window)
+{
+	u32 count = 0;
+	std::map<v2s16, MapSector *> *sectors = map->getSectorsPtr();
+	for (std::map<v2s16, MapSector *>::iterator it = sectors->begin();
+			it != sectors->end(); ++it) {
+		MapBlockVect blocks;
+		it->second->getBlocks(blocks);
+		for (size_t b = 0; b < blocks.size(); b++) {
+			MapBlock *block = blocks[b];
+			if (!lookup.blockHasTriggers(block))
+				continue;
+			window.invalidate();
+			v3s16 p0;
+			for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++)
+			for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+			for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++) {
+				const std::vector<ActiveABM> *aabms =
+						lookup.get(block->getNodeNoEx(p0).getContent());
+				if (aabms == NULL)
+					continue;
+				for (size_t i = 0; i < aabms->size(); i++) {
+					const ActiveABM &aabm = (*aabms)[i];
+					if (!aabm.required_neighbors.empty()) {
+						if (!window.isValid())
+							window.update(map, block);
+						if (!window.hasNeighbor(p0, aabm.required_neighbors))
+							continue;
+					}
+					count++;
+				}
+			}
+		}
+	}
+	return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestABM::testBlockContents(IGameDef *gamedef)
+{
+	MapBlock block(NULL, v3s16(0, 0, 0), gamedef);
+
+	const std::vector<content_t> &contents = block.getContents();
+	UASSERTEQ(size_t, contents.size(), 1);
+	UASSERTEQ(content_t, contents[0], CONTENT_IGNORE);
+
+	MapNode n(t_CONTENT_STONE);
+	block.setNode(v3s16(1, 2, 3), n);
+	block.setNode(v3s16(3, 2, 1), n);
+	UASSERTEQ(size_t, block.getContents().size(), 2);
+	UASSERT(block.getContents()[1] == t_CONTENT_STONE);
+
+	// Rebuilding drops contents that were overwritten
+	VoxelManipulator vm;
+	vm.addArea(VoxelArea(v3s16(0, 0, 0),
+		v3s16(MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1)));
+	block.copyTo(vm);
+	block.copyFrom(vm);
+	UASSERTEQ(size_t, block.getContents().size(), 2);
+	block.reallocate();
+	UASSERTEQ(size_t, block.getContents().size(), 1);
+}
+
+void TestABM::testContentLookup()
+{
+	ABMContentLookup lookup;
+	UASSERT(lookup.empty());
+	UASSERT(lookup.get(t_CONTENT_STONE) == NULL);
+
+	add_test_abms(lookup);
+	UASSERT(!lookup.empty());
+	UASSERT(lookup.get(CONTENT_AIR) == NULL);
+	UASSERT(lookup.get(CONTENT_IGNORE) == NULL);
+	UASSERT(lookup.get(t_CONTENT_STONE) != NULL);
+	UASSERTEQ(size_t, lookup.get(t_CONTENT_GRASS)->size(), 1);
+
+	// Blocks above ground are all air and never scanned
+	UASSERT(!lookup.blockHasTriggers(
+		m_map->getBlockNoCreate(v3s16(0, BENCH_MAP_RADIUS, 0))));
+	UASSERT(lookup.blockHasTriggers(
+		m_map->getBlockNoCreate(v3s16(0, -1, 0))));
+}
+
+void TestABM::testNeighborWindow()
+{
+	MapBlock *block = m_map->getBlockNoCreate(v3s16(0, -1, 0));
+	ABMNeighborWindow window;
+	UASSERT(!window.isValid());
+	window.update(m_map, block);
+	UASSERT(window.isValid());
+
+	v3s16 p0;
+	for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++)
+	for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+	for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++) {
+		std::vector<bool> wanted(t_CONTENT_GRASS + 1, false);
+		wanted[t_CONTENT_GRASS] = true;
+
+		bool expected = false;
+		v3s16 p = p0 + block->getPosRelative();
+		v3s16 d;
+		for (d.Z = -1; d.Z <= 1; d.Z++)
+		for (d.Y = -1; d.Y <= 1; d.Y++)
+		for (d.X = -1; d.X <= 1; d.X++) {
+			if (d != v3s16(0, 0, 0) &&
+					m_map->getNodeNoEx(p + d).getContent() == t_CONTENT_GRASS)
+				expected = true;
+		}
+		UASSERT(window.hasNeighbor(p0, wanted) == expected);
+	}
+
+	window.invalidate();
+	UASSERT(!window.isValid());
+}
+
+void TestABM::testFindCandidates()
+{
+	// Two ABMs on stone and one on grass
+	RecordingABM next_to_water, stone, grass;
+	std::set<content_t> contents;
+	contents.insert(t_CONTENT_STONE);
+	ActiveABM aabm = make_aabm(&next_to_water);
+	aabm.required_neighbors = make_aabm(t_CONTENT_WATER).required_neighbors;
+	ABMContentLookup lookup;
+	lookup.addABM(aabm, contents);
+	lookup.addABM(make_aabm(&stone), contents);
+	contents.clear();
+	contents.insert(t_CONTENT_GRASS);
+	lookup.addABM(make_aabm(&grass), contents);
+
+	MapBlock *block = m_map->getBlockNoCreate(v3s16(0, -1, 0));
+	u32 num_stone = 0;
+	u32 num_next_to_water = 0;
+	v3s16 p0;
+	for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++)
+	for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+	for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++) {
+		v3s16 p = p0 + block->getPosRelative();
+		if (m_map->getNodeNoEx(p).getContent() != t_CONTENT_STONE)
+			continue;
+		num_stone++;
+		v3s16 d;
+		bool found = false;
+		for (d.Z = -1; d.Z <= 1; d.Z++)
+		for (d.Y = -1; d.Y <= 1; d.Y++)
+		for (d.X = -1; d.X <= 1; d.X++) {
+			if (m_map->getNodeNoEx(p + d).getContent() == t_CONTENT_WATER)
+				found = true;
+		}
+		if (found)
+			num_next_to_water++;
+	}
+	UASSERT(num_next_to_water > 0 && num_next_to_water < num_stone);
+
+	std::vector<ABMTriggerCandidate> candidates;
+	ABMNeighborWindow window;
+	PcgRandom rand(1234);
+	lookup.findCandidates(m_map, block, window, rand, candidates);
+	UASSERTEQ(size_t, candidates.size(), num_next_to_water + num_stone);
+
+	// One run for each ABM, each in the order of the nodes
+	for (size_t i = 0; i < candidates.size(); i++) {
+		const ABMTriggerCandidate &c = candidates[i];
+		if (i < num_next_to_water) {
+			UASSERT(c.abm == &next_to_water);
+			UASSERTEQ(u32, c.abm_order, 0);
+		} else {
+			UASSERT(c.abm == &stone);
+			UASSERTEQ(u32, c.abm_order, 1);
+		}
+		UASSERT(c.n.getContent() == t_CONTENT_STONE);
+		if (i > 0 && c.abm == candidates[i - 1].abm)
+			UASSERT(scan_index(c.p) > scan_index(candidates[i - 1].p));
+	}
+
+	// Appended after what is there already
+	lookup.findCandidates(m_map, m_map->getBlockNoCreate(v3s16(0, 0, 0)),
+		window, rand, candidates);
+	UASSERTEQ(size_t, candidates.size(),
+		num_next_to_water + num_stone + MAP_BLOCKSIZE * MAP_BLOCKSIZE);
+	UASSERT(candidates.back().abm == &grass);
+}
+
+void TestABM::testTriggerCandidates()
+{
+	// The first one replaces the stone at x = 0 that the second one would
+	// trigger on
+	RecordingABM first, second;
+	first.replace_map = m_map;
+	std::set<content_t> contents;
+	contents.insert(t_CONTENT_STONE);
+	ABMContentLookup lookup;
+	lookup.addABM(make_aabm(&first), contents);
+	lookup.addABM(make_aabm(&second), contents);
+
+	MapBlock *block = m_map->getBlockNoCreate(v3s16(0, -1, 0));
+	std::vector<MapNode> saved;
+	v3s16 p0;
+	for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++)
+	for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+	for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++)
+		saved.push_back(block->getNodeNoEx(p0));
+
+	std::vector<ABMTriggerCandidate> candidates;
+	ABMNeighborWindow window;
+	PcgRandom rand(1234);
+	lookup.findCandidates(m_map, block, window, rand, candidates);
+	u32 num_stone = candidates.size() / 2;
+	UASSERT(num_stone > 2);
+
+	// Nodes changed between finding and triggering: one is replaced, the
+	// param2 of another is changed
+	v3s16 p_replaced = candidates[num_stone - 1].p;
+	v3s16 p_changed = candidates[num_stone - 2].p;
+	UASSERT(p_replaced.X != 0 && p_changed.X != 0);
+	MapNode air(CONTENT_AIR);
+	m_map->setNode(p_replaced, air);
+	MapNode rotated(t_CONTENT_STONE, 0, 7);
+	m_map->setNode(p_changed, rotated);
+
+	ABMTriggerContext context(m_map, block);
+	context.trigger(candidates);
+
+	// One batch for each ABM
+	UASSERTEQ(size_t, first.batches.size(), 1);
+	UASSERTEQ(u32, first.batches[0], num_stone);
+	UASSERTEQ(size_t, second.batches.size(), 1);
+	UASSERTEQ(u32, second.batches[0], num_stone);
+
+	UASSERTEQ(size_t, first.positions.size(), num_stone - 1);
+	u32 num_replaced = 0;
+	for (size_t i = 0; i < first.positions.size(); i++) {
+		UASSERT(first.positions[i] != p_replaced);
+		if (first.positions[i] == p_changed)
+			UASSERTEQ(u8, first.nodes[i].param2, 7);
+		if (first.positions[i].X == 0)
+			num_replaced++;
+	}
+	UASSERT(num_replaced > 0);
+
+	UASSERTEQ(size_t, second.positions.size(), num_stone - 1 - num_replaced);
+	for (size_t i = 0; i < second.positions.size(); i++) {
+		UASSERT(second.positions[i].X != 0);
+		UASSERT(second.nodes[i].getContent() == t_CONTENT_STONE);
+	}
+
+	u32 i = 0;
+	for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++)
+	for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+	for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++)
+		block->setNodeNoCheck(p0, saved[i++]);
+}
+
+void TestABM::benchScanMapLookup()
+{
+	for (u32 i = 0; i < BENCH_PASSES; i++)
+		UASSERTEQ(u32, countCandidatesReference(), m_expected_candidates);
+}
+
+void TestABM::benchScanContentLookup()
+{
+	ABMContentLookup lookup;
+	add_test_abms(lookup);
+	ABMNeighborWindow window;
+
+	for (u32 i = 0; i < BENCH_PASSES; i++) {
+		UASSERTEQ(u32, count_candidates(m_map, lookup, window),
+			m_expected_candidates);
+	}
+}
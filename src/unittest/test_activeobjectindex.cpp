@@ -0,0 +1,228 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "activeobjectindex.h"
+#include "constants.h"
+#include "noise.h"
+#include "porting.h"
+#include "util/basic_macros.h"
+
+// A server with many entities and players, sending objects 3 blocks away
+#define BENCH_OBJECTS 3000
+#define BENCH_PLAYERS 50
+#define BENCH_RADIUS (3 * MAP_BLOCKSIZE * BS)
+#define BENCH_STEPS 1000
+
+class TestActiveObjectIndex : public TestBase {
+public:
+	TestActiveObjectIndex() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestActiveObjectIndex"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testRandomOperations();
+	void testLargeArea();
+	void benchLinearScan();
+	void benchActiveObjectIndex();
+};
+
+static TestActiveObjectIndex g_test_instance;
+
+void TestActiveObjectIndex::runTests(IGameDef *gamedef)
+{
+	TEST(testRandomOperations);
+	TEST(testLargeArea);
+
+	// Compare these two to see how finding the objects near players performs
+	BENCH(benchLinearScan);
+	BENCH(benchActiveObjectIndex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static v3f random_pos(PcgRandom &pr, s32 range)
+{
+	return v3f(pr.range(-range, range), pr.range(-range, range),
+		pr.range(-range, range)) * BS;
+}
+
+// Checks the result of a query against looking at every object
+static void check_radius(const ActiveObjectIndex &index,
+		std::map<u16, v3f> &objects, v3f pos, f32 radius)
+{
+	std::vector<u16> ids;
+	ids.push_back(0);
+	index.getObjectsInsideRadius(pos, radius, ids);
+
+	// Appended after what was there
+	UASSERT(ids[0] == 0);
+	ids.erase(ids.begin());
+
+	std::vector<u16> expected;
+	for (std::map<u16, v3f>::iterator i = objects.begin();
+			i != objects.end(); ++i) {
+		if (i->second.getDistanceFrom(pos) <= radius)
+			expected.push_back(i->first);
+	}
+	UASSERT(ids == expected);
+}
+
+void TestActiveObjectIndex::testRandomOperations()
+{
+	PcgRandom pr(42);
+	ActiveObjectIndex index;
+	std::map<u16, v3f> objects;
+
+	for (u32 i = 0; i < 20000; i++) {
+		u16 id = pr.range(1, 500);
+		v3f pos = random_pos(pr, 100);
+		switch (pr.range(0, 3)) {
+		case 0:
+			index.insert(id, pos);
+			objects[id] = pos;
+			break;
+		case 1:
+			index.remove(id);
+			objects.erase(id);
+			break;
+		default:
+			index.update(id, pos);
+			if (objects.find(id) != objects.end())
+				objects[id] = pos;
+			break;
+		}
+
+		if (i % 100 == 0) {
+			check_radius(index, objects, random_pos(pr, 100),
+				pr.range(0, 40) * BS);
+		}
+	}
+	UASSERTEQ(size_t, index.size(), objects.size());
+
+	index.clear();
+	UASSERTEQ(size_t, index.size(), 0);
+	std::vector<u16> ids;
+	index.getObjectsInsideRadius(v3f(0, 0, 0), 1000 * BS, ids);
+	UASSERT(ids.empty());
+}
+
+void TestActiveObjectIndex::testLargeArea()
+{
+	ActiveObjectIndex index;
+	std::map<u16, v3f> objects;
+	objects[1] = v3f(0, 0, 0);
+	objects[2] = v3f(30000, -30000, 30000) * BS;
+	// Beyond the map limits
+	objects[3] = v3f(-1e9, 1e9, 0);
+	for (std::map<u16, v3f>::iterator i = objects.begin();
+			i != objects.end(); ++i)
+		index.insert(i->first, i->second);
+
+	// More cells than there are objects, and the whole range of cells
+	check_radius(index, objects, v3f(0, 0, 0), 1e10);
+	check_radius(index, objects, v3f(0, 0, 0), 10);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Stands in for a ServerActiveObject, which is about as large
+struct BenchObject
+{
+	v3f pos;
+	char other_members[500];
+};
+
+// Objects spread over some mapchunks, and players in the same area
+static void bench_world(std::map<u16, BenchObject *> &objects,
+		std::vector<v3f> &players)
+{
+	PcgRandom pr(3000);
+	for (u16 id = 1; id <= BENCH_OBJECTS; id++) {
+		objects[id] = new BenchObject;
+		objects[id]->pos = random_pos(pr, 200);
+	}
+	for (u32 i = 0; i < BENCH_PLAYERS; i++)
+		players.push_back(random_pos(pr, 200));
+}
+
+static void free_world(std::map<u16, BenchObject *> &objects)
+{
+	for (std::map<u16, BenchObject *>::iterator i = objects.begin();
+			i != objects.end(); ++i)
+		delete i->second;
+}
+
+/*
+	Both benchmarks find the objects within sending range of every player
+	once per step, as Server::SendActiveObjectRemoveAdd() does.
+*/
+
+void TestActiveObjectIndex::benchLinearScan()
+{
+	std::map<u16, BenchObject *> objects;
+	std::vector<v3f> players;
+	bench_world(objects, players);
+
+	u32 found = 0;
+	u32 t0 = porting::getTimeMs();
+	for (u32 step = 0; step < BENCH_STEPS; step++)
+	for (size_t p = 0; p < players.size(); p++) {
+		for (std::map<u16, BenchObject *>::iterator i = objects.begin();
+				i != objects.end(); ++i) {
+			if (i->second->pos.getDistanceFrom(players[p]) <= BENCH_RADIUS)
+				found++;
+		}
+	}
+	u32 dtime = MYMAX(porting::getTimeMs() - t0, 1);
+
+	free_world(objects);
+	UASSERT(found > 0);
+	rawstream << "    " << BENCH_STEPS * 1000 / dtime << " steps/s, "
+		<< found / BENCH_STEPS << " objects in range" << std::endl;
+}
+
+void TestActiveObjectIndex::benchActiveObjectIndex()
+{
+	std::map<u16, BenchObject *> objects;
+	std::vector<v3f> players;
+	bench_world(objects, players);
+
+	ActiveObjectIndex index;
+	for (std::map<u16, BenchObject *>::iterator i = objects.begin();
+			i != objects.end(); ++i)
+		index.insert(i->first, i->second->pos);
+
+	u32 found = 0;
+	std::vector<u16> ids;
+	u32 t0 = porting::getTimeMs();
+	for (u32 step = 0; step < BENCH_STEPS; step++)
+	for (size_t p = 0; p < players.size(); p++) {
+		ids.clear();
+		index.getObjectsInsideRadius(players[p], BENCH_RADIUS, ids);
+		found += ids.size();
+	}
+	u32 dtime = MYMAX(porting::getTimeMs() - t0, 1);
+
+	free_world(objects);
+	UASSERT(found > 0);
+	rawstream << "    " << BENCH_STEPS * 1000 / dtime << " steps/s, "
+		<< found / BENCH_STEPS << " objects in range" << std::endl;
+}
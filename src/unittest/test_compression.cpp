@@ -22,10 +22,19 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <sstream>
 
 #include "irrlichttypes_extrabloated.h"
+#include "clientiface.h"
 #include "log.h"
+#include "mapnode.h"
+#include "porting.h"
 #include "serialization.h"
 #include "nodedef.h"
 #include "noise.h"
+#include "network/networkprotocol.h"
+#include "util/basic_macros.h"
+
+// Blocks in the terrain corpus the codecs are benchmarked with
+#define CORPUS_SIZE_XZ 8
+#define CORPUS_SIZE_Y 6
 
 class TestCompression : public TestBase {
 public:
@@ -37,6 +46,9 @@ class TestCompression : public TestBase {
 	void testRLECompression();
 	void testZlibCompression();
 	void testZlibLargeData();
+	void testCodecs();
+	void testBlockCodecPerClient();
+	void benchCodecs();
 };
 
 static TestCompression g_test_instance;
@@ -46,6 +58,9 @@ void TestCompression::runTests(IGameDef *gamedef)
 	TEST(testRLECompression);
 	TEST(testZlibCompression);
 	TEST(testZlibLargeData);
+	TEST(testCodecs);
+	TEST(testBlockCodecPerClient);
+	BENCH(benchCodecs);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -170,3 +185,151 @@ void TestCompression::testZlibLargeData()
 				i, str_decompressed[i], i, data_in[i]);
 	}
 }
+
+static void check_codec(CompressionCodec codec, const std::string &data)
+{
+	// Two parts in one stream, as node data and metadata are in blocks
+	std::ostringstream os(std::ios_base::binary);
+	compressWithCodec(codec, data, os);
+	compressWithCodec(codec, std::string("end"), os);
+
+	std::istringstream is(os.str(), std::ios_base::binary);
+	std::ostringstream os1(std::ios_base::binary);
+	decompressWithCodec(codec, is, os1);
+	std::ostringstream os2(std::ios_base::binary);
+	decompressWithCodec(codec, is, os2);
+
+	UASSERT(os1.str() == data);
+	UASSERT(os2.str() == "end");
+}
+
+void TestCompression::testCodecs()
+{
+	std::string data(20000, 0);
+	PseudoRandom pseudorandom(1234);
+	for (u32 i = 0; i < data.size(); i++)
+		data[i] = i < 10000 ? (i / 100) : pseudorandom.range(0, 255);
+
+	for (int i = 0; i < COMPRESSION_CODEC_COUNT; i++) {
+		CompressionCodec codec = (CompressionCodec)i;
+		CompressionCodec parsed;
+		UASSERT(parseCompressionCodec(compressionCodecName(codec), &parsed));
+		UASSERT(parsed == codec);
+		if (!compressionCodecSupported(codec))
+			continue;
+
+		check_codec(codec, data);
+		check_codec(codec, "");
+	}
+
+	CompressionCodec parsed;
+	UASSERT(!parseCompressionCodec("gzip", &parsed));
+	UASSERT(getCompressionCodecSetting("gzip") == COMPRESSION_ZLIB);
+}
+
+void TestCompression::testBlockCodecPerClient()
+{
+	u16 supported = getSupportedCompressionCodecs();
+	UASSERTEQ(bool, (supported & NETPROTO_COMPRESSION_BLOCK_LZ4) != 0,
+		compressionCodecSupported(COMPRESSION_LZ4));
+	UASSERTEQ(bool, (supported & NETPROTO_COMPRESSION_BLOCK_ZSTD) != 0,
+		compressionCodecSupported(COMPRESSION_ZSTD));
+
+	// Older clients and builds without the codecs send no modes
+	RemoteClient client;
+	UASSERT(client.canReceiveBlockCodec(COMPRESSION_ZLIB));
+	UASSERT(!client.canReceiveBlockCodec(COMPRESSION_LZ4));
+	UASSERT(!client.canReceiveBlockCodec(COMPRESSION_ZSTD));
+
+	client.setDeployedCompressionMode(NETPROTO_COMPRESSION_BLOCK_ZSTD);
+	UASSERT(client.canReceiveBlockCodec(COMPRESSION_ZLIB));
+	UASSERT(!client.canReceiveBlockCodec(COMPRESSION_LZ4));
+	UASSERT(client.canReceiveBlockCodec(COMPRESSION_ZSTD));
+}
+
+/*
+	The corpus is the uncompressed node data of blocks of generated terrain:
+	stone with caves, a dirt layer (bricks here) with grass on top, water
+	below the water level and air with sunlight above.
+*/
+static void make_terrain_corpus(std::vector<std::string> &corpus)
+{
+	NoiseParams np_height(0, 20, v3f(80, 80, 80), 5, 4, 0.5, 2.0);
+	NoiseParams np_cave(0, 1, v3f(24, 24, 24), 6, 2, 0.5, 2.0);
+	s16 water_level = 1;
+
+	MapNode nodes[MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE];
+	v3s16 bp;
+	for (bp.Z = 0; bp.Z < CORPUS_SIZE_XZ; bp.Z++)
+	for (bp.Y = -CORPUS_SIZE_Y / 2; bp.Y < CORPUS_SIZE_Y / 2; bp.Y++)
+	for (bp.X = 0; bp.X < CORPUS_SIZE_XZ; bp.X++) {
+		u32 i = 0;
+		v3s16 p0;
+		for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++)
+		for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+		for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++, i++) {
+			v3s16 p = bp * MAP_BLOCKSIZE + p0;
+			s16 height = NoisePerlin2D(&np_height, p.X, p.Z, 0);
+			MapNode &n = nodes[i];
+			if (p.Y > height) {
+				if (p.Y <= water_level)
+					n = MapNode(t_CONTENT_WATER, 0, 0);
+				else
+					n = MapNode(CONTENT_AIR, 0xf, 0);
+			} else if (NoisePerlin3D(&np_cave, p.X, p.Y, p.Z, 0) > 0.6) {
+				n = MapNode(CONTENT_AIR, 0, 0);
+			} else if (p.Y == height && p.Y > water_level) {
+				n = MapNode(t_CONTENT_GRASS, 0, 0);
+			} else if (p.Y > height - 3) {
+				n = MapNode(t_CONTENT_BRICK, 0, 0);
+			} else {
+				n = MapNode(t_CONTENT_STONE, 0, 0);
+			}
+		}
+
+		std::ostringstream os(std::ios_base::binary);
+		MapNode::serializeBulk(os, SER_FMT_VER_HIGHEST_WRITE, nodes,
+			MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE, 2, 2, false);
+		corpus.push_back(os.str());
+	}
+}
+
+void TestCompression::benchCodecs()
+{
+	std::vector<std::string> corpus;
+	make_terrain_corpus(corpus);
+	u64 raw_size = 0;
+	for (size_t i = 0; i < corpus.size(); i++)
+		raw_size += corpus[i].size();
+
+	for (int c = 0; c < COMPRESSION_CODEC_COUNT; c++) {
+		CompressionCodec codec = (CompressionCodec)c;
+		if (!compressionCodecSupported(codec))
+			continue;
+
+		std::vector<std::string> compressed;
+		u32 t0 = porting::getTimeUs();
+		for (size_t i = 0; i < corpus.size(); i++) {
+			std::ostringstream os(std::ios_base::binary);
+			compressWithCodec(codec, corpus[i], os);
+			compressed.push_back(os.str());
+		}
+		u32 t1 = porting::getTimeUs();
+		u64 compressed_size = 0;
+		for (size_t i = 0; i < compressed.size(); i++) {
+			std::istringstream is(compressed[i], std::ios_base::binary);
+			std::ostringstream os(std::ios_base::binary);
+			decompressWithCodec(codec, is, os);
+			UASSERT(os.str() == corpus[i]);
+			compressed_size += compressed[i].size();
+		}
+		u32 t2 = porting::getTimeUs();
+
+		// Bytes per microsecond are megabytes per second
+		rawstream << "    " << compressionCodecName(codec)
+			<< ": ratio " << (float)raw_size / compressed_size
+			<< ", compress " << raw_size / MYMAX(t1 - t0, 1U) << " MB/s"
+			<< ", decompress " << raw_size / MYMAX(t2 - t1, 1U) << " MB/s"
+			<< std::endl;
+	}
+}
@@ -24,6 +24,18 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "settings.h"
 #include "util/serialize.h"
 #include "network/connection.h"
+#include "network/networkprotocol.h"
+#include "noise.h"
+#include "util/basic_macros.h"
+#include <ctime>
+#include <set>
+
+// Clients and blocks per client of the block sending benchmark
+#define BENCH_CLIENTS 100
+#define BENCH_BLOCKS 40
+#define BENCH_BLOCK_SIZE 2000
+#define BENCH_DATAGRAMS 200000
+#define BENCH_DATAGRAM_SIZE 100
 
 class TestConnection : public TestBase {
 public:
@@ -38,7 +50,11 @@ class TestConnection : public TestBase {
 	void runTests(IGameDef *gamedef);
 
 	void testHelpers();
+	void testSplitSharesPayload();
 	void testConnectSendReceive();
+	void benchSendBlocks();
+
+	void sendLoopbackDatagrams(int batch_size);
 };
 
 static TestConnection g_test_instance;
@@ -46,7 +62,13 @@ static TestConnection g_test_instance;
 void TestConnection::runTests(IGameDef *gamedef)
 {
 	TEST(testHelpers);
+	TEST(testSplitSharesPayload);
 	TEST(testConnectSendReceive);
+	BENCH(benchSendBlocks);
+
+	// Compare these two to see what batching the system calls brings
+	BENCH(sendLoopbackDatagrams, 1);
+	BENCH(sendLoopbackDatagrams, 32);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -65,6 +87,7 @@ struct Handler : public con::PeerHandler
 		infostream << "Handler(" << name << ")::peerAdded(): "
 			"id=" << peer->id << std::endl;
 		last_id = peer->id;
+		ids.insert(peer->id);
 		count++;
 	}
 
@@ -73,10 +96,12 @@ struct Handler : public con::PeerHandler
 		infostream << "Handler(" << name << ")::deletingPeer(): "
 			"id=" << peer->id << ", timeout=" << timeout << std::endl;
 		last_id = peer->id;
+		ids.erase(peer->id);
 		count--;
 	}
 
 	s32 count;
+	std::set<u16> ids;
 	u16 last_id;
 	const char *name;
 };
@@ -103,14 +128,17 @@ void TestConnection::testHelpers()
 		Data:
 			[7] u8 data1[0]
 	*/
-	UASSERT(readU32(&p1.data[0]) == proto_id);
-	UASSERT(readU16(&p1.data[4]) == peer_id);
-	UASSERT(readU8(&p1.data[6]) == channel);
-	UASSERT(readU8(&p1.data[7]) == data1[0]);
+	UASSERT(p1.getSize() == 8);
+	u8 p1data[8];
+	p1.copyTo(p1data, 0, 8);
+	UASSERT(readU32(&p1data[0]) == proto_id);
+	UASSERT(readU16(&p1data[4]) == peer_id);
+	UASSERT(readU8(&p1data[6]) == channel);
+	UASSERT(readU8(&p1data[7]) == data1[0]);
 
 	//infostream<<"initial data1[0]="<<((u32)data1[0]&0xff)<<std::endl;
 
-	SharedBuffer<u8> p2 = con::makeReliablePacket(data1, seqnum);
+	con::BufferedPacket p2 = con::makeReliablePacket(data1, seqnum);
 
 	/*infostream<<"p2.getSize()="<<p2.getSize()<<", data1.getSize()="
 			<<data1.getSize()<<std::endl;
@@ -119,9 +147,57 @@ void TestConnection::testHelpers()
 	infostream<<"data1[0]="<<((u32)data1[0]&0xff)<<std::endl;*/
 
 	UASSERT(p2.getSize() == 3 + data1.getSize());
-	UASSERT(readU8(&p2[0]) == TYPE_RELIABLE);
-	UASSERT(readU16(&p2[1]) == seqnum);
-	UASSERT(readU8(&p2[3]) == data1[0]);
+	UASSERT(p2.getU8(0) == TYPE_RELIABLE);
+	UASSERT(p2.getU16(1) == seqnum);
+	UASSERT(p2.getU8(3) == data1[0]);
+}
+
+void TestConnection::testSplitSharesPayload()
+{
+	std::vector<u8> block(3000);
+	for (u32 i = 0; i < block.size(); i++)
+		block[i] = i * 7;
+	SharedSlice<u8> shared(block);
+
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 6, 2);
+	pkt << v3s16(1, 2, 3);
+	pkt.putSharedData(shared);
+	Buffer<u8> expected = pkt.oldForgePacket();
+
+	con::ConnectionCommand c;
+	c.send(2, 2, &pkt, true);
+	UASSERTEQ(u32, c.data.getSize(), expected.getSize());
+
+	u32 chunksize_max = 512 - BASE_HEADER_SIZE - RELIABLE_HEADER_SIZE;
+	u16 split_seqnum = 10;
+	std::list<con::BufferedPacket> chunks =
+		con::makeAutoSplitPacket(c.data, chunksize_max, split_seqnum);
+	UASSERT(chunks.size() > 1);
+	UASSERT(split_seqnum == 11);
+
+	// The chunks have to hold the packet in order, with their payloads
+	// pointing into the shared block data
+	std::vector<u8> joined;
+	for (std::list<con::BufferedPacket>::iterator i = chunks.begin();
+			i != chunks.end(); ++i) {
+		con::BufferedPacket p = con::makeReliablePacket(*i, 65500);
+		UASSERT(p.getSize() <= chunksize_max + RELIABLE_HEADER_SIZE);
+		UASSERT(p.getU8(RELIABLE_HEADER_SIZE) == TYPE_SPLIT);
+		UASSERT(p.getU16(RELIABLE_HEADER_SIZE + 1) == 10);
+		UASSERT(p.getU16(RELIABLE_HEADER_SIZE + 3) == chunks.size());
+
+		const u8 *payload = *p.payload;
+		UASSERT(payload >= *shared &&
+			payload + p.payload.getSize() <= *shared + shared.getSize());
+
+		u32 headers_size = RELIABLE_HEADER_SIZE + SPLIT_HEADER_SIZE;
+		std::vector<u8> data(p.getSize() - headers_size);
+		p.copyTo(&data[0], headers_size, data.size());
+		joined.insert(joined.end(), data.begin(), data.end());
+	}
+
+	UASSERTEQ(size_t, joined.size(), expected.getSize());
+	UASSERT(memcmp(&joined[0], *expected, joined.size()) == 0);
 }
 
 
@@ -346,3 +422,163 @@ void TestConnection::testConnectSendReceive()
 	UASSERT(hand_server.count == 1);
 	UASSERT(hand_server.last_id == 2);
 }
+
+// A UDP port that is not in use, picked by the system
+static u16 get_free_port()
+{
+	UDPSocket socket(false);
+	socket.Bind(Address(0, 0, 0, 0, 0));
+
+	struct sockaddr_in address;
+	socklen_t address_len = sizeof(address);
+	if (getsockname(socket.GetHandle(), (struct sockaddr *)&address,
+			&address_len) != 0)
+		throw SocketException("getsockname() failed");
+	return ntohs(address.sin_port);
+}
+
+/*
+	Sends blocks to many clients over loopback, the way the server does, and
+	reports how much CPU time the connections use for them.
+*/
+void TestConnection::benchSendBlocks()
+{
+	u32 proto_id = 0xad26846a;
+	Handler hand_server("server");
+	Handler hand_client("client");
+
+	u16 port = get_free_port();
+	Address bind_addr(0, 0, 0, 0, port);
+	con::Connection server(proto_id, 512, 5.0, false, &hand_server);
+	server.Serve(bind_addr);
+	sleep_ms(50);
+
+	std::vector<con::Connection *> clients;
+	for (u32 i = 0; i < BENCH_CLIENTS; i++) {
+		clients.push_back(new con::Connection(proto_id, 512, 5.0, false,
+			&hand_client));
+		clients.back()->Connect(Address(127, 0, 0, 1, port));
+	}
+
+	// Wait for the server to know all of the clients
+	u32 t0 = porting::getTimeMs();
+	while (hand_server.ids.size() < BENCH_CLIENTS &&
+			porting::getTimeMs() - t0 < 10000) {
+		try {
+			NetworkPacket pkt;
+			server.Receive(&pkt);
+		} catch (con::NoIncomingDataException &e) {
+			sleep_ms(10);
+		}
+	}
+	UASSERTEQ(size_t, hand_server.ids.size(), BENCH_CLIENTS);
+
+	std::vector<u8> block(BENCH_BLOCK_SIZE);
+	PseudoRandom pr(5);
+	for (u32 i = 0; i < block.size(); i++)
+		block[i] = pr.range(0, 255);
+	SharedSlice<u8> block_data(block);
+
+	u32 count = 0;
+	// Of all connection threads, the server's and the clients'
+	std::clock_t cpu0 = std::clock();
+	t0 = porting::getTimeMs();
+	for (s16 b = 0; b < BENCH_BLOCKS; b++) {
+		for (std::set<u16>::iterator i = hand_server.ids.begin();
+				i != hand_server.ids.end(); ++i) {
+			NetworkPacket pkt(TOCLIENT_BLOCKDATA, 6, *i);
+			pkt << v3s16(b, 0, 0);
+			pkt.putSharedData(block_data);
+			server.Send(*i, 2, &pkt, true);
+		}
+	}
+
+	while (count < BENCH_CLIENTS * BENCH_BLOCKS &&
+			porting::getTimeMs() - t0 < 30000) {
+		bool received = false;
+		for (u32 i = 0; i < clients.size(); i++) {
+			try {
+				NetworkPacket pkt;
+				clients[i]->Receive(&pkt);
+				if (pkt.getCommand() == TOCLIENT_BLOCKDATA &&
+						pkt.getSize() == 6 + BENCH_BLOCK_SIZE)
+					count++;
+				received = true;
+			} catch (con::NoIncomingDataException &e) {
+			}
+		}
+		if (!received)
+			sleep_ms(1);
+	}
+	u32 dtime = MYMAX(porting::getTimeMs() - t0, 1);
+	u64 cpu = (u64)(std::clock() - cpu0) * 1000000 / CLOCKS_PER_SEC;
+
+	for (u32 i = 0; i < clients.size(); i++)
+		delete clients[i];
+
+	UASSERTEQ(u32, count, BENCH_CLIENTS * BENCH_BLOCKS);
+	rawstream << "    " << count * 1000 / dtime << " blocks/s, "
+		<< cpu / count << " us CPU per block" << std::endl;
+}
+
+/*
+	Sends small datagrams to a socket on loopback and reads them back,
+	batch_size at a time, the way the connection threads move them.
+*/
+void TestConnection::sendLoopbackDatagrams(int batch_size)
+{
+	u16 port = get_free_port();
+	UDPSocket socket(false);
+	socket.Bind(Address(0, 0, 0, 0, port));
+	Address address(127, 0, 0, 1, port);
+
+	// Of different sizes and contents, to tell them apart when received
+	u8 header[7] = { 0 };
+	std::vector<u8> data(batch_size * BENCH_DATAGRAM_SIZE);
+	std::vector<UDPDatagram> datagrams(batch_size);
+	for (int i = 0; i < batch_size; i++) {
+		datagrams[i].destination = address;
+		datagrams[i].header = header;
+		datagrams[i].header_size = sizeof(header);
+		datagrams[i].data = &data[i * BENCH_DATAGRAM_SIZE];
+		datagrams[i].size = BENCH_DATAGRAM_SIZE - i % 8;
+	}
+
+	std::vector<u8> buffer(batch_size * 1500);
+	std::vector<Address> senders(batch_size);
+	std::vector<int> sizes(batch_size);
+
+	u32 count = 0;
+	u32 t0 = porting::getTimeMs();
+	while (count < BENCH_DATAGRAMS) {
+		for (u32 i = 0; i < data.size(); i++)
+			data[i] = (count + i) * 7;
+
+		int sent = socket.Send(&datagrams[0], batch_size);
+		UASSERTEQ(int, sent, batch_size);
+
+		// Loopback delivers right away, so everything is there already
+		int received = 0;
+		while (received < batch_size) {
+			int n = socket.Receive(&senders[received],
+				&buffer[received * 1500], 1500, &sizes[received],
+				batch_size - received);
+			UASSERT(n > 0);
+			received += n;
+		}
+
+		for (int i = 0; i < batch_size; i++) {
+			const u8 *datagram = &buffer[i * 1500];
+			UASSERTEQ(int, sizes[i],
+				sizeof(header) + datagrams[i].size);
+			UASSERT(senders[i] == address);
+			UASSERT(memcmp(datagram, header, sizeof(header)) == 0);
+			UASSERT(memcmp(datagram + sizeof(header), datagrams[i].data,
+				datagrams[i].size) == 0);
+		}
+		count += received;
+	}
+	u32 dtime = MYMAX(porting::getTimeMs() - t0, 1);
+
+	rawstream << "    " << count * 1000ULL / dtime << " packets/s" << std::endl;
+}
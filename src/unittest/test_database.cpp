@@ -0,0 +1,210 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "database-dummy.h"
+#include "database-sqlite3.h"
+#include "porting.h"
+#include "util/basic_macros.h"
+#include "util/string.h"
+
+// Size of the test world in blocks
+#define WORLD_SIZE_XZ 21
+#define WORLD_SIZE_Y 14
+// Area loaded at once by the benchmarks: a 5^3 mapchunk and its borders
+#define BENCH_AREA_SIZE 7
+
+class TestDatabase : public TestBase {
+public:
+	TestDatabase() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestDatabase"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testLoadBlocksDefault();
+	void testLoadBlocksSQLite3();
+	void benchLoadBlockSQLite3();
+	void benchLoadBlocksSQLite3();
+
+	void makeWorld();
+
+	std::string m_world_dir;
+};
+
+static TestDatabase g_test_instance;
+
+void TestDatabase::runTests(IGameDef *gamedef)
+{
+	TEST(testLoadBlocksDefault);
+
+	makeWorld();
+	TEST(testLoadBlocksSQLite3);
+
+	// Compare these two to see how reading blocks from a cold world performs
+	BENCH(benchLoadBlockSQLite3);
+	BENCH(benchLoadBlocksSQLite3);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Some data of a plausible size that differs between blocks
+static std::string block_data(v3s16 p)
+{
+	std::string data = "block " + itos(p.X) + "," + itos(p.Y) + "," +
+		itos(p.Z) + ";";
+	while (data.size() < 1500)
+		data += data;
+	return data;
+}
+
+static bool in_world(v3s16 p)
+{
+	return p.X >= 0 && p.X < WORLD_SIZE_XZ &&
+		p.Y >= 0 && p.Y < WORLD_SIZE_Y &&
+		p.Z >= 0 && p.Z < WORLD_SIZE_XZ;
+}
+
+// Positions of the benchmark areas, some of them outside of the world
+static void bench_areas(std::vector<std::vector<v3s16> > &areas)
+{
+	for (s16 z = -1; z < WORLD_SIZE_XZ; z += BENCH_AREA_SIZE)
+	for (s16 y = -1; y < WORLD_SIZE_Y; y += BENCH_AREA_SIZE)
+	for (s16 x = -1; x < WORLD_SIZE_XZ; x += BENCH_AREA_SIZE) {
+		areas.push_back(std::vector<v3s16>());
+		v3s16 p;
+		for (p.Z = z; p.Z < z + BENCH_AREA_SIZE; p.Z++)
+		for (p.Y = y; p.Y < y + BENCH_AREA_SIZE; p.Y++)
+		for (p.X = x; p.X < x + BENCH_AREA_SIZE; p.X++)
+			areas.back().push_back(p);
+	}
+}
+
+void TestDatabase::makeWorld()
+{
+	m_world_dir = getTestTempDirectory() + DIR_DELIM "world";
+
+	Database_SQLite3 db(m_world_dir);
+	db.beginSave();
+	v3s16 p;
+	for (p.Z = 0; p.Z < WORLD_SIZE_XZ; p.Z++)
+	for (p.Y = 0; p.Y < WORLD_SIZE_Y; p.Y++)
+	for (p.X = 0; p.X < WORLD_SIZE_XZ; p.X++)
+		db.saveBlock(p, block_data(p));
+	db.endSave();
+}
+
+static void check_loaded_blocks(Database &db)
+{
+	std::vector<v3s16> positions;
+	positions.push_back(v3s16(1, 2, 3));
+	positions.push_back(v3s16(-5, 0, 0));
+	positions.push_back(v3s16(4, 4, 4));
+	// The same block may be asked for twice
+	positions.push_back(v3s16(1, 2, 3));
+	// More than fit into one query
+	for (s16 x = 0; x < WORLD_SIZE_XZ; x++)
+	for (s16 y = 0; y < 10; y++)
+		positions.push_back(v3s16(x, y, 7));
+
+	std::vector<std::string> blocks;
+	blocks.push_back("stale");
+	db.loadBlocks(positions, blocks);
+
+	UASSERTEQ(size_t, blocks.size(), positions.size());
+	for (size_t i = 0; i < positions.size(); i++) {
+		if (in_world(positions[i]))
+			UASSERT(blocks[i] == block_data(positions[i]));
+		else
+			UASSERT(blocks[i] == "");
+	}
+
+	positions.clear();
+	db.loadBlocks(positions, blocks);
+	UASSERT(blocks.empty());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestDatabase::testLoadBlocksDefault()
+{
+	Database_Dummy db;
+	v3s16 p;
+	for (p.Z = 0; p.Z < WORLD_SIZE_XZ; p.Z++)
+	for (p.Y = 0; p.Y < WORLD_SIZE_Y; p.Y++)
+	for (p.X = 0; p.X < WORLD_SIZE_XZ; p.X++)
+		db.saveBlock(p, block_data(p));
+
+	check_loaded_blocks(db);
+}
+
+void TestDatabase::testLoadBlocksSQLite3()
+{
+	Database_SQLite3 db(m_world_dir);
+	check_loaded_blocks(db);
+}
+
+/*
+	Both benchmarks open the database anew and load the world area by
+	area, as the emerge threads do for mapchunks.
+*/
+
+void TestDatabase::benchLoadBlockSQLite3()
+{
+	std::vector<std::vector<v3s16> > areas;
+	bench_areas(areas);
+
+	Database_SQLite3 db(m_world_dir);
+	u32 count = 0;
+	u32 t0 = porting::getTimeMs();
+	for (size_t a = 0; a < areas.size(); a++) {
+		for (size_t i = 0; i < areas[a].size(); i++) {
+			std::string data;
+			db.loadBlock(areas[a][i], &data);
+			if (!data.empty())
+				count++;
+		}
+	}
+	u32 dtime = MYMAX(porting::getTimeMs() - t0, 1);
+
+	UASSERTEQ(u32, count, WORLD_SIZE_XZ * WORLD_SIZE_Y * WORLD_SIZE_XZ);
+	rawstream << "    " << count * 1000 / dtime << " blocks/s" << std::endl;
+}
+
+void TestDatabase::benchLoadBlocksSQLite3()
+{
+	std::vector<std::vector<v3s16> > areas;
+	bench_areas(areas);
+
+	Database_SQLite3 db(m_world_dir);
+	u32 count = 0;
+	u32 t0 = porting::getTimeMs();
+	for (size_t a = 0; a < areas.size(); a++) {
+		std::vector<std::string> blocks;
+		db.loadBlocks(areas[a], blocks);
+		for (size_t i = 0; i < blocks.size(); i++) {
+			if (!blocks[i].empty())
+				count++;
+		}
+	}
+	u32 dtime = MYMAX(porting::getTimeMs() - t0, 1);
+
+	UASSERTEQ(u32, count, WORLD_SIZE_XZ * WORLD_SIZE_Y * WORLD_SIZE_XZ);
+	rawstream << "    " << count * 1000 / dtime << " blocks/s" << std::endl;
+}
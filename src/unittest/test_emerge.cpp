@@ -0,0 +1,320 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <deque>
+#include <set>
+#include "emerge.h"
+#include "util/basic_macros.h"
+
+// Simulated server: emerge threads, and the milliseconds it takes to
+// generate a mapchunk or to get a block of one that is generated already
+#define SIM_THREADS 4
+#define SIM_CHUNKSIZE 5
+#define SIM_GENERATE_MS 100
+#define SIM_FROM_MEMORY_MS 1
+// A player joins while an emerge_area() of this many blocks per side
+// is being worked on
+#define SIM_AREA_SIZE 30
+#define SIM_JOIN_MS 500
+
+class TestEmerge : public TestBase {
+public:
+	TestEmerge() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestEmerge"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testNearestChunkFirst();
+	void testChunkDeduplication();
+	void testPlayerMoves();
+	void benchJoiningPlayer();
+};
+
+static TestEmerge g_test_instance;
+
+void TestEmerge::runTests(IGameDef *gamedef)
+{
+	TEST(testNearestChunkFirst);
+	TEST(testChunkDeduplication);
+	TEST(testPlayerMoves);
+	BENCH(benchJoiningPlayer);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static v3s16 chunk_of(v3s16 blockpos)
+{
+	return EmergeManager::getContainingChunk(blockpos, SIM_CHUNKSIZE);
+}
+
+static bool push(EmergeScheduler &scheduler, v3s16 blockpos)
+{
+	return scheduler.push(blockpos, chunk_of(blockpos));
+}
+
+void TestEmerge::testNearestChunkFirst()
+{
+	v3s16 chunkpos;
+
+	// The order they came in without players
+	{
+		EmergeScheduler scheduler;
+		UASSERT(push(scheduler, v3s16(100, 0, 0)));
+		UASSERT(push(scheduler, v3s16(1, 0, 0)));
+		UASSERT(scheduler.takeChunk(&chunkpos));
+		UASSERT(chunkpos == chunk_of(v3s16(100, 0, 0)));
+		UASSERT(scheduler.takeChunk(&chunkpos));
+		UASSERT(chunkpos == chunk_of(v3s16(1, 0, 0)));
+		UASSERT(!scheduler.takeChunk(&chunkpos));
+	}
+
+	// Closest to any of the players first
+	{
+		EmergeScheduler scheduler;
+		std::vector<v3s16> players;
+		players.push_back(v3s16(0, 0, 0));
+		players.push_back(v3s16(0, 100, 0));
+		scheduler.setPlayerPositions(players);
+
+		UASSERT(push(scheduler, v3s16(100, 0, 0)));
+		UASSERT(push(scheduler, v3s16(0, 50, 0)));
+		UASSERT(push(scheduler, v3s16(0, 90, 0)));
+		UASSERT(push(scheduler, v3s16(20, 0, 0)));
+
+		UASSERT(scheduler.takeChunk(&chunkpos));
+		UASSERT(chunkpos == chunk_of(v3s16(0, 90, 0)));
+		UASSERT(scheduler.takeChunk(&chunkpos));
+		UASSERT(chunkpos == chunk_of(v3s16(20, 0, 0)));
+		UASSERT(scheduler.takeChunk(&chunkpos));
+		UASSERT(chunkpos == chunk_of(v3s16(0, 50, 0)));
+
+		// A closer block moves its mapchunk up
+		UASSERT(!push(scheduler, v3s16(98, 0, 0)));
+		UASSERT(push(scheduler, v3s16(0, 30, 0)));
+		UASSERT(scheduler.takeChunk(&chunkpos));
+		UASSERT(chunkpos == chunk_of(v3s16(0, 30, 0)));
+		UASSERT(scheduler.takeChunk(&chunkpos));
+		UASSERT(chunkpos == chunk_of(v3s16(100, 0, 0)));
+		UASSERT(!scheduler.takeChunk(&chunkpos));
+	}
+}
+
+void TestEmerge::testChunkDeduplication()
+{
+	EmergeScheduler scheduler;
+	v3s16 chunkpos, blockpos;
+
+	UASSERT(push(scheduler, v3s16(0, 0, 0)));
+	UASSERT(!push(scheduler, v3s16(1, 0, 0)));
+	UASSERT(!push(scheduler, v3s16(2, 2, 2)));
+	UASSERT(push(scheduler, v3s16(3, 0, 0)));
+
+	UASSERT(scheduler.takeChunk(&chunkpos));
+	UASSERT(chunkpos == chunk_of(v3s16(0, 0, 0)));
+	UASSERT(scheduler.popBlock(chunkpos, &blockpos));
+	UASSERT(blockpos == v3s16(0, 0, 0));
+
+	// Goes to the thread working on the mapchunk
+	UASSERT(!push(scheduler, v3s16(-1, 0, 0)));
+	UASSERT(scheduler.takeChunk(&chunkpos));
+	UASSERT(chunkpos == chunk_of(v3s16(3, 0, 0)));
+	UASSERT(!scheduler.takeChunk(&chunkpos));
+
+	chunkpos = chunk_of(v3s16(0, 0, 0));
+	UASSERT(scheduler.popBlock(chunkpos, &blockpos));
+	UASSERT(blockpos == v3s16(1, 0, 0));
+	UASSERT(scheduler.popBlock(chunkpos, &blockpos));
+	UASSERT(blockpos == v3s16(2, 2, 2));
+	UASSERT(scheduler.popBlock(chunkpos, &blockpos));
+	UASSERT(blockpos == v3s16(-1, 0, 0));
+	UASSERT(!scheduler.popBlock(chunkpos, &blockpos));
+
+	// Released with the last block
+	UASSERT(push(scheduler, v3s16(0, 0, 0)));
+	UASSERT(scheduler.takeChunk(&chunkpos));
+	UASSERT(chunkpos == chunk_of(v3s16(0, 0, 0)));
+}
+
+void TestEmerge::testPlayerMoves()
+{
+	EmergeScheduler scheduler;
+	std::vector<v3s16> players(1, v3s16(0, 0, 0));
+	scheduler.setPlayerPositions(players);
+	v3s16 chunkpos;
+
+	for (s16 x = 0; x <= 100; x += 10)
+		UASSERT(push(scheduler, v3s16(x, 0, 0)));
+
+	UASSERT(scheduler.takeChunk(&chunkpos));
+	UASSERT(chunkpos == chunk_of(v3s16(0, 0, 0)));
+
+	players[0] = v3s16(100, 0, 0);
+	scheduler.setPlayerPositions(players);
+	for (s16 x = 100; x > 0; x -= 10) {
+		UASSERT(scheduler.takeChunk(&chunkpos));
+		UASSERT(chunkpos == chunk_of(v3s16(x, 0, 0)));
+	}
+	UASSERT(!scheduler.takeChunk(&chunkpos));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct SimThread
+{
+	u32 busy_until;
+	bool busy;
+	v3s16 blockpos;
+	bool generating;
+	bool have_chunk;
+	v3s16 chunkpos;
+	std::deque<v3s16> queue;
+};
+
+struct SimResult
+{
+	u32 first_block_ms;
+	u32 all_blocks_ms;
+	// Mapchunks that were generated again
+	u32 duplicates;
+};
+
+static void sim_start(SimThread &thread, v3s16 blockpos, u32 time,
+		const std::set<v3s16> &generated)
+{
+	thread.busy = true;
+	thread.blockpos = blockpos;
+	// Threads that get a block of the same mapchunk generate it again
+	thread.generating = generated.find(chunk_of(blockpos)) == generated.end();
+	thread.busy_until = time +
+		(thread.generating ? SIM_GENERATE_MS : SIM_FROM_MEMORY_MS);
+}
+
+/*
+	Threads that work on the blocks of an emerge_area() far away when a
+	player joins and asks for the blocks around it.  Either with the
+	scheduler, or like before with a queue for every thread that each
+	block goes to the shortest of.
+*/
+static SimResult sim_join(bool use_scheduler)
+{
+	EmergeScheduler scheduler;
+	SimThread threads[SIM_THREADS];
+	std::set<v3s16> generated;
+	std::set<v3s16> player_blocks;
+	SimResult result;
+	result.first_block_ms = 0;
+	result.all_blocks_ms = 0;
+	result.duplicates = 0;
+
+	for (u32 i = 0; i < SIM_THREADS; i++) {
+		threads[i].busy = false;
+		threads[i].have_chunk = false;
+	}
+
+	std::vector<v3s16> requests;
+	v3s16 p;
+	for (p.Z = 0; p.Z < SIM_AREA_SIZE; p.Z++)
+	for (p.Y = 0; p.Y < SIM_AREA_SIZE / 3; p.Y++)
+	for (p.X = 0; p.X < SIM_AREA_SIZE; p.X++)
+		requests.push_back(p + v3s16(100, 0, 0));
+
+	for (u32 time = 0; result.all_blocks_ms == 0; time++) {
+		if (time == SIM_JOIN_MS) {
+			scheduler.setPlayerPositions(std::vector<v3s16>(1, v3s16(0, 0, 0)));
+			for (p.Z = -1; p.Z <= 1; p.Z++)
+			for (p.Y = -1; p.Y <= 1; p.Y++)
+			for (p.X = -1; p.X <= 1; p.X++) {
+				requests.push_back(p);
+				player_blocks.insert(p);
+			}
+		}
+
+		for (size_t i = 0; i < requests.size(); i++) {
+			if (use_scheduler) {
+				push(scheduler, requests[i]);
+				continue;
+			}
+			SimThread *shortest = &threads[0];
+			for (u32 j = 1; j < SIM_THREADS; j++) {
+				if (threads[j].queue.size() < shortest->queue.size())
+					shortest = &threads[j];
+			}
+			shortest->queue.push_back(requests[i]);
+		}
+		requests.clear();
+
+		for (u32 i = 0; i < SIM_THREADS; i++) {
+			SimThread &thread = threads[i];
+			if (thread.busy && thread.busy_until <= time) {
+				thread.busy = false;
+				if (thread.generating &&
+						!generated.insert(chunk_of(thread.blockpos)).second)
+					result.duplicates++;
+				if (player_blocks.erase(thread.blockpos)) {
+					if (result.first_block_ms == 0)
+						result.first_block_ms = time - SIM_JOIN_MS;
+					if (player_blocks.empty())
+						result.all_blocks_ms = time - SIM_JOIN_MS;
+				}
+			}
+			if (thread.busy)
+				continue;
+
+			v3s16 blockpos;
+			if (!use_scheduler) {
+				if (thread.queue.empty())
+					continue;
+				blockpos = thread.queue.front();
+				thread.queue.pop_front();
+				sim_start(thread, blockpos, time, generated);
+				continue;
+			}
+			while (!thread.busy) {
+				if (!thread.have_chunk &&
+						!scheduler.takeChunk(&thread.chunkpos))
+					break;
+				thread.have_chunk = true;
+				if (scheduler.popBlock(thread.chunkpos, &blockpos))
+					sim_start(thread, blockpos, time, generated);
+				else
+					thread.have_chunk = false;
+			}
+		}
+	}
+
+	return result;
+}
+
+void TestEmerge::benchJoiningPlayer()
+{
+	SimResult before = sim_join(false);
+	SimResult after = sim_join(true);
+
+	UASSERT(after.first_block_ms < before.first_block_ms);
+	UASSERT(after.all_blocks_ms < before.all_blocks_ms);
+	UASSERTEQ(u32, after.duplicates, 0);
+
+	rawstream << "    first block after " << after.first_block_ms << " ms (was "
+		<< before.first_block_ms << " ms), all 27 after "
+		<< after.all_blocks_ms << " ms (was " << before.all_blocks_ms
+		<< " ms), " << after.duplicates << " mapchunks generated twice (was "
+		<< before.duplicates << ")" << std::endl;
+}
@@ -0,0 +1,286 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <sstream>
+#include "constants.h"
+#include "genericobject.h"
+#include "noise.h"
+#include "util/basic_macros.h"
+#include "util/serialize.h"
+
+// Mobs walking around, with the update interval of LuaEntitySAO
+#define BENCH_OBJECTS 300
+#define BENCH_SECONDS 60
+#define BENCH_UPDATE_INTERVAL 0.2f
+// Share of the unreliable messages that get lost
+#define BENCH_LOSS_PERCENT 10
+
+class TestGenericObject : public TestBase {
+public:
+	TestGenericObject() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestGenericObject"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testPositionKeyframes();
+	void testPositionDeltas();
+	void testLostPositionMessages();
+	void benchPositionBandwidth();
+};
+
+static TestGenericObject g_test_instance;
+
+void TestGenericObject::runTests(IGameDef *gamedef)
+{
+	TEST(testPositionKeyframes);
+	TEST(testPositionDeltas);
+	TEST(testLostPositionMessages);
+	BENCH(benchPositionBandwidth);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns false if the decoder did not move the object
+static bool decode(PositionUpdateDecoder &decoder, const std::string &data,
+		ObjectPositionUpdate *update)
+{
+	std::istringstream is(data, std::ios::binary);
+	u8 cmd = readU8(is);
+	UASSERT(cmd == GENERIC_CMD_UPDATE_POSITION_KEYFRAME ||
+		cmd == GENERIC_CMD_UPDATE_POSITION_DELTA);
+	return decoder.read(cmd, is, update);
+}
+
+static ObjectPositionUpdate walking_update(v3f position, f32 yaw)
+{
+	ObjectPositionUpdate update;
+	update.position = position;
+	update.velocity = v3f(1.5, 0, -0.5) * BS;
+	update.acceleration = v3f(0, -9.81, 0) * BS;
+	update.yaw = yaw;
+	update.do_interpolate = true;
+	update.update_interval = 0.09;
+	return update;
+}
+
+void TestGenericObject::testPositionKeyframes()
+{
+	PositionUpdateEncoder encoder;
+	PositionUpdateDecoder decoder;
+	ObjectPositionUpdate decoded;
+	bool is_keyframe;
+
+	// Nothing to give to new clients yet
+	UASSERT(encoder.getKeyframe().empty());
+
+	// The first update is a keyframe
+	std::string data = encoder.encode(
+		walking_update(v3f(10, 20, 30) * BS, 90), &is_keyframe);
+	UASSERT(is_keyframe);
+	UASSERT(decode(decoder, data, &decoded));
+	UASSERT(decoded.position.getDistanceFrom(v3f(10, 20, 30) * BS) < 0.01);
+	UASSERT(decoded.velocity.getDistanceFrom(v3f(1.5, 0, -0.5) * BS) < 0.01);
+	UASSERT(fabs(decoded.yaw - 90) < 0.01);
+
+	// Then deltas, until the keyframe gets too old
+	encoder.encode(walking_update(v3f(11, 20, 30) * BS, 90), &is_keyframe);
+	UASSERT(!is_keyframe);
+	encoder.step(0.5);
+	encoder.encode(walking_update(v3f(12, 20, 30) * BS, 90), &is_keyframe);
+	UASSERT(!is_keyframe);
+	encoder.step(0.5);
+	encoder.encode(walking_update(v3f(13, 20, 30) * BS, 90), &is_keyframe);
+	UASSERT(is_keyframe);
+
+	// Moves out of the range of deltas
+	encoder.encode(walking_update(v3f(500, 20, 30) * BS, 90), &is_keyframe);
+	UASSERT(is_keyframe);
+
+	// Jumps are keyframes
+	ObjectPositionUpdate jump = walking_update(v3f(501, 20, 30) * BS, 90);
+	jump.do_interpolate = false;
+	encoder.encode(jump, &is_keyframe);
+	UASSERT(is_keyframe);
+
+	// A client that starts to see the object gets the keyframe without
+	// moving the object, and can use the deltas after it
+	PositionUpdateDecoder new_decoder;
+	UASSERT(!decode(new_decoder, encoder.getKeyframe(), &decoded));
+	data = encoder.encode(walking_update(v3f(502, 20, 30) * BS, 90),
+		&is_keyframe);
+	UASSERT(!is_keyframe);
+	UASSERT(decode(new_decoder, data, &decoded));
+	UASSERT(decoded.position.getDistanceFrom(v3f(502, 20, 30) * BS) < 0.1);
+}
+
+void TestGenericObject::testPositionDeltas()
+{
+	PcgRandom pr(13);
+	PositionUpdateEncoder encoder;
+	PositionUpdateDecoder decoder;
+	v3f base(-1000 * BS, 5 * BS, 2000 * BS);
+
+	for (u32 i = 0; i < 1000; i++) {
+		ObjectPositionUpdate update;
+		update.position = base + v3f(pr.range(-2000, 2000),
+			pr.range(-2000, 2000), pr.range(-2000, 2000)) * (0.1 * BS);
+		update.velocity = v3f(pr.range(-100, 100), pr.range(-100, 100),
+			pr.range(-100, 100)) * (0.1 * BS);
+		update.acceleration = v3f(0, pr.range(-10, 0), 0) * BS;
+		update.yaw = pr.range(-720, 720) * 0.5;
+		update.do_interpolate = pr.range(0, 10) > 0;
+		update.is_movement_end = pr.range(0, 1);
+		update.update_interval = pr.range(1, 3) * 0.1;
+
+		bool is_keyframe;
+		std::string data = encoder.encode(update, &is_keyframe);
+		ObjectPositionUpdate decoded;
+		UASSERT(decode(decoder, data, &decoded));
+
+		// Within half a step of the deltas
+		f32 max_error = BS / 256 + 0.01;
+		UASSERT(fabs(decoded.position.X - update.position.X) <= max_error);
+		UASSERT(fabs(decoded.position.Y - update.position.Y) <= max_error);
+		UASSERT(fabs(decoded.position.Z - update.position.Z) <= max_error);
+		UASSERT(decoded.velocity.getDistanceFrom(update.velocity) <= 2 * max_error);
+		UASSERT(decoded.acceleration.getDistanceFrom(update.acceleration) <= 2 * max_error);
+		// The same direction
+		f32 yaw_error = fmod(fabs(decoded.yaw - update.yaw) + 0.01, 360);
+		UASSERT(yaw_error < 0.02);
+		UASSERT(decoded.do_interpolate == update.do_interpolate);
+		UASSERT(decoded.is_movement_end == update.is_movement_end);
+		UASSERT(fabs(decoded.update_interval - update.update_interval) < 0.01);
+	}
+}
+
+void TestGenericObject::testLostPositionMessages()
+{
+	PositionUpdateEncoder encoder;
+	PositionUpdateDecoder decoder;
+	ObjectPositionUpdate decoded;
+	bool is_keyframe;
+
+	// Deltas before their keyframe arrived are ignored
+	std::string keyframe = encoder.encode(
+		walking_update(v3f(0, 0, 0), 0), &is_keyframe);
+	std::string delta = encoder.encode(
+		walking_update(v3f(1, 0, 0) * BS, 0), &is_keyframe);
+	UASSERT(!decode(decoder, delta, &decoded));
+	UASSERT(decode(decoder, keyframe, &decoded));
+
+	// A lost delta does not affect the next one
+	encoder.encode(walking_update(v3f(2, 0, 0) * BS, 0), &is_keyframe);
+	delta = encoder.encode(walking_update(v3f(3, 0, 0) * BS, 0), &is_keyframe);
+	UASSERT(decode(decoder, delta, &decoded));
+	UASSERT(decoded.position.getDistanceFrom(v3f(3, 0, 0) * BS) < 0.1);
+
+	// Deltas against an older keyframe are ignored
+	encoder.step(1.0);
+	std::string new_keyframe = encoder.encode(
+		walking_update(v3f(4, 0, 0) * BS, 0), &is_keyframe);
+	UASSERT(is_keyframe);
+	UASSERT(decode(decoder, new_keyframe, &decoded));
+	UASSERT(!decode(decoder, delta, &decoded));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct BenchMob
+{
+	v3f position;
+	v3f velocity;
+	f32 yaw;
+	f32 turn_timer;
+	PositionUpdateEncoder encoder;
+	PositionUpdateDecoder decoder;
+};
+
+/*
+	Mobs that walk in a direction for a few seconds, then pick another one.
+	Counts the bytes of the object messages for clients that only know
+	GENERIC_CMD_UPDATE_POSITION and for the ones that get keyframes and
+	deltas, including the object id and length in front of every message.
+*/
+void TestGenericObject::benchPositionBandwidth()
+{
+	PcgRandom pr(300);
+	std::vector<BenchMob> mobs(BENCH_OBJECTS);
+	for (size_t i = 0; i < mobs.size(); i++) {
+		mobs[i].position = v3f(pr.range(-500, 500), pr.range(0, 20),
+			pr.range(-500, 500)) * BS;
+		mobs[i].turn_timer = 0;
+	}
+
+	u64 full_bytes = 0;
+	u64 delta_bytes = 0;
+	u64 keyframe_bytes = 0;
+	f32 max_error = 0;
+	u32 steps = BENCH_SECONDS / BENCH_UPDATE_INTERVAL;
+	for (u32 step = 0; step < steps; step++)
+	for (size_t i = 0; i < mobs.size(); i++) {
+		BenchMob &mob = mobs[i];
+		mob.turn_timer -= BENCH_UPDATE_INTERVAL;
+		if (mob.turn_timer <= 0) {
+			mob.turn_timer = pr.range(2, 6);
+			mob.yaw = pr.range(0, 359);
+			f32 speed = pr.range(0, 4) * BS;
+			mob.velocity = v3f(-sin(mob.yaw * core::DEGTORAD) * speed, 0,
+				cos(mob.yaw * core::DEGTORAD) * speed);
+		}
+		mob.position += mob.velocity * BENCH_UPDATE_INTERVAL;
+		mob.encoder.step(BENCH_UPDATE_INTERVAL);
+
+		ObjectPositionUpdate update;
+		update.position = mob.position;
+		update.velocity = mob.velocity;
+		update.acceleration = v3f(0, -9.81, 0) * BS;
+		update.yaw = mob.yaw;
+		update.do_interpolate = true;
+		update.update_interval = BENCH_UPDATE_INTERVAL;
+
+		full_bytes += 4 + gob_cmd_update_position(update.position,
+			update.velocity, update.acceleration, update.yaw, true, false,
+			update.update_interval).size();
+
+		bool is_keyframe;
+		std::string data = mob.encoder.encode(update, &is_keyframe);
+		if (is_keyframe)
+			keyframe_bytes += 4 + data.size();
+		else
+			delta_bytes += 4 + data.size();
+
+		if (!is_keyframe && pr.range(0, 99) < BENCH_LOSS_PERCENT)
+			continue;
+		ObjectPositionUpdate decoded;
+		if (decode(mob.decoder, data, &decoded)) {
+			max_error = MYMAX(max_error,
+				decoded.position.getDistanceFrom(update.position));
+		}
+	}
+
+	// Losses don't add up
+	UASSERT(max_error < BS / 100);
+	UASSERT(keyframe_bytes + delta_bytes < full_bytes);
+	rawstream << "    full: " << full_bytes / BENCH_SECONDS << " B/s, "
+		<< "keyframes + deltas: " << (keyframe_bytes + delta_bytes) / BENCH_SECONDS
+		<< " B/s (" << keyframe_bytes / BENCH_SECONDS << " B/s keyframes), "
+		<< BENCH_OBJECTS << " objects" << std::endl;
+}
@@ -0,0 +1,215 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "gamedef.h"
+#include "map.h"
+#include "mapblock.h"
+#include "noise.h"
+#include "porting.h"
+#include "settings.h"
+#include "threading/thread.h"
+#include "util/basic_macros.h"
+#include "util/string.h"
+
+// Blocks of the test map, in each horizontal direction from the center
+#define MAP_RADIUS 3
+#define MAX_PASSES 1000
+
+class TestLiquid : public TestBase {
+public:
+	TestLiquid() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestLiquid"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testParallelMatchesSerial(IGameDef *gamedef);
+	void benchSerial(IGameDef *gamedef);
+	void benchParallel(IGameDef *gamedef);
+};
+
+static TestLiquid g_test_instance;
+
+void TestLiquid::runTests(IGameDef *gamedef)
+{
+	TEST(testParallelMatchesSerial, gamedef);
+
+	// Compare these two to see how the liquid queue drains
+	BENCH(benchSerial, gamedef);
+	BENCH(benchParallel, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+	Uneven ground with a lake held back by a wall along x = 0
+*/
+class FloodTerrain : public TestTerrain {
+public:
+	FloodTerrain(): pr(1234) {}
+
+	s16 getGroundHeight(s16 x, s16 z)
+	{
+		const s16 r = MAP_RADIUS * MAP_BLOCKSIZE;
+		return pr.range(-4, -1) + (x + r) / 8 - (z * z) / 200;
+	}
+
+	MapNode getNode(v3s16 p, s16 ground)
+	{
+		if (p.Y <= ground || (p.X == 0 && p.Y <= 12))
+			return MapNode(t_CONTENT_STONE);
+		if (p.X < 0 && p.Y <= 10)
+			return MapNode(t_CONTENT_WATER);
+		return MapNode(CONTENT_AIR);
+	}
+
+	// Goes on to place the springs
+	PcgRandom pr;
+};
+
+/*
+	The lake with some springs around.  The wall is removed and queued,
+	like a dam breaking.
+*/
+static Map *make_flood_map(IGameDef *gamedef)
+{
+	FloodTerrain terrain;
+	Map *map = make_test_map(gamedef, MAP_RADIUS, -1, 1, terrain);
+	const s16 r = MAP_RADIUS * MAP_BLOCKSIZE;
+
+	for (u32 i = 0; i < 30; i++) {
+		v3s16 p(terrain.pr.range(1, r - 1), 15, terrain.pr.range(-r, r - 1));
+		MapNode n(t_CONTENT_WATER);
+		map->setNode(p, n);
+		map->transforming_liquid_add(p);
+	}
+
+	for (s16 z = -r; z < r; z++)
+	for (s16 y = -MAP_BLOCKSIZE; y <= 12; y++) {
+		v3s16 p(0, y, z);
+		MapNode n(CONTENT_AIR);
+		map->setNode(p, n);
+		map->transforming_liquid_add(p);
+	}
+	return map;
+}
+
+static bool same_blocks(Map *a, Map *b, const std::map<v3s16, MapBlock *> &blocks)
+{
+	for (std::map<v3s16, MapBlock *>::const_iterator i = blocks.begin();
+			i != blocks.end(); ++i) {
+		v3s16 p0 = i->first * MAP_BLOCKSIZE;
+		v3s16 p;
+		for (p.Z = p0.Z; p.Z < p0.Z + MAP_BLOCKSIZE; p.Z++)
+		for (p.Y = p0.Y; p.Y < p0.Y + MAP_BLOCKSIZE; p.Y++)
+		for (p.X = p0.X; p.X < p0.X + MAP_BLOCKSIZE; p.X++) {
+			MapNode na = a->getNodeNoEx(p);
+			MapNode nb = b->getNodeNoEx(p);
+			if (na.getContent() != nb.getContent() || na.param2 != nb.param2)
+				return false;
+		}
+	}
+	return true;
+}
+
+// Runs liquid steps until the queue is empty, returns the nodes transformed
+static u32 drain_queue(Map *map, u32 *passes)
+{
+	u32 transformed = 0;
+	u32 loop_max = g_settings->getS32("liquid_loop_max");
+	for (*passes = 0; *passes < MAX_PASSES &&
+			map->transforming_liquid_size() > 0; (*passes)++) {
+		transformed += MYMIN(map->transforming_liquid_size(), loop_max);
+		std::map<v3s16, MapBlock *> modified_blocks;
+		map->transformLiquids(modified_blocks);
+	}
+	return transformed;
+}
+
+void TestLiquid::testParallelMatchesSerial(IGameDef *gamedef)
+{
+	std::string old_threads = g_settings->get("num_liquid_threads");
+	std::string old_loop_max = g_settings->get("liquid_loop_max");
+	// Several passes, and more regions than threads
+	g_settings->set("liquid_loop_max", "3000");
+
+	Map *serial = make_flood_map(gamedef);
+	Map *parallel = make_flood_map(gamedef);
+
+	u32 pass = 0;
+	for (; pass < MAX_PASSES && serial->transforming_liquid_size() > 0; pass++) {
+		std::map<v3s16, MapBlock *> serial_blocks;
+		std::map<v3s16, MapBlock *> parallel_blocks;
+
+		g_settings->set("num_liquid_threads", "0");
+		serial->transformLiquids(serial_blocks);
+		g_settings->set("num_liquid_threads", "3");
+		parallel->transformLiquids(parallel_blocks);
+
+		UASSERTEQ(s32, parallel->transforming_liquid_size(),
+			serial->transforming_liquid_size());
+		UASSERTEQ(size_t, parallel_blocks.size(), serial_blocks.size());
+		UASSERT(same_blocks(serial, parallel, serial_blocks));
+	}
+	// The flood settled
+	UASSERT(pass > 10 && pass < MAX_PASSES);
+	UASSERTEQ(s32, parallel->transforming_liquid_size(), 0);
+
+	std::map<v3s16, MapBlock *> all_blocks;
+	for (s16 z = -MAP_RADIUS; z < MAP_RADIUS; z++)
+	for (s16 y = -1; y <= 1; y++)
+	for (s16 x = -MAP_RADIUS; x < MAP_RADIUS; x++)
+		all_blocks[v3s16(x, y, z)] = NULL;
+	UASSERT(same_blocks(serial, parallel, all_blocks));
+
+	delete serial;
+	delete parallel;
+	g_settings->set("num_liquid_threads", old_threads);
+	g_settings->set("liquid_loop_max", old_loop_max);
+}
+
+static void bench_flood(IGameDef *gamedef, u16 num_threads)
+{
+	std::string old_threads = g_settings->get("num_liquid_threads");
+	g_settings->set("num_liquid_threads", itos(num_threads));
+
+	Map *map = make_flood_map(gamedef);
+	u32 passes;
+	u32 t0 = porting::getTimeMs();
+	u32 transformed = drain_queue(map, &passes);
+	u32 dtime = MYMAX(porting::getTimeMs() - t0, 1);
+	delete map;
+
+	g_settings->set("num_liquid_threads", old_threads);
+	UASSERT(passes < MAX_PASSES);
+	rawstream << "    " << num_threads << " threads: "
+		<< (u64)transformed * 1000 / dtime << " nodes/s, "
+		<< transformed << " nodes in " << passes << " steps" << std::endl;
+}
+
+void TestLiquid::benchSerial(IGameDef *gamedef)
+{
+	bench_flood(gamedef, 0);
+}
+
+void TestLiquid::benchParallel(IGameDef *gamedef)
+{
+	bench_flood(gamedef, MYMAX(Thread::getNumberOfProcessors(), 2) - 1);
+}
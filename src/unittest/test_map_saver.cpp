@@ -0,0 +1,236 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <sstream>
+#include "database-dummy.h"
+#include "map_saver.h"
+#include "mapblock.h"
+#include "serialization.h"
+#include "util/serialize.h"
+#include "threading/mutex_auto_lock.h"
+#include "threading/semaphore.h"
+#include "threading/thread.h"
+
+#define NUM_TEST_BLOCKS 8
+#define NUM_SAVES 50
+
+class TestMapSaver : public TestBase {
+public:
+	TestMapSaver() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapSaver"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testSnapshotRoundtrip(IGameDef *gamedef);
+	void testSynchronous(IGameDef *gamedef);
+	void testLatestSnapshotWins(IGameDef *gamedef);
+	void testWaitingThreads(IGameDef *gamedef);
+};
+
+static TestMapSaver g_test_instance;
+
+void TestMapSaver::runTests(IGameDef *gamedef)
+{
+	TEST(testSnapshotRoundtrip, gamedef);
+	TEST(testSynchronous, gamedef);
+	TEST(testLatestSnapshotWins, gamedef);
+	TEST(testWaitingThreads, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void fill_block(MapBlock &block, u8 param2)
+{
+	v3s16 p0;
+	for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++)
+	for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+	for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++) {
+		content_t c = p0.Y < 8 ? t_CONTENT_STONE : CONTENT_AIR;
+		MapNode n(c, 0, param2);
+		block.setNodeNoCheck(p0, n);
+	}
+}
+
+static MapBlockSnapshot *make_snapshot(IGameDef *gamedef, v3s16 pos,
+		u8 param2)
+{
+	MapBlock block(NULL, pos, gamedef);
+	fill_block(block, param2);
+	MapBlockSnapshot *s = new MapBlockSnapshot;
+	block.snapshot(*s, SER_FMT_VER_HIGHEST_WRITE);
+	return s;
+}
+
+// Loads the block at pos from db and checks it holds what fill_block wrote
+static bool check_saved_block(IGameDef *gamedef, Database &db, v3s16 pos,
+		u8 param2)
+{
+	std::string data;
+	db.loadBlock(pos, &data);
+	if (data.empty())
+		return false;
+
+	std::istringstream is(data, std::ios_base::binary);
+	u8 version = readU8(is);
+	MapBlock block(NULL, pos, gamedef);
+	block.deSerialize(is, version, true);
+
+	bool ok = true;
+	v3s16 p0;
+	for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++)
+	for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+	for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++) {
+		MapNode n = block.getNodeNoEx(p0);
+		content_t c = p0.Y < 8 ? t_CONTENT_STONE : CONTENT_AIR;
+		if (n.getContent() != c || n.getParam2() != param2)
+			ok = false;
+	}
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestMapSaver::testSnapshotRoundtrip(IGameDef *gamedef)
+{
+	// The snapshot has to give the same data as serializing the block
+	MapBlock block(NULL, v3s16(1, -2, 3), gamedef);
+	fill_block(block, 7);
+
+	std::ostringstream os1(std::ios_base::binary);
+	block.serialize(os1, SER_FMT_VER_HIGHEST_WRITE, true);
+
+	MapBlockSnapshot s;
+	block.snapshot(s, SER_FMT_VER_HIGHEST_WRITE);
+	std::ostringstream os2(std::ios_base::binary);
+	s.serialize(os2);
+
+	UASSERT(os1.str() == os2.str());
+}
+
+void TestMapSaver::testSynchronous(IGameDef *gamedef)
+{
+	Database_Dummy db;
+	MapSaver saver(&db, 0);
+	UASSERT(!saver.isAsync());
+
+	v3s16 pos(0, 0, 0);
+	saver.beginSave();
+	saver.enqueue(make_snapshot(gamedef, pos, 3));
+	saver.endSave();
+
+	// Written right away
+	UASSERT(!saver.isPending(pos));
+	UASSERT(check_saved_block(gamedef, db, pos, 3));
+}
+
+void TestMapSaver::testLatestSnapshotWins(IGameDef *gamedef)
+{
+	Database_Dummy db;
+	{
+		MapSaver saver(&db, 3);
+		UASSERT(saver.isAsync());
+
+		for (u32 i = 0; i < NUM_SAVES; i++) {
+			for (s16 b = 0; b < NUM_TEST_BLOCKS; b++)
+				saver.enqueue(make_snapshot(gamedef, v3s16(b, 0, 0), i));
+		}
+
+		saver.waitFor(v3s16(0, 0, 0));
+		UASSERT(!saver.isPending(v3s16(0, 0, 0)));
+		{
+			MutexAutoLock lock(saver.getDatabaseMutex());
+			UASSERT(check_saved_block(gamedef, db, v3s16(0, 0, 0),
+				NUM_SAVES - 1));
+		}
+
+		// Some more left for the destructor to write
+		for (s16 b = 0; b < NUM_TEST_BLOCKS; b++)
+			saver.enqueue(make_snapshot(gamedef, v3s16(b, 0, 0), NUM_SAVES));
+	}
+
+	std::vector<v3s16> blocks;
+	db.listAllLoadableBlocks(blocks);
+	UASSERTEQ(size_t, blocks.size(), NUM_TEST_BLOCKS);
+	for (s16 b = 0; b < NUM_TEST_BLOCKS; b++)
+		UASSERT(check_saved_block(gamedef, db, v3s16(b, 0, 0), NUM_SAVES));
+}
+
+// Waits for a block, like ServerMap::loadBlock() on an emerge thread
+class BlockWaitThread : public Thread {
+public:
+	BlockWaitThread(MapSaver *saver, v3s16 pos, Semaphore &trigger) :
+		Thread("BlockWait"),
+		written(false),
+		m_saver(saver),
+		m_pos(pos),
+		m_trigger(trigger)
+	{
+	}
+
+	bool written;
+
+private:
+	void *run()
+	{
+		m_trigger.wait();
+		m_saver->waitFor(m_pos);
+		written = !m_saver->isPending(m_pos);
+		return NULL;
+	}
+
+	MapSaver *m_saver;
+	v3s16 m_pos;
+	Semaphore &m_trigger;
+};
+
+void TestMapSaver::testWaitingThreads(IGameDef *gamedef)
+{
+	Database_Dummy db;
+	MapSaver saver(&db, 2);
+
+	for (u32 i = 0; i < NUM_SAVES; i++) {
+		for (s16 b = 0; b < NUM_TEST_BLOCKS; b++)
+			saver.enqueue(make_snapshot(gamedef, v3s16(b, 0, 0), i));
+	}
+
+	// Several threads wait at the same time, each is woken up once its
+	// block is written.  They start waiting together, as Thread::start()
+	// doesn't return if the thread is done before it notices.
+	Semaphore trigger;
+	std::vector<BlockWaitThread *> threads;
+	for (s16 b = 0; b < NUM_TEST_BLOCKS; b += 2) {
+		threads.push_back(new BlockWaitThread(&saver, v3s16(b, 0, 0),
+			trigger));
+		UASSERT(threads.back()->start());
+	}
+	trigger.post(threads.size());
+
+	saver.flush();
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i]->wait();
+		UASSERT(threads[i]->written);
+		delete threads[i];
+	}
+
+	MutexAutoLock lock(saver.getDatabaseMutex());
+	for (s16 b = 0; b < NUM_TEST_BLOCKS; b++)
+		UASSERT(check_saved_block(gamedef, db, v3s16(b, 0, 0), NUM_SAVES - 1));
+}
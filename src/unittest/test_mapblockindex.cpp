@@ -0,0 +1,248 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <cmath>
+#include "mapblockindex.h"
+#include "noise.h"
+#include "porting.h"
+#include "util/basic_macros.h"
+
+#define BENCH_LOOKUPS 1000000
+
+class TestMapBlockIndex : public TestBase {
+public:
+	TestMapBlockIndex() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapBlockIndex"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testInsertRemove();
+	void testRandomOperations();
+	void benchSectorMap();
+	void benchMapBlockIndex();
+};
+
+static TestMapBlockIndex g_test_instance;
+
+void TestMapBlockIndex::runTests(IGameDef *gamedef)
+{
+	TEST(testInsertRemove);
+	TEST(testRandomOperations);
+
+	// Compare these two to see how block lookups perform
+	BENCH(benchSectorMap);
+	BENCH(benchMapBlockIndex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The blocks are never dereferenced, any distinct non-NULL pointer will do
+static MapBlock *fake_block(u32 i)
+{
+	return (MapBlock *)((size_t)i * 8 + 8);
+}
+
+// Positions of a roughly cubic area of num_blocks blocks
+static void make_positions(u32 num_blocks, std::vector<v3s16> &positions)
+{
+	s16 side = ceil(pow((double)num_blocks, 1.0 / 3));
+	for (u32 i = 0; i < num_blocks; i++) {
+		positions.push_back(v3s16(
+			i % side - side / 2,
+			(i / side) % side - side / 2,
+			i / side / side - side / 2));
+	}
+}
+
+// The lookup structure of the sectors that the index replaced
+class SectorMap {
+public:
+	MapBlock *get(v3s16 p)
+	{
+		if (m_sector_cache != NULL && m_sector_cache_p == v2s16(p.X, p.Z))
+			return find(*m_sector_cache, p.Y);
+		std::map<v2s16, std::map<s16, MapBlock *> >::iterator n =
+				m_sectors.find(v2s16(p.X, p.Z));
+		if (n == m_sectors.end())
+			return NULL;
+		m_sector_cache_p = n->first;
+		m_sector_cache = &n->second;
+		return find(n->second, p.Y);
+	}
+
+	void insert(v3s16 p, MapBlock *block)
+	{
+		m_sectors[v2s16(p.X, p.Z)][p.Y] = block;
+	}
+
+	SectorMap(): m_sector_cache(NULL) {}
+
+private:
+	static MapBlock *find(std::map<s16, MapBlock *> &blocks, s16 y)
+	{
+		std::map<s16, MapBlock *>::iterator n = blocks.find(y);
+		return n == blocks.end() ? NULL : n->second;
+	}
+
+	std::map<v2s16, std::map<s16, MapBlock *> > m_sectors;
+	std::map<s16, MapBlock *> *m_sector_cache;
+	v2s16 m_sector_cache_p;
+};
+
+/*
+	Looks up random positions in and around the area, then the 27 blocks
+	around random positions, as lighting and ABMs do.
+*/
+template <typename T>
+static void bench_lookups(T &index, const std::vector<v3s16> &positions)
+{
+	PcgRandom pr(positions.size());
+	s16 side = positions.back().Z - positions.front().Z + 1;
+	u32 found = 0;
+
+	u32 t0 = porting::getTimeMs();
+	for (u32 i = 0; i < BENCH_LOOKUPS; i++) {
+		v3s16 p(pr.range(-side, side), pr.range(-side, side),
+			pr.range(-side, side));
+		if (index.get(p))
+			found++;
+	}
+	u32 t1 = porting::getTimeMs();
+	for (u32 i = 0; i < BENCH_LOOKUPS / 27; i++) {
+		v3s16 p = positions[pr.range(0, positions.size() - 1)];
+		v3s16 d;
+		for (d.Z = -1; d.Z <= 1; d.Z++)
+		for (d.Y = -1; d.Y <= 1; d.Y++)
+		for (d.X = -1; d.X <= 1; d.X++) {
+			if (index.get(p + d))
+				found++;
+		}
+	}
+	u32 t2 = porting::getTimeMs();
+
+	UASSERT(found > 0);
+	rawstream << "    " << positions.size() << " blocks: random "
+		<< (t1 - t0) << "ms, neighbourhood " << (t2 - t1) << "ms"
+		<< std::endl;
+}
+
+template <typename T>
+static void bench_index()
+{
+	u32 sizes[] = {10000, 100000, 1000000};
+	for (size_t s = 0; s < ARRLEN(sizes); s++) {
+		std::vector<v3s16> positions;
+		make_positions(sizes[s], positions);
+
+		T index;
+		for (u32 i = 0; i < positions.size(); i++)
+			index.insert(positions[i], fake_block(i));
+
+		bench_lookups(index, positions);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestMapBlockIndex::testInsertRemove()
+{
+	MapBlockIndex index;
+	UASSERT(index.size() == 0);
+	UASSERT(index.get(v3s16(0, 0, 0)) == NULL);
+
+	index.insert(v3s16(0, 0, 0), fake_block(1));
+	index.insert(v3s16(-1, 2, -3), fake_block(2));
+	index.insert(v3s16(-32768, 32767, 0), fake_block(3));
+	UASSERT(index.size() == 3);
+	UASSERT(index.get(v3s16(0, 0, 0)) == fake_block(1));
+	UASSERT(index.get(v3s16(-1, 2, -3)) == fake_block(2));
+	UASSERT(index.get(v3s16(-32768, 32767, 0)) == fake_block(3));
+	UASSERT(index.get(v3s16(1, 2, -3)) == NULL);
+
+	// Replacing keeps the size
+	index.insert(v3s16(0, 0, 0), fake_block(4));
+	UASSERT(index.size() == 3);
+	UASSERT(index.get(v3s16(0, 0, 0)) == fake_block(4));
+
+	index.remove(v3s16(-1, 2, -3));
+	index.remove(v3s16(5, 5, 5));
+	UASSERT(index.size() == 2);
+	UASSERT(index.get(v3s16(-1, 2, -3)) == NULL);
+	UASSERT(index.get(v3s16(-32768, 32767, 0)) == fake_block(3));
+
+	index.clear();
+	UASSERT(index.size() == 0);
+	UASSERT(index.get(v3s16(0, 0, 0)) == NULL);
+}
+
+void TestMapBlockIndex::testRandomOperations()
+{
+	MapBlockIndex index;
+	std::map<v3s16, MapBlock *> reference;
+	PcgRandom pr(42);
+
+	// A small area so that removals and replacements happen often, and
+	// the table grows and shrinks several times
+	for (u32 round = 0; round < 4; round++) {
+		for (u32 i = 0; i < 20000; i++) {
+			v3s16 p(pr.range(-12, 12), pr.range(-12, 12), pr.range(-12, 12));
+			if (pr.range(0, 2) != 0) {
+				index.insert(p, fake_block(i));
+				reference[p] = fake_block(i);
+			} else {
+				index.remove(p);
+				reference.erase(p);
+			}
+		}
+		UASSERTEQ(size_t, index.size(), reference.size());
+
+		v3s16 p;
+		for (p.Z = -13; p.Z <= 13; p.Z++)
+		for (p.Y = -13; p.Y <= 13; p.Y++)
+		for (p.X = -13; p.X <= 13; p.X++) {
+			std::map<v3s16, MapBlock *>::iterator it = reference.find(p);
+			UASSERT(index.get(p) ==
+				(it == reference.end() ? NULL : it->second));
+		}
+
+		// Empty most of it again
+		for (std::map<v3s16, MapBlock *>::iterator it = reference.begin();
+				it != reference.end();) {
+			if (pr.range(0, 9) != 0) {
+				index.remove(it->first);
+				reference.erase(it++);
+			} else {
+				++it;
+			}
+		}
+		UASSERTEQ(size_t, index.size(), reference.size());
+	}
+}
+
+void TestMapBlockIndex::benchSectorMap()
+{
+	bench_index<SectorMap>();
+}
+
+void TestMapBlockIndex::benchMapBlockIndex()
+{
+	bench_index<MapBlockIndex>();
+}
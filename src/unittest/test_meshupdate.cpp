@@ -0,0 +1,906 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+// Meshes are only built by the client
+#ifndef SERVER
+
+#include "clientmap.h"
+#include "gamedef.h"
+#include "map.h"
+#include "mapblock.h"
+#include "mapblock_mesh.h"
+#include "mapsector.h"
+#include "nodedef.h"
+#include "mesh_generator_thread.h"
+#include "noise.h"
+#include "porting.h"
+#include "shader.h"
+#include "client/tile.h"
+#include "threading/thread.h"
+#include "util/basic_macros.h"
+#include "util/directiontables.h"
+
+// Blocks of the benchmark map, in each horizontal direction from the center
+#define BENCH_RADIUS 4
+#define BENCH_TIMEOUT_MS 60000
+// Blocks of the draw list benchmark map, and the view range in nodes
+#define DRAWLIST_RADIUS 8
+#define DRAWLIST_RANGE 100
+
+class TestMeshUpdate : public TestBase {
+public:
+	TestMeshUpdate() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMeshUpdate"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testNearestFirst(IGameDef *gamedef);
+	void testBlockDeduplication(IGameDef *gamedef);
+	void testBlockInProgress(IGameDef *gamedef);
+	void testFillBorders(IGameDef *gamedef);
+	void testCachedFaces(IGameDef *gamedef);
+	void testMergedFaces(IGameDef *gamedef);
+	void testCrackOnWorkers(IGameDef *gamedef);
+	void benchFillBlock(IGameDef *gamedef);
+	void benchNodeEdits(IGameDef *gamedef);
+	void benchOneThread(IGameDef *gamedef);
+	void benchThreadPool(IGameDef *gamedef);
+	void benchDrawList(IGameDef *gamedef);
+};
+
+static TestMeshUpdate g_test_instance;
+
+void TestMeshUpdate::runTests(IGameDef *gamedef)
+{
+	TEST(testNearestFirst, gamedef);
+	TEST(testBlockDeduplication, gamedef);
+	TEST(testBlockInProgress, gamedef);
+	TEST(testFillBorders, gamedef);
+	TEST(testCachedFaces, gamedef);
+	TEST(testMergedFaces, gamedef);
+	TEST(testCrackOnWorkers, gamedef);
+	BENCH(benchFillBlock, gamedef);
+	BENCH(benchNodeEdits, gamedef);
+
+	// Compare these two to see how the meshes of a joining player get built
+	BENCH(benchOneThread, gamedef);
+	BENCH(benchThreadPool, gamedef);
+
+	BENCH(benchDrawList, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void add(MeshUpdateQueue &queue, IGameDef *gamedef, v3s16 p,
+		bool urgent = false)
+{
+	queue.addBlock(p, new MeshMakeData(gamedef, false), false, urgent);
+}
+
+// Returns the block taken and finishes it
+static v3s16 take(MeshUpdateQueue &queue)
+{
+	QueuedMeshUpdate *q = queue.pop();
+	UASSERT(q != NULL);
+	v3s16 p = q->p;
+	delete q;
+	queue.done(p);
+	return p;
+}
+
+void TestMeshUpdate::testNearestFirst(IGameDef *gamedef)
+{
+	MeshUpdateQueue queue;
+	queue.setCameraBlock(v3s16(0, 0, 0));
+
+	add(queue, gamedef, v3s16(10, 0, 0));
+	add(queue, gamedef, v3s16(0, -3, 0));
+	add(queue, gamedef, v3s16(1, 1, 1));
+	add(queue, gamedef, v3s16(20, 0, 0), true);
+
+	// Urgent ones go first, like blocks the player digs in
+	UASSERT(take(queue) == v3s16(20, 0, 0));
+	UASSERT(take(queue) == v3s16(1, 1, 1));
+
+	// The camera moved
+	queue.setCameraBlock(v3s16(9, 0, 0));
+	UASSERT(take(queue) == v3s16(10, 0, 0));
+	UASSERT(take(queue) == v3s16(0, -3, 0));
+	UASSERT(queue.pop() == NULL);
+}
+
+void TestMeshUpdate::testBlockDeduplication(IGameDef *gamedef)
+{
+	MeshUpdateQueue queue;
+	queue.setCameraBlock(v3s16(0, 0, 0));
+
+	MeshMakeData *newest = new MeshMakeData(gamedef, false);
+	add(queue, gamedef, v3s16(5, 0, 0));
+	add(queue, gamedef, v3s16(3, 0, 0));
+	queue.addBlock(v3s16(5, 0, 0), newest, true, false);
+	UASSERTEQ(u32, queue.size(), 2);
+
+	UASSERT(take(queue) == v3s16(3, 0, 0));
+
+	// The block has the data it was queued with last
+	QueuedMeshUpdate *q = queue.pop();
+	UASSERT(q != NULL);
+	UASSERT(q->data == newest);
+	UASSERT(q->ack_block_to_server);
+	queue.done(q->p);
+	delete q;
+
+	// Queued again as urgent
+	add(queue, gamedef, v3s16(7, 0, 0));
+	add(queue, gamedef, v3s16(1, 0, 0));
+	add(queue, gamedef, v3s16(7, 0, 0), true);
+	UASSERT(take(queue) == v3s16(7, 0, 0));
+	UASSERT(take(queue) == v3s16(1, 0, 0));
+	UASSERT(queue.pop() == NULL);
+}
+
+void TestMeshUpdate::testBlockInProgress(IGameDef *gamedef)
+{
+	MeshUpdateQueue queue;
+	queue.setCameraBlock(v3s16(0, 0, 0));
+
+	add(queue, gamedef, v3s16(0, 0, 0));
+	add(queue, gamedef, v3s16(4, 0, 0));
+	QueuedMeshUpdate *q = queue.pop();
+	UASSERT(q != NULL && q->p == v3s16(0, 0, 0));
+
+	// Not given to another thread while the first one builds its mesh
+	add(queue, gamedef, v3s16(0, 0, 0));
+	UASSERT(take(queue) == v3s16(4, 0, 0));
+	UASSERT(queue.pop() == NULL);
+
+	delete q;
+	queue.done(v3s16(0, 0, 0));
+	UASSERT(take(queue) == v3s16(0, 0, 0));
+	UASSERT(queue.pop() == NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+	The node definitions of the test gamedef, with the texture and shader
+	sources of a device with the null driver
+*/
+class BenchGameDef : public IGameDef {
+public:
+	BenchGameDef(IGameDef *gamedef, IrrlichtDevice *device):
+		m_gamedef(gamedef),
+		m_device(device),
+		m_texturesrc(createTextureSource(device)),
+		m_shadersrc(createShaderSource(device))
+	{
+	}
+
+	~BenchGameDef()
+	{
+		delete m_texturesrc;
+		delete m_shadersrc;
+	}
+
+	IItemDefManager *getItemDefManager()
+	{ return m_gamedef->getItemDefManager(); }
+	INodeDefManager *getNodeDefManager()
+	{ return m_gamedef->getNodeDefManager(); }
+	ICraftDefManager *getCraftDefManager() { return NULL; }
+	ITextureSource *getTextureSource() { return m_texturesrc; }
+	IShaderSource *getShaderSource() { return m_shadersrc; }
+	ISoundManager *getSoundManager() { return NULL; }
+	MtEventManager *getEventManager() { return NULL; }
+	scene::ISceneManager *getSceneManager()
+	{ return m_device->getSceneManager(); }
+	u16 allocateUnknownNodeId(const std::string &name) { return 0; }
+
+	// Makes the textures and shaders that other threads wait for, like
+	// the main loop of the client
+	void processQueues()
+	{
+		m_texturesrc->processQueue();
+		m_shadersrc->processQueue();
+	}
+
+private:
+	IGameDef *m_gamedef;
+	IrrlichtDevice *m_device;
+	IWritableTextureSource *m_texturesrc;
+	IWritableShaderSource *m_shadersrc;
+};
+
+static void no_progress(void *args, u32 progress, u32 max_progress)
+{
+}
+
+/*
+	With the textures of the nodes, like the client has them after it got
+	the node definitions.  Faces without a texture aren't drawn, and only
+	the ones of tileable textures are merged.
+*/
+class TexturedGameDef : public BenchGameDef {
+public:
+	TexturedGameDef(IGameDef *gamedef, IrrlichtDevice *device):
+		BenchGameDef(gamedef, device),
+		m_nodedef(dynamic_cast<IWritableNodeDefManager *>(
+			gamedef->getNodeDefManager())->clone())
+	{
+		m_nodedef->updateTextures(this, no_progress, NULL);
+	}
+
+	~TexturedGameDef()
+	{
+		delete m_nodedef;
+	}
+
+	INodeDefManager *getNodeDefManager() { return m_nodedef; }
+
+private:
+	IWritableNodeDefManager *m_nodedef;
+};
+
+// Hills of stone and grass with water in the valleys
+class BenchTerrain : public TestTerrain {
+public:
+	BenchTerrain(): m_pr(1234) {}
+
+	s16 getGroundHeight(s16 x, s16 z)
+	{
+		return (x * x + z * z) % 23 / 4 + m_pr.range(-2, 2) + x / 6 - z / 9;
+	}
+
+	MapNode getNode(v3s16 p, s16 ground)
+	{
+		content_t c = CONTENT_AIR;
+		if (p.Y < ground)
+			c = t_CONTENT_STONE;
+		else if (p.Y == ground)
+			c = t_CONTENT_GRASS;
+		else if (p.Y <= 0)
+			c = t_CONTENT_WATER;
+		return MapNode(c, p.Y > ground ? 15 : 0);
+	}
+
+private:
+	PcgRandom m_pr;
+};
+
+static Map *make_terrain_map(IGameDef *gamedef)
+{
+	BenchTerrain terrain;
+	return make_test_map(gamedef, BENCH_RADIUS, -1, 1, terrain);
+}
+
+void TestMeshUpdate::testFillBorders(IGameDef *gamedef)
+{
+	Map *map = make_terrain_map(gamedef);
+	MeshMakeData data(gamedef, false);
+
+	// The nodes of the block and the ones next to it
+	data.fill(map->getBlockNoCreate(v3s16(0, 0, 0)));
+	v3s16 p;
+	for (p.Z = -2; p.Z <= MAP_BLOCKSIZE + 1; p.Z++)
+	for (p.Y = -2; p.Y <= MAP_BLOCKSIZE + 1; p.Y++)
+	for (p.X = -2; p.X <= MAP_BLOCKSIZE + 1; p.X++) {
+		MapNode n = data.getNodeNoEx(p);
+		if (!data.m_nodes_area.contains(p)) {
+			UASSERT(n.getContent() == CONTENT_IGNORE);
+			continue;
+		}
+		MapNode expected = map->getNodeNoEx(p);
+		UASSERT(n.getContent() == expected.getContent());
+		UASSERT(n.param1 == expected.param1 && n.param2 == expected.param2);
+	}
+
+	// Neighbors that aren't loaded are ignore
+	v3s16 blockpos(-BENCH_RADIUS, 1, 0);
+	data.fill(map->getBlockNoCreate(blockpos));
+	p = blockpos * MAP_BLOCKSIZE;
+	UASSERT(data.getNodeNoEx(p + v3s16(-1, 0, 0)).getContent() == CONTENT_IGNORE);
+	UASSERT(data.getNodeNoEx(p + v3s16(0, MAP_BLOCKSIZE, 0)).getContent()
+		== CONTENT_IGNORE);
+	UASSERT(data.getNodeNoEx(p + v3s16(MAP_BLOCKSIZE, 0, 0)).getContent()
+		== map->getNodeNoEx(p + v3s16(MAP_BLOCKSIZE, 0, 0)).getContent());
+
+	MapNode node(t_CONTENT_STONE);
+	data.fillSingleNode(&node);
+	UASSERT(data.getNodeNoEx(v3s16(1, 1, 1)).getContent() == t_CONTENT_STONE);
+	UASSERT(data.getNodeNoEx(v3s16(0, 1, 1)).getContent() == CONTENT_AIR);
+
+	delete map;
+}
+
+/*
+	Copying the nodes for the mesh of a block, like MeshMakeData::fill()
+	did before: a VoxelManipulator of the block and all of its neighbors
+*/
+static void fill_whole_neighbors(VoxelManipulator &vmanip, MapBlock *block)
+{
+	v3s16 blockpos_nodes = block->getPosRelative();
+	vmanip.clear();
+	vmanip.addArea(VoxelArea(blockpos_nodes - v3s16(1,1,1) * MAP_BLOCKSIZE,
+		blockpos_nodes + v3s16(1,1,1) * MAP_BLOCKSIZE * 2 - v3s16(1,1,1)));
+	block->copyTo(vmanip);
+	for (u16 i = 0; i < 26; i++) {
+		MapBlock *b = block->getParent()->getBlockNoCreateNoEx(
+			block->getPos() + g_26dirs[i]);
+		if (b)
+			b->copyTo(vmanip);
+	}
+}
+
+void TestMeshUpdate::benchFillBlock(IGameDef *gamedef)
+{
+	Map *map = make_terrain_map(gamedef);
+	std::vector<MapBlock *> blocks;
+	for (s16 z = -BENCH_RADIUS; z < BENCH_RADIUS; z++)
+	for (s16 y = -1; y <= 1; y++)
+	for (s16 x = -BENCH_RADIUS; x < BENCH_RADIUS; x++)
+		blocks.push_back(map->getBlockNoCreate(v3s16(x, y, z)));
+
+	const u32 rounds = 10;
+	u32 fills = rounds * blocks.size();
+	u64 before_bytes = 0;
+	u32 t0 = porting::getTimeUs();
+	for (u32 i = 0; i < fills; i++) {
+		VoxelManipulator vmanip;
+		fill_whole_neighbors(vmanip, blocks[i % blocks.size()]);
+		before_bytes += vmanip.m_area.getVolume() * (sizeof(MapNode) + 1);
+	}
+	u32 before_us = MYMAX(porting::getTimeUs() - t0, 1);
+
+	// Each MeshMakeData is freed by a mesh update thread after its mesh
+	// is made, which gives its nodes back to the pool
+	u64 after_bytes = 0;
+	t0 = porting::getTimeUs();
+	for (u32 i = 0; i < fills; i++) {
+		MeshMakeData data(gamedef, false);
+		data.fill(blocks[i % blocks.size()]);
+		after_bytes += sizeof(MapNode) * MESH_NODES_VOLUME;
+	}
+	u32 after_us = MYMAX(porting::getTimeUs() - t0, 1);
+	delete map;
+
+	rawstream << "    " << after_bytes / fills << " B per mesh in "
+		<< (u64)after_us * 1000 / fills << " ns (was " << before_bytes / fills
+		<< " B in " << (u64)before_us * 1000 / fills << " ns), buffers are reused"
+		<< std::endl;
+}
+
+static bool same_meshes(scene::IMesh *a, scene::IMesh *b)
+{
+	if (a->getMeshBufferCount() != b->getMeshBufferCount())
+		return false;
+	for (u32 i = 0; i < a->getMeshBufferCount(); i++) {
+		scene::IMeshBuffer *buf_a = a->getMeshBuffer(i);
+		scene::IMeshBuffer *buf_b = b->getMeshBuffer(i);
+		if (buf_a->getVertexCount() != buf_b->getVertexCount() ||
+				buf_a->getIndexCount() != buf_b->getIndexCount() ||
+				buf_a->getMaterial().getTexture(0) !=
+					buf_b->getMaterial().getTexture(0))
+			return false;
+		if (memcmp(buf_a->getVertices(), buf_b->getVertices(),
+				buf_a->getVertexCount() * sizeof(video::S3DVertex)) != 0 ||
+				memcmp(buf_a->getIndices(), buf_b->getIndices(),
+				buf_a->getIndexCount() * sizeof(u16)) != 0)
+			return false;
+	}
+	return true;
+}
+
+// Digs or places a node, and changes the light of some around it
+static void edit_node(Map *map, v3s16 p, PcgRandom &pr)
+{
+	MapNode n(pr.range(0, 2) ? CONTENT_AIR : t_CONTENT_STONE, 15);
+	map->setNode(p, n);
+	for (u32 i = 0; i < 5; i++) {
+		v3s16 p2 = p + v3s16(pr.range(-2, 2), pr.range(-2, 2), pr.range(-2, 2));
+		MapNode n2 = map->getNodeNoEx(p2);
+		if (n2.getContent() == CONTENT_IGNORE)
+			continue;
+		n2.param1 = pr.range(0, 255);
+		map->setNode(p2, n2);
+	}
+}
+
+void TestMeshUpdate::testCachedFaces(IGameDef *gamedef)
+{
+	IrrlichtDevice *device = createDevice(video::EDT_NULL);
+	UASSERT(device != NULL);
+	TexturedGameDef bench_gamedef(gamedef, device);
+	Map *map = make_terrain_map(&bench_gamedef);
+	PcgRandom pr(42);
+	v3s16 blockpos(0, 0, 0);
+
+	for (u16 smooth_lighting = 0; smooth_lighting < 2; smooth_lighting++) {
+		MapBlockMeshCache cache;
+		for (u32 i = 0; i < 40; i++) {
+			// In the block, and at the sides of the ones next to it
+			v3s16 p(pr.range(-1, MAP_BLOCKSIZE), pr.range(-1, MAP_BLOCKSIZE),
+				pr.range(-1, MAP_BLOCKSIZE));
+			if (i > 0)
+				edit_node(map, p, pr);
+
+			MeshMakeData data_cached(&bench_gamedef, false);
+			MeshMakeData data_whole(&bench_gamedef, false);
+			data_cached.fill(map->getBlockNoCreate(blockpos));
+			data_whole.fill(map->getBlockNoCreate(blockpos));
+			data_cached.setSmoothLighting(smooth_lighting);
+			data_whole.setSmoothLighting(smooth_lighting);
+			if (i % 4 == 1) {
+				data_cached.setCrack(3, p);
+				data_whole.setCrack(3, p);
+			}
+
+			MapBlockMesh mesh_cached(&data_cached, v3s16(0, 0, 0), &cache);
+			MapBlockMesh mesh_whole(&data_whole, v3s16(0, 0, 0));
+			UASSERT(same_meshes(mesh_cached.getMesh(), mesh_whole.getMesh()));
+		}
+	}
+
+	delete map;
+	device->drop();
+}
+
+struct FaceSample
+{
+	video::ITexture *texture;
+	v3f normal;
+	// Within the texture
+	v2f uv;
+	f32 color[4];
+};
+
+static void get_color_channels(video::SColor color, f32 *channels)
+{
+	channels[0] = color.getAlpha();
+	channels[1] = color.getRed();
+	channels[2] = color.getGreen();
+	channels[3] = color.getBlue();
+}
+
+/*
+	Samples each node that a face of the mesh covers at the same spot of
+	the node, by the position of the samples in eighths of a node.
+	Returns the number of faces, or -1 if one isn't a rectangle of whole
+	nodes.
+*/
+static s32 sample_faces(scene::IMesh *mesh,
+		std::map<v3s32, FaceSample> &samples)
+{
+	s32 num_faces = 0;
+	for (u32 i = 0; i < mesh->getMeshBufferCount(); i++) {
+		scene::IMeshBuffer *buf = mesh->getMeshBuffer(i);
+		video::S3DVertex *vertices = (video::S3DVertex *)buf->getVertices();
+		u16 *indices = buf->getIndices();
+		for (u32 k = 0; k + 5 < buf->getIndexCount(); k += 6) {
+			// Corners in the order of makeFastFace(), with either diagonal
+			video::S3DVertex *q[4];
+			q[0] = &vertices[indices[k]];
+			q[1] = &vertices[indices[k + 1]];
+			if (indices[k + 3] == indices[k + 2] && indices[k + 5] == indices[k]) {
+				q[2] = &vertices[indices[k + 2]];
+				q[3] = &vertices[indices[k + 4]];
+			} else if (indices[k + 4] == indices[k + 2] &&
+					indices[k + 5] == indices[k + 1]) {
+				q[2] = &vertices[indices[k + 3]];
+				q[3] = &vertices[indices[k + 2]];
+			} else {
+				return -1;
+			}
+			num_faces++;
+
+			f32 width_f = q[0]->Pos.getDistanceFrom(q[1]->Pos) / BS;
+			f32 height_f = q[1]->Pos.getDistanceFrom(q[2]->Pos) / BS;
+			s32 width = core::round32(width_f);
+			s32 height = core::round32(height_f);
+			if (width < 1 || height < 1 ||
+					fabs(width_f - width) > 0.001 ||
+					fabs(height_f - height) > 0.001)
+				return -1;
+
+			f32 colors[4][4];
+			for (u16 c = 0; c < 4; c++)
+				get_color_channels(q[c]->Color, colors[c]);
+
+			for (s32 y = 0; y < height; y++)
+			for (s32 x = 0; x < width; x++) {
+				f32 s = (x + 0.25f) / width;
+				f32 t = (y + 0.375f) / height;
+				v3f pos = q[1]->Pos + (q[0]->Pos - q[1]->Pos) * s
+					+ (q[2]->Pos - q[1]->Pos) * t;
+				v2f uv = q[1]->TCoords + (q[0]->TCoords - q[1]->TCoords) * s
+					+ (q[2]->TCoords - q[1]->TCoords) * t;
+
+				FaceSample &sample = samples[v3s32(
+					core::round32(pos.X * 8 / BS),
+					core::round32(pos.Y * 8 / BS),
+					core::round32(pos.Z * 8 / BS))];
+				sample.texture = buf->getMaterial().getTexture(0);
+				sample.normal = q[0]->Normal;
+				sample.uv = v2f(uv.X - floor(uv.X), uv.Y - floor(uv.Y));
+				for (u16 c = 0; c < 4; c++) {
+					sample.color[c] =
+						(1 - s) * (1 - t) * colors[1][c] +
+						s * (1 - t) * colors[0][c] +
+						(1 - s) * t * colors[2][c] +
+						s * t * colors[3][c];
+				}
+			}
+		}
+	}
+	return num_faces;
+}
+
+static bool same_samples(const FaceSample &a, const FaceSample &b)
+{
+	if (a.texture != b.texture || !a.normal.equals(b.normal) ||
+			fabs(a.uv.X - b.uv.X) > 0.001 || fabs(a.uv.Y - b.uv.Y) > 0.001)
+		return false;
+	for (u16 c = 0; c < 4; c++) {
+		if (fabs(a.color[c] - b.color[c]) > 0.01)
+			return false;
+	}
+	return true;
+}
+
+void TestMeshUpdate::testMergedFaces(IGameDef *gamedef)
+{
+	IrrlichtDevice *device = createDevice(video::EDT_NULL);
+	UASSERT(device != NULL);
+	TexturedGameDef bench_gamedef(gamedef, device);
+	Map *map = make_terrain_map(&bench_gamedef);
+	PcgRandom pr(42);
+
+	// Some nodes with less light, in rectangles of light that can be merged
+	// and single nodes at their edges that can't
+	for (u32 i = 0; i < 200; i++)
+		edit_node(map, v3s16(pr.range(-20, 19), pr.range(-6, 6),
+			pr.range(-20, 19)), pr);
+
+	s32 merged_faces = 0;
+	s32 node_faces = 0;
+	for (u16 smooth_lighting = 0; smooth_lighting < 2; smooth_lighting++)
+	for (s16 z = -1; z <= 0; z++)
+	for (s16 y = -1; y <= 1; y++)
+	for (s16 x = -1; x <= 0; x++) {
+		MeshMakeData data_merged(&bench_gamedef, false);
+		MeshMakeData data_nodes(&bench_gamedef, false);
+		data_merged.fill(map->getBlockNoCreate(v3s16(x, y, z)));
+		data_nodes.fill(map->getBlockNoCreate(v3s16(x, y, z)));
+		data_merged.setSmoothLighting(smooth_lighting);
+		data_nodes.setSmoothLighting(smooth_lighting);
+		data_nodes.setMergeFaces(false);
+
+		MapBlockMesh mesh_merged(&data_merged, v3s16(0, 0, 0));
+		MapBlockMesh mesh_nodes(&data_nodes, v3s16(0, 0, 0));
+		std::map<v3s32, FaceSample> samples_merged;
+		std::map<v3s32, FaceSample> samples_nodes;
+		s32 num_merged = sample_faces(mesh_merged.getMesh(), samples_merged);
+		s32 num_nodes = sample_faces(mesh_nodes.getMesh(), samples_nodes);
+		UASSERT(num_merged >= 0 && num_nodes >= 0);
+		merged_faces += num_merged;
+		node_faces += num_nodes;
+
+		// The same at every node that the faces cover
+		UASSERTEQ(size_t, samples_merged.size(), (size_t)num_nodes);
+		UASSERTEQ(size_t, samples_nodes.size(), (size_t)num_nodes);
+		for (std::map<v3s32, FaceSample>::iterator i = samples_nodes.begin();
+				i != samples_nodes.end(); ++i) {
+			std::map<v3s32, FaceSample>::iterator j =
+				samples_merged.find(i->first);
+			UASSERT(j != samples_merged.end());
+			UASSERT(same_samples(i->second, j->second));
+		}
+	}
+
+	// With less faces
+	UASSERT(node_faces > 0);
+	UASSERT(merged_faces < node_faces);
+
+	delete map;
+	device->drop();
+}
+
+void TestMeshUpdate::testCrackOnWorkers(IGameDef *gamedef)
+{
+	IrrlichtDevice *device = createDevice(video::EDT_NULL);
+	UASSERT(device != NULL);
+	TexturedGameDef bench_gamedef(gamedef, device);
+	Map *map = make_terrain_map(&bench_gamedef);
+
+	// A cracked node in the air of each block, of different nodes so that
+	// the workers wait for different cracked textures at the same time
+	const content_t contents[] = {t_CONTENT_STONE, t_CONTENT_GRASS,
+		t_CONTENT_BRICK, t_CONTENT_LAVA};
+	std::map<v3s16, v3s16> crack_positions;
+	for (s16 z = -2; z < 2; z++)
+	for (s16 x = -2; x < 2; x++) {
+		v3s16 blockpos(x, 1, z);
+		v3s16 p = blockpos * MAP_BLOCKSIZE + v3s16(8, 8, 8);
+		MapNode n(contents[crack_positions.size() % ARRLEN(contents)], 15);
+		map->setNode(p, n);
+		crack_positions[blockpos] = p;
+	}
+
+	MeshUpdateManager manager(4);
+	manager.updateCameraBlock(v3s16(0, 1, 0));
+	for (std::map<v3s16, v3s16>::iterator i = crack_positions.begin();
+			i != crack_positions.end(); ++i) {
+		MeshMakeData *data = new MeshMakeData(&bench_gamedef, false);
+		data->fill(map->getBlockNoCreate(i->first));
+		data->setCrack(2, i->second);
+		manager.enqueueUpdate(i->first, data, false, false);
+	}
+	manager.start();
+
+	std::map<v3s16, MapBlockMesh *> meshes;
+	u32 t0 = porting::getTimeMs();
+	while (meshes.size() < crack_positions.size() &&
+			porting::getTimeMs() - t0 < BENCH_TIMEOUT_MS) {
+		bench_gamedef.processQueues();
+		MeshUpdateResult r = manager.m_queue_out.pop_frontNoEx(10);
+		if (r.mesh != NULL)
+			meshes[r.p] = r.mesh;
+	}
+	manager.stop();
+	manager.wait();
+	UASSERTEQ(size_t, meshes.size(), crack_positions.size());
+
+	// The same cracked textures as the meshes made on the main thread
+	for (std::map<v3s16, MapBlockMesh *>::iterator i = meshes.begin();
+			i != meshes.end(); ++i) {
+		MeshMakeData data(&bench_gamedef, false);
+		data.fill(map->getBlockNoCreate(i->first));
+		data.setCrack(2, crack_positions[i->first]);
+		MapBlockMesh mesh(&data, v3s16(0, 0, 0));
+		UASSERT(same_meshes(i->second->getMesh(), mesh.getMesh()));
+		delete i->second;
+	}
+
+	delete map;
+	device->drop();
+}
+
+/*
+	Edits nodes near the ground and makes the meshes of the block of each
+	and of the blocks at its leading edges, like
+	Client::addUpdateMeshTaskForNode() queues them.  Returns the time taken.
+*/
+static u32 remesh_node_edits(IGameDef *gamedef, bool use_caches,
+		u32 *num_meshes)
+{
+	Map *map = make_terrain_map(gamedef);
+	PcgRandom pr(1234);
+	const s16 r = BENCH_RADIUS * MAP_BLOCKSIZE;
+
+	// The meshes the blocks had before
+	std::map<v3s16, MapBlockMeshCache *> caches;
+	for (s16 z = -BENCH_RADIUS; z < BENCH_RADIUS; z++)
+	for (s16 y = -1; y <= 1; y++)
+	for (s16 x = -BENCH_RADIUS; x < BENCH_RADIUS; x++) {
+		v3s16 blockpos(x, y, z);
+		MapBlockMeshCache *cache = new MapBlockMeshCache;
+		if (use_caches) {
+			MeshMakeData data(gamedef, false);
+			data.fill(map->getBlockNoCreate(blockpos));
+			data.setSmoothLighting(true);
+			delete new MapBlockMesh(&data, v3s16(0, 0, 0), cache);
+		}
+		caches[blockpos] = cache;
+	}
+
+	*num_meshes = 0;
+	u32 t0 = porting::getTimeUs();
+	for (u32 i = 0; i < 100; i++) {
+		v3s16 p(pr.range(-r + 2, r - 3), pr.range(-4, 4), pr.range(-r + 2, r - 3));
+		edit_node(map, p, pr);
+
+		v3s16 blockpos = getNodeBlockPos(p);
+		v3s16 p_rel = p - blockpos * MAP_BLOCKSIZE;
+		std::vector<v3s16> blocks(1, blockpos);
+		if (p_rel.X == 0)
+			blocks.push_back(blockpos + v3s16(-1, 0, 0));
+		if (p_rel.Y == 0)
+			blocks.push_back(blockpos + v3s16(0, -1, 0));
+		if (p_rel.Z == 0)
+			blocks.push_back(blockpos + v3s16(0, 0, -1));
+
+		for (size_t j = 0; j < blocks.size(); j++) {
+			std::map<v3s16, MapBlockMeshCache *>::iterator it =
+				caches.find(blocks[j]);
+			if (it == caches.end())
+				continue;
+			MeshMakeData data(gamedef, false);
+			data.fill(map->getBlockNoCreate(blocks[j]));
+			data.setSmoothLighting(true);
+			MapBlockMesh mesh(&data, v3s16(0, 0, 0),
+				use_caches ? it->second : NULL);
+			(*num_meshes)++;
+		}
+	}
+	u32 dtime = porting::getTimeUs() - t0;
+
+	for (std::map<v3s16, MapBlockMeshCache *>::iterator
+			i = caches.begin(); i != caches.end(); ++i)
+		delete i->second;
+	delete map;
+	return dtime;
+}
+
+void TestMeshUpdate::benchNodeEdits(IGameDef *gamedef)
+{
+	IrrlichtDevice *device = createDevice(video::EDT_NULL);
+	UASSERT(device != NULL);
+	BenchGameDef bench_gamedef(gamedef, device);
+
+	u32 num_meshes;
+	u32 before_us = MYMAX(remesh_node_edits(&bench_gamedef, false,
+		&num_meshes), 1);
+	u32 after_us = MYMAX(remesh_node_edits(&bench_gamedef, true,
+		&num_meshes), 1);
+	device->drop();
+
+	rawstream << "    " << num_meshes << " meshes after 100 node edits in "
+		<< after_us / 1000 << " ms (was " << before_us / 1000
+		<< " ms), the faces of layers that didn't change are reused"
+		<< std::endl;
+}
+
+static void bench_meshes(IGameDef *gamedef, u16 num_threads)
+{
+	IrrlichtDevice *device = createDevice(video::EDT_NULL);
+	UASSERT(device != NULL);
+	BenchGameDef bench_gamedef(gamedef, device);
+	Map *map = make_terrain_map(&bench_gamedef);
+
+	MeshUpdateManager manager(num_threads);
+	manager.updateCameraBlock(v3s16(0, 0, 0));
+
+	std::vector<MapBlock *> blocks;
+	for (s16 z = -BENCH_RADIUS; z < BENCH_RADIUS; z++)
+	for (s16 y = -1; y <= 1; y++)
+	for (s16 x = -BENCH_RADIUS; x < BENCH_RADIUS; x++)
+		blocks.push_back(map->getBlockNoCreate(v3s16(x, y, z)));
+
+	u32 t0 = porting::getTimeMs();
+	for (size_t i = 0; i < blocks.size(); i++) {
+		MeshMakeData *data = new MeshMakeData(&bench_gamedef, false);
+		data->fill(blocks[i]);
+		data->setSmoothLighting(true);
+		manager.enqueueUpdate(blocks[i]->getPos(), data, false, false);
+	}
+	manager.start();
+
+	u32 first_ms = 0;
+	u32 done = 0;
+	u32 vertices = 0;
+	u32 indices = 0;
+	while (done < blocks.size() &&
+			porting::getTimeMs() - t0 < BENCH_TIMEOUT_MS) {
+		MeshUpdateResult r = manager.m_queue_out.pop_frontNoEx(10);
+		if (r.mesh == NULL)
+			continue;
+		if (done++ == 0)
+			first_ms = porting::getTimeMs() - t0;
+		scene::IMesh *mesh = r.mesh->getMesh();
+		for (u32 i = 0; i < mesh->getMeshBufferCount(); i++) {
+			vertices += mesh->getMeshBuffer(i)->getVertexCount();
+			indices += mesh->getMeshBuffer(i)->getIndexCount();
+		}
+		delete r.mesh;
+	}
+	u32 dtime = MYMAX(porting::getTimeMs() - t0, 1);
+
+	manager.stop();
+	manager.wait();
+	delete map;
+	device->drop();
+
+	UASSERTEQ(u32, done, blocks.size());
+	rawstream << "    " << manager.getThreadCount() << " threads: "
+		<< (u64)done * 1000 / dtime << " meshes/s, first after "
+		<< first_ms << " ms, " << done << " blocks in " << dtime << " ms, "
+		<< vertices << " vertices, " << indices << " indices" << std::endl;
+}
+
+void TestMeshUpdate::benchOneThread(IGameDef *gamedef)
+{
+	bench_meshes(gamedef, 1);
+}
+
+void TestMeshUpdate::benchThreadPool(IGameDef *gamedef)
+{
+	bench_meshes(gamedef, MYMAX(Thread::getNumberOfProcessors(), 2) - 1);
+}
+
+/*
+	Updates the draw list while the camera turns around, walks and flies
+	over hills.  If find_again, the blocks in range and whether they are
+	occluded are found again for every update, like they were before.
+*/
+static u32 update_draw_lists(ClientMap *map, MapDrawControl &control,
+		bool find_again, u32 *blocks_drawn)
+{
+	*blocks_drawn = 0;
+	u32 t0 = porting::getTimeUs();
+	for (u32 i = 0; i < 300; i++) {
+		f32 speed = i < 100 ? 0 : i < 200 ? 0.3 : 1.2;
+		f32 angle = i * 0.15;
+		map->updateCamera(v3f((i % 100) * speed + 0.5, 20.5, 0.5) * BS,
+			v3f(cos(angle), -0.2, sin(angle)).normalize(),
+			72 * M_PI / 180, v3s16(0, 0, 0));
+		if (find_again)
+			map->onBlocksChanged();
+		map->updateDrawList(NULL);
+		*blocks_drawn += control.blocks_drawn;
+	}
+	return porting::getTimeUs() - t0;
+}
+
+void TestMeshUpdate::benchDrawList(IGameDef *gamedef)
+{
+	IrrlichtDevice *device = createDevice(video::EDT_NULL);
+	UASSERT(device != NULL);
+	BenchGameDef bench_gamedef(gamedef, device);
+	MapDrawControl control;
+	control.wanted_range = DRAWLIST_RANGE;
+	ClientMap *map = new ClientMap(NULL, &bench_gamedef, control, NULL,
+		device->getSceneManager(), -1);
+
+	// Hills of stone, with empty meshes to draw
+	for (s16 z = -DRAWLIST_RADIUS; z < DRAWLIST_RADIUS; z++)
+	for (s16 x = -DRAWLIST_RADIUS; x < DRAWLIST_RADIUS; x++) {
+		MapSector *sector = map->emergeSector(v2s16(x, z));
+		for (s16 y = -3; y < 3; y++) {
+			MapBlock *block = sector->createBlankBlock(y);
+			MapNode air(CONTENT_AIR);
+			MeshMakeData data(&bench_gamedef, false);
+			data.fillSingleNode(&air);
+			block->mesh = new MapBlockMesh(&data, v3s16(0, 0, 0));
+		}
+	}
+	const s16 r = DRAWLIST_RADIUS * MAP_BLOCKSIZE;
+	for (s16 z = -r; z < r; z++)
+	for (s16 x = -r; x < r; x++) {
+		s16 ground = 8 * sin(x / 20.0) + 8 * cos(z / 27.0);
+		for (s16 y = -3 * MAP_BLOCKSIZE; y < 3 * MAP_BLOCKSIZE; y++) {
+			MapNode n(y < ground ? t_CONTENT_STONE : CONTENT_AIR);
+			map->setNode(v3s16(x, y, z), n);
+		}
+	}
+
+	u32 before_drawn, after_drawn;
+	u32 before_us = MYMAX(update_draw_lists(map, control, true,
+		&before_drawn), 1);
+	u32 after_us = MYMAX(update_draw_lists(map, control, false,
+		&after_drawn), 1);
+	map->drop();
+	device->drop();
+
+	UASSERTEQ(u32, after_drawn, before_drawn);
+	rawstream << "    " << after_us / 300 << " us per update (was "
+		<< before_us / 300 << " us), " << after_drawn / 300
+		<< " blocks drawn" << std::endl;
+}
+
+#endif
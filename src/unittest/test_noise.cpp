@@ -21,6 +21,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "exceptions.h"
 #include "noise.h"
+#include "porting.h"
+#include "util/basic_macros.h"
+
+// Noise maps of a mapchunk
+#define BENCH_CHUNK_SIZE 80
+#define BENCH_MAPS_3D 20
+#define BENCH_MAPS_2D 1000
 
 class TestNoise : public TestBase {
 public:
@@ -34,6 +41,9 @@ class TestNoise : public TestBase {
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoiseSimd2dMatchesScalar();
+	void testNoiseSimd3dMatchesScalar();
+	void benchNoiseMaps();
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -48,6 +58,9 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoiseSimd2dMatchesScalar);
+	TEST(testNoiseSimd3dMatchesScalar);
+	BENCH(benchNoiseMaps);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -120,6 +133,94 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+// Eased and not, abs values, and octaves with more than one lattice point
+// between samples
+static NoiseParams simd_test_params[] = {
+	NoiseParams(0, 1, v3f(250, 350, 250), 5333, 5, 0.63, 2.0, 0),
+	NoiseParams(4, 70, v3f(600, 600, 600), 82341, 5, 0.6, 2.0),
+	NoiseParams(-1, 3, v3f(5, 7, 3), -3, 4, 0.7, 2.3,
+		NOISE_FLAG_EASED | NOISE_FLAG_ABSVALUE),
+	NoiseParams(0, 1, v3f(2, 3, 1.5), 7, 2, 0.7, 2.0, 0),
+};
+
+static bool same_noise(float *a, float *b, size_t size)
+{
+	for (size_t i = 0; i != size; i++) {
+		if (fabs(a[i] - b[i]) > 0.00001)
+			return false;
+	}
+	return true;
+}
+
+void TestNoise::testNoiseSimd2dMatchesScalar()
+{
+	// Rows that don't fill the vectors
+	const u32 sx = 53, sy = 47;
+
+	for (int level = NOISE_SIMD_SSE2; level <= noise_simd_supported(); level++)
+	for (size_t i = 0; i != ARRLEN(simd_test_params); i++) {
+		Noise scalar(&simd_test_params[i], 77, sx, sy);
+		Noise simd(&simd_test_params[i], 77, sx, sy);
+		scalar.simd = NOISE_SIMD_NONE;
+		simd.simd = (NoiseSimd)level;
+
+		UASSERT(same_noise(scalar.perlinMap2D(-1234.5, 77.25),
+			simd.perlinMap2D(-1234.5, 77.25), sx * sy));
+		UASSERT(same_noise(scalar.perlinMap2D(-8e5, 3e6),
+			simd.perlinMap2D(-8e5, 3e6), sx * sy));
+	}
+}
+
+void TestNoise::testNoiseSimd3dMatchesScalar()
+{
+	const u32 sx = 37, sy = 41, sz = 29;
+	std::vector<float> persist(sx * sy * sz);
+	for (u32 i = 0; i != sx * sy * sz; i++)
+		persist[i] = 0.4 + (i % 7) * 0.05;
+
+	for (int level = NOISE_SIMD_SSE2; level <= noise_simd_supported(); level++)
+	for (size_t i = 0; i != ARRLEN(simd_test_params); i++) {
+		Noise scalar(&simd_test_params[i], 77, sx, sy, sz);
+		Noise simd(&simd_test_params[i], 77, sx, sy, sz);
+		scalar.simd = NOISE_SIMD_NONE;
+		simd.simd = (NoiseSimd)level;
+
+		UASSERT(same_noise(scalar.perlinMap3D(-1234.5, 77.25, 9999),
+			simd.perlinMap3D(-1234.5, 77.25, 9999), sx * sy * sz));
+		UASSERT(same_noise(scalar.perlinMap3D(-8e5, 3e4, 1e6, &persist[0]),
+			simd.perlinMap3D(-8e5, 3e4, 1e6, &persist[0]), sx * sy * sz));
+	}
+}
+
+void TestNoise::benchNoiseMaps()
+{
+	// Like the 3D and 2D noises of mapgen v7
+	NoiseParams np_3d(0, 1, v3f(250, 350, 250), 5333, 5, 0.63, 2.0, 0);
+	NoiseParams np_2d(4, 70, v3f(600, 600, 600), 82341, 5, 0.6, 2.0);
+	const char *names[] = {"scalar", "SSE2", "AVX2"};
+
+	for (int level = NOISE_SIMD_NONE; level <= noise_simd_supported(); level++) {
+		Noise noise_3d(&np_3d, 1, BENCH_CHUNK_SIZE, BENCH_CHUNK_SIZE,
+			BENCH_CHUNK_SIZE);
+		Noise noise_2d(&np_2d, 1, BENCH_CHUNK_SIZE, BENCH_CHUNK_SIZE);
+		noise_3d.simd = (NoiseSimd)level;
+		noise_2d.simd = (NoiseSimd)level;
+
+		u32 t0 = porting::getTimeMs();
+		for (u32 i = 0; i != BENCH_MAPS_3D; i++)
+			noise_3d.perlinMap3D(i * BENCH_CHUNK_SIZE, 0, 0);
+		u32 t1 = porting::getTimeMs();
+		for (u32 i = 0; i != BENCH_MAPS_2D; i++)
+			noise_2d.perlinMap2D(i * BENCH_CHUNK_SIZE, 0);
+		u32 t2 = porting::getTimeMs();
+
+		rawstream << "    " << names[level] << ": "
+			<< BENCH_MAPS_3D * 1000 / MYMAX(t1 - t0, 1) << " 3D maps/s, "
+			<< BENCH_MAPS_2D * 1000 / MYMAX(t2 - t1, 1) << " 2D maps/s"
+			<< std::endl;
+	}
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "log.h"
 #include "socket.h"
 #include "settings.h"
+#include "util/string.h"
 
 class TestSocket : public TestBase {
 public:
@@ -37,6 +38,7 @@ class TestSocket : public TestBase {
 
 	void testIPv4Socket();
 	void testIPv6Socket();
+	void testBatchedSocket();
 
 	static const int port = 30003;
 };
@@ -49,6 +51,8 @@ void TestSocket::runTests(IGameDef *gamedef)
 
 	if (g_settings->getBool("enable_ipv6"))
 		TEST(testIPv6Socket);
+
+	TEST(testBatchedSocket);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -149,3 +153,47 @@ void TestSocket::testIPv6Socket()
 					<< std::endl;
 	}
 }
+
+void TestSocket::testBatchedSocket()
+{
+	UDPSocket socket(false);
+	socket.Bind(Address(0, 0, 0, 0, port));
+	Address address(127, 0, 0, 1, port);
+
+	// Every other datagram has a header in front of its data
+	const char header[] = "head:";
+	std::string data[10];
+	UDPDatagram datagrams[10];
+	for (int i = 0; i < 10; i++) {
+		data[i] = "datagram " + itos(i);
+		datagrams[i].destination = address;
+		datagrams[i].header = i % 2 ? header : NULL;
+		datagrams[i].header_size = i % 2 ? strlen(header) : 0;
+		datagrams[i].data = data[i].c_str();
+		datagrams[i].size = data[i].size();
+	}
+	UASSERTEQ(int, socket.Send(datagrams, 10), 10);
+
+	sleep_ms(50);
+
+	char rcvbuffer[10 * 256];
+	Address senders[10];
+	int sizes[10];
+	int count = 0;
+	while (count < 10) {
+		int n = socket.Receive(&senders[count], &rcvbuffer[count * 256], 256,
+				&sizes[count], 10 - count);
+		if (n == 0)
+			break;
+		count += n;
+	}
+
+	UASSERTEQ(int, count, 10);
+	for (int i = 0; i < 10; i++) {
+		std::string expected = (i % 2 ? header : "") + data[i];
+		UASSERT(std::string(&rcvbuffer[i * 256], sizes[i]) == expected);
+		UASSERT(senders[i].getAddress().sin_addr.s_addr ==
+				address.getAddress().sin_addr.s_addr);
+		UASSERTEQ(u16, senders[i].getPort(), port);
+	}
+}
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "threading/atomic.h"
 #include "threading/semaphore.h"
 #include "threading/thread.h"
+#include "util/workerpool.h"
 
 
 class TestThreading : public TestBase {
@@ -33,6 +34,7 @@ class TestThreading : public TestBase {
 	void testStartStopWait();
 	void testThreadKill();
 	void testAtomicSemaphoreThread();
+	void testWorkerPool();
 };
 
 static TestThreading g_test_instance;
@@ -44,6 +46,7 @@ void TestThreading::runTests(IGameDef *gamedef)
 #endif
 	TEST(testThreadKill);
 	TEST(testAtomicSemaphoreThread);
+	TEST(testWorkerPool);
 }
 
 class SimpleTestThread : public Thread {
@@ -182,3 +185,42 @@ void TestThreading::testAtomicSemaphoreThread()
 	UASSERT(val == num_threads * 0x10000);
 }
 
+
+
+class CountingTestJob : public WorkerJob {
+public:
+	CountingTestJob() : count(0) {}
+
+	void run()
+	{
+		for (u32 i = 0; i < 0x1000; ++i)
+			++count;
+	}
+
+	u32 count;
+};
+
+
+void TestThreading::testWorkerPool()
+{
+	static const u8 num_jobs = 16;
+
+	// A pool without threads runs the jobs on the calling thread
+	for (u16 num_threads = 0; num_threads <= 3; num_threads += 3) {
+		WorkerPool pool("TestPool", num_threads);
+		UASSERT(pool.getThreadCount() == num_threads);
+
+		std::vector<WorkerJob *> jobs;
+		for (u8 i = 0; i < num_jobs; ++i)
+			jobs.push_back(new CountingTestJob());
+
+		// The pool has to be reusable
+		for (u8 batch = 0; batch < 3; ++batch)
+			pool.run(jobs);
+
+		for (u8 i = 0; i < num_jobs; ++i) {
+			UASSERT(((CountingTestJob *)jobs[i])->count == 3 * 0x1000);
+			delete jobs[i];
+		}
+	}
+}
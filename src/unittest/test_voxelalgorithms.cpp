@@ -20,7 +20,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include "gamedef.h"
+#include "map.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "noise.h"
+#include "porting.h"
 #include "voxelalgorithms.h"
+#include "util/basic_macros.h"
+
+// Blocks of the lighting test map, in each direction from the center
+#define LIGHT_MAP_RADIUS 2
+#define LIGHT_BENCH_EDITS 10000
 
 class TestVoxelAlgorithms : public TestBase {
 public:
@@ -31,6 +41,8 @@ class TestVoxelAlgorithms : public TestBase {
 
 	void testPropogateSunlight(INodeDefManager *ndef);
 	void testClearLightAndCollectSources(INodeDefManager *ndef);
+	void testLightingEdits(IGameDef *gamedef);
+	void benchLightingEdits(IGameDef *gamedef);
 };
 
 static TestVoxelAlgorithms g_test_instance;
@@ -41,6 +53,8 @@ void TestVoxelAlgorithms::runTests(IGameDef *gamedef)
 
 	TEST(testPropogateSunlight, ndef);
 	TEST(testClearLightAndCollectSources, ndef);
+	TEST(testLightingEdits, gamedef);
+	BENCH(benchLightingEdits, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -202,3 +216,223 @@ void TestVoxelAlgorithms::testClearLightAndCollectSources(INodeDefManager *ndef)
 		UASSERT(unlight_from.size() == 1);
 	}
 }
+
+////////////////////////////////////////////////////////////////////////////////
+
+static VoxelArea light_map_area()
+{
+	const s16 r = LIGHT_MAP_RADIUS * MAP_BLOCKSIZE;
+	return VoxelArea(v3s16(-r, -r, -r), v3s16(r - 1, r - 1, r - 1));
+}
+
+// Hilly ground
+class LightMapTerrain : public TestTerrain {
+public:
+	LightMapTerrain(): pr(42) {}
+
+	s16 getGroundHeight(s16 x, s16 z)
+	{
+		return (x * 3 + z * 5) / 16 + pr.range(-1, 1);
+	}
+
+	MapNode getNode(v3s16 p, s16 ground)
+	{
+		return MapNode(p.Y <= ground ? t_CONTENT_STONE : CONTENT_AIR);
+	}
+
+	// Goes on to place the rooms
+	PcgRandom pr;
+};
+
+/*
+	Hilly ground with rooms dug into it.  Torches and lava light some of
+	the rooms, and the sky lights everything above the ground.
+*/
+static Map *make_light_map(IGameDef *gamedef)
+{
+	LightMapTerrain terrain;
+	Map *map = make_test_map(gamedef, LIGHT_MAP_RADIUS, -LIGHT_MAP_RADIUS,
+		LIGHT_MAP_RADIUS - 1, terrain);
+	PcgRandom &pr = terrain.pr;
+	VoxelArea a = light_map_area();
+
+	for (u32 i = 0; i < 40; i++) {
+		v3s16 p0(pr.range(a.MinEdge.X, a.MaxEdge.X - 5),
+			pr.range(a.MinEdge.Y, 0), pr.range(a.MinEdge.Z, a.MaxEdge.Z - 5));
+		v3s16 p;
+		for (p.Z = p0.Z; p.Z < p0.Z + 5; p.Z++)
+		for (p.Y = p0.Y; p.Y < p0.Y + 3; p.Y++)
+		for (p.X = p0.X; p.X < p0.X + 5; p.X++) {
+			MapNode n(CONTENT_AIR);
+			map->setNode(p, n);
+		}
+		content_t c = i % 3 == 0 ? t_CONTENT_LAVA : t_CONTENT_TORCH;
+		if (i % 4 != 3) {
+			MapNode n(c);
+			map->setNode(p0 + v3s16(2, 0, 2), n);
+		}
+	}
+	return map;
+}
+
+/*
+	Lights the whole map from scratch.  Nothing is around the map, so the
+	sky is right above it and no light comes from the sides.
+*/
+static void compute_light(Map *map, INodeDefManager *ndef,
+		enum LightBank bank, std::vector<u8> &light)
+{
+	VoxelArea a = light_map_area();
+	light.assign(a.getVolume(), 0);
+	std::vector<s32> queues[LIGHT_SUN + 1];
+
+	for (s16 z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++)
+	for (s16 x = a.MinEdge.X; x <= a.MaxEdge.X; x++) {
+		bool sunlight = bank == LIGHTBANK_DAY;
+		for (s16 y = a.MaxEdge.Y; y >= a.MinEdge.Y; y--) {
+			const ContentFeatures &f = ndef->get(map->getNodeNoEx(v3s16(x, y, z)));
+			sunlight = sunlight && f.sunlight_propagates;
+			u8 l = sunlight ? LIGHT_SUN : f.light_source;
+			s32 i = a.index(x, y, z);
+			light[i] = l;
+			queues[l].push_back(i);
+		}
+	}
+
+	const v3s16 dirs[6] = {
+		v3s16(0, 0, 1), v3s16(0, 1, 0), v3s16(1, 0, 0),
+		v3s16(0, 0, -1), v3s16(0, -1, 0), v3s16(-1, 0, 0),
+	};
+	for (s32 l = LIGHT_SUN; l > 0; l--)
+	for (size_t k = 0; k < queues[l].size(); k++) {
+		s32 i = queues[l][k];
+		if (light[i] != l)
+			continue;
+		v3s16 p = a.MinEdge + v3s16(i % a.getExtent().X,
+			i / a.getExtent().X % a.getExtent().Y,
+			i / a.getExtent().X / a.getExtent().Y);
+		for (u16 d = 0; d < 6; d++) {
+			v3s16 p2 = p + dirs[d];
+			if (!a.contains(p2))
+				continue;
+			s32 i2 = a.index(p2);
+			u8 l2 = diminish_light(l);
+			if (light[i2] >= l2 || !ndef->get(map->getNodeNoEx(p2)).light_propagates)
+				continue;
+			light[i2] = l2;
+			queues[l2].push_back(i2);
+		}
+	}
+}
+
+static void set_light(Map *map, INodeDefManager *ndef)
+{
+	VoxelArea a = light_map_area();
+	std::vector<u8> day, night;
+	compute_light(map, ndef, LIGHTBANK_DAY, day);
+	compute_light(map, ndef, LIGHTBANK_NIGHT, night);
+
+	v3s16 p;
+	for (p.Z = a.MinEdge.Z; p.Z <= a.MaxEdge.Z; p.Z++)
+	for (p.Y = a.MinEdge.Y; p.Y <= a.MaxEdge.Y; p.Y++)
+	for (p.X = a.MinEdge.X; p.X <= a.MaxEdge.X; p.X++) {
+		MapNode n = map->getNodeNoEx(p);
+		n.setLight(LIGHTBANK_DAY, day[a.index(p)], ndef);
+		n.setLight(LIGHTBANK_NIGHT, night[a.index(p)], ndef);
+		map->setNode(p, n);
+	}
+}
+
+// Returns the number of nodes that are not lit like from scratch
+static u32 count_wrong_light(Map *map, INodeDefManager *ndef)
+{
+	VoxelArea a = light_map_area();
+	std::vector<u8> day, night;
+	compute_light(map, ndef, LIGHTBANK_DAY, day);
+	compute_light(map, ndef, LIGHTBANK_NIGHT, night);
+
+	u32 wrong = 0;
+	v3s16 p;
+	for (p.Z = a.MinEdge.Z; p.Z <= a.MaxEdge.Z; p.Z++)
+	for (p.Y = a.MinEdge.Y; p.Y <= a.MaxEdge.Y; p.Y++)
+	for (p.X = a.MinEdge.X; p.X <= a.MaxEdge.X; p.X++) {
+		MapNode n = map->getNodeNoEx(p);
+		if (n.getLight(LIGHTBANK_DAY, ndef) != day[a.index(p)] ||
+				n.getLight(LIGHTBANK_NIGHT, ndef) != night[a.index(p)])
+			wrong++;
+	}
+	return wrong;
+}
+
+/*
+	Digs or builds at a random place, mostly close to the ground.
+	Returns the number of blocks that changed.
+*/
+static u32 random_edit(Map *map, PcgRandom &pr)
+{
+	VoxelArea a = light_map_area();
+	v3s16 p(pr.range(a.MinEdge.X, a.MaxEdge.X),
+		pr.range(-6, 6), pr.range(a.MinEdge.Z, a.MaxEdge.Z));
+	if (pr.range(0, 3) == 0)
+		p.Y = pr.range(a.MinEdge.Y, a.MaxEdge.Y);
+
+	std::map<v3s16, MapBlock *> modified_blocks;
+	if (map->getNodeNoEx(p).getContent() != CONTENT_AIR) {
+		map->removeNodeAndUpdate(p, modified_blocks);
+	} else {
+		s32 r = pr.range(0, 15);
+		content_t c = r == 0 ? t_CONTENT_LAVA :
+			r < 4 ? t_CONTENT_TORCH : t_CONTENT_STONE;
+		map->addNodeAndUpdate(p, MapNode(c), modified_blocks);
+	}
+	return modified_blocks.size();
+}
+
+void TestVoxelAlgorithms::testLightingEdits(IGameDef *gamedef)
+{
+	INodeDefManager *ndef = gamedef->getNodeDefManager();
+	Map *map = make_light_map(gamedef);
+	set_light(map, ndef);
+	UASSERTEQ(u32, count_wrong_light(map, ndef), 0);
+
+	PcgRandom pr(7);
+	for (u32 i = 0; i < 500; i++) {
+		random_edit(map, pr);
+		// Every edit at first, then every now and then
+		if (i < 30 || i % 50 == 49)
+			UASSERTEQ(u32, count_wrong_light(map, ndef), 0);
+	}
+
+	// Shadows fall all the way down and go away again
+	v3s16 top(0, LIGHT_MAP_RADIUS * MAP_BLOCKSIZE - 1, 0);
+	std::map<v3s16, MapBlock *> modified_blocks;
+	map->addNodeAndUpdate(top, MapNode(t_CONTENT_STONE), modified_blocks);
+	UASSERTEQ(u32, count_wrong_light(map, ndef), 0);
+	map->removeNodeAndUpdate(top, modified_blocks);
+	UASSERTEQ(u32, count_wrong_light(map, ndef), 0);
+
+	delete map;
+}
+
+// Every edit relights the day and the night bank
+void TestVoxelAlgorithms::benchLightingEdits(IGameDef *gamedef)
+{
+	INodeDefManager *ndef = gamedef->getNodeDefManager();
+	Map *map = make_light_map(gamedef);
+	set_light(map, ndef);
+
+	PcgRandom pr(11);
+	u64 modified_blocks = 0;
+	u32 t0 = porting::getTimeMs();
+	for (u32 i = 0; i < LIGHT_BENCH_EDITS; i++)
+		modified_blocks += random_edit(map, pr);
+	u32 dtime = MYMAX(porting::getTimeMs() - t0, 1);
+
+	u32 wrong = count_wrong_light(map, ndef);
+	delete map;
+
+	rawstream << "    " << (u64)LIGHT_BENCH_EDITS * 1000 / dtime << " edits/s, "
+		<< (f32)modified_blocks / LIGHT_BENCH_EDITS << " blocks/edit, "
+		<< wrong << " nodes lit wrong" << std::endl;
+	UASSERTEQ(u32, wrong, 0);
+}
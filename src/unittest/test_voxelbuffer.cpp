@@ -0,0 +1,270 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+#include "map.h"
+#include "porting.h"
+#include "common/c_types.h"
+#include "lua_api/l_vmanip.h"
+#include "util/basic_macros.h"
+
+// The size of a 5x5x5 block VoxelManip
+#define BENCH_SIZE 80
+
+class TestVoxelBuffer : public TestBase {
+public:
+	TestVoxelBuffer() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestVoxelBuffer"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testBufferViewsData();
+	void testBufferReuse();
+	void testMapgenChunkFinished();
+	void benchBufferVsTable();
+};
+
+static TestVoxelBuffer g_test_instance;
+
+void TestVoxelBuffer::runTests(IGameDef *gamedef)
+{
+	TEST(testBufferViewsData);
+	TEST(testBufferReuse);
+	TEST(testMapgenChunkFinished);
+	BENCH(benchBufferVsTable);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static MMVManip *make_vmanip(s16 size)
+{
+	MMVManip *vm = new MMVManip(NULL);
+	vm->addArea(VoxelArea(v3s16(0, 0, 0), v3s16(size - 1, size - 1, size - 1)));
+	u32 volume = vm->m_area.getVolume();
+	for (u32 i = 0; i < volume; i++)
+		vm->m_data[i] = MapNode(i % 3 == 0 ? CONTENT_AIR : t_CONTENT_STONE,
+			i % 16, i % 256);
+	return vm;
+}
+
+// A Lua state with the VoxelManip in the global "vm"
+static lua_State *make_lua(MMVManip *vm)
+{
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+	LuaVoxelManip::Register(L);
+	LuaVoxelBuffer::Register(L);
+
+	LuaVoxelManip::pushMapgenObject(L, vm);
+	lua_setglobal(L, "vm");
+	return L;
+}
+
+// Whether running code throws a LuaError. The state can't be used after
+// one was thrown.
+static bool lua_throws(lua_State *L, const char *code)
+{
+	try {
+		luaL_dostring(L, code);
+	} catch (LuaError &e) {
+		return true;
+	}
+	return false;
+}
+
+static void run_lua(lua_State *L, const char *code)
+{
+	if (luaL_dostring(L, code) != 0) {
+		rawstream << "    " << lua_tostring(L, -1) << std::endl;
+		UASSERT(false);
+	}
+}
+
+void TestVoxelBuffer::testBufferViewsData()
+{
+	MMVManip *vm = make_vmanip(4);
+	lua_State *L = make_lua(vm);
+
+	run_lua(L,
+		"local data = vm:get_data()\n"
+		"local buf = vm:get_data_buffer()\n"
+		"assert(#buf == #data)\n"
+		"for i = 1, #data do assert(buf[i] == data[i]) end\n"
+		"assert(buf[0] == nil and buf[#buf + 1] == nil)\n"
+		"buf[2] = 10\n"
+		"local light = vm:get_light_buffer()\n"
+		"assert(light[17] == vm:get_light_data()[17])\n"
+		"light[3] = 0xF5\n"
+		"local param2 = vm:get_param2_buffer()\n"
+		"assert(param2[64] == 63)\n"
+		"param2[4] = 200\n");
+
+	// Written straight to the nodes, without set_data()
+	UASSERTEQ(content_t, vm->m_data[1].getContent(), 10);
+	UASSERTEQ(u8, vm->m_data[1].param2, 1);
+	UASSERTEQ(u8, vm->m_data[2].param1, 0xF5);
+	UASSERTEQ(u8, vm->m_data[3].param2, 200);
+
+	// And read as they are now
+	vm->m_data[4].setContent(42);
+	run_lua(L, "assert(vm:get_data_buffer()[5] == 42)");
+
+	lua_close(L);
+	delete vm;
+}
+
+void TestVoxelBuffer::testBufferReuse()
+{
+	MMVManip *vm = make_vmanip(4);
+	MMVManip *other = make_vmanip(2);
+	lua_State *L = make_lua(vm);
+	lua_pushinteger(L, CONTENT_AIR);
+	lua_setglobal(L, "air");
+
+	// Binding an existing buffer gives it back, viewing the new VoxelManip
+	LuaVoxelManip::pushMapgenObject(L, other);
+	lua_setglobal(L, "other");
+	run_lua(L,
+		"local buf = vm:get_data_buffer()\n"
+		"assert(#buf == 64)\n"
+		"assert(rawequal(other:get_param2_buffer(buf), buf))\n"
+		"assert(#buf == 8 and buf[8] == 7)\n"
+		"buf[8] = 100\n");
+	UASSERTEQ(u8, other->m_data[7].param2, 100);
+	UASSERTEQ(u8, vm->m_data[7].param2, 7);
+
+	// The buffer keeps the VoxelManip from being collected
+	run_lua(L,
+		"buf = other:get_data_buffer()\n"
+		"other = nil\n"
+		"collectgarbage()\n"
+		"assert(buf[1] == air)\n"
+		"buf = nil\n"
+		"collectgarbage()\n");
+
+	lua_close(L);
+	delete vm;
+	delete other;
+}
+
+void TestVoxelBuffer::testMapgenChunkFinished()
+{
+	const char *uses[] = {
+		"return #buf",
+		"return buf[1]",
+		"buf[1] = 0",
+		"return buf:get_pointer()",
+		"return vm:get_data()",
+	};
+
+	for (size_t i = 0; i < ARRLEN(uses); i++) {
+		MMVManip *vm = make_vmanip(4);
+		lua_State *L = make_lua(vm);
+		run_lua(L, "buf = vm:get_data_buffer()");
+
+		// The next chunk: the buffer works once it is bound again
+		LuaVoxelManip::invalidateMapgenObjects(L);
+		delete vm;
+		vm = make_vmanip(3);
+		LuaVoxelManip::pushMapgenObject(L, vm);
+		lua_setglobal(L, "next_vm");
+		run_lua(L,
+			"assert(rawequal(next_vm:get_data_buffer(buf), buf))\n"
+			"assert(#buf == 27)\n");
+
+		// Kept until after that chunk is finished
+		LuaVoxelManip::invalidateMapgenObjects(L);
+		delete vm;
+		UASSERT(lua_throws(L, uses[i]));
+		lua_close(L);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Turns air into stone and the stone into air, the way mapgen mods go
+// through the data of a VoxelManip
+static const char *bench_table_code =
+	"local data = vm:get_data()\n"
+	"for i = 1, #data do\n"
+	"	if data[i] == air then data[i] = stone else data[i] = air end\n"
+	"end\n"
+	"vm:set_data(data)\n";
+
+static const char *bench_buffer_code =
+	"local data = vm:get_data_buffer(buffer)\n"
+	"buffer = data\n"
+	"for i = 1, #data do\n"
+	"	if data[i] == air then data[i] = stone else data[i] = air end\n"
+	"end\n";
+
+// Returns the milliseconds the runs took, and the KiB of Lua memory a run
+// allocated in *kib
+static u32 bench_lua(lua_State *L, const char *code, u32 runs, u32 *kib)
+{
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	lua_gc(L, LUA_GCSTOP, 0);
+	int kib_before = lua_gc(L, LUA_GCCOUNT, 0);
+	run_lua(L, code);
+	*kib = lua_gc(L, LUA_GCCOUNT, 0) - kib_before;
+	lua_gc(L, LUA_GCRESTART, 0);
+
+	u32 t0 = porting::getTimeMs();
+	for (u32 i = 1; i < runs; i++)
+		run_lua(L, code);
+	return MYMAX(porting::getTimeMs() - t0, 1);
+}
+
+void TestVoxelBuffer::benchBufferVsTable()
+{
+	const u32 runs = 6;
+	MMVManip *vm = make_vmanip(BENCH_SIZE);
+	lua_State *L = make_lua(vm);
+	lua_pushinteger(L, CONTENT_AIR);
+	lua_setglobal(L, "air");
+	lua_pushinteger(L, t_CONTENT_STONE);
+	lua_setglobal(L, "stone");
+
+	u32 table_kib, buffer_kib;
+	u32 table_ms = bench_lua(L, bench_table_code, runs, &table_kib);
+	u32 buffer_ms = bench_lua(L, bench_buffer_code, runs, &buffer_kib);
+
+	// An even number of runs of both, back to the start
+	u32 volume = vm->m_area.getVolume();
+	for (u32 i = 0; i < volume; i++) {
+		UASSERTEQ(content_t, vm->m_data[i].getContent(),
+			i % 3 == 0 ? CONTENT_AIR : t_CONTENT_STONE);
+	}
+
+	lua_close(L);
+	delete vm;
+
+	rawstream << "    " << volume << " nodes: tables "
+		<< (runs - 1) * 1000.0 / table_ms << " runs/s, " << table_kib
+		<< " KiB garbage per run; buffers "
+		<< (runs - 1) * 1000.0 / buffer_ms << " runs/s, " << buffer_kib
+		<< " KiB garbage per run" << std::endl;
+}
@@ -22,7 +22,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "../irrlichttypes.h"
 #include "../debug.h" // For assert()
+#include "../threading/atomic.h"
 #include <cstring>
+#include <vector>
 
 template <typename T>
 class SharedPtr
@@ -298,6 +300,119 @@ class SharedBuffer
 	unsigned int *refcount;
 };
 
+/*
+	Read-only view of a part of a reference counted buffer.
+
+	Unlike with SharedBuffer the reference count is atomic, so copies can be
+	handed to other threads. Slices of the same buffer share its data, none
+	of it is copied. The data must not be changed once it has been shared.
+*/
+template <typename T>
+class SharedSlice
+{
+public:
+	SharedSlice():
+		m_holder(NULL),
+		m_data(NULL),
+		m_size(0)
+	{}
+	/*
+		Copies the data
+	*/
+	SharedSlice(const T *t, unsigned int size):
+		m_holder(NULL),
+		m_data(NULL),
+		m_size(size)
+	{
+		if (size == 0)
+			return;
+		m_holder = new Holder;
+		m_holder->data.assign(t, t + size);
+		m_data = &m_holder->data[0];
+	}
+	/*
+		Takes over the contents of v, leaving it empty
+	*/
+	explicit SharedSlice(std::vector<T> &v):
+		m_holder(NULL),
+		m_data(NULL),
+		m_size(v.size())
+	{
+		if (m_size == 0)
+			return;
+		m_holder = new Holder;
+		m_holder->data.swap(v);
+		m_data = &m_holder->data[0];
+	}
+	SharedSlice(const SharedSlice &slice):
+		m_holder(slice.m_holder),
+		m_data(slice.m_data),
+		m_size(slice.m_size)
+	{
+		if (m_holder)
+			m_holder->refcount++;
+	}
+	SharedSlice &operator=(const SharedSlice &slice)
+	{
+		if (slice.m_holder)
+			slice.m_holder->refcount++;
+		drop();
+		m_holder = slice.m_holder;
+		m_data = slice.m_data;
+		m_size = slice.m_size;
+		return *this;
+	}
+	~SharedSlice()
+	{
+		drop();
+	}
+	/*
+		Part of this slice, sharing its data
+	*/
+	SharedSlice slice(unsigned int offset, unsigned int size) const
+	{
+		assert(offset + size <= m_size);
+		SharedSlice result;
+		if (size == 0)
+			return result;
+		result.m_holder = m_holder;
+		result.m_data = m_data + offset;
+		result.m_size = size;
+		m_holder->refcount++;
+		return result;
+	}
+	const T &operator[](unsigned int i) const
+	{
+		assert(i < m_size);
+		return m_data[i];
+	}
+	const T *operator*() const
+	{
+		return m_data;
+	}
+	unsigned int getSize() const
+	{
+		return m_size;
+	}
+private:
+	struct Holder
+	{
+		Holder(): refcount(1) {}
+		Atomic<u32> refcount;
+		std::vector<T> data;
+	};
+
+	void drop()
+	{
+		if (m_holder && --m_holder->refcount == 0)
+			delete m_holder;
+	}
+
+	Holder *m_holder;
+	const T *m_data;
+	unsigned int m_size;
+};
+
 inline SharedBuffer<u8> SharedBufferFromString(const char *string)
 {
 	SharedBuffer<u8> b((u8*)string, strlen(string)+1);
@@ -121,7 +121,8 @@ class RequestQueue {
 			MutexAutoLock lock(m_queue.getMutex());
 
 			/*
-				If the caller is already on the list, only update CallerData
+				If the caller is already on the list with the same
+				destination, only update CallerData
 			*/
 			for (i = m_queue.getQueue().begin(); i != m_queue.getQueue().end(); ++i) {
 				GetRequest<Key, T, Caller, CallerData> &request = *i;
@@ -130,7 +131,7 @@ class RequestQueue {
 
 				for (j = request.callers.begin(); j != request.callers.end(); ++j) {
 					CallerInfo<Caller, CallerData, Key, T> &ca = *j;
-					if (ca.caller == caller) {
+					if (ca.caller == caller && ca.dest == dest) {
 						ca.data = callerdata;
 						return;
 					}
@@ -170,6 +171,33 @@ class RequestQueue {
 		return m_queue.pop_frontNoEx();
 	}
 
+	/*
+		Takes dest off the request for key, so that it can be destroyed.
+		Returns false if the request was popped already, then its result
+		is still pushed to dest.
+	*/
+	bool cancel(Key key, ResultQueue<Key, T, Caller, CallerData> *dest)
+	{
+		typename std::deque<GetRequest<Key, T, Caller, CallerData> >::iterator i;
+		typename std::list<CallerInfo<Caller, CallerData, Key, T> >::iterator j;
+
+		MutexAutoLock lock(m_queue.getMutex());
+
+		for (i = m_queue.getQueue().begin(); i != m_queue.getQueue().end(); ++i) {
+			GetRequest<Key, T, Caller, CallerData> &request = *i;
+			if (request.key != key)
+				continue;
+
+			for (j = request.callers.begin(); j != request.callers.end(); ++j) {
+				if (j->dest == dest) {
+					request.callers.erase(j);
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
 	void pushResult(GetRequest<Key, T, Caller, CallerData> req, T res)
 	{
 		for (typename std::list<CallerInfo<Caller, CallerData, Key, T> >::iterator
@@ -0,0 +1,131 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "workerpool.h"
+#include "threading/thread.h"
+#include "threading/mutex_auto_lock.h"
+#include "debug.h"
+#include "log.h"
+#include "util/string.h"
+
+class WorkerPoolThread : public Thread
+{
+public:
+	WorkerPoolThread(WorkerPool *pool, const std::string &name) :
+		Thread(name),
+		m_pool(pool)
+	{}
+
+	void *run()
+	{
+		DSTACK(FUNCTION_NAME);
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		for (;;) {
+			m_pool->m_start_sem.wait();
+			if (m_pool->m_stopping)
+				break;
+
+			m_pool->processJobs();
+			m_pool->m_done_sem.post();
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return NULL;
+	}
+
+private:
+	WorkerPool *m_pool;
+};
+
+
+WorkerPool::WorkerPool(const std::string &name, u16 num_threads) :
+	m_jobs(NULL),
+	m_next_job(0),
+	m_stopping(false)
+{
+	for (u16 i = 0; i != num_threads; i++) {
+		WorkerPoolThread *thread = new WorkerPoolThread(this,
+			name + itos(i));
+		if (!thread->start()) {
+			errorstream << "WorkerPool: failed to start thread \""
+				<< name << i << "\"" << std::endl;
+			delete thread;
+			break;
+		}
+		m_threads.push_back(thread);
+	}
+}
+
+
+WorkerPool::~WorkerPool()
+{
+	m_stopping = true;
+	m_start_sem.post(m_threads.size());
+
+	for (size_t i = 0; i != m_threads.size(); i++) {
+		m_threads[i]->wait();
+		delete m_threads[i];
+	}
+}
+
+
+void WorkerPool::run(const std::vector<WorkerJob *> &jobs)
+{
+	if (m_threads.empty() || jobs.size() <= 1) {
+		for (size_t i = 0; i != jobs.size(); i++)
+			jobs[i]->run();
+		return;
+	}
+
+	{
+		MutexAutoLock lock(m_jobs_mutex);
+		m_jobs = &jobs;
+		m_next_job = 0;
+	}
+
+	// Don't wake up more threads than there is work for;
+	// this thread takes one share of the batch itself.
+	size_t num_helpers = MYMIN(m_threads.size(), jobs.size() - 1);
+	m_start_sem.post(num_helpers);
+
+	processJobs();
+
+	for (size_t i = 0; i != num_helpers; i++)
+		m_done_sem.wait();
+
+	MutexAutoLock lock(m_jobs_mutex);
+	m_jobs = NULL;
+}
+
+
+void WorkerPool::processJobs()
+{
+	for (;;) {
+		WorkerJob *job;
+		{
+			MutexAutoLock lock(m_jobs_mutex);
+			if (m_jobs == NULL || m_next_job >= m_jobs->size())
+				return;
+			job = (*m_jobs)[m_next_job++];
+		}
+		job->run();
+	}
+}
@@ -0,0 +1,79 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef UTIL_WORKERPOOL_HEADER
+#define UTIL_WORKERPOOL_HEADER
+
+#include "../irrlichttypes.h"
+#include "../threading/mutex.h"
+#include "../threading/semaphore.h"
+#include <string>
+#include <vector>
+
+class WorkerPoolThread;
+
+/*
+	A unit of work for WorkerPool::run().
+	Jobs of one batch must not depend on each other; they may run in any
+	order and on any thread.
+*/
+class WorkerJob
+{
+public:
+	virtual ~WorkerJob() {}
+	virtual void run() = 0;
+};
+
+/*
+	A fixed set of threads for running batches of independent jobs.
+
+	run() blocks until the whole batch is done, so the jobs may use data
+	owned by the caller, including anything protected by locks the caller
+	holds.  The calling thread takes part in processing the batch.
+	With a pool of zero threads the jobs are simply run in order.
+*/
+class WorkerPool
+{
+public:
+	WorkerPool(const std::string &name, u16 num_threads);
+	~WorkerPool();
+
+	u16 getThreadCount() const { return m_threads.size(); }
+
+	// Not reentrant: only one thread may call this at a time.
+	void run(const std::vector<WorkerJob *> &jobs);
+
+private:
+	friend class WorkerPoolThread;
+
+	// Runs jobs of the current batch until none are left
+	void processJobs();
+
+	std::vector<WorkerPoolThread *> m_threads;
+
+	Mutex m_jobs_mutex;
+	const std::vector<WorkerJob *> *m_jobs;
+	size_t m_next_job;
+
+	Semaphore m_start_sem;
+	Semaphore m_done_sem;
+	bool m_stopping;
+};
+
+#endif
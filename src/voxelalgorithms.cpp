@@ -19,6 +19,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "voxelalgorithms.h"
 #include "nodedef.h"
+#include "map.h"
+#include "mapblock.h"
 
 namespace voxalgo
 {
@@ -153,5 +155,278 @@ SunlightPropagateResult propagateSunlight(VoxelManipulator &v, VoxelArea a,
 	return SunlightPropagateResult(bottom_sunlight_valid);
 }
 
+/*
+	LightingWindow
+*/
+
+// Flags of the nodes in a LightingWindow
+#define LW_LIGHT_PROPAGATES 0x01
+#define LW_SUNLIGHT_PROPAGATES 0x02
+// On the outermost layer, the neighbours are outside of the window
+#define LW_BORDER 0x04
+#define LW_CHANGED 0x08
+
+// Light reaches this far from the changed nodes, plus the nodes it is
+// compared with
+#define LW_PADDING (LIGHT_SUN + 1)
+
+LightingWindow::LightingWindow():
+	m_map(NULL),
+	m_ndef(NULL),
+	m_ystride(0),
+	m_zstride(0),
+	m_stamp(0)
+{
+}
+
+void LightingWindow::reset(const VoxelArea &area)
+{
+	m_area = area;
+	m_ystride = area.getExtent().X;
+	m_zstride = area.getExtent().X * area.getExtent().Y;
+	m_block_area = VoxelArea(getNodeBlockPos(area.MinEdge),
+			getNodeBlockPos(area.MaxEdge));
+
+	// Nothing is loaded with a new stamp, unless it wraps around
+	if (++m_stamp == 0) {
+		m_stamps.assign(m_stamps.size(), 0);
+		m_block_stamps.assign(m_block_stamps.size(), 0);
+		m_stamp = 1;
+	}
+
+	size_t volume = area.getVolume();
+	if (m_stamps.size() < volume) {
+		m_stamps.resize(volume, 0);
+		m_flags.resize(volume);
+		m_sources.resize(volume);
+		m_light[LIGHTBANK_DAY].resize(volume);
+		m_light[LIGHTBANK_NIGHT].resize(volume);
+	}
+	size_t block_volume = m_block_area.getVolume();
+	if (m_blocks.size() < block_volume) {
+		m_blocks.resize(block_volume);
+		m_block_stamps.resize(block_volume, 0);
+	}
+	m_changed.clear();
+}
+
+v3s16 LightingWindow::nodePos(s32 i) const
+{
+	return m_area.MinEdge + v3s16(i % m_ystride,
+			i % m_zstride / m_ystride, i / m_zstride);
+}
+
+void LightingWindow::load(s32 i)
+{
+	if (m_stamps[i] == m_stamp)
+		return;
+	m_stamps[i] = m_stamp;
+
+	v3s16 p = nodePos(i);
+	u8 flags = 0;
+	if (p.X == m_area.MinEdge.X || p.X == m_area.MaxEdge.X ||
+			p.Y == m_area.MinEdge.Y || p.Y == m_area.MaxEdge.Y ||
+			p.Z == m_area.MinEdge.Z || p.Z == m_area.MaxEdge.Z)
+		flags |= LW_BORDER;
+
+	v3s16 blockpos = getNodeBlockPos(p);
+	s32 bi = m_block_area.index(blockpos);
+	if (m_block_stamps[bi] != m_stamp) {
+		MapBlock *block = m_map->getBlockNoCreateNoEx(blockpos);
+		m_blocks[bi] = block && !block->isDummy() ? block : NULL;
+		m_block_stamps[bi] = m_stamp;
+	}
+
+	// Light does not go through unloaded nodes
+	MapBlock *block = m_blocks[bi];
+	if (block == NULL) {
+		m_flags[i] = flags;
+		m_sources[i] = 0;
+		m_light[LIGHTBANK_DAY][i] = 0;
+		m_light[LIGHTBANK_NIGHT][i] = 0;
+		return;
+	}
+
+	bool is_valid_position;
+	MapNode n = block->getNodeNoCheck(p - blockpos * MAP_BLOCKSIZE,
+			&is_valid_position);
+	const ContentFeatures &f = m_ndef->get(n);
+	if (f.light_propagates)
+		flags |= LW_LIGHT_PROPAGATES;
+	if (f.sunlight_propagates)
+		flags |= LW_SUNLIGHT_PROPAGATES;
+	m_flags[i] = flags;
+	m_sources[i] = f.light_source;
+	if (f.param_type == CPT_LIGHT) {
+		m_light[LIGHTBANK_DAY][i] = n.getLightNoChecks(LIGHTBANK_DAY, &f);
+		m_light[LIGHTBANK_NIGHT][i] = n.getLightNoChecks(LIGHTBANK_NIGHT, &f);
+	} else {
+		m_light[LIGHTBANK_DAY][i] = f.light_source;
+		m_light[LIGHTBANK_NIGHT][i] = f.light_source;
+	}
+}
+
+void LightingWindow::setLight(enum LightBank bank, s32 i, u8 light)
+{
+	m_light[bank][i] = light;
+	if (!(m_flags[i] & LW_CHANGED)) {
+		m_flags[i] |= LW_CHANGED;
+		m_changed.push_back(i);
+	}
+}
+
+/*
+	Takes away the light of the nodes that may have got it from the queued
+	ones, brightest first.  The nodes around that keep their light are
+	queued for spreadLight().
+*/
+void LightingWindow::unspreadLight(enum LightBank bank)
+{
+	const s32 dirs[6] = { m_zstride, m_ystride, 1, -m_zstride, -m_ystride, -1 };
+	std::vector<u8> &light = m_light[bank];
+
+	for (s32 level = LIGHT_SUN; level >= 0; level--) {
+		std::vector<s32> &queue = m_unlight_queues[level];
+		for (size_t k = 0; k < queue.size(); k++) {
+			s32 i = queue[k];
+			if (m_flags[i] & LW_BORDER)
+				continue;
+			for (u16 d = 0; d < 6; d++) {
+				s32 i2 = i + dirs[d];
+				load(i2);
+				u8 light2 = light[i2];
+				if (light2 == 0)
+					continue;
+				u8 source = m_sources[i2];
+				if ((m_flags[i2] & LW_LIGHT_PROPAGATES) &&
+						light2 < level && light2 > source) {
+					setLight(bank, i2, source);
+					m_unlight_queues[light2].push_back(i2);
+					if (source != 0)
+						m_spread_queues[source].push_back(i2);
+				} else {
+					m_spread_queues[light2].push_back(i2);
+				}
+			}
+		}
+		queue.clear();
+	}
+}
+
+/*
+	Spreads the light of the queued nodes, brightest first, so that every
+	node is spread from once it has its final light.
+*/
+void LightingWindow::spreadLight(enum LightBank bank)
+{
+	const s32 dirs[6] = { m_zstride, m_ystride, 1, -m_zstride, -m_ystride, -1 };
+	std::vector<u8> &light = m_light[bank];
+
+	for (s32 level = LIGHT_SUN; level > 0; level--) {
+		std::vector<s32> &queue = m_spread_queues[level];
+		u8 light2 = diminish_light(level);
+		for (size_t k = 0; k < queue.size(); k++) {
+			s32 i = queue[k];
+			// Queued again with more light, or unlit after being queued
+			if (light[i] != level || (m_flags[i] & LW_BORDER))
+				continue;
+			for (u16 d = 0; d < 6; d++) {
+				s32 i2 = i + dirs[d];
+				load(i2);
+				if (light[i2] < light2 && (m_flags[i2] & LW_LIGHT_PROPAGATES)) {
+					setLight(bank, i2, light2);
+					m_spread_queues[light2].push_back(i2);
+				}
+			}
+		}
+		queue.clear();
+	}
+	m_spread_queues[0].clear();
+}
+
+void LightingWindow::updateNode(Map *map, INodeDefManager *ndef, v3s16 p,
+		const MapNode &oldnode,
+		std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	m_map = map;
+	m_ndef = ndef;
+	const ContentFeatures &f = ndef->get(map->getNodeNoEx(p));
+
+	/*
+		Sunlight comes from the node above, or from the sky if it isn't
+		loaded.  Under the node, the column gets or loses sunlight down to
+		the first node that already is like that.
+	*/
+	bool is_valid_position;
+	MapNode top = map->getNodeNoEx(p + v3s16(0,1,0), &is_valid_position);
+	bool sunlight = f.sunlight_propagates && (!is_valid_position ||
+			top.getLight(LIGHTBANK_DAY, ndef) == LIGHT_SUN);
+	s16 bottom = p.Y;
+	for (;;) {
+		MapNode n2 = map->getNodeNoEx(v3s16(p.X, bottom - 1, p.Z),
+				&is_valid_position);
+		if (!is_valid_position || !ndef->get(n2).sunlight_propagates ||
+				(n2.getLight(LIGHTBANK_DAY, ndef) == LIGHT_SUN) == sunlight)
+			break;
+		bottom--;
+	}
+
+	reset(VoxelArea(v3s16(p.X, bottom, p.Z) - v3s16(1,1,1) * LW_PADDING,
+			p + v3s16(1,1,1) * LW_PADDING));
+
+	s32 ip = m_area.index(p);
+	load(ip);
+	m_light[LIGHTBANK_DAY][ip] = oldnode.getLight(LIGHTBANK_DAY, ndef);
+	m_light[LIGHTBANK_NIGHT][ip] = oldnode.getLight(LIGHTBANK_NIGHT, ndef);
+
+	enum LightBank banks[] = {
+		LIGHTBANK_DAY,
+		LIGHTBANK_NIGHT
+	};
+	for (u16 b = 0; b < 2; b++) {
+		enum LightBank bank = banks[b];
+		std::vector<u8> &light = m_light[bank];
+
+		// The changed nodes are unlit from their old light
+		u8 light_p = bank == LIGHTBANK_DAY && sunlight ?
+				LIGHT_SUN : f.light_source;
+		m_unlight_queues[light[ip]].push_back(ip);
+		setLight(bank, ip, light_p);
+		m_spread_queues[light_p].push_back(ip);
+
+		if (bank == LIGHTBANK_DAY) {
+			for (s16 y = bottom; y < p.Y; y++) {
+				s32 i = m_area.index(p.X, y, p.Z);
+				load(i);
+				u8 light_i = sunlight ? LIGHT_SUN : m_sources[i];
+				m_unlight_queues[light[i]].push_back(i);
+				setLight(bank, i, light_i);
+				m_spread_queues[light_i].push_back(i);
+			}
+		}
+
+		unspreadLight(bank);
+		spreadLight(bank);
+	}
+
+	for (size_t k = 0; k < m_changed.size(); k++) {
+		s32 i = m_changed[k];
+		v3s16 p2 = nodePos(i);
+		v3s16 blockpos = getNodeBlockPos(p2);
+		v3s16 relpos = p2 - blockpos * MAP_BLOCKSIZE;
+		MapBlock *block = m_blocks[m_block_area.index(blockpos)];
+		MapNode n2 = block->getNodeNoCheck(relpos, &is_valid_position);
+		// Many nodes are unlit and get the same light again
+		if (i != ip &&
+				n2.getLight(LIGHTBANK_DAY, ndef) == m_light[LIGHTBANK_DAY][i] &&
+				n2.getLight(LIGHTBANK_NIGHT, ndef) == m_light[LIGHTBANK_NIGHT][i])
+			continue;
+		n2.setLight(LIGHTBANK_DAY, m_light[LIGHTBANK_DAY][i], ndef);
+		n2.setLight(LIGHTBANK_NIGHT, m_light[LIGHTBANK_NIGHT][i], ndef);
+		block->setNodeNoCheck(relpos, n2);
+		modified_blocks[blockpos] = block;
+	}
+}
+
 } // namespace voxalgo
 
@@ -24,6 +24,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapnode.h"
 #include <set>
 #include <map>
+#include <vector>
+
+class Map;
+class MapBlock;
 
 namespace voxalgo
 {
@@ -52,6 +56,55 @@ SunlightPropagateResult propagateSunlight(VoxelManipulator &v, VoxelArea a,
 		std::set<v3s16> & light_sources,
 		INodeDefManager *ndef);
 
+/*
+	Relights the surroundings of a single node that was changed on a Map.
+
+	The nodes the edit can affect are read lazily into a flat window
+	around it, which is relit with queues bucketed by light level and
+	written back at the end.  The buffers are kept for the next edit.
+*/
+class LightingWindow
+{
+public:
+	LightingWindow();
+
+	// The new node must already be on the map, oldnode is the node that
+	// was there before and still has its light
+	void updateNode(Map *map, INodeDefManager *ndef, v3s16 p,
+			const MapNode &oldnode,
+			std::map<v3s16, MapBlock*> &modified_blocks);
+
+private:
+	void reset(const VoxelArea &area);
+	v3s16 nodePos(s32 i) const;
+	void load(s32 i);
+	void setLight(enum LightBank bank, s32 i, u8 light);
+	void unspreadLight(enum LightBank bank);
+	void spreadLight(enum LightBank bank);
+
+	Map *m_map;
+	INodeDefManager *m_ndef;
+
+	VoxelArea m_area;
+	s32 m_ystride;
+	s32 m_zstride;
+	VoxelArea m_block_area;
+	std::vector<MapBlock *> m_blocks;
+	std::vector<u16> m_block_stamps;
+
+	// Nodes whose stamp is not the current one are not loaded yet
+	u16 m_stamp;
+	std::vector<u16> m_stamps;
+	std::vector<u8> m_flags;
+	std::vector<u8> m_sources;
+	std::vector<u8> m_light[2];
+	std::vector<s32> m_changed;
+
+	// Indexed by the light of the nodes in them
+	std::vector<s32> m_unlight_queues[LIGHT_SUN + 1];
+	std::vector<s32> m_spread_queues[LIGHT_SUN + 1];
+};
+
 } // namespace voxalgo
 
 #endif